@@ -131,6 +131,13 @@ void show_help(void)
             "                           the image to (default=256)\n"
             "-m FILE, --mapfile=FILE    transform image colors to match this\n"
             "                           set of colorsspecify map\n"
+            "-M FILE, --mapfile-output=FILE\n"
+            "                           write the palette into FILE, which\n"
+            "                           can be given to -m option later\n"
+            "-K DIR, --palette-cache=DIR\n"
+            "                           store computed palettes into DIR\n"
+            "                           and reuse them when the same image\n"
+            "                           is encoded with the same parameters\n"
             "-e, --monochrome           output monochrome sixel image\n"
             "                           this option assumes the terminal\n"
             "                           background color is black\n"
@@ -152,6 +159,11 @@ void show_help(void)
             "                           specify an number argument for the\n"
             "                           score of complexion correction.\n"
             "                           COMPLEXIONSCORE must be 1 or more.\n"
+            "-j THREADS, --threads=THREADS\n"
+            "                           resize and apply palette with\n"
+            "                           THREADS threads,\n"
+            "                           the output does not depend on\n"
+            "                           the number of THREADS\n"
             "-g, --ignore-delay         render GIF animation without delay\n"
             "-S, --static               render animated GIF as a static image\n"
             );
@@ -347,7 +359,7 @@ main(int argc, char *argv[])
     int long_opt;
     int option_index;
 #endif  /* HAVE_GETOPT_LONG */
-    char const *optstring = "o:78Rp:m:eb:Id:f:s:c:w:h:r:q:kil:t:ugvSn:PE:B:C:DVH";
+    char const *optstring = "o:78Rp:m:M:K:eb:Id:f:s:c:w:h:r:q:kil:t:ugvSn:PE:B:C:j:DVH";
 #if HAVE_GETOPT_LONG
     struct option long_options[] = {
         {"outfile",          no_argument,        &long_opt, 'o'},
@@ -356,6 +368,8 @@ main(int argc, char *argv[])
         {"gri-limit",        no_argument,        &long_opt, 'R'},
         {"colors",           required_argument,  &long_opt, 'p'},
         {"mapfile",          required_argument,  &long_opt, 'm'},
+        {"mapfile-output",   required_argument,  &long_opt, 'M'},
+        {"palette-cache",    required_argument,  &long_opt, 'K'},
         {"monochrome",       no_argument,        &long_opt, 'e'},
         {"high-color",       no_argument,        &long_opt, 'I'},
         {"builtin-palette",  required_argument,  &long_opt, 'b'},
@@ -380,6 +394,7 @@ main(int argc, char *argv[])
         {"encode-policy",    required_argument,  &long_opt, 'E'},
         {"bgcolor",          required_argument,  &long_opt, 'B'},
         {"complexion-score", required_argument,  &long_opt, 'C'},
+        {"threads",          required_argument,  &long_opt, 'j'},
         {"pipe-mode",        no_argument,        &long_opt, 'D'}, /* deprecated */
         {"version",          no_argument,        &long_opt, 'V'},
         {"help",             no_argument,        &long_opt, 'H'},
@@ -467,11 +482,13 @@ main(int argc, char *argv[])
 
 argerr:
     fprintf(stderr,
-            "usage: img2sixel [-78eIkiugvSPDVH] [-p colors] [-m file] [-d diffusiontype]\n"
-            "                 [-f findtype] [-s selecttype] [-c geometory] [-w width]\n"
-            "                 [-h height] [-r resamplingtype] [-q quality] [-l loopmode]\n"
-            "                 [-t palettetype] [-n macronumber] [-C score] [-b palette]\n"
-            "                 [-E encodepolicy] [-B bgcolor] [-o outfile] [filename ...]\n"
+            "usage: img2sixel [-78eIkiugvSPDVH] [-p colors] [-m file] [-M file]\n"
+            "                 [-K dir] [-d diffusiontype] [-f findtype]\n"
+            "                 [-s selecttype] [-c geometory] [-w width] [-h height]\n"
+            "                 [-r resamplingtype] [-q quality] [-l loopmode]\n"
+            "                 [-t palettetype] [-n macronumber] [-C score] [-j threads]\n"
+            "                 [-b palette] [-E encodepolicy] [-B bgcolor]\n"
+            "                 [-o outfile] [filename ...]\n"
             "for more details, type: 'img2sixel -H'.\n");
 
 error:
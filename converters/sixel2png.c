@@ -130,6 +130,13 @@ show_help(void)
             "Options:\n"
             "-i, --input     specify input file\n"
             "-o, --output    specify output file\n"
+            "-j, --threads   decode bands with specified number of\n"
+            "                threads\n"
+            "-N, --numbered  write each image of the input into a\n"
+            "                numbered file, output.png is written as\n"
+            "                output-0001.png, output-0002.png, ...\n"
+            "-A, --apng      write images of the input as frames of\n"
+            "                an animated PNG\n"
             "-V, --version   show version and license information\n"
             "-H, --help      show this help\n"
            );
@@ -146,12 +153,15 @@ main(int argc, char *argv[])
     int long_opt;
     int option_index;
 #endif  /* HAVE_GETOPT_LONG */
-    char const *optstring = "i:o:VH";
+    char const *optstring = "i:o:j:NAVH";
 
 #if HAVE_GETOPT_LONG
     struct option long_options[] = {
         {"input",        required_argument,  &long_opt, 'i'},
         {"output",       required_argument,  &long_opt, 'o'},
+        {"threads",      required_argument,  &long_opt, 'j'},
+        {"numbered",     no_argument,        &long_opt, 'N'},
+        {"apng",         no_argument,        &long_opt, 'A'},
         {"version",      no_argument,        &long_opt, 'V'},
         {"help",         no_argument,        &long_opt, 'H'},
         {0, 0, 0, 0}
@@ -186,6 +186,12 @@ SIXEL_OPTFLAG_7BIT_MODE        = '7'  # -7, --7bit-mode: for 7bit terminals or p
 SIXEL_OPTFLAG_8BIT_MODE        = '8'  # -8, --8bit-mode: for 8bit terminals or printers
 SIXEL_OPTFLAG_COLORS           = 'p'  # -p COLORS, --colors=COLORS: specify number of colors
 SIXEL_OPTFLAG_MAPFILE          = 'm'  # -m FILE, --mapfile=FILE: specify set of colors
+SIXEL_OPTFLAG_MAPFILE_OUTPUT   = 'M'  # -M FILE, --mapfile-output=FILE:
+                                      #        write the palette into FILE,
+                                      #        which can be given to -m
+SIXEL_OPTFLAG_PALETTE_CACHE    = 'K'  # -K DIR, --palette-cache=DIR:
+                                      #        store computed palettes into DIR
+                                      #        and reuse them for the same images
 SIXEL_OPTFLAG_MONOCHROME       = 'e'  # -e, --monochrome: output monochrome sixel image
 SIXEL_OPTFLAG_INSECURE         = 'k'  # -k, --insecure: allow to connect to SSL sites without certs
 SIXEL_OPTFLAG_INVERT           = 'i'  # -i, --invert: assume the terminal background color
@@ -196,6 +202,8 @@ SIXEL_OPTFLAG_MACRO_NUMBER     = 'n'  # -n MACRONO, --macro-number=MACRONO:
 SIXEL_OPTFLAG_COMPLEXION_SCORE = 'C'  # -C COMPLEXIONSCORE, --complexion-score=COMPLEXIONSCORE:
                                       #        specify an number argument for the score of
                                       #        complexion correction.
+SIXEL_OPTFLAG_THREADS          = 'j'  # -j THREADS, --threads=THREADS:
+                                      #        resize and apply palette with THREADS threads
 SIXEL_OPTFLAG_IGNORE_DELAY     = 'g'  # -g, --ignore-delay: render GIF animation without delay
 SIXEL_OPTFLAG_STATIC           = 'S'  # -S, --static: render animated GIF as a static image
 SIXEL_OPTFLAG_DIFFUSION        = 'd'  # -d DIFFUSIONTYPE, --diffusion=DIFFUSIONTYPE:
@@ -589,6 +597,21 @@ def sixel_dither_set_transparent(dither, transparent):
     _sixel.sixel_dither_set_transparent(dither, transparent)
 
 
+def sixel_dither_set_threads(dither, nthreads):
+    _sixel.sixel_dither_set_threads.restype = None
+    _sixel.sixel_dither_set_threads.argtypes = [c_void_p, c_int]
+    _sixel.sixel_dither_set_threads(dither, nthreads)
+
+
+def sixel_dither_write_palette_file(dither, filename, embed_lut=True):
+    _sixel.sixel_dither_write_palette_file.restype = c_int
+    _sixel.sixel_dither_write_palette_file.argtypes = [c_void_p, c_char_p, c_int]
+    status = _sixel.sixel_dither_write_palette_file(dither, filename, embed_lut)
+    if SIXEL_FAILED(status):
+        message = sixel_helper_format_error(status)
+        raise RuntimeError(message)
+
+
 # convert pixels into sixel format and write it to output context
 def sixel_encode(pixels, width, height, depth, dither, output):
     _sixel.sixel_encode.restype = c_int
@@ -680,6 +703,38 @@ def sixel_encoder_encode_bytes(encoder, buf, width, height, pixelformat, palette
         raise RuntimeError(message)
 
 
+# encode a subrectangle of pixel data whose rows are stride bytes apart
+def sixel_encoder_encode_bytes_with_stride(encoder, buf, stride, x, y, width, height, pixelformat, palette):
+
+    depth = sixel_helper_compute_depth(pixelformat)
+
+    if depth <= 0:
+        raise ValueError("invalid pixelformat value : %d" % pixelformat)
+
+    if len(buf) < stride * (y + height):
+        raise ValueError("buf.len is too short : %d < %d * (%d + %d)" % (len(buf), stride, y, height))
+
+    if not hasattr(buf, "readonly") or buf.readonly:
+        cbuf = c_void_p.from_buffer_copy(buf)
+    else:
+        cbuf = c_void_p.from_buffer(buf)
+
+    if palette:
+        cpalettelen = len(palette)
+        cpalette = (c_byte * cpalettelen)(*palette)
+    else:
+        cpalettelen = None
+        cpalette = None
+
+    _sixel.sixel_encoder_encode_bytes_with_stride.restype = c_int
+    _sixel.sixel_encoder_encode_bytes_with_stride.argtypes = [c_void_p, c_void_p, c_int, c_int, c_int, c_int, c_int, c_int, c_void_p, c_int]
+
+    status = _sixel.sixel_encoder_encode_bytes_with_stride(encoder, buf, stride, x, y, width, height, pixelformat, cpalette, cpalettelen)
+    if SIXEL_FAILED(status):
+        message = sixel_helper_format_error(status)
+        raise RuntimeError(message)
+
+
 # create decoder object
 def sixel_decoder_new(allocator=c_void_p(None)):
     _sixel.sixel_decoder_new.restype = c_int
@@ -729,3 +784,37 @@ def sixel_decoder_decode(decoder, infile=None):
     if SIXEL_FAILED(status):
         message = sixel_helper_format_error(status)
         raise RuntimeError(message)
+
+
+# set a callback which receives bands decoded by sixel_decoder_feed()
+def sixel_decoder_set_band_function(decoder, fn_band, priv=None):
+    def _fn_band_local(pixels, width, stride, y, height, palette, priv_):
+        rows = [string_at(pixels + stride * i, width) for i in range(height)]
+        fn_band(rows, y, string_at(palette, SIXEL_PALETTE_MAX * 3), priv)
+        return SIXEL_OK
+    sixel_band_function = CFUNCTYPE(c_int, c_void_p, c_int, c_int, c_int, c_int, c_void_p, c_void_p)
+    _sixel.sixel_decoder_set_band_function.restype = None
+    _sixel.sixel_decoder_set_band_function.argtypes = [c_void_p, sixel_band_function, c_void_p]
+    _fn_band = sixel_band_function(_fn_band_local)
+    _sixel.sixel_decoder_set_band_function(decoder, _fn_band, c_void_p(None))
+    decoder.__fn_band = _fn_band
+
+
+# decode a piece of sixel data
+def sixel_decoder_feed(decoder, data):
+    _sixel.sixel_decoder_feed.restype = c_int
+    _sixel.sixel_decoder_feed.argtypes = [c_void_p, c_char_p, c_int]
+    status = _sixel.sixel_decoder_feed(decoder, data, len(data))
+    if SIXEL_FAILED(status):
+        message = sixel_helper_format_error(status)
+        raise RuntimeError(message)
+
+
+# finish decoding the data given by sixel_decoder_feed()
+def sixel_decoder_finish(decoder):
+    _sixel.sixel_decoder_finish.restype = c_int
+    _sixel.sixel_decoder_finish.argtypes = [c_void_p]
+    status = _sixel.sixel_decoder_finish(decoder)
+    if SIXEL_FAILED(status):
+        message = sixel_helper_format_error(status)
+        raise RuntimeError(message)
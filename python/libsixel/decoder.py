@@ -37,6 +37,15 @@ class Decoder(object):
     def decode(self, infile=None):
         sixel_decoder_decode(self._decoder, infile)
 
+    def set_band_function(self, fn_band, priv=None):
+        sixel_decoder_set_band_function(self._decoder, fn_band, priv)
+
+    def feed(self, data):
+        sixel_decoder_feed(self._decoder, data)
+
+    def finish(self):
+        sixel_decoder_finish(self._decoder)
+
     def test(self, infile=None, outfile=None):
         import threading
 
@@ -40,6 +40,9 @@ class Encoder(object):
     def encode_bytes(self, buf, width, height, pixelformat, palette):
         sixel_encoder_encode_bytes(self._encoder, buf, width, height, pixelformat, palette)
 
+    def encode_bytes_with_stride(self, buf, stride, x, y, width, height, pixelformat, palette):
+        sixel_encoder_encode_bytes_with_stride(self._encoder, buf, stride, x, y, width, height, pixelformat, palette)
+
     def test(self, filename):
         import threading
 
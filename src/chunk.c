@@ -52,6 +52,9 @@
 #if HAVE_SYS_SELECT_H
 # include <sys/select.h>
 #endif  /* HAVE_SYS_SELECT_H */
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif  /* HAVE_SYS_MMAN_H */
 
 #if !defined(HAVE_MEMCPY)
 # define memcpy(d, s, n) (bcopy ((s), (d), (n)))
@@ -65,6 +68,19 @@
 # define O_BINARY _O_BINARY
 #endif  /* !defined(O_BINARY) && !defined(_O_BINARY) */
 
+#if HAVE_SYS_MMAN_H && HAVE_MMAP && HAVE_MUNMAP && HAVE_FSTAT
+# define SIXEL_CHUNK_USE_MMAP 1
+#endif
+
+/* files smaller than this are read into a buffer, mapping them costs
+   more than copying */
+#define SIXEL_CHUNK_MAP_MIN (64 * 1024)
+
+/* size of a read from pipes and terminals, it grows while the reads are
+   filled */
+#define SIXEL_CHUNK_READ_MIN (64 * 1024)
+#define SIXEL_CHUNK_READ_MAX (1024 * 1024)
+
 #include "chunk.h"
 #include "allocator.h"
 
@@ -104,13 +120,79 @@ sixel_chunk_destroy(
 
     if (pchunk) {
         allocator = pchunk->allocator;
-        sixel_allocator_free(allocator, pchunk->buffer);
+        if (pchunk->mapped) {
+            sixel_chunk_unmap(pchunk->buffer, pchunk->size);
+        } else {
+            sixel_allocator_free(allocator, pchunk->buffer);
+        }
         sixel_allocator_free(allocator, pchunk);
         sixel_allocator_unref(allocator);
     }
 }
 
 
+/* map a regular file opened for reading into memory, NULL is returned
+   if the file is small or can not be mapped */
+unsigned char *
+sixel_chunk_map(
+    int                 /* in */    fd,
+    size_t              /* out */   *psize)
+{
+#if SIXEL_CHUNK_USE_MMAP
+    struct stat sb;
+    void *p;
+
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        return NULL;
+    }
+    if (sb.st_size < SIXEL_CHUNK_MAP_MIN || (unsigned long long)sb.st_size > (size_t)-1) {
+        return NULL;
+    }
+    /* the mapping starts at the head of the file, stdin may be
+       redirected from a file which is partially consumed */
+    if (lseek(fd, 0, SEEK_CUR) != 0) {
+        return NULL;
+    }
+
+    /* the mapping is private and writable, loaders may modify the data
+       in place without touching the file */
+    p = mmap(NULL, (size_t)sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+# if defined(MADV_SEQUENTIAL)
+    (void) madvise(p, (size_t)sb.st_size, MADV_SEQUENTIAL);
+# endif
+
+    *psize = (size_t)sb.st_size;
+
+    return (unsigned char *)p;
+#else
+    (void) fd;
+    (void) psize;
+
+    return NULL;
+#endif  /* SIXEL_CHUNK_USE_MMAP */
+}
+
+
+/* release a mapping given by sixel_chunk_map() */
+void
+sixel_chunk_unmap(
+    unsigned char       /* in */    *mapped,
+    size_t              /* in */    size)
+{
+#if SIXEL_CHUNK_USE_MMAP
+    if (mapped) {
+        munmap(mapped, size);
+    }
+#else
+    (void) mapped;
+    (void) size;
+#endif  /* SIXEL_CHUNK_USE_MMAP */
+}
+
+
 # ifdef HAVE_LIBCURL
 static size_t
 memory_write(void   /* in */ *ptr,
@@ -255,16 +337,53 @@ sixel_chunk_from_file(
     SIXELSTATUS status = SIXEL_FALSE;
     int ret;
     FILE *f = NULL;
+    int fd;
+    int is_tty;
     size_t n;
-    size_t const bucket_size = 4096;
+    size_t request;
+    size_t bucket_size = SIXEL_CHUNK_READ_MIN;
+    size_t initial_size = SIXEL_CHUNK_READ_MIN;
+#if HAVE_UNISTD_H
+    ssize_t nread;
+#endif  /* HAVE_UNISTD_H */
+#if HAVE_FSTAT
+    struct stat sb;
+#endif  /* HAVE_FSTAT */
 
     status = open_binary_file(&f, filename);
     if (SIXEL_FAILED(status) || f == NULL) {
         goto end;
     }
+    fd = fileno(f);
+
+    /* large regular files are used in place */
+    pchunk->buffer = sixel_chunk_map(fd, &pchunk->size);
+    if (pchunk->buffer) {
+        pchunk->mapped = 1;
+        pchunk->max_size = pchunk->size;
+        status = SIXEL_OK;
+        goto end;
+    }
+
+#if HAVE_FSTAT
+    /* the size of a regular file is known, one more byte is needed to
+       see the end of the file without growing the buffer */
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0 &&
+            (unsigned long long)sb.st_size < (size_t)-1) {
+        initial_size = (size_t)sb.st_size + 1;
+        bucket_size = initial_size;
+    }
+#endif  /* HAVE_FSTAT */
+
+    status = sixel_chunk_init(pchunk, initial_size);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    is_tty = isatty(fd);
 
     for (;;) {
-        if (pchunk->max_size - pchunk->size < bucket_size) {
+        if (pchunk->max_size == pchunk->size) {
             pchunk->max_size *= 2;
             pchunk->buffer = (unsigned char *)sixel_allocator_realloc(pchunk->allocator,
                                                                       pchunk->buffer,
@@ -277,13 +396,13 @@ sixel_chunk_from_file(
             }
         }
 
-        if (isatty(fileno(f))) {
+        if (is_tty) {
             for (;;) {
                 if (*cancel_flag) {
                     status = SIXEL_INTERRUPTED;
                     goto end;
                 }
-                ret = wait_file(fileno(f), 10000);
+                ret = wait_file(fd, 10000);
                 if (ret < 0) {
                     sixel_helper_set_additional_message(
                         "sixel_chunk_from_file: wait_file() failed.");
@@ -295,20 +414,46 @@ sixel_chunk_from_file(
                 }
             }
         }
-        n = fread(pchunk->buffer + pchunk->size, 1, 4096, f);
+
+        request = pchunk->max_size - pchunk->size;
+        if (request > bucket_size) {
+            request = bucket_size;
+        }
+#if HAVE_UNISTD_H
+        /* stdio buffering only adds a copy here */
+        nread = read(fd, pchunk->buffer + pchunk->size, request);
+        if (nread < 0) {
+# if HAVE_ERRNO_H
+            if (errno == EINTR) {
+                continue;
+            }
+# endif  /* HAVE_ERRNO_H */
+            sixel_helper_set_additional_message(
+                "sixel_chunk_from_file: read() failed.");
+            status = (SIXEL_LIBC_ERROR | (errno & 0xff));
+            goto end;
+        }
+        n = (size_t)nread;
+#else
+        n = fread(pchunk->buffer + pchunk->size, 1, request, f);
+#endif  /* HAVE_UNISTD_H */
         if (n == 0) {
             break;
         }
         pchunk->size += n;
-    }
 
-    if (f != stdin) {
-        fclose(f);
+        /* pipes fill larger reads while the writer is ahead of us */
+        if (n == request && bucket_size < SIXEL_CHUNK_READ_MAX) {
+            bucket_size *= 2;
+        }
     }
 
     status = SIXEL_OK;
 
 end:
+    if (f && f != stdin) {
+        fclose(f);
+    }
     return status;
 }
 
@@ -441,18 +586,18 @@ sixel_chunk_new(
 
     /* set allocator to chunk object */
     (*ppchunk)->allocator = allocator;
-
-    status = sixel_chunk_init(*ppchunk, 1024 * 32);
-    if (SIXEL_FAILED(status)) {
-        sixel_allocator_free(allocator, *ppchunk);
-        *ppchunk = NULL;
-        goto end;
-    }
+    (*ppchunk)->buffer = NULL;
+    (*ppchunk)->size = 0;
+    (*ppchunk)->max_size = 0;
+    (*ppchunk)->mapped = 0;
 
     sixel_allocator_ref(allocator);
 
     if (filename != NULL && strstr(filename, "://")) {
-        status = sixel_chunk_from_url(filename, *ppchunk, finsecure);
+        status = sixel_chunk_init(*ppchunk, 1024 * 32);
+        if (SIXEL_SUCCEEDED(status)) {
+            status = sixel_chunk_from_url(filename, *ppchunk, finsecure);
+        }
     } else {
         status = sixel_chunk_from_file(filename, *ppchunk, cancel_flag);
     }
@@ -477,7 +622,7 @@ test1(void)
     unsigned char *ptr = malloc(16);
 
 #ifdef HAVE_LIBCURL
-    sixel_chunk_t chunk = {0, 0, 0, NULL};
+    sixel_chunk_t chunk = {0, 0, 0, NULL, 0};
     int nread;
 
     nread = memory_write(NULL, 1, 1, NULL);
@@ -583,6 +728,52 @@ error:
 }
 
 
+/* large files are mapped, small files are read into a buffer */
+static int
+test5(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_chunk_t *chunk = NULL;
+    sixel_chunk_t *small = NULL;
+    sixel_allocator_t *allocator = NULL;
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_chunk_new(&chunk, "../images/snake.ppm", 0, NULL, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (chunk->size != 810015 || memcmp(chunk->buffer, "P6", 2) != 0) {
+        goto error;
+    }
+#if SIXEL_CHUNK_USE_MMAP
+    if (!chunk->mapped) {
+        goto error;
+    }
+#endif  /* SIXEL_CHUNK_USE_MMAP */
+
+    status = sixel_chunk_new(&small, "../images/map8.six", 0, NULL, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (small->mapped || small->size != 255) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_chunk_destroy(chunk);
+    sixel_chunk_destroy(small);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_chunk_tests_main(void)
 {
@@ -595,6 +786,7 @@ sixel_chunk_tests_main(void)
         test2,
         test3,
         test4,
+        test5,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
@@ -31,6 +31,7 @@ typedef struct sixel_chunk
     size_t size;
     size_t max_size;
     sixel_allocator_t *allocator;
+    int mapped;             /* buffer is a mapping of the file */
 } sixel_chunk_t;
 
 #ifdef __cplusplus
@@ -51,6 +52,21 @@ sixel_chunk_destroy(
     sixel_chunk_t * const /* in */ pchunk);
 
 
+/* map a regular file opened for reading into memory, NULL is returned
+   if the file is small or can not be mapped */
+unsigned char *
+sixel_chunk_map(
+    int                 /* in */    fd,
+    size_t              /* out */   *psize);
+
+
+/* release a mapping given by sixel_chunk_map() */
+void
+sixel_chunk_unmap(
+    unsigned char       /* in */    *mapped,
+    size_t              /* in */    size);
+
+
 #if HAVE_TESTS
 int
 sixel_chunk_tests_main(void);
@@ -62,8 +62,17 @@
 #if HAVE_IO_H
 # include <io.h>
 #endif  /* HAVE_IO_H */
+#if HAVE_LIMITS_H
+# include <limits.h>
+#endif  /* HAVE_LIMITS_H */
 
 #include "decoder.h"
+#include "fromsixel.h"
+#include "chunk.h"
+#include "writer.h"
+
+/* size of a piece of input passed to the parser at once */
+#define SIXEL_DECODER_READ_SIZE (64 * 1024)
 
 
 /* original version of strdup(1) with allocator object */
@@ -114,6 +123,11 @@ sixel_decoder_new(
     (*ppdecoder)->output       = strdup_with_allocator("-", allocator);
     (*ppdecoder)->input        = strdup_with_allocator("-", allocator);
     (*ppdecoder)->allocator    = allocator;
+    (*ppdecoder)->fn_band      = NULL;
+    (*ppdecoder)->band_priv    = NULL;
+    (*ppdecoder)->stream       = NULL;
+    (*ppdecoder)->nthreads     = 0;
+    (*ppdecoder)->images       = SIXEL_DECODER_FIRST_IMAGE;
 
     if ((*ppdecoder)->output == NULL || (*ppdecoder)->input == NULL) {
         sixel_decoder_unref(*ppdecoder);
@@ -157,6 +171,7 @@ sixel_decoder_destroy(sixel_decoder_t *decoder)
 
     if (decoder) {
         allocator = decoder->allocator;
+        sixel_decode_stream_destroy(decoder->stream);
         sixel_allocator_free(allocator, decoder->input);
         sixel_allocator_free(allocator, decoder->output);
         sixel_allocator_free(allocator, decoder);
@@ -218,6 +233,21 @@ sixel_decoder_setopt(
             goto end;
         }
         break;
+    case SIXEL_OPTFLAG_THREADS:  /* j */
+        decoder->nthreads = atoi(value);
+        if (decoder->nthreads < 1) {
+            sixel_helper_set_additional_message(
+                "threads parameter must be 1 or more.");
+            status = SIXEL_BAD_ARGUMENT;
+            goto end;
+        }
+        break;
+    case SIXEL_OPTFLAG_NUMBERED:  /* N */
+        decoder->images = SIXEL_DECODER_NUMBERED;
+        break;
+    case SIXEL_OPTFLAG_APNG:  /* A */
+        decoder->images = SIXEL_DECODER_APNG;
+        break;
     case '?':
     default:
         status = SIXEL_BAD_ARGUMENT;
@@ -233,6 +263,247 @@ end:
 }
 
 
+/* set a callback which receives bands decoded by sixel_decoder_feed(),
+   the decoded image is written to the output file if it is not set */
+SIXELAPI void
+sixel_decoder_set_band_function(
+    sixel_decoder_t     /* in */ *decoder,  /* decoder object */
+    sixel_band_function /* in */ fn_band,   /* callback, or NULL */
+    void                /* in */ *priv)     /* private data for fn_band */
+{
+    decoder->fn_band = fn_band;
+    decoder->band_priv = priv;
+}
+
+
+/* create the decoder state for sixel data given in pieces if it does
+   not exist yet */
+static SIXELSTATUS
+sixel_decoder_open_stream(
+    sixel_decoder_t     /* in */ *decoder)  /* decoder object */
+{
+    SIXELSTATUS status = SIXEL_OK;
+
+    if (decoder->stream == NULL) {
+        status = sixel_decode_stream_new(&decoder->stream,
+                                         decoder->fn_band,
+                                         decoder->band_priv,
+                                         decoder->allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        sixel_decode_stream_set_threads(decoder->stream, decoder->nthreads);
+    }
+
+end:
+    return status;
+}
+
+
+/* decode a piece of sixel data, completed bands are passed to the band
+   callback as soon as the following band is started */
+SIXELAPI SIXELSTATUS
+sixel_decoder_feed(
+    sixel_decoder_t     /* in */ *decoder,  /* decoder object */
+    unsigned char const /* in */ *bytes,    /* sixel bytes */
+    int                 /* in */ len)       /* size of sixel bytes */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    sixel_decoder_ref(decoder);
+
+    status = sixel_decoder_open_stream(decoder);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_decode_stream_feed(decoder->stream, bytes, len);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    sixel_decoder_unref(decoder);
+
+    return status;
+}
+
+
+/* finish decoding the data given by sixel_decoder_feed(), the rest of
+   bands are passed to the band callback, or the image is written to the
+   output file, and the decoder gets ready for the next image */
+SIXELAPI SIXELSTATUS
+sixel_decoder_finish(
+    sixel_decoder_t     /* in */ *decoder)  /* decoder object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *indexed_pixels = NULL;
+    unsigned char *palette = NULL;
+    int sx;
+    int sy;
+    int ncolors;
+
+    sixel_decoder_ref(decoder);
+
+    status = sixel_decoder_open_stream(decoder);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_decode_stream_finish(decoder->stream,
+                                        &indexed_pixels,
+                                        &sx,
+                                        &sy,
+                                        &palette,
+                                        &ncolors);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    if (indexed_pixels) {
+        status = sixel_helper_write_image_file(indexed_pixels, sx, sy, palette,
+                                               SIXEL_PIXELFORMAT_PAL8,
+                                               decoder->output,
+                                               SIXEL_FORMAT_PNG,
+                                               decoder->allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    status = SIXEL_OK;
+
+end:
+    sixel_decode_stream_destroy(decoder->stream);
+    decoder->stream = NULL;
+    sixel_allocator_free(decoder->allocator, indexed_pixels);
+    sixel_allocator_free(decoder->allocator, palette);
+    sixel_decoder_unref(decoder);
+
+    return status;
+}
+
+
+/* make the name of the n-th numbered file, the number is put before
+   the extension */
+static char *
+numbered_filename(
+    char const          /* in */ *path,
+    int                 /* in */ n,
+    sixel_allocator_t   /* in */ *allocator)
+{
+    char *name;
+    char const *ext;
+    char const *sep;
+    size_t len;
+
+    name = (char *)sixel_allocator_malloc(allocator, strlen(path) + 16);
+    if (name == NULL) {
+        sixel_helper_set_additional_message(
+            "numbered_filename: sixel_allocator_malloc() failed.");
+        return NULL;
+    }
+
+    ext = strrchr(path, '.');
+    sep = strrchr(path, '/');
+    if (ext == NULL || (sep && ext < sep)) {
+        ext = path + strlen(path);
+    }
+    len = (size_t)(ext - path);
+    memcpy(name, path, len);
+    sprintf(name + len, "-%04d%s", n, ext);
+
+    return name;
+}
+
+
+/* decode all images of the data, and write them into numbered files or
+   an animated PNG */
+static SIXELSTATUS
+sixel_decoder_write_images(
+    sixel_decoder_t     /* in */ *decoder,  /* decoder object */
+    unsigned char const /* in */ *data,     /* sixel bytes */
+    int                 /* in */ len)       /* size of sixel bytes */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_decode_iterator_t *iterator = NULL;
+    sixel_apng_writer_t *writer = NULL;
+    unsigned char *pixels;
+    unsigned char *palette;
+    char *filename;
+    int sx;
+    int sy;
+    int ncolors;
+    int n;
+
+    if (decoder->images == SIXEL_DECODER_NUMBERED &&
+        strcmp(decoder->output, "-") == 0) {
+        sixel_helper_set_additional_message(
+            "sixel_decoder_write_images: numbered files need an output filename.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    status = sixel_decode_iterator_new(&iterator, data, len, decoder->allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    if (decoder->images == SIXEL_DECODER_APNG) {
+        status = sixel_apng_writer_new(&writer, decoder->output, decoder->allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    for (n = 1;; ++n) {
+        status = sixel_decode_iterator_next(iterator, &pixels, &sx, &sy,
+                                            &palette, &ncolors);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        if (pixels == NULL) {
+            break;
+        }
+        if (writer) {
+            status = sixel_apng_writer_add_frame(writer, pixels, sx, sy, palette,
+                                                 SIXEL_PIXELFORMAT_PAL8);
+        } else {
+            filename = numbered_filename(decoder->output, n, decoder->allocator);
+            if (filename == NULL) {
+                status = SIXEL_BAD_ALLOCATION;
+                goto end;
+            }
+            status = sixel_helper_write_image_file(pixels, sx, sy, palette,
+                                                   SIXEL_PIXELFORMAT_PAL8,
+                                                   filename,
+                                                   SIXEL_FORMAT_PNG,
+                                                   decoder->allocator);
+            sixel_allocator_free(decoder->allocator, filename);
+        }
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    if (writer) {
+        status = sixel_apng_writer_finish(writer);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    status = SIXEL_OK;
+
+end:
+    sixel_apng_writer_destroy(writer);
+    sixel_decode_iterator_unref(iterator);
+    return status;
+}
+
+
 /* load source data from stdin or the file specified with
    SIXEL_OPTFLAG_INPUT flag, and decode it */
 SIXELAPI SIXELSTATUS
@@ -241,18 +512,20 @@ sixel_decoder_decode(
 {
     SIXELSTATUS status = SIXEL_FALSE;
     unsigned char *raw_data = NULL;
-    int sx;
-    int sy;
-    int raw_len;
-    int max;
+    unsigned char *new_data;
+    unsigned char *mapped = NULL;
+    size_t mapped_size = 0;
     int n;
+    int size;
+    int capacity;
     FILE *input_fp = NULL;
-    unsigned char *indexed_pixels = NULL;
-    unsigned char *palette = NULL;
-    int ncolors;
 
     sixel_decoder_ref(decoder);
 
+    /* discard data given by sixel_decoder_feed() */
+    sixel_decode_stream_destroy(decoder->stream);
+    decoder->stream = NULL;
+
     if (strcmp(decoder->input, "-") == 0) {
         /* for windows */
 #if defined(O_BINARY)
@@ -273,10 +546,27 @@ sixel_decoder_decode(
         }
     }
 
-    raw_len = 0;
-    max = 64 * 1024;
+    /* large regular files are decoded in place */
+    mapped = sixel_chunk_map(fileno(input_fp), &mapped_size);
+    if (mapped && mapped_size <= INT_MAX) {
+        if (decoder->images != SIXEL_DECODER_FIRST_IMAGE) {
+            status = sixel_decoder_write_images(decoder, mapped, (int)mapped_size);
+            goto end;
+        }
+        status = sixel_decoder_open_stream(decoder);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        status = sixel_decode_stream_feed_all(decoder->stream, mapped, (int)mapped_size);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        status = sixel_decoder_finish(decoder);
+        goto end;
+    }
 
-    raw_data = (unsigned char *)sixel_allocator_malloc(decoder->allocator, (size_t)max);
+    raw_data = (unsigned char *)sixel_allocator_malloc(decoder->allocator,
+                                                       SIXEL_DECODER_READ_SIZE);
     if (raw_data == NULL) {
         sixel_helper_set_additional_message(
             "sixel_decoder_decode: sixel_allocator_malloc() failed.");
@@ -284,59 +574,57 @@ sixel_decoder_decode(
         goto end;
     }
 
-    for (;;) {
-        if ((max - raw_len) < 4096) {
-            max *= 2;
-            raw_data = (unsigned char *)sixel_allocator_realloc(decoder->allocator, raw_data, (size_t)max);
-            if (raw_data == NULL) {
-                sixel_helper_set_additional_message(
-                    "sixel_decoder_decode: sixel_allocator_realloc() failed.");
-                status = SIXEL_BAD_ALLOCATION;
-                goto end;
+    if (decoder->images != SIXEL_DECODER_FIRST_IMAGE) {
+        /* the images are decoded one by one from the whole input */
+        size = 0;
+        capacity = SIXEL_DECODER_READ_SIZE;
+        while ((n = (int)fread(raw_data + size, 1, (size_t)(capacity - size), input_fp)) > 0) {
+            size += n;
+            if (size == capacity) {
+                if (capacity > INT_MAX / 2) {
+                    sixel_helper_set_additional_message(
+                        "sixel_decoder_decode: the input is too large.");
+                    status = SIXEL_BAD_INPUT;
+                    goto end;
+                }
+                capacity *= 2;
+                new_data = (unsigned char *)sixel_allocator_realloc(decoder->allocator,
+                                                                    raw_data,
+                                                                    (size_t)capacity);
+                if (new_data == NULL) {
+                    sixel_helper_set_additional_message(
+                        "sixel_decoder_decode: sixel_allocator_realloc() failed.");
+                    status = SIXEL_BAD_ALLOCATION;
+                    goto end;
+                }
+                raw_data = new_data;
             }
         }
-        if ((n = (int)fread(raw_data + raw_len, 1, 4096, input_fp)) <= 0) {
-            break;
-        }
-        raw_len += n;
-    }
-
-    if (input_fp != stdout) {
-        fclose(input_fp);
-    }
-
-    status = sixel_decode_raw(
-        raw_data,
-        raw_len,
-        &indexed_pixels,
-        &sx,
-        &sy,
-        &palette,
-        &ncolors,
-        decoder->allocator);
-    if (SIXEL_FAILED(status)) {
+        status = sixel_decoder_write_images(decoder, raw_data, size);
         goto end;
     }
 
-    if (sx > SIXEL_WIDTH_LIMIT || sy > SIXEL_HEIGHT_LIMIT) {
-        status = SIXEL_BAD_INPUT;
-        goto end;
+    /* the data is decoded while it is read, the whole input is not kept */
+    while ((n = (int)fread(raw_data, 1, SIXEL_DECODER_READ_SIZE, input_fp)) > 0) {
+        status = sixel_decoder_feed(decoder, raw_data, n);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
     }
 
-    status = sixel_helper_write_image_file(indexed_pixels, sx, sy, palette,
-                                           SIXEL_PIXELFORMAT_PAL8,
-                                           decoder->output,
-                                           SIXEL_FORMAT_PNG,
-                                           decoder->allocator);
-
+    status = sixel_decoder_finish(decoder);
     if (SIXEL_FAILED(status)) {
         goto end;
     }
 
 end:
+    sixel_chunk_unmap(mapped, mapped_size);
+    if (input_fp && input_fp != stdin) {
+        fclose(input_fp);
+    }
+    sixel_decode_stream_destroy(decoder->stream);
+    decoder->stream = NULL;
     sixel_allocator_free(decoder->allocator, raw_data);
-    sixel_allocator_free(decoder->allocator, indexed_pixels);
-    sixel_allocator_free(decoder->allocator, palette);
     sixel_decoder_unref(decoder);
 
     return status;
@@ -582,6 +870,113 @@ error:
 }
 
 
+typedef struct test_image {
+    unsigned char pixels[64 * 24];
+    int width;
+    int height;
+    int nbands;
+} test_image_t;
+
+
+static SIXELSTATUS
+test_band(unsigned char *pixels, int width, int stride, int y, int height,
+          unsigned char *palette, void *priv)
+{
+    test_image_t *image = (test_image_t *)priv;
+    int i;
+
+    (void) palette;
+
+    if (y != image->height || width > 64 || y + height > 24) {
+        return SIXEL_LOGIC_ERROR;
+    }
+    for (i = 0; i < height; ++i) {
+        memset(image->pixels + (y + i) * 64, 255, 64);
+        memcpy(image->pixels + (y + i) * 64, pixels + i * stride, (size_t)width);
+    }
+    if (image->width < width) {
+        image->width = width;
+    }
+    image->height += height;
+    image->nbands++;
+
+    return SIXEL_OK;
+}
+
+
+/* sixel data fed in pieces is passed to the band callback band by band */
+static int
+test9(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_decoder_t *decoder = NULL;
+    SIXELSTATUS status;
+    static char const sixel[] = "\033Pq#1;2;100;0;0#2;2;0;100;0"
+                                "#1!40~$#2!10?!20N-"
+                                "!50~-"
+                                "-"
+                                "#1!60@\033\\";
+    int len = (int)sizeof(sixel) - 1;
+    unsigned char *pixels = NULL;
+    unsigned char *palette = NULL;
+    int width;
+    int height;
+    int ncolors;
+    int chunk;
+    int i;
+    int y;
+    test_image_t image;
+
+    status = sixel_decoder_new(&decoder, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_decode_raw((unsigned char *)sixel, len, &pixels,
+                              &width, &height, &palette, &ncolors, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (width != 60 || height != 19) {
+        goto error;
+    }
+
+    sixel_decoder_set_band_function(decoder, test_band, &image);
+
+    for (chunk = 1; chunk < len; chunk += 6) {
+        memset(&image, 0, sizeof(image));
+        for (i = 0; i < len; i += chunk) {
+            status = sixel_decoder_feed(decoder,
+                                        (unsigned char const *)sixel + i,
+                                        len - i < chunk ? len - i : chunk);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+        }
+        status = sixel_decoder_finish(decoder);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (image.nbands != 4 || image.width != width || image.height != height) {
+            goto error;
+        }
+        for (y = 0; y < height; ++y) {
+            if (memcmp(image.pixels + y * 64, pixels + y * width, (size_t)width) != 0) {
+                goto error;
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    free(pixels);
+    free(palette);
+    sixel_decoder_unref(decoder);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_decoder_tests_main(void)
 {
@@ -597,7 +992,8 @@ sixel_decoder_tests_main(void)
         test5,
         test6,
         test7,
-        test8
+        test8,
+        test9
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
@@ -24,12 +24,27 @@
 
 #include <sixel.h>
 
+/* how the images of the input are written */
+enum {
+    SIXEL_DECODER_FIRST_IMAGE = 0,  /* the first image only */
+    SIXEL_DECODER_NUMBERED    = 1,  /* each image into a numbered file */
+    SIXEL_DECODER_APNG        = 2   /* all images into an animated PNG */
+};
+
 /* encode settings object */
 struct sixel_decoder {
     unsigned int ref;
     char *input;
     char *output;
     sixel_allocator_t *allocator;
+    sixel_band_function fn_band;        /* callback for decoded bands */
+    void *band_priv;                    /* private data for fn_band */
+    struct sixel_decode_stream *stream; /* state of sixel_decoder_feed() */
+    int nthreads;                       /* threads for decoding bands, 0 for
+                                           sequential decoding */
+    int images;                         /* one of SIXEL_DECODER_FIRST_IMAGE,
+                                           SIXEL_DECODER_NUMBERED or
+                                           SIXEL_DECODER_APNG */
 };
 
 #if HAVE_TESTS
@@ -40,218 +40,12 @@
 
 #include "dither.h"
 #include "quant.h"
+#include "palcache.h"
+#include "palette.h"
+#include "lookuptable.h"
 #include <sixel.h>
 
 
-static const unsigned char pal_mono_dark[] = {
-    0x00, 0x00, 0x00, 0xff, 0xff, 0xff
-};
-
-
-static const unsigned char pal_mono_light[] = {
-    0xff, 0xff, 0xff, 0x00, 0x00, 0x00
-};
-
-static const unsigned char pal_gray_1bit[] = {
-    0x00, 0x00, 0x00, 0xff, 0xff, 0xff
-};
-
-
-static const unsigned char pal_gray_2bit[] = {
-    0x00, 0x00, 0x00, 0x55, 0x55, 0x55, 0xaa, 0xaa, 0xaa, 0xff, 0xff, 0xff
-};
-
-
-static const unsigned char pal_gray_4bit[] = {
-    0x00, 0x00, 0x00, 0x11, 0x11, 0x11, 0x22, 0x22, 0x22, 0x33, 0x33, 0x33,
-    0x44, 0x44, 0x44, 0x55, 0x55, 0x55, 0x66, 0x66, 0x66, 0x77, 0x77, 0x77,
-    0x88, 0x88, 0x88, 0x99, 0x99, 0x99, 0xaa, 0xaa, 0xaa, 0xbb, 0xbb, 0xbb,
-    0xcc, 0xcc, 0xcc, 0xdd, 0xdd, 0xdd, 0xee, 0xee, 0xee, 0xff, 0xff, 0xff
-};
-
-
-static const unsigned char pal_gray_8bit[] = {
-    0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x02, 0x02, 0x02, 0x03, 0x03, 0x03,
-    0x04, 0x04, 0x04, 0x05, 0x05, 0x05, 0x06, 0x06, 0x06, 0x07, 0x07, 0x07,
-    0x08, 0x08, 0x08, 0x09, 0x09, 0x09, 0x0a, 0x0a, 0x0a, 0x0b, 0x0b, 0x0b,
-    0x0c, 0x0c, 0x0c, 0x0d, 0x0d, 0x0d, 0x0e, 0x0e, 0x0e, 0x0f, 0x0f, 0x0f,
-    0x10, 0x10, 0x10, 0x11, 0x11, 0x11, 0x12, 0x12, 0x12, 0x13, 0x13, 0x13,
-    0x14, 0x14, 0x14, 0x15, 0x15, 0x15, 0x16, 0x16, 0x16, 0x17, 0x17, 0x17,
-    0x18, 0x18, 0x18, 0x19, 0x19, 0x19, 0x1a, 0x1a, 0x1a, 0x1b, 0x1b, 0x1b,
-    0x1c, 0x1c, 0x1c, 0x1d, 0x1d, 0x1d, 0x1e, 0x1e, 0x1e, 0x1f, 0x1f, 0x1f,
-    0x20, 0x20, 0x20, 0x21, 0x21, 0x21, 0x22, 0x22, 0x22, 0x23, 0x23, 0x23,
-    0x24, 0x24, 0x24, 0x25, 0x25, 0x25, 0x26, 0x26, 0x26, 0x27, 0x27, 0x27,
-    0x28, 0x28, 0x28, 0x29, 0x29, 0x29, 0x2a, 0x2a, 0x2a, 0x2b, 0x2b, 0x2b,
-    0x2c, 0x2c, 0x2c, 0x2d, 0x2d, 0x2d, 0x2e, 0x2e, 0x2e, 0x2f, 0x2f, 0x2f,
-    0x30, 0x30, 0x30, 0x31, 0x31, 0x31, 0x32, 0x32, 0x32, 0x33, 0x33, 0x33,
-    0x34, 0x34, 0x34, 0x35, 0x35, 0x35, 0x36, 0x36, 0x36, 0x37, 0x37, 0x37,
-    0x38, 0x38, 0x38, 0x39, 0x39, 0x39, 0x3a, 0x3a, 0x3a, 0x3b, 0x3b, 0x3b,
-    0x3c, 0x3c, 0x3c, 0x3d, 0x3d, 0x3d, 0x3e, 0x3e, 0x3e, 0x3f, 0x3f, 0x3f,
-    0x40, 0x40, 0x40, 0x41, 0x41, 0x41, 0x42, 0x42, 0x42, 0x43, 0x43, 0x43,
-    0x44, 0x44, 0x44, 0x45, 0x45, 0x45, 0x46, 0x46, 0x46, 0x47, 0x47, 0x47,
-    0x48, 0x48, 0x48, 0x49, 0x49, 0x49, 0x4a, 0x4a, 0x4a, 0x4b, 0x4b, 0x4b,
-    0x4c, 0x4c, 0x4c, 0x4d, 0x4d, 0x4d, 0x4e, 0x4e, 0x4e, 0x4f, 0x4f, 0x4f,
-    0x50, 0x50, 0x50, 0x51, 0x51, 0x51, 0x52, 0x52, 0x52, 0x53, 0x53, 0x53,
-    0x54, 0x54, 0x54, 0x55, 0x55, 0x55, 0x56, 0x56, 0x56, 0x57, 0x57, 0x57,
-    0x58, 0x58, 0x58, 0x59, 0x59, 0x59, 0x5a, 0x5a, 0x5a, 0x5b, 0x5b, 0x5b,
-    0x5c, 0x5c, 0x5c, 0x5d, 0x5d, 0x5d, 0x5e, 0x5e, 0x5e, 0x5f, 0x5f, 0x5f,
-    0x60, 0x60, 0x60, 0x61, 0x61, 0x61, 0x62, 0x62, 0x62, 0x63, 0x63, 0x63,
-    0x64, 0x64, 0x64, 0x65, 0x65, 0x65, 0x66, 0x66, 0x66, 0x67, 0x67, 0x67,
-    0x68, 0x68, 0x68, 0x69, 0x69, 0x69, 0x6a, 0x6a, 0x6a, 0x6b, 0x6b, 0x6b,
-    0x6c, 0x6c, 0x6c, 0x6d, 0x6d, 0x6d, 0x6e, 0x6e, 0x6e, 0x6f, 0x6f, 0x6f,
-    0x70, 0x70, 0x70, 0x71, 0x71, 0x71, 0x72, 0x72, 0x72, 0x73, 0x73, 0x73,
-    0x74, 0x74, 0x74, 0x75, 0x75, 0x75, 0x76, 0x76, 0x76, 0x77, 0x77, 0x77,
-    0x78, 0x78, 0x78, 0x79, 0x79, 0x79, 0x7a, 0x7a, 0x7a, 0x7b, 0x7b, 0x7b,
-    0x7c, 0x7c, 0x7c, 0x7d, 0x7d, 0x7d, 0x7e, 0x7e, 0x7e, 0x7f, 0x7f, 0x7f,
-    0x80, 0x80, 0x80, 0x81, 0x81, 0x81, 0x82, 0x82, 0x82, 0x83, 0x83, 0x83,
-    0x84, 0x84, 0x84, 0x85, 0x85, 0x85, 0x86, 0x86, 0x86, 0x87, 0x87, 0x87,
-    0x88, 0x88, 0x88, 0x89, 0x89, 0x89, 0x8a, 0x8a, 0x8a, 0x8b, 0x8b, 0x8b,
-    0x8c, 0x8c, 0x8c, 0x8d, 0x8d, 0x8d, 0x8e, 0x8e, 0x8e, 0x8f, 0x8f, 0x8f,
-    0x90, 0x90, 0x90, 0x91, 0x91, 0x91, 0x92, 0x92, 0x92, 0x93, 0x93, 0x93,
-    0x94, 0x94, 0x94, 0x95, 0x95, 0x95, 0x96, 0x96, 0x96, 0x97, 0x97, 0x97,
-    0x98, 0x98, 0x98, 0x99, 0x99, 0x99, 0x9a, 0x9a, 0x9a, 0x9b, 0x9b, 0x9b,
-    0x9c, 0x9c, 0x9c, 0x9d, 0x9d, 0x9d, 0x9e, 0x9e, 0x9e, 0x9f, 0x9f, 0x9f,
-    0xa0, 0xa0, 0xa0, 0xa1, 0xa1, 0xa1, 0xa2, 0xa2, 0xa2, 0xa3, 0xa3, 0xa3,
-    0xa4, 0xa4, 0xa4, 0xa5, 0xa5, 0xa5, 0xa6, 0xa6, 0xa6, 0xa7, 0xa7, 0xa7,
-    0xa8, 0xa8, 0xa8, 0xa9, 0xa9, 0xa9, 0xaa, 0xaa, 0xaa, 0xab, 0xab, 0xab,
-    0xac, 0xac, 0xac, 0xad, 0xad, 0xad, 0xae, 0xae, 0xae, 0xaf, 0xaf, 0xaf,
-    0xb0, 0xb0, 0xb0, 0xb1, 0xb1, 0xb1, 0xb2, 0xb2, 0xb2, 0xb3, 0xb3, 0xb3,
-    0xb4, 0xb4, 0xb4, 0xb5, 0xb5, 0xb5, 0xb6, 0xb6, 0xb6, 0xb7, 0xb7, 0xb7,
-    0xb8, 0xb8, 0xb8, 0xb9, 0xb9, 0xb9, 0xba, 0xba, 0xba, 0xbb, 0xbb, 0xbb,
-    0xbc, 0xbc, 0xbc, 0xbd, 0xbd, 0xbd, 0xbe, 0xbe, 0xbe, 0xbf, 0xbf, 0xbf,
-    0xc0, 0xc0, 0xc0, 0xc1, 0xc1, 0xc1, 0xc2, 0xc2, 0xc2, 0xc3, 0xc3, 0xc3,
-    0xc4, 0xc4, 0xc4, 0xc5, 0xc5, 0xc5, 0xc6, 0xc6, 0xc6, 0xc7, 0xc7, 0xc7,
-    0xc8, 0xc8, 0xc8, 0xc9, 0xc9, 0xc9, 0xca, 0xca, 0xca, 0xcb, 0xcb, 0xcb,
-    0xcc, 0xcc, 0xcc, 0xcd, 0xcd, 0xcd, 0xce, 0xce, 0xce, 0xcf, 0xcf, 0xcf,
-    0xd0, 0xd0, 0xd0, 0xd1, 0xd1, 0xd1, 0xd2, 0xd2, 0xd2, 0xd3, 0xd3, 0xd3,
-    0xd4, 0xd4, 0xd4, 0xd5, 0xd5, 0xd5, 0xd6, 0xd6, 0xd6, 0xd7, 0xd7, 0xd7,
-    0xd8, 0xd8, 0xd8, 0xd9, 0xd9, 0xd9, 0xda, 0xda, 0xda, 0xdb, 0xdb, 0xdb,
-    0xdc, 0xdc, 0xdc, 0xdd, 0xdd, 0xdd, 0xde, 0xde, 0xde, 0xdf, 0xdf, 0xdf,
-    0xe0, 0xe0, 0xe0, 0xe1, 0xe1, 0xe1, 0xe2, 0xe2, 0xe2, 0xe3, 0xe3, 0xe3,
-    0xe4, 0xe4, 0xe4, 0xe5, 0xe5, 0xe5, 0xe6, 0xe6, 0xe6, 0xe7, 0xe7, 0xe7,
-    0xe8, 0xe8, 0xe8, 0xe9, 0xe9, 0xe9, 0xea, 0xea, 0xea, 0xeb, 0xeb, 0xeb,
-    0xec, 0xec, 0xec, 0xed, 0xed, 0xed, 0xee, 0xee, 0xee, 0xef, 0xef, 0xef,
-    0xf0, 0xf0, 0xf0, 0xf1, 0xf1, 0xf1, 0xf2, 0xf2, 0xf2, 0xf3, 0xf3, 0xf3,
-    0xf4, 0xf4, 0xf4, 0xf5, 0xf5, 0xf5, 0xf6, 0xf6, 0xf6, 0xf7, 0xf7, 0xf7,
-    0xf8, 0xf8, 0xf8, 0xf9, 0xf9, 0xf9, 0xfa, 0xfa, 0xfa, 0xfb, 0xfb, 0xfb,
-    0xfc, 0xfc, 0xfc, 0xfd, 0xfd, 0xfd, 0xfe, 0xfe, 0xfe, 0xff, 0xff, 0xff
-};
-
-
-static const unsigned char pal_xterm256[] = {
-    0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x80, 0x80, 0x00,
-    0x00, 0x00, 0x80, 0x80, 0x00, 0x80, 0x00, 0x80, 0x80, 0xc0, 0xc0, 0xc0,
-    0x80, 0x80, 0x80, 0xff, 0x00, 0x00, 0x00, 0xff, 0x00, 0xff, 0xff, 0x00,
-    0x00, 0x00, 0xff, 0xff, 0x00, 0xff, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x5f, 0x00, 0x00, 0x87, 0x00, 0x00, 0xaf,
-    0x00, 0x00, 0xd7, 0x00, 0x00, 0xff, 0x00, 0x5f, 0x00, 0x00, 0x5f, 0x5f,
-    0x00, 0x5f, 0x87, 0x00, 0x5f, 0xaf, 0x00, 0x5f, 0xd7, 0x00, 0x5f, 0xff,
-    0x00, 0x87, 0x00, 0x00, 0x87, 0x5f, 0x00, 0x87, 0x87, 0x00, 0x87, 0xaf,
-    0x00, 0x87, 0xd7, 0x00, 0x87, 0xff, 0x00, 0xaf, 0x00, 0x00, 0xaf, 0x5f,
-    0x00, 0xaf, 0x87, 0x00, 0xaf, 0xaf, 0x00, 0xaf, 0xd7, 0x00, 0xaf, 0xff,
-    0x00, 0xd7, 0x00, 0x00, 0xd7, 0x5f, 0x00, 0xd7, 0x87, 0x00, 0xd7, 0xaf,
-    0x00, 0xd7, 0xd7, 0x00, 0xd7, 0xff, 0x00, 0xff, 0x00, 0x00, 0xff, 0x5f,
-    0x00, 0xff, 0x87, 0x00, 0xff, 0xaf, 0x00, 0xff, 0xd7, 0x00, 0xff, 0xff,
-    0x5f, 0x00, 0x00, 0x5f, 0x00, 0x5f, 0x5f, 0x00, 0x87, 0x5f, 0x00, 0xaf,
-    0x5f, 0x00, 0xd7, 0x5f, 0x00, 0xff, 0x5f, 0x5f, 0x00, 0x5f, 0x5f, 0x5f,
-    0x5f, 0x5f, 0x87, 0x5f, 0x5f, 0xaf, 0x5f, 0x5f, 0xd7, 0x5f, 0x5f, 0xff,
-    0x5f, 0x87, 0x00, 0x5f, 0x87, 0x5f, 0x5f, 0x87, 0x87, 0x5f, 0x87, 0xaf,
-    0x5f, 0x87, 0xd7, 0x5f, 0x87, 0xff, 0x5f, 0xaf, 0x00, 0x5f, 0xaf, 0x5f,
-    0x5f, 0xaf, 0x87, 0x5f, 0xaf, 0xaf, 0x5f, 0xaf, 0xd7, 0x5f, 0xaf, 0xff,
-    0x5f, 0xd7, 0x00, 0x5f, 0xd7, 0x5f, 0x5f, 0xd7, 0x87, 0x5f, 0xd7, 0xaf,
-    0x5f, 0xd7, 0xd7, 0x5f, 0xd7, 0xff, 0x5f, 0xff, 0x00, 0x5f, 0xff, 0x5f,
-    0x5f, 0xff, 0x87, 0x5f, 0xff, 0xaf, 0x5f, 0xff, 0xd7, 0x5f, 0xff, 0xff,
-    0x87, 0x00, 0x00, 0x87, 0x00, 0x5f, 0x87, 0x00, 0x87, 0x87, 0x00, 0xaf,
-    0x87, 0x00, 0xd7, 0x87, 0x00, 0xff, 0x87, 0x5f, 0x00, 0x87, 0x5f, 0x5f,
-    0x87, 0x5f, 0x87, 0x87, 0x5f, 0xaf, 0x87, 0x5f, 0xd7, 0x87, 0x5f, 0xff,
-    0x87, 0x87, 0x00, 0x87, 0x87, 0x5f, 0x87, 0x87, 0x87, 0x87, 0x87, 0xaf,
-    0x87, 0x87, 0xd7, 0x87, 0x87, 0xff, 0x87, 0xaf, 0x00, 0x87, 0xaf, 0x5f,
-    0x87, 0xaf, 0x87, 0x87, 0xaf, 0xaf, 0x87, 0xaf, 0xd7, 0x87, 0xaf, 0xff,
-    0x87, 0xd7, 0x00, 0x87, 0xd7, 0x5f, 0x87, 0xd7, 0x87, 0x87, 0xd7, 0xaf,
-    0x87, 0xd7, 0xd7, 0x87, 0xd7, 0xff, 0x87, 0xff, 0x00, 0x87, 0xff, 0x5f,
-    0x87, 0xff, 0x87, 0x87, 0xff, 0xaf, 0x87, 0xff, 0xd7, 0x87, 0xff, 0xff,
-    0xaf, 0x00, 0x00, 0xaf, 0x00, 0x5f, 0xaf, 0x00, 0x87, 0xaf, 0x00, 0xaf,
-    0xaf, 0x00, 0xd7, 0xaf, 0x00, 0xff, 0xaf, 0x5f, 0x00, 0xaf, 0x5f, 0x5f,
-    0xaf, 0x5f, 0x87, 0xaf, 0x5f, 0xaf, 0xaf, 0x5f, 0xd7, 0xaf, 0x5f, 0xff,
-    0xaf, 0x87, 0x00, 0xaf, 0x87, 0x5f, 0xaf, 0x87, 0x87, 0xaf, 0x87, 0xaf,
-    0xaf, 0x87, 0xd7, 0xaf, 0x87, 0xff, 0xaf, 0xaf, 0x00, 0xaf, 0xaf, 0x5f,
-    0xaf, 0xaf, 0x87, 0xaf, 0xaf, 0xaf, 0xaf, 0xaf, 0xd7, 0xaf, 0xaf, 0xff,
-    0xaf, 0xd7, 0x00, 0xaf, 0xd7, 0x5f, 0xaf, 0xd7, 0x87, 0xaf, 0xd7, 0xaf,
-    0xaf, 0xd7, 0xd7, 0xaf, 0xd7, 0xff, 0xaf, 0xff, 0x00, 0xaf, 0xff, 0x5f,
-    0xaf, 0xff, 0x87, 0xaf, 0xff, 0xaf, 0xaf, 0xff, 0xd7, 0xaf, 0xff, 0xff,
-    0xd7, 0x00, 0x00, 0xd7, 0x00, 0x5f, 0xd7, 0x00, 0x87, 0xd7, 0x00, 0xaf,
-    0xd7, 0x00, 0xd7, 0xd7, 0x00, 0xff, 0xd7, 0x5f, 0x00, 0xd7, 0x5f, 0x5f,
-    0xd7, 0x5f, 0x87, 0xd7, 0x5f, 0xaf, 0xd7, 0x5f, 0xd7, 0xd7, 0x5f, 0xff,
-    0xd7, 0x87, 0x00, 0xd7, 0x87, 0x5f, 0xd7, 0x87, 0x87, 0xd7, 0x87, 0xaf,
-    0xd7, 0x87, 0xd7, 0xd7, 0x87, 0xff, 0xd7, 0xaf, 0x00, 0xd7, 0xaf, 0x5f,
-    0xd7, 0xaf, 0x87, 0xd7, 0xaf, 0xaf, 0xd7, 0xaf, 0xd7, 0xd7, 0xaf, 0xff,
-    0xd7, 0xd7, 0x00, 0xd7, 0xd7, 0x5f, 0xd7, 0xd7, 0x87, 0xd7, 0xd7, 0xaf,
-    0xd7, 0xd7, 0xd7, 0xd7, 0xd7, 0xff, 0xd7, 0xff, 0x00, 0xd7, 0xff, 0x5f,
-    0xd7, 0xff, 0x87, 0xd7, 0xff, 0xaf, 0xd7, 0xff, 0xd7, 0xd7, 0xff, 0xff,
-    0xff, 0x00, 0x00, 0xff, 0x00, 0x5f, 0xff, 0x00, 0x87, 0xff, 0x00, 0xaf,
-    0xff, 0x00, 0xd7, 0xff, 0x00, 0xff, 0xff, 0x5f, 0x00, 0xff, 0x5f, 0x5f,
-    0xff, 0x5f, 0x87, 0xff, 0x5f, 0xaf, 0xff, 0x5f, 0xd7, 0xff, 0x5f, 0xff,
-    0xff, 0x87, 0x00, 0xff, 0x87, 0x5f, 0xff, 0x87, 0x87, 0xff, 0x87, 0xaf,
-    0xff, 0x87, 0xd7, 0xff, 0x87, 0xff, 0xff, 0xaf, 0x00, 0xff, 0xaf, 0x5f,
-    0xff, 0xaf, 0x87, 0xff, 0xaf, 0xaf, 0xff, 0xaf, 0xd7, 0xff, 0xaf, 0xff,
-    0xff, 0xd7, 0x00, 0xff, 0xd7, 0x5f, 0xff, 0xd7, 0x87, 0xff, 0xd7, 0xaf,
-    0xff, 0xd7, 0xd7, 0xff, 0xd7, 0xff, 0xff, 0xff, 0x00, 0xff, 0xff, 0x5f,
-    0xff, 0xff, 0x87, 0xff, 0xff, 0xaf, 0xff, 0xff, 0xd7, 0xff, 0xff, 0xff,
-    0x08, 0x08, 0x08, 0x12, 0x12, 0x12, 0x1c, 0x1c, 0x1c, 0x26, 0x26, 0x26,
-    0x30, 0x30, 0x30, 0x3a, 0x3a, 0x3a, 0x44, 0x44, 0x44, 0x4e, 0x4e, 0x4e,
-    0x58, 0x58, 0x58, 0x62, 0x62, 0x62, 0x6c, 0x6c, 0x6c, 0x76, 0x76, 0x76,
-    0x80, 0x80, 0x80, 0x8a, 0x8a, 0x8a, 0x94, 0x94, 0x94, 0x9e, 0x9e, 0x9e,
-    0xa8, 0xa8, 0xa8, 0xb2, 0xb2, 0xb2, 0xbc, 0xbc, 0xbc, 0xc6, 0xc6, 0xc6,
-    0xd0, 0xd0, 0xd0, 0xda, 0xda, 0xda, 0xe4, 0xe4, 0xe4, 0xee, 0xee, 0xee,
-};
-
-
-/*
- * VT340 undocumented behavior regarding the color palette reported
- * by Vertis Sidus(@vrtsds):
- *     it loads the first fifteen colors as 1 through 15, and loads the
- *     sixteenth color as 0.
- */
-static const unsigned char pal_vt340_mono[] = {
-    /* 1   Gray-2   */  13 * 255 / 100, 13 * 255 / 100, 13 * 255 / 100,
-    /* 2   Gray-4   */  26 * 255 / 100, 26 * 255 / 100, 26 * 255 / 100,
-    /* 3   Gray-6   */  40 * 255 / 100, 40 * 255 / 100, 40 * 255 / 100,
-    /* 4   Gray-1   */   6 * 255 / 100,  6 * 255 / 100,  6 * 255 / 100,
-    /* 5   Gray-3   */  20 * 255 / 100, 20 * 255 / 100, 20 * 255 / 100,
-    /* 6   Gray-5   */  33 * 255 / 100, 33 * 255 / 100, 33 * 255 / 100,
-    /* 7   White 7  */  46 * 255 / 100, 46 * 255 / 100, 46 * 255 / 100,
-    /* 8   Black 0  */   0 * 255 / 100,  0 * 255 / 100,  0 * 255 / 100,
-    /* 9   Gray-2   */  13 * 255 / 100, 13 * 255 / 100, 13 * 255 / 100,
-    /* 10  Gray-4   */  26 * 255 / 100, 26 * 255 / 100, 26 * 255 / 100,
-    /* 11  Gray-6   */  40 * 255 / 100, 40 * 255 / 100, 40 * 255 / 100,
-    /* 12  Gray-1   */   6 * 255 / 100,  6 * 255 / 100,  6 * 255 / 100,
-    /* 13  Gray-3   */  20 * 255 / 100, 20 * 255 / 100, 20 * 255 / 100,
-    /* 14  Gray-5   */  33 * 255 / 100, 33 * 255 / 100, 33 * 255 / 100,
-    /* 15  White 7  */  46 * 255 / 100, 46 * 255 / 100, 46 * 255 / 100,
-    /* 0   Black    */   0 * 255 / 100,  0 * 255 / 100,  0 * 255 / 100,
-};
-
-
-static const unsigned char pal_vt340_color[] = {
-    /* 1   Blue     */  20 * 255 / 100, 20 * 255 / 100, 80 * 255 / 100,
-    /* 2   Red      */  80 * 255 / 100, 13 * 255 / 100, 13 * 255 / 100,
-    /* 3   Green    */  20 * 255 / 100, 80 * 255 / 100, 20 * 255 / 100,
-    /* 4   Magenta  */  80 * 255 / 100, 20 * 255 / 100, 80 * 255 / 100,
-    /* 5   Cyan     */  20 * 255 / 100, 80 * 255 / 100, 80 * 255 / 100,
-    /* 6   Yellow   */  80 * 255 / 100, 80 * 255 / 100, 20 * 255 / 100,
-    /* 7   Gray 50% */  53 * 255 / 100, 53 * 255 / 100, 53 * 255 / 100,
-    /* 8   Gray 25% */  26 * 255 / 100, 26 * 255 / 100, 26 * 255 / 100,
-    /* 9   Blue*    */  33 * 255 / 100, 33 * 255 / 100, 60 * 255 / 100,
-    /* 10  Red*     */  60 * 255 / 100, 26 * 255 / 100, 26 * 255 / 100,
-    /* 11  Green*   */  33 * 255 / 100, 60 * 255 / 100, 33 * 255 / 100,
-    /* 12  Magenta* */  60 * 255 / 100, 33 * 255 / 100, 60 * 255 / 100,
-    /* 13  Cyan*    */  33 * 255 / 100, 60 * 255 / 100, 60 * 255 / 100,
-    /* 14  Yellow*  */  60 * 255 / 100, 60 * 255 / 100, 33 * 255 / 100,
-    /* 15  Gray 75% */  80 * 255 / 100, 80 * 255 / 100, 80 * 255 / 100,
-    /* 0   Black    */   0 * 255 / 100,  0 * 255 / 100,  0 * 255 / 100,
-};
-
-
 /* create dither context object */
 SIXELAPI SIXELSTATUS
 sixel_dither_new(
@@ -315,6 +109,8 @@ sixel_dither_new(
     (*ppdither)->ref = 1;
     (*ppdither)->palette = (unsigned char*)(*ppdither + 1);
     (*ppdither)->cachetable = NULL;
+    (*ppdither)->lut = NULL;
+    (*ppdither)->lut_type = SIXEL_LUT_NONE;
     (*ppdither)->reqcolors = ncolors;
     (*ppdither)->ncolors = ncolors;
     (*ppdither)->origcolors = (-1);
@@ -328,6 +124,7 @@ sixel_dither_new(
     (*ppdither)->method_for_diffuse = SIXEL_DIFFUSE_FS;
     (*ppdither)->quality_mode = quality_mode;
     (*ppdither)->pixelformat = SIXEL_PIXELFORMAT_RGB888;
+    (*ppdither)->nthreads = 0;
     (*ppdither)->allocator = allocator;
 
     status = SIXEL_OK;
@@ -399,6 +196,8 @@ sixel_dither_get(
     unsigned char *palette;
     int ncolors;
     int keycolor;
+    unsigned char const *lut = NULL;
+    int lut_type = SIXEL_LUT_NONE;
     sixel_dither_t *dither = NULL;
 
     switch (builtin_dither) {
@@ -416,41 +215,56 @@ sixel_dither_get(
         ncolors = 16;
         palette = (unsigned char *)pal_xterm256;
         keycolor = (-1);
+        lut = lut_xterm16;
+        lut_type = SIXEL_LUT_RGB555;
         break;
     case SIXEL_BUILTIN_XTERM256:
         ncolors = 256;
         palette = (unsigned char *)pal_xterm256;
         keycolor = (-1);
+        lut = lut_xterm256;
+        lut_type = SIXEL_LUT_RGB555;
         break;
     case SIXEL_BUILTIN_VT340_MONO:
         ncolors = 16;
         palette = (unsigned char *)pal_vt340_mono;
         keycolor = (-1);
+        lut = lut_vt340_mono;
+        lut_type = SIXEL_LUT_GRAYSUM;
         break;
     case SIXEL_BUILTIN_VT340_COLOR:
         ncolors = 16;
         palette = (unsigned char *)pal_vt340_color;
         keycolor = (-1);
+        lut = lut_vt340_color;
+        lut_type = SIXEL_LUT_RGB555;
         break;
     case SIXEL_BUILTIN_G1:
         ncolors = 2;
         palette = (unsigned char *)pal_gray_1bit;
         keycolor = (-1);
+        /* no table, lookup_mono_darkbg() is used */
         break;
     case SIXEL_BUILTIN_G2:
         ncolors = 4;
         palette = (unsigned char *)pal_gray_2bit;
         keycolor = (-1);
+        lut = lut_gray_2bit;
+        lut_type = SIXEL_LUT_GRAYSUM;
         break;
     case SIXEL_BUILTIN_G4:
         ncolors = 16;
         palette = (unsigned char *)pal_gray_4bit;
         keycolor = (-1);
+        lut = lut_gray_4bit;
+        lut_type = SIXEL_LUT_GRAYSUM;
         break;
     case SIXEL_BUILTIN_G8:
         ncolors = 256;
         palette = (unsigned char *)pal_gray_8bit;
         keycolor = (-1);
+        lut = lut_gray_8bit;
+        lut_type = SIXEL_LUT_GRAYSUM;
         break;
     default:
         goto end;
@@ -463,6 +277,8 @@ sixel_dither_get(
     }
 
     dither->palette = palette;
+    dither->lut = lut;
+    dither->lut_type = lut_type;
     dither->keycolor = keycolor;
     dither->optimized = 1;
     dither->optimize_palette = 0;
@@ -608,6 +424,60 @@ end:
 }
 
 
+/* initialize dither object with a palette which is computed in advance */
+SIXELSTATUS
+sixel_dither_initialize_with_palette(
+    sixel_dither_t      /* in */ *dither,
+    unsigned char const /* in */ *palette,
+    int                 /* in */ ncolors,
+    int                 /* in */ origcolors,
+    unsigned short      /* in */ *cachetable,
+    int                 /* in */ method_for_largest,
+    int                 /* in */ method_for_rep,
+    int                 /* in */ quality_mode)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    /* ensure dither object is not null */
+    if (dither == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_initialize_with_palette: dither is null.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    if (ncolors < 1 || ncolors > dither->reqcolors) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_initialize_with_palette: bad number of colors.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    sixel_dither_set_method_for_largest(dither, method_for_largest);
+    sixel_dither_set_method_for_rep(dither, method_for_rep);
+    sixel_dither_set_quality_mode(dither, quality_mode);
+
+    memcpy(dither->palette, palette, (size_t)(ncolors * 3));
+    dither->ncolors = ncolors;
+    dither->origcolors = origcolors;
+
+    if (cachetable) {
+        sixel_allocator_free(dither->allocator, dither->cachetable);
+        dither->cachetable = cachetable;
+    }
+
+    dither->optimized = 1;
+    if (dither->origcolors <= dither->ncolors) {
+        dither->method_for_diffuse = SIXEL_DIFFUSE_NONE;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
 /* set diffusion type, choose from enum methodForDiffuse */
 SIXELAPI void
 sixel_dither_set_diffusion_type(
@@ -723,6 +593,104 @@ sixel_dither_set_transparent(
 }
 
 
+/* set number of threads for applying palette */
+SIXELAPI void
+sixel_dither_set_threads(
+    sixel_dither_t /* in */ *dither,      /* dither context object */
+    int            /* in */ nthreads)     /* number of threads, 0 for
+                                             legacy sequential processing */
+{
+    dither->nthreads = nthreads < 0 ? 0: nthreads;
+}
+
+
+/* write palette into a file which can be given to -m option */
+SIXELAPI SIXELSTATUS
+sixel_dither_write_palette_file(
+    sixel_dither_t  /* in */ *dither,     /* dither context object */
+    char const      /* in */ *filename,   /* output file name */
+    int             /* in */ fembed_lut)  /* embed nearest color lookup table */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned short *cachetable = NULL;
+
+    /* ensure dither object is not null */
+    if (dither == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_write_palette_file: dither is null.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    if (dither->quality_mode == SIXEL_QUALITY_HIGHCOLOR) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_write_palette_file: "
+            "high color dither has no palette.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    if (fembed_lut) {
+        cachetable = (unsigned short *)sixel_allocator_malloc(
+            dither->allocator,
+            SIXEL_PALCACHE_LUT_SIZE * sizeof(unsigned short));
+        if (cachetable == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_dither_write_palette_file: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        sixel_palcache_build_lut(cachetable,
+                                 dither->palette,
+                                 dither->ncolors,
+                                 dither->complexion);
+    }
+
+    status = sixel_palcache_write(filename,
+                                  dither->palette,
+                                  dither->ncolors,
+                                  dither->origcolors,
+                                  dither->complexion,
+                                  cachetable,
+                                  dither->allocator);
+
+end:
+    if (dither) {
+        sixel_allocator_free(dither->allocator, cachetable);
+    }
+    return status;
+}
+
+
+/* prepare the cache table of nearest colors before applying palette */
+static SIXELSTATUS
+sixel_dither_prepare_cachetable(
+    sixel_dither_t  /* in */ *dither)
+{
+    /* if quality_mode is full, do not use palette caching */
+    if (dither->quality_mode == SIXEL_QUALITY_FULL) {
+        dither->optimized = 0;
+    }
+
+    /* builtin palettes with a precomputed table need no cache table */
+    if (dither->cachetable == NULL && dither->optimized
+        && (dither->lut == NULL || dither->complexion != 1)) {
+        if (dither->palette != pal_mono_dark && dither->palette != pal_mono_light) {
+            dither->cachetable = (unsigned short *)sixel_allocator_calloc(dither->allocator,
+                                                                          (size_t)(1 << 3 * 5),
+                                                                          sizeof(unsigned short));
+            if (dither->cachetable == NULL) {
+                sixel_helper_set_additional_message(
+                    "sixel_dither_new: sixel_allocator_calloc() failed.");
+                return SIXEL_BAD_ALLOCATION;
+            }
+        }
+    }
+
+    return SIXEL_OK;
+}
+
+
 /* set transparent */
 SIXELAPI sixel_index_t *
 sixel_dither_apply_palette(
@@ -757,23 +725,9 @@ sixel_dither_apply_palette(
         goto end;
     }
 
-    /* if quality_mode is full, do not use palette caching */
-    if (dither->quality_mode == SIXEL_QUALITY_FULL) {
-        dither->optimized = 0;
-    }
-
-    if (dither->cachetable == NULL && dither->optimized) {
-        if (dither->palette != pal_mono_dark && dither->palette != pal_mono_light) {
-            dither->cachetable = (unsigned short *)sixel_allocator_calloc(dither->allocator,
-                                                                          (size_t)(1 << 3 * 5),
-                                                                          sizeof(unsigned short));
-            if (dither->cachetable == NULL) {
-                sixel_helper_set_additional_message(
-                    "sixel_dither_new: sixel_allocator_calloc() failed.");
-                status = SIXEL_BAD_ALLOCATION;
-                goto end;
-            }
-        }
+    status = sixel_dither_prepare_cachetable(dither);
+    if (SIXEL_FAILED(status)) {
+        goto end;
     }
 
     if (dither->pixelformat != SIXEL_PIXELFORMAT_RGB888) {
@@ -808,6 +762,9 @@ sixel_dither_apply_palette(
                                        dither->optimize_palette,
                                        dither->complexion,
                                        dither->cachetable,
+                                       dither->lut,
+                                       dither->lut_type,
+                                       dither->nthreads,
                                        &ncolors,
                                        dither->allocator);
     if (SIXEL_FAILED(status)) {
@@ -825,6 +782,50 @@ end:
 }
 
 
+/* apply palette to the first nrows rows of a band of RGB888 pixels */
+SIXELSTATUS
+sixel_dither_apply_palette_rows(
+    sixel_dither_t  /* in */  *dither,  /* dither context */
+    sixel_index_t   /* out */ *result,  /* nrows rows of palette indexes */
+    unsigned char   /* in */  *pixels,  /* band of height rows */
+    int             /* in */  width,    /* band width */
+    int             /* in */  height,   /* band height including lookahead rows */
+    int             /* in */  nrows,    /* rows to be quantized */
+    int             /* in */  y)        /* position of the band in the image */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    if (dither->pixelformat != SIXEL_PIXELFORMAT_RGB888) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_apply_palette_rows: "
+            "pixelformat other than RGB888 is not supported.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    status = sixel_dither_prepare_cachetable(dither);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_quant_apply_palette_rows(result,
+                                            pixels,
+                                            width, height, nrows, y, 3,
+                                            dither->palette,
+                                            dither->ncolors,
+                                            dither->method_for_diffuse,
+                                            dither->optimized,
+                                            dither->complexion,
+                                            dither->cachetable,
+                                            dither->lut,
+                                            dither->lut_type,
+                                            dither->allocator);
+
+end:
+    return status;
+}
+
+
 #if HAVE_TESTS
 static int
 test1(void)
@@ -883,6 +884,88 @@ error:
 }
 
 
+/* builtin lookup tables agree with exhaustive search */
+static int
+test3(void)
+{
+    static int const builtins[] = {
+        SIXEL_BUILTIN_XTERM16, SIXEL_BUILTIN_XTERM256,
+        SIXEL_BUILTIN_VT340_MONO, SIXEL_BUILTIN_VT340_COLOR,
+        SIXEL_BUILTIN_G2, SIXEL_BUILTIN_G4, SIXEL_BUILTIN_G8,
+    };
+    enum { npixels = 4096 };
+    sixel_dither_t *dither = NULL;
+    unsigned char pixels[npixels * 3];
+    unsigned char target[3];
+    sixel_index_t *result = NULL;
+    unsigned int seed = 1;
+    size_t i;
+    int n;
+    int c;
+    int k;
+    int expected;
+    int diff;
+    int distant;
+    int nret = EXIT_FAILURE;
+
+    for (n = 0; n < npixels * 3; ++n) {
+        seed = seed * 1103515245 + 12345;
+        pixels[n] = (unsigned char)(seed >> 16 & 0xff);
+    }
+
+    for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+        dither = sixel_dither_get(builtins[i]);
+        if (dither == NULL || dither->lut == NULL) {
+            goto error;
+        }
+        sixel_dither_set_diffusion_type(dither, SIXEL_DIFFUSE_NONE);
+        result = sixel_dither_apply_palette(dither, pixels, npixels, 1);
+        if (result == NULL) {
+            goto error;
+        }
+        for (n = 0; n < npixels; ++n) {
+            for (c = 0; c < 3; ++c) {
+                target[c] = pixels[n * 3 + c];
+                if (dither->lut_type == SIXEL_LUT_RGB555) {
+                    /* approximated by the center of the RGB555 cell */
+                    target[c] = (unsigned char)((target[c] & 0xf8) | 0x4);
+                }
+            }
+            expected = 0;
+            diff = INT_MAX;
+            for (k = 0; k < dither->ncolors; ++k) {
+                distant = (target[0] - dither->palette[k * 3 + 0]) * (target[0] - dither->palette[k * 3 + 0])
+                        + (target[1] - dither->palette[k * 3 + 1]) * (target[1] - dither->palette[k * 3 + 1])
+                        + (target[2] - dither->palette[k * 3 + 2]) * (target[2] - dither->palette[k * 3 + 2]);
+                if (distant < diff) {
+                    diff = distant;
+                    expected = k;
+                }
+            }
+            if (result[n] != expected) {
+                goto error;
+            }
+        }
+        if (dither->cachetable != NULL) {
+            goto error;
+        }
+        sixel_allocator_free(dither->allocator, result);
+        result = NULL;
+        sixel_dither_unref(dither);
+        dither = NULL;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    if (dither) {
+        sixel_allocator_free(dither->allocator, result);
+    }
+    sixel_dither_unref(dither);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_dither_tests_main(void)
 {
@@ -893,6 +976,7 @@ sixel_dither_tests_main(void)
     static testcase const testcases[] = {
         test1,
         test2,
+        test3,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
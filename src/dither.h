@@ -29,6 +29,8 @@ struct sixel_dither {
     unsigned int ref;               /* reference counter */
     unsigned char *palette;         /* palette definition */
     unsigned short *cachetable;     /* cache table */
+    unsigned char const *lut;       /* precomputed lookup table of builtin palette */
+    int lut_type;                   /* type of lut, one of SIXEL_LUT_* */
     int reqcolors;                  /* requested colors */
     int ncolors;                    /* active colors */
     int origcolors;                 /* original colors */
@@ -43,6 +45,8 @@ struct sixel_dither {
     int quality_mode;               /* quality of histogram */
     int keycolor;                   /* background color */
     int pixelformat;                /* pixelformat for internal processing */
+    int nthreads;                   /* threads for applying palette, 0 for legacy
+                                       sequential processing */
     sixel_allocator_t *allocator;   /* allocator */
 };
 
@@ -50,6 +54,19 @@ struct sixel_dither {
 extern "C" {
 #endif
 
+/* initialize dither object with a palette which is computed in advance,
+   the ownership of cachetable is moved to the dither object */
+SIXELSTATUS
+sixel_dither_initialize_with_palette(
+    struct sixel_dither /* in */ *dither,
+    unsigned char const /* in */ *palette,
+    int                 /* in */ ncolors,
+    int                 /* in */ origcolors,
+    unsigned short      /* in */ *cachetable,
+    int                 /* in */ method_for_largest,
+    int                 /* in */ method_for_rep,
+    int                 /* in */ quality_mode);
+
 /* apply palette */
 sixel_index_t *
 sixel_dither_apply_palette(struct sixel_dither /* in */ *dither,
@@ -57,6 +74,17 @@ sixel_dither_apply_palette(struct sixel_dither /* in */ *dither,
                            int                 /* in */ width,
                            int                 /* in */ height);
 
+/* apply palette to the first nrows rows of a band, errors diffused into
+   the following rows of the band are carried over to the next band */
+SIXELSTATUS
+sixel_dither_apply_palette_rows(struct sixel_dither /* in */  *dither,
+                                sixel_index_t       /* out */ *result,
+                                unsigned char       /* in */  *pixels,
+                                int                 /* in */  width,
+                                int                 /* in */  height,
+                                int                 /* in */  nrows,
+                                int                 /* in */  y);
+
 #if HAVE_TESTS
 int
 sixel_frame_tests_main(void);
@@ -60,6 +60,10 @@
 #include <sixel.h>
 #include "tty.h"
 #include "encoder.h"
+#include "frame.h"
+#include "loader.h"
+#include "scale.h"
+#include "tosixel.h"
 #include "rgblookup.h"
 
 
@@ -443,6 +447,15 @@ sixel_prepare_specified_palette(
     SIXELSTATUS status = SIXEL_FALSE;
     sixel_callback_context_for_mapfile_t callback_context;
 
+    /* a palette file written by -M option is loaded without decoding */
+    status = sixel_palcache_load_file(dither,
+                                      encoder->mapfile,
+                                      encoder->complexion,
+                                      encoder->allocator);
+    if (SIXEL_FAILED(status) || *dither) {
+        return status;
+    }
+
     callback_context.reqcolors = encoder->reqcolors;
     callback_context.dither = NULL;
     callback_context.allocator = encoder->allocator;
@@ -567,6 +580,37 @@ sixel_encoder_prepare_palette(
     if (encoder->dither_cache) {
         sixel_dither_unref(encoder->dither_cache);
     }
+
+    /* evaluate -K option: try to restore the palette from the cache */
+    if (encoder->palette_cache_dir) {
+        sixel_palcache_compute_key(encoder->palette_cache_key,
+                                   sixel_frame_get_pixels(frame),
+                                   sixel_frame_get_width(frame),
+                                   sixel_frame_get_height(frame),
+                                   sixel_frame_get_pixelformat(frame),
+                                   encoder->reqcolors,
+                                   encoder->method_for_largest,
+                                   encoder->method_for_rep,
+                                   encoder->quality_mode);
+        status = sixel_palcache_load(dither,
+                                     encoder->palette_cache_dir,
+                                     encoder->palette_cache_key,
+                                     encoder->reqcolors,
+                                     encoder->method_for_largest,
+                                     encoder->method_for_rep,
+                                     encoder->quality_mode,
+                                     encoder->complexion,
+                                     encoder->allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        if (*dither) {
+            /* cache hit, nothing to be stored */
+            encoder->palette_cache_key[0] = '\0';
+            goto initialized;
+        }
+    }
+
     status = sixel_dither_new(dither, encoder->reqcolors, encoder->allocator);
     if (SIXEL_FAILED(status)) {
         goto end;
@@ -585,6 +629,7 @@ sixel_encoder_prepare_palette(
         goto end;
     }
 
+initialized:
     histogram_colors = sixel_dither_get_num_of_histogram_colors(*dither);
     if (histogram_colors <= encoder->reqcolors) {
         encoder->method_for_diffuse = SIXEL_DIFFUSE_NONE;
@@ -598,46 +643,63 @@ end:
 }
 
 
-/* resize a frame with settings of specified encoder object */
-static SIXELSTATUS
-sixel_encoder_do_resize(
-    sixel_encoder_t /* in */    *encoder,   /* encoder object */
-    sixel_frame_t   /* in */    *frame)     /* frame object to be resized */
+/* compute the size of the frame after scaling with -w and -h options,
+   the size is not positive if the frame is not scaled */
+static void
+sixel_encoder_compute_size(
+    sixel_encoder_t /* in */    *encoder,       /* encoder object */
+    sixel_frame_t   /* in */    *frame,         /* frame object */
+    int             /* out */   *dst_width,     /* width after scaling */
+    int             /* out */   *dst_height)    /* height after scaling */
 {
-    SIXELSTATUS status = SIXEL_FALSE;
     int src_width;
     int src_height;
-    int dst_width;
-    int dst_height;
 
     /* get frame width and height */
     src_width = sixel_frame_get_width(frame);
     src_height = sixel_frame_get_height(frame);
 
     /* settings around scaling */
-    dst_width = encoder->pixelwidth;    /* may be -1 (default) */
-    dst_height = encoder->pixelheight;  /* may be -1 (default) */
+    *dst_width = encoder->pixelwidth;    /* may be -1 (default) */
+    *dst_height = encoder->pixelheight;  /* may be -1 (default) */
 
     /* if the encoder has percentwidth or percentheight property,
        convert them to pixelwidth / pixelheight */
     if (encoder->percentwidth > 0) {
-        dst_width = src_width * encoder->percentwidth / 100;
+        *dst_width = src_width * encoder->percentwidth / 100;
     }
     if (encoder->percentheight > 0) {
-        dst_height = src_height * encoder->percentheight / 100;
+        *dst_height = src_height * encoder->percentheight / 100;
     }
 
     /* if only either width or height is set, set also the other
        to retain frame aspect ratio */
-    if (encoder->pixelwidth > 0 && dst_height <= 0) {
-        dst_height = src_height * encoder->pixelwidth / src_width;
+    if (encoder->pixelwidth > 0 && *dst_height <= 0) {
+        *dst_height = src_height * encoder->pixelwidth / src_width;
     }
-    if (encoder->pixelheight > 0 && dst_width <= 0) {
-        dst_width = src_width * encoder->pixelheight / src_height;
+    if (encoder->pixelheight > 0 && *dst_width <= 0) {
+        *dst_width = src_width * encoder->pixelheight / src_height;
     }
+}
+
+
+/* resize a frame with settings of specified encoder object */
+static SIXELSTATUS
+sixel_encoder_do_resize(
+    sixel_encoder_t /* in */    *encoder,   /* encoder object */
+    sixel_frame_t   /* in */    *frame)     /* frame object to be resized */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int dst_width;
+    int dst_height;
+
+    sixel_encoder_compute_size(encoder, frame, &dst_width, &dst_height);
 
     /* do resize */
     if (dst_width > 0 && dst_height > 0) {
+        if (encoder->nthreads > 0) {
+            sixel_frame_set_threads(frame, encoder->nthreads);
+        }
         status = sixel_frame_resize(frame, dst_width, dst_height,
                                     encoder->method_for_resampling);
         if (SIXEL_FAILED(status)) {
@@ -738,7 +800,6 @@ sixel_encoder_output_without_macro(
     sixel_encoder_t     /* in */ *encoder)
 {
     SIXELSTATUS status = SIXEL_OK;
-    static unsigned char *p;
     int depth;
     enum { message_buffer_size = 256 };
     char message[message_buffer_size];
@@ -756,7 +817,6 @@ sixel_encoder_output_without_macro(
     int width;
     int height;
     int pixelformat;
-    size_t size;
 
     if (encoder == NULL) {
         sixel_helper_set_additional_message(
@@ -783,16 +843,16 @@ sixel_encoder_output_without_macro(
         goto end;
     }
 
-    width = sixel_frame_get_width(frame);
-    height = sixel_frame_get_height(frame);
-    size = (size_t)(width * height * depth);
-    p = (unsigned char *)sixel_allocator_malloc(encoder->allocator, size);
-    if (p == NULL) {
-        sixel_helper_set_additional_message(
-            "sixel_encoder_output_without_macro: sixel_allocator_malloc() failed.");
-        status = SIXEL_BAD_ALLOCATION;
-        goto end;
+    /* the frame is not referred after encoding, so the pixels are copied
+       only if they are borrowed from the caller and the error diffusion
+       is going to modify them in place */
+    if (sixel_encode_modifies_pixels(dither)) {
+        status = sixel_frame_own_pixels(frame);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
     }
+
 #if HAVE_NANOSLEEP && HAVE_CLOCK
     start = clock();
 #endif
@@ -816,20 +876,19 @@ sixel_encoder_output_without_macro(
 #endif
 
     pixbuf = sixel_frame_get_pixels(frame);
-    memcpy(p, pixbuf, (size_t)(width * height * depth));
+    width = sixel_frame_get_width(frame);
+    height = sixel_frame_get_height(frame);
 
     if (encoder->cancel_flag && *encoder->cancel_flag) {
         goto end;
     }
 
-    status = sixel_encode(p, width, height, depth, dither, output);
+    status = sixel_encode(pixbuf, width, height, depth, dither, output);
     if (status != SIXEL_OK) {
         goto end;
     }
 
 end:
-    sixel_allocator_free(encoder->allocator, p);
-
     return status;
 }
 
@@ -938,6 +997,150 @@ end:
 }
 
 
+/* whether scaling, applying palette and encoding of the frame can be
+   fused into the band pipeline, it requires a palette which is fixed
+   before the frame is scaled */
+static int
+sixel_encoder_can_use_pipeline(
+    sixel_encoder_t /* in */    *encoder,   /* encoder object */
+    sixel_frame_t   /* in */    *frame)     /* frame object */
+{
+    switch (encoder->color_option) {
+    case SIXEL_COLOR_OPTION_MONOCHROME:
+    case SIXEL_COLOR_OPTION_MAPFILE:
+    case SIXEL_COLOR_OPTION_BUILTIN:
+        break;
+    default:
+        /* the palette is made from the scaled frame */
+        return 0;
+    }
+
+    if (encoder->fuse_macro || encoder->macro_number >= 0) {
+        /* -u or -n option */
+        return 0;
+    }
+    if (encoder->clipwidth > 0 && encoder->clipheight > 0) {
+        /* -c option */
+        return 0;
+    }
+    if (encoder->nthreads > 0) {
+        /* -j option, the whole frame is processed in stripes */
+        return 0;
+    }
+    if (sixel_frame_get_multiframe(frame)) {
+        /* animation frames are paced by output_without_macro */
+        return 0;
+    }
+    if (sixel_frame_get_pixelformat(frame) != SIXEL_PIXELFORMAT_RGB888) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/* row source of the band pipeline */
+typedef struct sixel_encoder_pipeline {
+    sixel_encoder_t *encoder;
+    sixel_scaler_t *scaler;     /* NULL if the frame is not scaled */
+    unsigned char *pixels;      /* pixels of the frame */
+    int width;                  /* width of the frame */
+    int stride;                 /* bytes per row of the frame */
+} sixel_encoder_pipeline_t;
+
+
+static SIXELSTATUS
+sixel_encoder_pipeline_source(
+    unsigned char   /* out */ *rows,
+    int             /* in */  y,
+    int             /* in */  nrows,
+    void            /* in */  *priv)
+{
+    sixel_encoder_pipeline_t *pipeline = (sixel_encoder_pipeline_t *)priv;
+    size_t rowsize = (size_t)pipeline->width * 3;
+    size_t stride = (size_t)pipeline->stride;
+    int i;
+
+    if (pipeline->encoder->cancel_flag && *pipeline->encoder->cancel_flag) {
+        return SIXEL_INTERRUPTED;
+    }
+
+    if (pipeline->scaler) {
+        return sixel_scaler_get_rows(pipeline->scaler, rows, y, nrows);
+    }
+
+    if (stride == rowsize) {
+        memcpy(rows, pipeline->pixels + rowsize * (size_t)y, rowsize * (size_t)nrows);
+    } else {
+        /* the frame refers a subrectangle of the caller's buffer */
+        for (i = 0; i < nrows; i++) {
+            memcpy(rows + rowsize * (size_t)i,
+                   pipeline->pixels + stride * (size_t)(y + i),
+                   rowsize);
+        }
+    }
+
+    return SIXEL_OK;
+}
+
+
+/* scale, apply palette and encode the frame six rows at a time, neither
+   the scaled frame nor the palette indexes of the whole frame are kept */
+static SIXELSTATUS
+sixel_encoder_output_pipeline(
+    sixel_frame_t       /* in */ *frame,
+    sixel_dither_t      /* in */ *dither,
+    sixel_output_t      /* in */ *output,
+    sixel_encoder_t     /* in */ *encoder)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_encoder_pipeline_t pipeline;
+    int width;
+    int height;
+
+    pipeline.encoder = encoder;
+    pipeline.scaler = NULL;
+    pipeline.pixels = sixel_frame_get_pixels(frame);
+    pipeline.width = sixel_frame_get_width(frame);
+    pipeline.stride = sixel_frame_get_stride(frame);
+
+    sixel_encoder_compute_size(encoder, frame, &width, &height);
+    if (width > 0 && height > 0) {
+        if (width > SIXEL_WIDTH_LIMIT || height > SIXEL_HEIGHT_LIMIT) {
+            sixel_helper_set_additional_message(
+                "sixel_encoder_output_pipeline: given size parameter is too huge.");
+            status = SIXEL_BAD_INPUT;
+            goto end;
+        }
+        status = sixel_scaler_new(&pipeline.scaler,
+                                  pipeline.pixels,
+                                  sixel_frame_get_width(frame),
+                                  sixel_frame_get_height(frame),
+                                  pipeline.stride,
+                                  sixel_frame_get_pixelformat(frame),
+                                  width,
+                                  height,
+                                  encoder->method_for_resampling,
+                                  encoder->allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        pipeline.width = width;
+    } else {
+        width = sixel_frame_get_width(frame);
+        height = sixel_frame_get_height(frame);
+    }
+
+    status = sixel_encode_rows(sixel_encoder_pipeline_source, &pipeline,
+                               width, height, dither, output);
+
+end:
+    sixel_scaler_destroy(pipeline.scaler);
+
+    return status;
+}
+
+
 static SIXELSTATUS
 sixel_encoder_encode_frame(
     sixel_encoder_t *encoder,
@@ -949,9 +1152,17 @@ sixel_encoder_encode_frame(
     int height;
     int is_animation = 0;
     int nwrite;
+    unsigned char palette[SIXEL_PALETTE_MAX * 3];
+    int ncolors = 0;
+    int fpipeline;
+
+    /* scaling is deferred to the band pipeline if the palette is fixed */
+    fpipeline = sixel_encoder_can_use_pipeline(encoder, frame);
 
     /* evaluate -w, -h, and -c option: crop/scale input source */
-    if (encoder->clipfirst) {
+    if (fpipeline) {
+        /* scaled in sixel_encoder_output_pipeline() */
+    } else if (encoder->clipfirst) {
         /* clipping */
         status = sixel_encoder_do_clip(encoder, frame);
         if (SIXEL_FAILED(status)) {
@@ -977,12 +1188,28 @@ sixel_encoder_encode_frame(
         }
     }
 
+    /* the frame may still refer a subrectangle of the caller's buffer */
+    if (!fpipeline) {
+        status = sixel_frame_pack_pixels(frame);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
     /* prepare dither context */
+    encoder->palette_cache_key[0] = '\0';
     status = sixel_encoder_prepare_palette(encoder, frame, &dither);
     if (status != SIXEL_OK) {
         goto end;
     }
 
+    /* the palette may be rearranged while encoding, so keep the original
+       one for the palette cache */
+    if (encoder->palette_cache_key[0]) {
+        ncolors = sixel_dither_get_num_of_palette_colors(dither);
+        memcpy(palette, sixel_dither_get_palette(dither), (size_t)(ncolors * 3));
+    }
+
     if (encoder->dither_cache != NULL) {
         encoder->dither_cache = dither;
         sixel_dither_ref(dither);
@@ -1003,6 +1230,21 @@ sixel_encoder_encode_frame(
         sixel_dither_set_complexion_score(dither, encoder->complexion);
     }
 
+    /* evaluate -j option: set number of threads */
+    if (encoder->nthreads > 0) {
+        sixel_dither_set_threads(dither, encoder->nthreads);
+    }
+
+    /* evaluate -M option: write the palette before it is rearranged */
+    if (encoder->mapfile_output) {
+        status = sixel_dither_write_palette_file(dither,
+                                                 encoder->mapfile_output,
+                                                 1);  /* fembed_lut */
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
     if (output) {
         sixel_output_ref(output);
     } else {
@@ -1051,6 +1293,9 @@ sixel_encoder_encode_frame(
     } else if (encoder->macro_number >= 0) { /* -n option */
         /* use macro */
         status = sixel_encoder_output_with_macro(frame, dither, output, encoder);
+    } else if (fpipeline) {
+        /* fuse scaling, applying palette and encoding */
+        status = sixel_encoder_output_pipeline(frame, dither, output, encoder);
     } else {
         /* do not use macro */
         status = sixel_encoder_output_without_macro(frame, dither, output, encoder);
@@ -1071,6 +1316,18 @@ sixel_encoder_encode_frame(
         goto end;
     }
 
+    /* store the palette and the lookup table built by the encoding,
+       failure of the cache is not fatal */
+    if (encoder->palette_cache_key[0]) {
+        (void) sixel_palcache_store(dither,
+                                    palette,
+                                    ncolors,
+                                    encoder->palette_cache_dir,
+                                    encoder->palette_cache_key,
+                                    encoder->complexion);
+        encoder->palette_cache_key[0] = '\0';
+    }
+
 end:
     if (output) {
         sixel_output_unref(output);
@@ -1133,6 +1390,7 @@ sixel_encoder_new(
     (*ppencoder)->fuse_macro            = 0;
     (*ppencoder)->fignore_delay         = 0;
     (*ppencoder)->complexion            = 1;
+    (*ppencoder)->nthreads              = 0;
     (*ppencoder)->fstatic               = 0;
     (*ppencoder)->pixelwidth            = (-1);
     (*ppencoder)->pixelheight           = (-1);
@@ -1153,6 +1411,9 @@ sixel_encoder_new(
     (*ppencoder)->finsecure             = 0;
     (*ppencoder)->cancel_flag           = NULL;
     (*ppencoder)->dither_cache          = NULL;
+    (*ppencoder)->mapfile_output        = NULL;
+    (*ppencoder)->palette_cache_dir     = NULL;
+    (*ppencoder)->palette_cache_key[0]  = '\0';
     (*ppencoder)->allocator             = allocator;
 
     /* evaluate environment variable ${SIXEL_BGCOLOR} */
@@ -1216,6 +1477,8 @@ sixel_encoder_destroy(sixel_encoder_t *encoder)
         allocator = encoder->allocator;
         sixel_allocator_free(allocator, encoder->mapfile);
         sixel_allocator_free(allocator, encoder->bgcolor);
+        sixel_allocator_free(allocator, encoder->mapfile_output);
+        sixel_allocator_free(allocator, encoder->palette_cache_dir);
         sixel_dither_unref(encoder->dither_cache);
         if (encoder->outfd
             && encoder->outfd != STDOUT_FILENO
@@ -1319,6 +1582,42 @@ sixel_encoder_setopt(
         }
         encoder->color_option = SIXEL_COLOR_OPTION_MAPFILE;
         break;
+    case SIXEL_OPTFLAG_MAPFILE_OUTPUT:  /* M */
+        if (*value == '\0') {
+            sixel_helper_set_additional_message(
+                "no file name specified.");
+            status = SIXEL_BAD_ARGUMENT;
+            goto end;
+        }
+        if (encoder->mapfile_output) {
+            sixel_allocator_free(encoder->allocator, encoder->mapfile_output);
+        }
+        encoder->mapfile_output = arg_strdup(value, encoder->allocator);
+        if (encoder->mapfile_output == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_encoder_setopt: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        break;
+    case SIXEL_OPTFLAG_PALETTE_CACHE:  /* K */
+        if (*value == '\0') {
+            sixel_helper_set_additional_message(
+                "no directory name specified.");
+            status = SIXEL_BAD_ARGUMENT;
+            goto end;
+        }
+        if (encoder->palette_cache_dir) {
+            sixel_allocator_free(encoder->allocator, encoder->palette_cache_dir);
+        }
+        encoder->palette_cache_dir = arg_strdup(value, encoder->allocator);
+        if (encoder->palette_cache_dir == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_encoder_setopt: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        break;
     case SIXEL_OPTFLAG_MONOCHROME:  /* e */
         encoder->color_option = SIXEL_COLOR_OPTION_MONOCHROME;
         break;
@@ -1614,6 +1913,15 @@ sixel_encoder_setopt(
             goto end;
         }
         break;
+    case SIXEL_OPTFLAG_THREADS:  /* j */
+        encoder->nthreads = atoi(value);
+        if (encoder->nthreads < 1) {
+            sixel_helper_set_additional_message(
+                "threads parameter must be 1 or more.");
+            status = SIXEL_BAD_ARGUMENT;
+            goto end;
+        }
+        break;
     case SIXEL_OPTFLAG_PIPE_MODE:  /* D */
         encoder->pipe_mode = 1;
         break;
@@ -1689,6 +1997,8 @@ sixel_encoder_encode(
 {
     SIXELSTATUS status = SIXEL_FALSE;
     int fuse_palette = 1;
+    int hint_width;
+    int hint_height;
 
     if (encoder == NULL) {
 #if HAVE_DIAGNOSTIC_DEPRECATED_DECLARATIONS
@@ -1731,26 +2041,40 @@ sixel_encoder_encode(
     }
 
     /* if scaling options are set, prohibit to read the file as
-       a paletted image */
-    if (encoder->percentwidth > 0 ||
-        encoder->percentheight > 0 ||
-        encoder->pixelwidth > 0 ||
-        encoder->pixelheight > 0) {
+       a paletted image, except nearest neighbour scaling which keeps
+       the palette */
+    if ((encoder->percentwidth > 0 ||
+         encoder->percentheight > 0 ||
+         encoder->pixelwidth > 0 ||
+         encoder->pixelheight > 0) &&
+        encoder->method_for_resampling != SIXEL_RES_NEAREST) {
         fuse_palette = 0;
     }
 
+    /* if the size is given in pixels, let the decoder reduce the image
+       in advance. percent sizes and clipping before scaling refer to
+       the original size, so they can not be combined with it. */
+    hint_width = hint_height = 0;
+    if (encoder->percentwidth <= 0 && encoder->percentheight <= 0 &&
+        !encoder->clipfirst) {
+        hint_width = encoder->pixelwidth > 0 ? encoder->pixelwidth: 0;
+        hint_height = encoder->pixelheight > 0 ? encoder->pixelheight: 0;
+    }
+
 reload:
-    status = sixel_helper_load_image_file(filename,
-                                          encoder->fstatic,
-                                          fuse_palette,
-                                          encoder->reqcolors,
-                                          encoder->bgcolor,
-                                          encoder->loop_mode,
-                                          load_image_callback,
-                                          encoder->finsecure,
-                                          encoder->cancel_flag,
-                                          (void *)encoder,
-                                          encoder->allocator);
+    status = sixel_loader_load_file(filename,
+                                    encoder->fstatic,
+                                    fuse_palette,
+                                    encoder->reqcolors,
+                                    encoder->bgcolor,
+                                    encoder->loop_mode,
+                                    hint_width,
+                                    hint_height,
+                                    load_image_callback,
+                                    encoder->finsecure,
+                                    encoder->cancel_flag,
+                                    (void *)encoder,
+                                    encoder->allocator);
     if (status != SIXEL_OK) {
         goto end;
     }
@@ -1813,6 +2137,58 @@ sixel_encoder_encode_bytes(
         goto end;
     }
 
+    /* bytes are owned by the caller, they are copied before modification */
+    sixel_frame_set_borrowed(frame);
+
+    status = sixel_encoder_encode_frame(encoder, frame, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* encode a subrectangle of pixel data whose rows are stride bytes apart
+ * output to encoder->outfd */
+SIXELAPI SIXELSTATUS
+sixel_encoder_encode_bytes_with_stride(
+    sixel_encoder_t     /* in */    *encoder,
+    unsigned char       /* in */    *bytes,
+    int                 /* in */    stride,
+    int                 /* in */    x,
+    int                 /* in */    y,
+    int                 /* in */    width,
+    int                 /* in */    height,
+    int                 /* in */    pixelformat,
+    unsigned char       /* in */    *palette,
+    int                 /* in */    ncolors)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_frame_t *frame;
+
+    if (encoder == NULL || bytes == NULL) {
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    status = sixel_frame_new(&frame, encoder->allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    /* the frame refers the subrectangle in place, the rows are copied
+       just before quantization */
+    status = sixel_frame_init_with_stride(frame, bytes, stride, x, y,
+                                          width, height,
+                                          pixelformat, palette, ncolors);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
     status = sixel_encoder_encode_frame(encoder, frame, NULL);
     if (SIXEL_FAILED(status)) {
         goto end;
@@ -2006,6 +2382,398 @@ error:
 }
 
 
+/* growing buffer which receives the output of tests */
+typedef struct test_buffer {
+    char *data;
+    int size;
+    int capacity;
+} test_buffer_t;
+
+
+static int
+test_buffer_write(char *data, int size, void *priv)
+{
+    test_buffer_t *buffer = (test_buffer_t *)priv;
+    char *p;
+
+    if (buffer->size + size > buffer->capacity) {
+        buffer->capacity = (buffer->size + size) * 2;
+        p = (char *)realloc(buffer->data, (size_t)buffer->capacity);
+        if (p == NULL) {
+            return (-1);
+        }
+        buffer->data = p;
+    }
+    memcpy(buffer->data + buffer->size, data, (size_t)size);
+    buffer->size += size;
+
+    return size;
+}
+
+
+/* the band pipeline writes the same sequence as scaling, applying palette
+   and encoding the whole frame one after another */
+static int
+test6(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    sixel_encoder_t *encoder = NULL;
+    sixel_frame_t *frame = NULL;
+    sixel_dither_t *dither = NULL;
+    sixel_output_t *output = NULL;
+    unsigned char *pixels;
+    test_buffer_t fused = { NULL, 0, 0 };
+    test_buffer_t plain = { NULL, 0, 0 };
+    char const *diffusions[] = { "fs", "atkinson", "jajuni", "x_dither" };
+    char const *widths[] = { "53", "48", "97" };
+    size_t i;
+    int j;
+    int k;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (i = 0; i < sizeof(diffusions) / sizeof(diffusions[0]); i++) {
+        status = sixel_encoder_new(&encoder, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        status = sixel_encoder_setopt(encoder, SIXEL_OPTFLAG_BUILTIN_PALETTE, "xterm256");
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        status = sixel_encoder_setopt(encoder, SIXEL_OPTFLAG_DIFFUSION, diffusions[i]);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        status = sixel_encoder_setopt(encoder, SIXEL_OPTFLAG_WIDTH, widths[i % 3]);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+
+        for (j = 0; j < 2; j++) {
+            status = sixel_frame_new(&frame, allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            pixels = (unsigned char *)sixel_allocator_malloc(allocator, 97 * 61 * 3);
+            if (pixels == NULL) {
+                goto error;
+            }
+            for (k = 0; k < 97 * 61 * 3; k++) {
+                pixels[k] = (unsigned char)(k * 7 + k / 291 * 13);
+            }
+            status = sixel_frame_init(frame, pixels, 97, 61,
+                                      SIXEL_PIXELFORMAT_RGB888, NULL, 0);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_output_new(&output, test_buffer_write,
+                                      j == 0 ? &fused : &plain, allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            if (j == 0) {
+                status = sixel_encoder_encode_frame(encoder, frame, output);
+            } else {
+                /* same steps as sixel_encoder_encode_frame() without
+                   the pipeline */
+                status = sixel_encoder_do_resize(encoder, frame);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+                status = sixel_prepare_builtin_palette(&dither, encoder->builtin_palette);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+                sixel_dither_set_diffusion_type(dither, encoder->method_for_diffuse);
+                sixel_output_set_8bit_availability(output, encoder->f8bit);
+                sixel_output_set_gri_arg_limit(output, encoder->has_gri_arg_limit);
+                sixel_output_set_palette_type(output, encoder->palette_type);
+                sixel_output_set_encode_policy(output, encoder->encode_policy);
+                status = sixel_encoder_output_without_macro(frame, dither, output, encoder);
+                sixel_dither_unref(dither);
+                dither = NULL;
+            }
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            sixel_output_unref(output);
+            output = NULL;
+            sixel_frame_unref(frame);
+            frame = NULL;
+        }
+        sixel_encoder_unref(encoder);
+        encoder = NULL;
+
+        if (fused.size == 0 || fused.size != plain.size) {
+            goto error;
+        }
+        if (memcmp(fused.data, plain.data, (size_t)fused.size) != 0) {
+            goto error;
+        }
+        fused.size = plain.size = 0;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    free(fused.data);
+    free(plain.data);
+    sixel_output_unref(output);
+    sixel_frame_unref(frame);
+    sixel_encoder_unref(encoder);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* a subrectangle of a strided buffer is encoded as its packed copy */
+static int
+test7(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    sixel_encoder_t *encoder = NULL;
+    sixel_frame_t *frame = NULL;
+    sixel_output_t *output = NULL;
+    unsigned char buffer[50 * (80 * 3 + 5)];
+    unsigned char packed[31 * 53 * 3];
+    test_buffer_t strided = { NULL, 0, 0 };
+    test_buffer_t plain = { NULL, 0, 0 };
+    int const stride = 80 * 3 + 5;
+    /* pipeline with and without scaling, quantization, clipping */
+    int const flags[] = {
+        SIXEL_OPTFLAG_BUILTIN_PALETTE,
+        SIXEL_OPTFLAG_WIDTH,
+        SIXEL_OPTFLAG_COLORS,
+        SIXEL_OPTFLAG_CROP,
+    };
+    char const *optargs[] = { "xterm256", "40", "16", "20x10+3+4" };
+    size_t i;
+    int j;
+    int k;
+
+    for (k = 0; k < (int)sizeof(buffer); k++) {
+        buffer[k] = (unsigned char)(k * 7 + k / 245 * 13);
+    }
+    for (k = 0; k < 31; k++) {
+        memcpy(packed + k * 53 * 3, buffer + (5 + k) * stride + 7 * 3, 53 * 3);
+    }
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (i = 0; i < sizeof(optargs) / sizeof(optargs[0]); i++) {
+        status = sixel_encoder_new(&encoder, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        status = sixel_encoder_setopt(encoder, flags[i], optargs[i]);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (flags[i] == SIXEL_OPTFLAG_WIDTH) {
+            status = sixel_encoder_setopt(encoder, SIXEL_OPTFLAG_BUILTIN_PALETTE, "xterm256");
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+        }
+
+        for (j = 0; j < 2; j++) {
+            status = sixel_frame_new(&frame, allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            if (j == 0) {
+                status = sixel_frame_init_with_stride(frame, buffer, stride,
+                                                      7, 5, 53, 31,
+                                                      SIXEL_PIXELFORMAT_RGB888,
+                                                      NULL, 0);
+            } else {
+                status = sixel_frame_init(frame, packed, 53, 31,
+                                          SIXEL_PIXELFORMAT_RGB888, NULL, 0);
+                sixel_frame_set_borrowed(frame);
+            }
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_output_new(&output, test_buffer_write,
+                                      j == 0 ? &strided : &plain, allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_encoder_encode_frame(encoder, frame, output);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            sixel_output_unref(output);
+            output = NULL;
+            sixel_frame_unref(frame);
+            frame = NULL;
+        }
+        sixel_encoder_unref(encoder);
+        encoder = NULL;
+
+        if (strided.size == 0 || strided.size != plain.size) {
+            goto error;
+        }
+        if (memcmp(strided.data, plain.data, (size_t)strided.size) != 0) {
+            goto error;
+        }
+        strided.size = plain.size = 0;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    free(strided.data);
+    free(plain.data);
+    sixel_output_unref(output);
+    sixel_frame_unref(frame);
+    sixel_encoder_unref(encoder);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* paletted frames are scaled by nearest neighbour without quantization,
+   and PAL4 indexes are unpacked band by band, both result in the same
+   output as the equivalent PAL8 frames */
+static int
+test8(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    sixel_encoder_t *encoder = NULL;
+    sixel_frame_t *frame = NULL;
+    sixel_output_t *output = NULL;
+    test_buffer_t packed = { NULL, 0, 0 };
+    test_buffer_t plain = { NULL, 0, 0 };
+    unsigned char *pixels;
+    unsigned char *palette;
+    int i;
+    int j;
+    int x;
+    int y;
+    int width;
+    int height;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++) {
+            status = sixel_encoder_new(&encoder, allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            width = 20;
+            height = 13;
+            if (i == 1 && j == 0) {
+                status = sixel_encoder_setopt(encoder, SIXEL_OPTFLAG_WIDTH, "30");
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+                status = sixel_encoder_setopt(encoder, SIXEL_OPTFLAG_HEIGHT, "26");
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+                status = sixel_encoder_setopt(encoder, SIXEL_OPTFLAG_RESAMPLING, "nearest");
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+            } else if (i == 1) {
+                width = 30;
+                height = 26;
+            }
+
+            pixels = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                             (size_t)(width * height));
+            palette = (unsigned char *)sixel_allocator_malloc(allocator, 16 * 3);
+            if (pixels == NULL || palette == NULL) {
+                sixel_allocator_free(allocator, pixels);
+                sixel_allocator_free(allocator, palette);
+                goto error;
+            }
+            for (x = 0; x < 16 * 3; x++) {
+                palette[x] = (unsigned char)(x * 37);
+            }
+            for (y = 0; y < height; y++) {
+                for (x = 0; x < width; x++) {
+                    /* index of the source pixel (x, y) of 20x13 PAL4 image */
+                    int sx = i == 1 && j == 1 ? x * 20 / 30: x;
+                    int sy = i == 1 && j == 1 ? y * 13 / 26: y;
+                    int index = (sx * 3 + sy * 5 + sx * sy) & 0xf;
+                    if (j == 1) {
+                        pixels[y * width + x] = (unsigned char)index;
+                    } else if (x % 2 == 0) {
+                        pixels[y * 10 + x / 2] = (unsigned char)(index << 4);
+                    } else {
+                        pixels[y * 10 + x / 2] |= (unsigned char)index;
+                    }
+                }
+            }
+
+            status = sixel_frame_new(&frame, allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_frame_init(frame, pixels, width, height,
+                                      j == 0 ? SIXEL_PIXELFORMAT_PAL4: SIXEL_PIXELFORMAT_PAL8,
+                                      palette, 16);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_output_new(&output, test_buffer_write,
+                                      j == 0 ? &packed : &plain, allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_encoder_encode_frame(encoder, frame, output);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            sixel_output_unref(output);
+            output = NULL;
+            sixel_frame_unref(frame);
+            frame = NULL;
+            sixel_encoder_unref(encoder);
+            encoder = NULL;
+        }
+
+        if (packed.size == 0 || packed.size != plain.size) {
+            goto error;
+        }
+        if (memcmp(packed.data, plain.data, (size_t)packed.size) != 0) {
+            goto error;
+        }
+        packed.size = plain.size = 0;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    free(packed.data);
+    free(plain.data);
+    sixel_output_unref(output);
+    sixel_frame_unref(frame);
+    sixel_encoder_unref(encoder);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_encoder_tests_main(void)
 {
@@ -2018,7 +2786,10 @@ sixel_encoder_tests_main(void)
         test2,
         test3,
         test4,
-        test5
+        test5,
+        test6,
+        test7,
+        test8
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
@@ -22,6 +22,8 @@
 #ifndef LIBSIXEL_ENCODER_H
 #define LIBSIXEL_ENCODER_H
 
+#include "palcache.h"
+
 /* palette type */
 #define SIXEL_COLOR_OPTION_DEFAULT          0   /* use default settings */
 #define SIXEL_COLOR_OPTION_MONOCHROME       1   /* use monochrome palette */
@@ -49,6 +51,7 @@ struct sixel_encoder {
     int fuse_macro;
     int fignore_delay;
     int complexion;
+    int nthreads;                   /* threads for applying palette, 0 if not specified */
     int fstatic;
     int pixelwidth;
     int pixelheight;
@@ -70,6 +73,11 @@ struct sixel_encoder {
     int finsecure;
     int *cancel_flag;
     void *dither_cache;
+    char *mapfile_output;           /* palette file to be written */
+    char *palette_cache_dir;        /* directory for persistent palette cache */
+    char palette_cache_key[SIXEL_PALCACHE_KEY_LENGTH + 1];
+                                    /* key of the palette to be stored,
+                                       empty if nothing to be stored */
 };
 
 #if HAVE_TESTS
@@ -37,6 +37,8 @@
 #endif  /* HAVE_INTTYPES_H */
 
 #include "frame.h"
+#include "scale.h"
+#include "pixelformat.h"
 
 #if !defined(HAVE_MEMMOVE)
 # define memmove(d, s, n) (bcopy ((s), (d), (n)))
@@ -78,6 +80,9 @@ sixel_frame_new(
     (*ppframe)->loop_count = 0;
     (*ppframe)->multiframe = 0;
     (*ppframe)->transparent = (-1);
+    (*ppframe)->nthreads = 0;
+    (*ppframe)->borrowed = 0;
+    (*ppframe)->stride = 0;
     (*ppframe)->allocator = allocator;
 
     sixel_allocator_ref(allocator);
@@ -112,7 +117,9 @@ sixel_frame_destroy(sixel_frame_t /* in */ *frame)
 
     if (frame) {
         allocator = frame->allocator;
-        sixel_allocator_free(allocator, frame->pixels);
+        if (!frame->borrowed) {
+            sixel_allocator_free(allocator, frame->pixels);
+        }
         sixel_allocator_free(allocator, frame->palette);
         sixel_allocator_free(allocator, frame);
         sixel_allocator_unref(allocator);
@@ -120,6 +127,21 @@ sixel_frame_destroy(sixel_frame_t /* in */ *frame)
 }
 
 
+/* replace the pixel buffer with a new one owned by the frame */
+static void
+sixel_frame_set_pixels(
+    sixel_frame_t   /* in */ *frame,    /* frame object */
+    unsigned char   /* in */ *pixels)   /* new pixel buffer */
+{
+    if (!frame->borrowed) {
+        sixel_allocator_free(frame->allocator, frame->pixels);
+    }
+    frame->pixels = pixels;
+    frame->borrowed = 0;
+    frame->stride = 0;
+}
+
+
 /* increase reference count of frame object (thread-unsafe) */
 SIXELAPI void
 sixel_frame_ref(sixel_frame_t *frame)
@@ -183,6 +205,8 @@ sixel_frame_init(
     }
 
     frame->pixels = pixels;
+    frame->borrowed = 0;
+    frame->stride = 0;
     frame->width = width;
     frame->height = height;
     frame->pixelformat = pixelformat;
@@ -198,6 +222,80 @@ end:
 }
 
 
+/* initialize frame object with a subrectangle of a pixel buffer whose
+   rows are stride bytes apart, the buffer is borrowed from the caller:
+   it is neither modified nor freed by the frame object */
+SIXELAPI SIXELSTATUS
+sixel_frame_init_with_stride(
+    sixel_frame_t   /* in */ *frame,        /* frame object to be initialize */
+    unsigned char   /* in */ *pixels,       /* pixel buffer */
+    int             /* in */ stride,        /* bytes per row of buffer */
+    int             /* in */ x,             /* left of subrectangle */
+    int             /* in */ y,             /* top of subrectangle */
+    int             /* in */ width,         /* width of subrectangle */
+    int             /* in */ height,        /* height of subrectangle */
+    int             /* in */ pixelformat,   /* pixelformat of buffer */
+    unsigned char   /* in */ *palette,      /* palette for buffer or NULL */
+    int             /* in */ ncolors        /* number of palette colors or (-1) */
+)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int offset;
+
+    sixel_frame_ref(frame);
+
+    /* check parameters */
+    if (sixel_pixelformat_compute_stride(pixelformat, 1) < 0) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_init_with_stride: an invalid pixelformat parameter detected.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+    if (x < 0 || y < 0) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_init_with_stride: an invalid offset parameter detected.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+    if (width <= 0 || x > SIXEL_WIDTH_LIMIT ||
+        stride < sixel_pixelformat_compute_stride(pixelformat, x + width)) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_init_with_stride: an invalid stride parameter detected.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    /* the left of subrectangle must be on a byte boundary, pixels of
+       PAL1/2/4 and G1/2/4 are not addressable in the middle of a byte */
+    offset = sixel_pixelformat_compute_stride(pixelformat, x);
+    if (sixel_pixelformat_compute_stride(pixelformat, x + 1) == offset) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_init_with_stride: "
+            "the left of subrectangle must be aligned to a byte.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    status = sixel_frame_init(frame,
+                              pixels + (size_t)y * (size_t)stride + (size_t)offset,
+                              width, height, pixelformat, palette, ncolors);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    frame->borrowed = 1;
+    if (stride != sixel_pixelformat_compute_stride(pixelformat, width)) {
+        frame->stride = stride;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    sixel_frame_unref(frame);
+
+    return status;
+}
+
+
 /* get pixels */
 SIXELAPI unsigned char *
 sixel_frame_get_pixels(sixel_frame_t /* in */ *frame)  /* frame object */
@@ -286,6 +384,168 @@ sixel_frame_get_loop_no(sixel_frame_t /* in */ *frame)  /* frame object */
 }
 
 
+/* set number of threads for resizing */
+SIXELAPI void
+sixel_frame_set_threads(
+    sixel_frame_t  /* in */ *frame,     /* frame object */
+    int            /* in */ nthreads)   /* number of threads */
+{
+    frame->nthreads = nthreads;
+}
+
+
+/* mark the pixel buffer as borrowed from the caller, it is copied before
+   being modified in place and is never freed by the frame */
+void
+sixel_frame_set_borrowed(
+    sixel_frame_t  /* in */ *frame)     /* frame object */
+{
+    frame->borrowed = 1;
+}
+
+
+/* copy-on-write: take a private copy of the pixel buffer if it is borrowed,
+   so that the frame can be modified in place, rows of the copy are packed */
+SIXELSTATUS
+sixel_frame_own_pixels(
+    sixel_frame_t  /* in */ *frame)     /* frame object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *pixels;
+    size_t rowsize;
+    size_t stride;
+    int y;
+
+    if (!frame->borrowed) {
+        return SIXEL_OK;
+    }
+
+    if (sixel_pixelformat_compute_stride(frame->pixelformat, frame->width) < 0) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_own_pixels: invalid pixelformat.");
+        status = SIXEL_LOGIC_ERROR;
+        goto end;
+    }
+    rowsize = (size_t)sixel_pixelformat_compute_stride(frame->pixelformat,
+                                                       frame->width);
+    stride = (size_t)sixel_frame_get_stride(frame);
+
+    pixels = (unsigned char *)sixel_allocator_malloc(frame->allocator,
+                                                     rowsize * (size_t)frame->height);
+    if (pixels == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_own_pixels: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    if (stride == rowsize) {
+        memcpy(pixels, frame->pixels, rowsize * (size_t)frame->height);
+    } else {
+        for (y = 0; y < frame->height; y++) {
+            memcpy(pixels + rowsize * (size_t)y,
+                   frame->pixels + stride * (size_t)y,
+                   rowsize);
+        }
+    }
+    sixel_frame_set_pixels(frame, pixels);
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* compute the number of bytes per row of the pixel buffer */
+int
+sixel_frame_get_stride(
+    sixel_frame_t  /* in */ *frame)     /* frame object */
+{
+    if (frame->stride > 0) {
+        return frame->stride;
+    }
+
+    return sixel_pixelformat_compute_stride(frame->pixelformat, frame->width);
+}
+
+
+/* pack the rows of the pixel buffer if they are not contiguous, e.g. the
+   frame refers a subrectangle of the caller's buffer */
+SIXELSTATUS
+sixel_frame_pack_pixels(
+    sixel_frame_t  /* in */ *frame)     /* frame object */
+{
+    if (frame->stride == 0) {
+        return SIXEL_OK;
+    }
+
+    return sixel_frame_own_pixels(frame);
+}
+
+
+/* composite RGBA/ARGB/BGRA/ABGR formatted pixbuf over the background, which
+   is bgcolor if bgrows is NULL, or the first height rows of bgrows repeated
+   vertically otherwise, bgrows has the same width as the frame */
+static SIXELSTATUS
+sixel_frame_composite(
+    sixel_frame_t       /* in */ *frame,
+    unsigned char const /* in */ *bgcolor,
+    unsigned char const /* in */ *bgrows,
+    int                 /* in */ height)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *pixels;
+    int y;
+
+    switch (frame->pixelformat) {
+    case SIXEL_PIXELFORMAT_ARGB8888:
+    case SIXEL_PIXELFORMAT_RGBA8888:
+    case SIXEL_PIXELFORMAT_ABGR8888:
+    case SIXEL_PIXELFORMAT_BGRA8888:
+        break;
+    default:
+        return SIXEL_OK;
+    }
+
+    status = sixel_frame_own_pixels(frame);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    pixels = frame->pixels;
+
+    if (bgcolor == NULL && bgrows == NULL) {
+        /* just drop alpha channel */
+        status = sixel_pixelformat_normalize_in_place(pixels,
+                                                      &frame->pixelformat,
+                                                      frame->width,
+                                                      frame->height,
+                                                      frame->width * 4);
+        goto end;
+    }
+
+    /* RGB888 rows are written over the head of 32bpp rows */
+    for (y = 0; y < frame->height; y++) {
+        status = sixel_pixelformat_composite_row(
+            pixels + (size_t)y * (size_t)frame->width * 3,
+            pixels + (size_t)y * (size_t)frame->width * 4,
+            bgrows ? bgrows + (size_t)(y % height) * (size_t)frame->width * 3 : bgcolor,
+            bgrows ? 3 : 0,
+            frame->width,
+            frame->pixelformat);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+    frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
 /* strip alpha from RGBA/ARGB/BGRA/ABGR formatted pixbuf */
 SIXELAPI SIXELSTATUS
 sixel_frame_strip_alpha(
@@ -294,105 +554,124 @@ sixel_frame_strip_alpha(
 )
 {
     SIXELSTATUS status = SIXEL_FALSE;
-    int i;
-    unsigned char *src;
-    unsigned char *dst;
-    unsigned char alpha;
 
     sixel_frame_ref(frame);
 
-    src = dst = frame->pixels;
-
-    if (bgcolor) {
-        switch (frame->pixelformat) {
-        case SIXEL_PIXELFORMAT_ARGB8888:
-            for (i = 0; i < frame->height * frame->width; i++) {
-                alpha = src[0];
-                *dst++ = (*src++ * alpha + bgcolor[0] * (0xff - alpha)) >> 8;
-                *dst++ = (*src++ * alpha + bgcolor[1] * (0xff - alpha)) >> 8;
-                *dst++ = (*src++ * alpha + bgcolor[2] * (0xff - alpha)) >> 8;
-                src++;
-            }
-            frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
-            break;
-        case SIXEL_PIXELFORMAT_RGBA8888:
-            for (i = 0; i < frame->height * frame->width; i++) {
-                alpha = src[3];
-                *dst++ = (*src++ * alpha + bgcolor[0] * (0xff - alpha)) >> 8;
-                *dst++ = (*src++ * alpha + bgcolor[1] * (0xff - alpha)) >> 8;
-                *dst++ = (*src++ * alpha + bgcolor[2] * (0xff - alpha)) >> 8;
-                src++;
-            }
-            frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
-            break;
-        case SIXEL_PIXELFORMAT_ABGR8888:
-            for (i = 0; i < frame->height * frame->width; i++) {
-                alpha = src[0];
-                *dst++ = (src[3] * alpha + bgcolor[0] * (0xff - alpha)) >> 8;
-                *dst++ = (src[2] * alpha + bgcolor[1] * (0xff - alpha)) >> 8;
-                *dst++ = (src[1] * alpha + bgcolor[2] * (0xff - alpha)) >> 8;
-                src += 4;
-            }
-            frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
-            break;
-        case SIXEL_PIXELFORMAT_BGRA8888:
-            for (i = 0; i < frame->height * frame->width; i++) {
-                alpha = src[3];
-                *dst++ = (src[2] * alpha + bgcolor[0] * (0xff - alpha)) >> 8;
-                *dst++ = (src[1] * alpha + bgcolor[1] * (0xff - alpha)) >> 8;
-                *dst++ = (src[0] * alpha + bgcolor[2] * (0xff - alpha)) >> 8;
-                src += 4;
-            }
-            frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
-            break;
-        default:
-            break;
+    status = sixel_frame_composite(frame, bgcolor, NULL, 0);
+
+    sixel_frame_unref(frame);
+
+    return status;
+}
+
+
+/* composite RGBA/ARGB/BGRA/ABGR formatted pixbuf over a RGB888 tile
+   repeated from the top-left corner */
+SIXELAPI SIXELSTATUS
+sixel_frame_strip_alpha_with_tile(
+    sixel_frame_t       /* in */ *frame,        /* frame object */
+    unsigned char const /* in */ *tile,         /* RGB888 tile */
+    int                 /* in */ tile_width,    /* width of tile */
+    int                 /* in */ tile_height)   /* height of tile */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *bgrows = NULL;
+    unsigned char *p;
+    int height;
+    int n;
+    int x;
+    int y;
+
+    sixel_frame_ref(frame);
+
+    if (tile == NULL || tile_width <= 0 || tile_height <= 0) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_strip_alpha_with_tile: an invalid tile parameter detected.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    /* tile rows are repeated horizontally to the width of the frame */
+    height = tile_height < frame->height ? tile_height : frame->height;
+    bgrows = (unsigned char *)sixel_allocator_malloc(
+        frame->allocator, (size_t)frame->width * (size_t)height * 3);
+    if (bgrows == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_strip_alpha_with_tile: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    p = bgrows;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < frame->width; x += n) {
+            n = frame->width - x < tile_width ? frame->width - x : tile_width;
+            memcpy(p, tile + (size_t)y * (size_t)tile_width * 3, (size_t)n * 3);
+            p += n * 3;
         }
-    } else {
-        switch (frame->pixelformat) {
-        case SIXEL_PIXELFORMAT_ARGB8888:
-            for (i = 0; i < frame->height * frame->width; i++) {
-                src++;            /* A */
-                *dst++ = *src++;  /* R */
-                *dst++ = *src++;  /* G */
-                *dst++ = *src++;  /* B */
-            }
-            frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
-            break;
-        case SIXEL_PIXELFORMAT_RGBA8888:
-            for (i = 0; i < frame->height * frame->width; i++) {
-                *dst++ = *src++;  /* R */
-                *dst++ = *src++;  /* G */
-                *dst++ = *src++;  /* B */
-                src++;            /* A */
-            }
-            frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
-            break;
-        case SIXEL_PIXELFORMAT_ABGR8888:
-            for (i = 0; i < frame->height * frame->width; i++) {
-                *dst++ = src[3];  /* R */
-                *dst++ = src[2];  /* G */
-                *dst++ = src[1];  /* B */
-                src += 4;
-            }
-            frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
-            break;
-        case SIXEL_PIXELFORMAT_BGRA8888:
-            for (i = 0; i < frame->height * frame->width; i++) {
-                *dst++ = src[2];  /* R */
-                *dst++ = src[1];  /* G */
-                *dst++ = src[0];  /* B */
-                src += 4;
-            }
-            frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
-            break;
-        default:
-            break;
+    }
+
+    status = sixel_frame_composite(frame, NULL, bgrows, height);
+
+end:
+    sixel_allocator_free(frame->allocator, bgrows);
+    sixel_frame_unref(frame);
+
+    return status;
+}
+
+
+/* composite RGBA/ARGB/BGRA/ABGR formatted pixbuf over a checkerboard of two
+   colors, e.g. for previews of transparent images */
+SIXELAPI SIXELSTATUS
+sixel_frame_strip_alpha_with_checkerboard(
+    sixel_frame_t       /* in */ *frame,        /* frame object */
+    unsigned char const /* in */ *color1,       /* RGB888 color of top-left cell */
+    unsigned char const /* in */ *color2,       /* RGB888 color of other cells */
+    int                 /* in */ cellsize)      /* size of cells in pixels */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *tile = NULL;
+    unsigned char const *color;
+    int size;
+    int x;
+    int y;
+
+    sixel_frame_ref(frame);
+
+    if (color1 == NULL || color2 == NULL || cellsize <= 0 ||
+        cellsize > SIXEL_WIDTH_LIMIT) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_strip_alpha_with_checkerboard: an invalid parameter detected.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    /* a cell larger than the frame covers it all the same */
+    size = frame->width > frame->height ? frame->width : frame->height;
+    if (size > 0 && cellsize > size) {
+        cellsize = size;
+    }
+
+    tile = (unsigned char *)sixel_allocator_malloc(
+        frame->allocator, (size_t)cellsize * (size_t)cellsize * 4 * 3);
+    if (tile == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_strip_alpha_with_checkerboard: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    for (y = 0; y < cellsize * 2; y++) {
+        for (x = 0; x < cellsize * 2; x++) {
+            color = (x / cellsize + y / cellsize) % 2 ? color2 : color1;
+            memcpy(tile + ((size_t)y * (size_t)cellsize * 2 + (size_t)x) * 3, color, 3);
         }
     }
 
-    status = SIXEL_OK;
+    status = sixel_frame_strip_alpha_with_tile(frame, tile,
+                                               cellsize * 2, cellsize * 2);
 
+end:
+    sixel_allocator_free(frame->allocator, tile);
     sixel_frame_unref(frame);
 
     return status;
@@ -408,6 +687,7 @@ sixel_frame_convert_to_rgb888(sixel_frame_t /*in */ *frame)
     unsigned char *dst;
     unsigned char *src;
     unsigned char *p;
+    int y;
 
     sixel_frame_ref(frame);
 
@@ -425,12 +705,14 @@ sixel_frame_convert_to_rgb888(sixel_frame_t /*in */ *frame)
         }
         src = normalized_pixels + frame->width * frame->height * 3;
         dst = normalized_pixels;
-        status = sixel_helper_normalize_pixelformat(src,
-                                                    &frame->pixelformat,
-                                                    frame->pixels,
-                                                    frame->pixelformat,
-                                                    frame->width,
-                                                    frame->height);
+        status = sixel_helper_normalize_pixelformat_with_stride(
+            src,
+            &frame->pixelformat,
+            frame->pixels,
+            frame->pixelformat,
+            frame->width,
+            frame->height,
+            sixel_frame_get_stride(frame));
         if (SIXEL_FAILED(status)) {
             sixel_allocator_free(frame->allocator, normalized_pixels);
             goto end;
@@ -440,8 +722,7 @@ sixel_frame_convert_to_rgb888(sixel_frame_t /*in */ *frame)
             *dst++ = *(frame->palette + *p * 3 + 1);
             *dst++ = *(frame->palette + *p * 3 + 2);
         }
-        sixel_allocator_free(frame->allocator, frame->pixels);
-        frame->pixels = normalized_pixels;
+        sixel_frame_set_pixels(frame, normalized_pixels);
         frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
         break;
     case SIXEL_PIXELFORMAT_PAL8:
@@ -453,15 +734,16 @@ sixel_frame_convert_to_rgb888(sixel_frame_t /*in */ *frame)
             status = SIXEL_BAD_ALLOCATION;
             goto end;
         }
-        src = frame->pixels;
         dst = normalized_pixels;
-        for (; dst != normalized_pixels + size; ++src) {
-            *dst++ = frame->palette[*src * 3 + 0];
-            *dst++ = frame->palette[*src * 3 + 1];
-            *dst++ = frame->palette[*src * 3 + 2];
+        for (y = 0; y < frame->height; ++y) {
+            src = frame->pixels + y * sixel_frame_get_stride(frame);
+            for (p = src + frame->width; src != p; ++src) {
+                *dst++ = frame->palette[*src * 3 + 0];
+                *dst++ = frame->palette[*src * 3 + 1];
+                *dst++ = frame->palette[*src * 3 + 2];
+            }
         }
-        sixel_allocator_free(frame->allocator, frame->pixels);
-        frame->pixels = normalized_pixels;
+        sixel_frame_set_pixels(frame, normalized_pixels);
         frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
         break;
     case SIXEL_PIXELFORMAT_RGB888:
@@ -473,10 +755,25 @@ sixel_frame_convert_to_rgb888(sixel_frame_t /*in */ *frame)
     case SIXEL_PIXELFORMAT_RGB565:
     case SIXEL_PIXELFORMAT_BGR555:
     case SIXEL_PIXELFORMAT_BGR565:
+    case SIXEL_PIXELFORMAT_BGR888:
     case SIXEL_PIXELFORMAT_RGBA8888:
     case SIXEL_PIXELFORMAT_ARGB8888:
+    case SIXEL_PIXELFORMAT_BGRA8888:
+    case SIXEL_PIXELFORMAT_ABGR8888:
         /* normalize pixelformat */
         size = (size_t)(frame->width * frame->height * 3);
+        if (!frame->borrowed && sixel_helper_compute_depth(frame->pixelformat) >= 3) {
+            /* RGB888 pixels fit in the own buffer */
+            status = sixel_pixelformat_normalize_in_place(frame->pixels,
+                                                          &frame->pixelformat,
+                                                          frame->width,
+                                                          frame->height,
+                                                          sixel_frame_get_stride(frame));
+            if (SIXEL_FAILED(status)) {
+                goto end;
+            }
+            break;
+        }
         normalized_pixels = (unsigned char *)sixel_allocator_malloc(frame->allocator, size);
         if (normalized_pixels == NULL) {
             sixel_helper_set_additional_message(
@@ -484,18 +781,19 @@ sixel_frame_convert_to_rgb888(sixel_frame_t /*in */ *frame)
             status = SIXEL_BAD_ALLOCATION;
             goto end;
         }
-        status = sixel_helper_normalize_pixelformat(normalized_pixels,
-                                                    &frame->pixelformat,
-                                                    frame->pixels,
-                                                    frame->pixelformat,
-                                                    frame->width,
-                                                    frame->height);
+        status = sixel_helper_normalize_pixelformat_with_stride(
+            normalized_pixels,
+            &frame->pixelformat,
+            frame->pixels,
+            frame->pixelformat,
+            frame->width,
+            frame->height,
+            sixel_frame_get_stride(frame));
         if (SIXEL_FAILED(status)) {
             sixel_allocator_free(frame->allocator, normalized_pixels);
             goto end;
         }
-        sixel_allocator_free(frame->allocator, frame->pixels);
-        frame->pixels = normalized_pixels;
+        sixel_frame_set_pixels(frame, normalized_pixels);
         break;
     default:
         status = SIXEL_LOGIC_ERROR;
@@ -512,6 +810,105 @@ end:
     return status;
 }
 
+/* number of bits of an index for paletted and grayscale formats,
+   0 for others */
+static int
+index_bits(int pixelformat)
+{
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_PAL1:
+    case SIXEL_PIXELFORMAT_G1:
+        return 1;
+    case SIXEL_PIXELFORMAT_PAL2:
+    case SIXEL_PIXELFORMAT_G2:
+        return 2;
+    case SIXEL_PIXELFORMAT_PAL4:
+    case SIXEL_PIXELFORMAT_G4:
+        return 4;
+    case SIXEL_PIXELFORMAT_PAL8:
+    case SIXEL_PIXELFORMAT_G8:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+
+/* extract width indexes from a row of packed indexes of the given bits,
+   starting at column x */
+static void
+unpack_indexes(
+    unsigned char       /* out */ *dst,
+    unsigned char const /* in */  *row,
+    int                 /* in */  x,
+    int                 /* in */  width,
+    int                 /* in */  bits)
+{
+    int i;
+    int pos;
+    int const mask = (1 << bits) - 1;
+
+    for (i = 0; i < width; i++) {
+        pos = (x + i) * bits;
+        dst[i] = (unsigned char)(row[pos >> 3] >> (8 - bits - (pos & 7)) & mask);
+    }
+}
+
+
+/* scale the index plane of a paletted frame by nearest neighbour, the
+   palette is kept as it is and sub-byte indexes are unpacked into PAL8
+   on the way */
+static SIXELSTATUS
+resize_indexes(
+    sixel_frame_t   /* in */ *frame,
+    int             /* in */ width,
+    int             /* in */ height)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *scaled_frame;
+    unsigned char const *row;
+    unsigned char *dst;
+    int bits;
+    int stride;
+    int x;
+    int y;
+    int pos;
+
+    bits = index_bits(frame->pixelformat);
+    stride = sixel_frame_get_stride(frame);
+
+    scaled_frame = (unsigned char *)sixel_allocator_malloc(frame->allocator,
+                                                           (size_t)width * (size_t)height);
+    if (scaled_frame == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_frame_resize: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    dst = scaled_frame;
+    for (y = 0; y < height; y++) {
+        row = frame->pixels + y * frame->height / height * stride;
+        for (x = 0; x < width; x++) {
+            pos = x * frame->width / width * bits;
+            *dst++ = (unsigned char)(row[pos >> 3] >> (8 - bits - (pos & 7))
+                                     & ((1 << bits) - 1));
+        }
+    }
+
+    sixel_frame_set_pixels(frame, scaled_frame);
+    frame->pixelformat = frame->pixelformat & SIXEL_FORMATTYPE_PALETTE ?
+                         SIXEL_PIXELFORMAT_PAL8 : SIXEL_PIXELFORMAT_G8;
+    frame->width = width;
+    frame->height = height;
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
 /* resize a frame to given size with specified resampling filter */
 SIXELAPI SIXELSTATUS
 sixel_frame_resize(
@@ -553,6 +950,15 @@ sixel_frame_resize(
         goto end;
     }
 
+    /* nearest neighbour never makes new colors, so paletted frames are
+       scaled as they are and the palette is reused */
+    if (method_for_resampling == SIXEL_RES_NEAREST &&
+        ((frame->pixelformat & SIXEL_FORMATTYPE_PALETTE) ||
+         frame->pixelformat == SIXEL_PIXELFORMAT_G8)) {
+        status = resize_indexes(frame, width, height);
+        goto end;
+    }
+
     status = sixel_frame_convert_to_rgb888(frame);
     if (SIXEL_FAILED(status)) {
         goto end;
@@ -567,21 +973,22 @@ sixel_frame_resize(
         goto end;
     }
 
-    status = sixel_helper_scale_image(
+    status = sixel_scale_image(
         scaled_frame,
         frame->pixels,
         frame->width,
         frame->height,
+        sixel_frame_get_stride(frame),
         3,
         width,
         height,
         method_for_resampling,
+        frame->nthreads,
         frame->allocator);
     if (SIXEL_FAILED(status)) {
         goto end;
     }
-    sixel_allocator_free(frame->allocator, frame->pixels);
-    frame->pixels = scaled_frame;
+    sixel_frame_set_pixels(frame, scaled_frame);
     frame->width = width;
     frame->height = height;
 
@@ -619,7 +1026,18 @@ clip(unsigned char *pixels,
     switch (pixelformat) {
     case SIXEL_PIXELFORMAT_PAL8:
     case SIXEL_PIXELFORMAT_G8:
+    case SIXEL_PIXELFORMAT_GA88:
+    case SIXEL_PIXELFORMAT_AG88:
+    case SIXEL_PIXELFORMAT_RGB555:
+    case SIXEL_PIXELFORMAT_RGB565:
+    case SIXEL_PIXELFORMAT_BGR555:
+    case SIXEL_PIXELFORMAT_BGR565:
     case SIXEL_PIXELFORMAT_RGB888:
+    case SIXEL_PIXELFORMAT_BGR888:
+    case SIXEL_PIXELFORMAT_RGBA8888:
+    case SIXEL_PIXELFORMAT_ARGB8888:
+    case SIXEL_PIXELFORMAT_BGRA8888:
+    case SIXEL_PIXELFORMAT_ABGR8888:
         depth = sixel_helper_compute_depth(pixelformat);
         if (depth < 0) {
             status = SIXEL_LOGIC_ERROR;
@@ -673,6 +1091,9 @@ sixel_frame_clip(
 {
     SIXELSTATUS status = SIXEL_FALSE;
     unsigned char *normalized_pixels;
+    int stride;
+    int depth;
+    int i;
 
     sixel_frame_ref(frame);
 
@@ -709,22 +1130,42 @@ sixel_frame_clip(
     case SIXEL_PIXELFORMAT_G1:
     case SIXEL_PIXELFORMAT_G2:
     case SIXEL_PIXELFORMAT_G4:
+        /* unpack the indexes of the clipped area only */
         normalized_pixels = (unsigned char *)sixel_allocator_malloc(frame->allocator,
-                                                                    (size_t)(frame->width * frame->height));
-        status = sixel_helper_normalize_pixelformat(normalized_pixels,
-                                                    &frame->pixelformat,
-                                                    frame->pixels,
-                                                    frame->pixelformat,
-                                                    frame->width,
-                                                    frame->height);
-        if (SIXEL_FAILED(status)) {
-            sixel_allocator_free(frame->allocator, normalized_pixels);
+                                                                    (size_t)width * (size_t)height);
+        if (normalized_pixels == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_frame_clip: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
             goto end;
         }
-        sixel_allocator_free(frame->allocator, frame->pixels);
-        frame->pixels = normalized_pixels;
-        break;
+        stride = sixel_frame_get_stride(frame);
+        depth = index_bits(frame->pixelformat);
+        for (i = 0; i < height; i++) {
+            unpack_indexes(normalized_pixels + i * width,
+                           frame->pixels + (y + i) * stride,
+                           x, width, depth);
+        }
+        sixel_frame_set_pixels(frame, normalized_pixels);
+        frame->pixelformat = frame->pixelformat & SIXEL_FORMATTYPE_PALETTE ?
+                             SIXEL_PIXELFORMAT_PAL8 : SIXEL_PIXELFORMAT_G8;
+        frame->width = width;
+        frame->height = height;
+        status = SIXEL_OK;
+        goto end;
     default:
+        if (frame->borrowed) {
+            /* refer the subrectangle of the borrowed buffer instead of
+               copying it, rows are packed just before quantization */
+            stride = sixel_frame_get_stride(frame);
+            depth = sixel_helper_compute_depth(frame->pixelformat);
+            frame->pixels += y * stride + x * depth;
+            frame->stride = width * depth == stride ? 0 : stride;
+            frame->width = width;
+            frame->height = height;
+            status = SIXEL_OK;
+            goto end;
+        }
         break;
     }
 
@@ -1112,6 +1553,359 @@ error:
 }
 
 
+/* borrowed pixels are clipped in place, copied before modification and
+   are not freed */
+static int
+test7(void)
+{
+    sixel_frame_t *frame = NULL;
+    sixel_allocator_t *allocator = NULL;
+    int nret = EXIT_FAILURE;
+    unsigned char pixels[4 * 2 * 3];
+    unsigned char orig[4 * 2 * 3];
+    SIXELSTATUS status;
+    int i;
+
+    for (i = 0; i < 4 * 2 * 3; i++) {
+        pixels[i] = orig[i] = (unsigned char)(i * 11);
+    }
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_frame_new(&frame, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_frame_init(frame, pixels, 4, 2,
+                              SIXEL_PIXELFORMAT_RGB888, NULL, 0);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    sixel_frame_set_borrowed(frame);
+
+    /* clipping refers the subrectangle of the borrowed buffer */
+    status = sixel_frame_clip(frame, 1, 1, 2, 1);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (frame->pixels != pixels + (4 + 1) * 3 || !frame->borrowed) {
+        goto error;
+    }
+    if (sixel_frame_get_stride(frame) != 4 * 3) {
+        goto error;
+    }
+
+    /* not borrowed any longer after the rows are packed */
+    status = sixel_frame_pack_pixels(frame);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (frame->pixels == pixels || frame->borrowed) {
+        goto error;
+    }
+    if (memcmp(pixels, orig, sizeof(orig)) != 0) {
+        goto error;
+    }
+    if (memcmp(frame->pixels, orig + (4 + 1) * 3, 2 * 3) != 0) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_frame_unref(frame);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* subrectangles of a strided buffer are converted without repacking */
+static int
+test8(void)
+{
+    sixel_frame_t *frame = NULL;
+    sixel_allocator_t *allocator = NULL;
+    int nret = EXIT_FAILURE;
+    unsigned char pixels[3 * 8];
+    unsigned char *palette;
+    SIXELSTATUS status;
+    int i;
+
+    /* 12x3 PAL4 pixels with 8 bytes per row */
+    for (i = 0; i < 3 * 8; i++) {
+        pixels[i] = (unsigned char)(i * 0x11 + 0x01);
+    }
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    palette = (unsigned char *)sixel_allocator_malloc(allocator, 16 * 3);
+    if (palette == NULL) {
+        goto error;
+    }
+    for (i = 0; i < 16 * 3; i++) {
+        palette[i] = (unsigned char)i;
+    }
+
+    status = sixel_frame_new(&frame, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    /* the left must be on a byte boundary */
+    status = sixel_frame_init_with_stride(frame, pixels, 8, 3, 1, 4, 2,
+                                          SIXEL_PIXELFORMAT_PAL4, NULL, 16);
+    if (status != SIXEL_BAD_INPUT) {
+        goto error;
+    }
+    status = sixel_frame_init_with_stride(frame, pixels, 8, 2, 1, 4, 2,
+                                          SIXEL_PIXELFORMAT_PAL4, palette, 16);
+    if (SIXEL_FAILED(status)) {
+        sixel_allocator_free(allocator, palette);
+        goto error;
+    }
+
+    status = sixel_frame_resize(frame, 4, 2, SIXEL_RES_NEAREST);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (frame->borrowed || frame->stride != 0) {
+        goto error;
+    }
+    if (frame->pixelformat != SIXEL_PIXELFORMAT_PAL8) {
+        goto error;
+    }
+
+    /* pixel (2, 1) is the high nibble of pixels[8 + 1] */
+    if (frame->pixels[0] != pixels[8 + 1] >> 4) {
+        goto error;
+    }
+    /* pixel (5, 2) is the low nibble of pixels[16 + 2] */
+    if (frame->pixels[1 * 4 + 3] != (pixels[16 + 2] & 0xf)) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_frame_unref(frame);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* alpha of every layout is composited over a color and a checkerboard */
+static int
+test9(void)
+{
+    sixel_frame_t *frame = NULL;
+    sixel_allocator_t *allocator = NULL;
+    int nret = EXIT_FAILURE;
+    static struct {
+        int pixelformat;
+        int offsets[4];
+    } const formats[] = {
+        { SIXEL_PIXELFORMAT_RGBA8888, { 0, 1, 2, 3 } },
+        { SIXEL_PIXELFORMAT_ARGB8888, { 1, 2, 3, 0 } },
+        { SIXEL_PIXELFORMAT_BGRA8888, { 2, 1, 0, 3 } },
+        { SIXEL_PIXELFORMAT_ABGR8888, { 3, 2, 1, 0 } },
+    };
+    unsigned char orig[37 * 3 * 4];
+    unsigned char *pixels;
+    unsigned char color1[] = { 0x10, 0x80, 0xf0 };
+    unsigned char color2[] = { 0xff, 0x20, 0x00 };
+    unsigned char const *bg;
+    unsigned char const *src;
+    SIXELSTATUS status;
+    size_t i;
+    int j;
+    int k;
+    int pass;
+
+    for (j = 0; j < (int)sizeof(orig); j++) {
+        orig[j] = (unsigned char)(j * 37 + j / 7);
+    }
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        for (pass = 0; pass < 3; pass++) {
+            status = sixel_frame_new(&frame, allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            pixels = (unsigned char *)sixel_allocator_malloc(allocator, sizeof(orig));
+            if (pixels == NULL) {
+                goto error;
+            }
+            memcpy(pixels, orig, sizeof(orig));
+            status = sixel_frame_init(frame, pixels, 37, 3,
+                                      formats[i].pixelformat, NULL, 0);
+            if (SIXEL_FAILED(status)) {
+                sixel_allocator_free(allocator, pixels);
+                goto error;
+            }
+            if (pass == 0) {
+                status = sixel_frame_strip_alpha(frame, color1);
+            } else if (pass == 1) {
+                status = sixel_frame_strip_alpha_with_checkerboard(frame, color1,
+                                                                   color2, 2);
+            } else {
+                /* the top-left cell covers the whole frame */
+                status = sixel_frame_strip_alpha_with_checkerboard(frame, color1,
+                                                                   color2,
+                                                                   SIXEL_WIDTH_LIMIT);
+            }
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            if (frame->pixelformat != SIXEL_PIXELFORMAT_RGB888) {
+                goto error;
+            }
+            for (j = 0; j < 37 * 3; j++) {
+                src = orig + j * 4;
+                if (pass != 1 || (j % 37 / 2 + j / 37 / 2) % 2 == 0) {
+                    bg = color1;
+                } else {
+                    bg = color2;
+                }
+                for (k = 0; k < 3; k++) {
+                    if (frame->pixels[j * 3 + k] !=
+                        (src[formats[i].offsets[k]] * src[formats[i].offsets[3]]
+                         + bg[k] * (0xff - src[formats[i].offsets[3]])) >> 8) {
+                        goto error;
+                    }
+                }
+            }
+            sixel_frame_unref(frame);
+            frame = NULL;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_frame_unref(frame);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* nearest neighbour scaling and clipping of sub-byte indexes keep the
+   palette and agree with the RGB888 path */
+static int
+test10(void)
+{
+    sixel_frame_t *frame = NULL;
+    sixel_frame_t *reference = NULL;
+    sixel_allocator_t *allocator = NULL;
+    int nret = EXIT_FAILURE;
+    unsigned char pixels[5 * 5];
+    unsigned char *palette;
+    unsigned char *copy;
+    SIXELSTATUS status;
+    int i;
+    int j;
+    int index;
+
+    /* 17x5 PAL2 pixels */
+    for (i = 0; i < 5 * 5; i++) {
+        pixels[i] = (unsigned char)(i * 0x53 + 0x1b);
+    }
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (j = 0; j < 2; j++) {
+        status = sixel_frame_new(&frame, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        status = sixel_frame_new(&reference, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        for (i = 0; i < 2; i++) {
+            palette = (unsigned char *)sixel_allocator_malloc(allocator, 4 * 3);
+            copy = (unsigned char *)sixel_allocator_malloc(allocator, sizeof(pixels));
+            if (palette == NULL || copy == NULL) {
+                sixel_allocator_free(allocator, palette);
+                sixel_allocator_free(allocator, copy);
+                goto error;
+            }
+            memcpy(palette, "\x10\x20\x30\x40\x50\x60\x70\x80\x90\xa0\xb0\xc0", 4 * 3);
+            memcpy(copy, pixels, sizeof(pixels));
+            status = sixel_frame_init(i == 0 ? frame: reference, copy, 17, 5,
+                                      SIXEL_PIXELFORMAT_PAL2, palette, 4);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+        }
+
+        status = sixel_frame_convert_to_rgb888(reference);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (j == 0) {
+            status = sixel_frame_resize(frame, 7, 9, SIXEL_RES_NEAREST);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_frame_resize(reference, 7, 9, SIXEL_RES_NEAREST);
+        } else {
+            status = sixel_frame_clip(frame, 3, 1, 9, 3);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_frame_clip(reference, 3, 1, 9, 3);
+        }
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+
+        if (frame->pixelformat != SIXEL_PIXELFORMAT_PAL8 || frame->ncolors != 4) {
+            goto error;
+        }
+        if (frame->width != reference->width || frame->height != reference->height) {
+            goto error;
+        }
+        for (i = 0; i < frame->width * frame->height * 3; i++) {
+            index = frame->pixels[i / 3];
+            if (index >= 4) {
+                goto error;
+            }
+            if (frame->palette[index * 3 + i % 3] != reference->pixels[i]) {
+                goto error;
+            }
+        }
+
+        sixel_frame_unref(frame);
+        frame = NULL;
+        sixel_frame_unref(reference);
+        reference = NULL;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_frame_unref(frame);
+    sixel_frame_unref(reference);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_frame_tests_main(void)
 {
@@ -1126,6 +1920,10 @@ sixel_frame_tests_main(void)
         test4,
         test5,
         test6,
+        test7,
+        test8,
+        test9,
+        test10,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
@@ -38,6 +38,10 @@ struct sixel_frame {
     int loop_count;                 /* loop count */
     int multiframe;                 /* whether the image has multiple frames */
     int transparent;                /* -1(no transparent) or >= 0(index of transparent color) */
+    int nthreads;                   /* threads for resizing, 0 for sequential processing */
+    int borrowed;                   /* pixels are owned by the caller */
+    int stride;                     /* bytes per row of borrowed pixels,
+                                       0 if rows are tightly packed */
     sixel_allocator_t *allocator;   /* allocator object */
 };
 
@@ -45,6 +49,26 @@ struct sixel_frame {
 extern "C" {
 #endif
 
+/* mark the pixel buffer as borrowed from the caller */
+void
+sixel_frame_set_borrowed(
+    sixel_frame_t  /* in */ *frame);
+
+/* take a private copy of the pixel buffer if it is borrowed */
+SIXELSTATUS
+sixel_frame_own_pixels(
+    sixel_frame_t  /* in */ *frame);
+
+/* compute the number of bytes per row of the pixel buffer */
+int
+sixel_frame_get_stride(
+    sixel_frame_t  /* in */ *frame);
+
+/* pack the rows of the pixel buffer if they are not contiguous */
+SIXELSTATUS
+sixel_frame_pack_pixels(
+    sixel_frame_t  /* in */ *frame);
+
 #if HAVE_TESTS
 int
 sixel_dither_tests_main(void);
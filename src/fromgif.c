@@ -65,6 +65,7 @@ typedef struct
 typedef struct
 {
    signed short prefix;
+   unsigned short length;   /* length of the string of the code */
    unsigned char first;
    unsigned char suffix;
 } gif_lzw;
@@ -81,6 +82,7 @@ typedef struct
    unsigned char pal[256][3];
    unsigned char lpal[256][3];
    gif_lzw codes[1 << gif_lzw_max_code_size];
+   unsigned char string[1 << gif_lzw_max_code_size];  /* work area to expand a code */
    unsigned char *color_table;
    int parse, step;
    int lflags;
@@ -272,40 +274,91 @@ end:
 }
 
 
+/* move to the next row, rows of interlaced images are visited in the
+   order of the passes */
+static void
+gif_next_row(
+    gif_t           /* in */ *g
+)
+{
+    g->cur_x = g->start_x;
+    g->cur_y += g->step;
+
+    while (g->cur_y >= g->max_y && g->parse > 0) {
+        g->step = 1 << g->parse;
+        g->cur_y = g->start_y + (g->step >> 1);
+        --g->parse;
+    }
+}
+
+
+/* write the string of a code into the image */
 static void
 gif_out_code(
     gif_t           /* in */ *g,
     unsigned short  /* in */ code
 )
 {
-    /* recurse to decode the prefixes, since the linked-list is backwards,
-       and working backwards through an interleaved image would be nasty */
-    if (g->codes[code].prefix >= 0) {
-        gif_out_code(g, (unsigned short)g->codes[code].prefix);
-    }
+    gif_lzw const *codes = g->codes;
+    unsigned char *dst;
+    unsigned char const *src;
+    int len;
+    int n;
+    int c;
 
     if (g->cur_y >= g->max_y) {
         return;
     }
 
-    g->out[g->cur_x + g->cur_y * g->max_x] = g->codes[code].suffix;
-    if (g->cur_x >= g->actual_width) {
-        g->actual_width = g->cur_x + 1;
-    }
-    if (g->cur_y >= g->actual_height) {
-        g->actual_height = g->cur_y + 1;
+    len = codes[code].length;
+    if (g->cur_x + len <= g->max_x) {
+        /* the string fits in the current row, it is expanded in place
+           from its tail by following the prefixes */
+        dst = g->out + g->cur_x + g->cur_y * g->max_x + len;
+        if (len == 1) {
+            dst[-1] = codes[code].suffix;
+        } else {
+            for (c = code; c >= 0; c = codes[c].prefix) {
+                *--dst = codes[c].suffix;
+            }
+        }
+        g->cur_x += len;
+        if (g->cur_x > g->actual_width) {
+            g->actual_width = g->cur_x;
+        }
+        if (g->cur_y >= g->actual_height) {
+            g->actual_height = g->cur_y + 1;
+        }
+        if (g->cur_x >= g->max_x) {
+            gif_next_row(g);
+        }
+        return;
     }
 
-    g->cur_x++;
-
-    if (g->cur_x >= g->max_x) {
-        g->cur_x = g->start_x;
-        g->cur_y += g->step;
-
-        while (g->cur_y >= g->max_y && g->parse > 0) {
-            g->step = 1 << g->parse;
-            g->cur_y = g->start_y + (g->step >> 1);
-            --g->parse;
+    /* the string is split into rows, it is expanded into the work area
+       and copied row by row */
+    dst = g->string + len;
+    for (c = code; c >= 0; c = codes[c].prefix) {
+        *--dst = codes[c].suffix;
+    }
+    src = g->string;
+    while (len > 0 && g->cur_y < g->max_y) {
+        n = g->max_x - g->cur_x;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(g->out + g->cur_x + g->cur_y * g->max_x, src, (size_t)n);
+        src += n;
+        len -= n;
+        g->cur_x += n;
+        if (g->cur_x > g->actual_width) {
+            g->actual_width = g->cur_x;
+        }
+        if (g->cur_y >= g->actual_height) {
+            g->actual_height = g->cur_y + 1;
+        }
+        if (g->cur_x >= g->max_x) {
+            gif_next_row(g);
         }
     }
 }
@@ -339,6 +392,7 @@ gif_process_raster(
     valid_bits = 0;
     for (code = 0; code < clear; code++) {
         g->codes[code].prefix = -1;
+        g->codes[code].length = 1;
         g->codes[code].first = (unsigned char) code;
         g->codes[code].suffix = (unsigned char) code;
     }
@@ -349,7 +403,7 @@ gif_process_raster(
 
     len = 0;
     for(;;) {
-        if (valid_bits < codesize) {
+        while (valid_bits < codesize) {
             if (len == 0) {
                 len = gif_get8(s); /* start new block */
                 if (len == 0) {
@@ -359,51 +413,47 @@ gif_process_raster(
             --len;
             bits |= (signed int) gif_get8(s) << valid_bits;
             valid_bits += 8;
-        } else {
-            code = bits & codemask;
-            bits >>= codesize;
-            valid_bits -= codesize;
-            /* @OPTIMIZE: is there some way we can accelerate the non-clear path? */
-            if (code == clear) {  /* clear code */
-                codesize = lzw_cs + 1;
-                codemask = (1 << codesize) - 1;
-                avail = clear + 2;
-                oldcode = -1;
-            } else if (code == clear + 1) { /* end of stream code */
+        }
+        code = bits & codemask;
+        bits >>= codesize;
+        valid_bits -= codesize;
+        if (code == clear) {  /* clear code */
+            codesize = lzw_cs + 1;
+            codemask = (1 << codesize) - 1;
+            avail = clear + 2;
+            oldcode = -1;
+        } else if (code == clear + 1) { /* end of stream code */
+            s->img_buffer += len;
+            while ((len = gif_get8(s)) > 0) {
                 s->img_buffer += len;
-                while ((len = gif_get8(s)) > 0) {
-                    s->img_buffer += len;
-                }
-                return SIXEL_OK;
-            } else if (code <= avail) {
-                if (oldcode >= 0) {
-                    if (avail < (1 << gif_lzw_max_code_size)) {
-                        p = &g->codes[avail++];
-                        p->prefix = (signed short) oldcode;
-                        p->first = g->codes[oldcode].first;
-                        p->suffix = (code == avail) ? p->first : g->codes[code].first;
-                    }
-                } else if (code == avail) {
-                    sixel_helper_set_additional_message(
-                        "corrupt GIF (reason: illegal code in raster).");
-                    status = SIXEL_RUNTIME_ERROR;
-                    goto end;
-                }
-
-                gif_out_code(g, (unsigned short) code);
+            }
+            return SIXEL_OK;
+        } else if (code < avail ||
+                   (code == avail && oldcode >= 0 &&
+                    avail < (1 << gif_lzw_max_code_size))) {
+            if (oldcode >= 0 && avail < (1 << gif_lzw_max_code_size)) {
+                /* if the code is the new one, the first character of
+                   the new string is taken from itself */
+                p = &g->codes[avail++];
+                p->prefix = (signed short) oldcode;
+                p->length = (unsigned short) (g->codes[oldcode].length + 1);
+                p->first = g->codes[oldcode].first;
+                p->suffix = g->codes[code].first;
+            }
 
-                if ((avail & codemask) == 0 && avail <= 0x0FFF) {
-                    codesize++;
-                    codemask = (1 << codesize) - 1;
-                }
+            gif_out_code(g, (unsigned short) code);
 
-                oldcode = code;
-            } else {
-                sixel_helper_set_additional_message(
-                    "corrupt GIF (reason: illegal code in raster).");
-                status = SIXEL_RUNTIME_ERROR;
-                goto end;
+            if ((avail & codemask) == 0 && avail <= 0x0FFF) {
+                codesize++;
+                codemask = (1 << codesize) - 1;
             }
+
+            oldcode = code;
+        } else {
+            sixel_helper_set_additional_message(
+                "corrupt GIF (reason: illegal code in raster).");
+            status = SIXEL_RUNTIME_ERROR;
+            goto end;
         }
     }
 
@@ -714,6 +764,68 @@ test1(void)
 }
 
 
+static SIXELSTATUS
+test2_callback(sixel_frame_t *frame, void *context)
+{
+    int *nret = (int *)context;
+    unsigned char *pixels;
+    int x;
+    int y;
+
+    if (frame->width != 4 || frame->height != 9 ||
+        frame->pixelformat != SIXEL_PIXELFORMAT_PAL8) {
+        return SIXEL_OK;
+    }
+    pixels = frame->pixels;
+    for (y = 0; y < frame->height; ++y) {
+        for (x = 0; x < frame->width; ++x) {
+            if (*pixels++ != (y < 4 ? 0: (x + y) % 4)) {
+                return SIXEL_OK;
+            }
+        }
+    }
+    *nret = EXIT_SUCCESS;
+
+    return SIXEL_OK;
+}
+
+
+/* rows of an interlaced image are put in place, strings of codes which
+   span rows are split into the rows */
+static int
+test2(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    fn_pointer fnp;
+    /* 4x9, interlaced, 4 colors */
+    static unsigned char gif[] =
+        "\x47\x49\x46\x38\x39\x61\x04\x00\x09\x00\x81\x00\x00\x00\x00\x00"
+        "\x25\x5b\x0d\x4a\xb6\x1a\x6f\x11\x27\x21\xff\x0b\x4e\x45\x54\x53"
+        "\x43\x41\x50\x45\x32\x2e\x30\x03\x01\x00\x00\x00\x21\xf9\x04\x00"
+        "\x05\x00\x00\x00\x2c\x00\x00\x00\x00\x04\x00\x09\x00\x40\x02\x0b"
+        "\x84\x1d\x32\x90\x7b\xca\x8e\x64\x70\xa5\x02\x00\x3b";
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    fnp.fn = test2_callback;
+    status = load_gif(gif, (int)sizeof(gif) - 1, NULL, 256, 1, 1,
+                      SIXEL_LOOP_DISABLE, fnp.p, &nret, allocator);
+    if (SIXEL_FAILED(status)) {
+        nret = EXIT_FAILURE;
+        goto error;
+    }
+
+error:
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_fromgif_tests_main(void)
 {
@@ -723,6 +835,7 @@ sixel_fromgif_tests_main(void)
 
     static testcase const testcases[] = {
         test1,
+        test2,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
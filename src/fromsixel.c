@@ -34,6 +34,8 @@
 
 #include <sixel.h>
 #include "output.h"
+#include "fromsixel.h"
+#include "thread.h"
 
 #define SIXEL_RGB(r, g, b) (((r) << 16) + ((g) << 8) +  (b))
 
@@ -64,13 +66,43 @@ static int const sixel_default_color_table[] = {
 
 
 typedef struct image_buffer {
-    unsigned char *data;
-    int width;
-    int height;
+    unsigned char *data;    /* contiguous pixels, or NULL while the bands
+                               are stored separately */
+    int width;              /* width of data */
+    int height;             /* height of data */
     int palette[SIXEL_PALETTE_MAX];
     int ncolors;
+    unsigned char **bands;  /* separately allocated bands of six rows */
+    int *band_widths;       /* allocated width of each band */
+    int nbands;             /* number of entries of bands */
+    int bands_capacity;     /* allocated entries of bands */
+    unsigned char *band;    /* band being drawn, NULL until a pixel is drawn */
+    int band_y;             /* top row of the band being drawn */
+    int band_width;         /* allocated width of the band being drawn */
+    sixel_band_function fn_band;  /* callback for completed bands, or NULL
+                                     to keep the whole image */
+    void *band_priv;        /* private data for fn_band */
+    int emitted_y;          /* number of rows passed to fn_band */
+    unsigned long long *columns;  /* the band being drawn in column-major
+                                     order, a column of six pixels is
+                                     stored in the first six bytes */
+    int columns_capacity;   /* allocated entries of columns */
+    int columns_extent;     /* drawn columns of the band */
+    int columns_bits;       /* sixel bits drawn in the band */
+    int scratch_y;          /* top row of columns, -1 until a pixel is drawn */
+    unsigned long long masks[64];  /* bytes of a column for sixel bits */
+    int coverage_tracked;   /* 1 if drawn pixels are told from the background */
+    unsigned char *drawn;   /* sixel bits drawn in each column of the band
+                               being drawn, NULL unless coverage_tracked */
+    unsigned char *coverage;  /* sixel bits drawn in each column of the band
+                                 flushed last */
+    int coverage_y;         /* top row of coverage, -1 if nothing is flushed */
+    int coverage_extent;    /* entries of coverage */
 } image_buffer_t;
 
+/* a byte repeated in all bytes of a column */
+#define SIXEL_COLUMN_BYTES(c) ((unsigned long long)(unsigned char)(c) * 0x0101010101010101ULL)
+
 typedef enum parse_state {
     PS_GROUND     = 0,
     PS_ESC        = 1,  /* ESC */
@@ -97,6 +129,9 @@ typedef struct parser_context {
     int param;
     int nparams;
     int params[DECSIXEL_PARAMS_MAX];
+    int terminated;         /* string terminator has been reached */
+    int bgselect;           /* P2 of DECSIXEL, 1 if the background is
+                               left transparent */
 } parser_context_t;
 
 
@@ -168,8 +203,10 @@ hls_to_rgb(int hue, int lum, int sat)
 }
 
 
+/* allocate contiguous pixels of given size, the height is rounded up to
+   a multiple of six so that every band is contained in it */
 static SIXELSTATUS
-image_buffer_init(
+image_buffer_allocate(
     image_buffer_t     *image,
     int                 width,
     int                 height,
@@ -178,51 +215,107 @@ image_buffer_init(
 {
     SIXELSTATUS status = SIXEL_FALSE;
     size_t size;
-    int i;
-    int n;
-    int r;
-    int g;
-    int b;
 
     /* check parameters */
     if (width <= 0) {
         sixel_helper_set_additional_message(
-            "image_buffer_init: an invalid width parameter detected.");
+            "image_buffer_allocate: an invalid width parameter detected.");
         status = SIXEL_BAD_INPUT;
         goto end;
     }
     if (height <= 0) {
         sixel_helper_set_additional_message(
-            "image_buffer_init: an invalid width parameter detected.");
+            "image_buffer_allocate: an invalid height parameter detected.");
         status = SIXEL_BAD_INPUT;
         goto end;
     }
     if (width > SIXEL_WIDTH_LIMIT) {
         sixel_helper_set_additional_message(
-            "image_buffer_init: given width parameter is too huge.");
+            "image_buffer_allocate: given width parameter is too huge.");
         status = SIXEL_BAD_INPUT;
         goto end;
     }
     if (height > SIXEL_HEIGHT_LIMIT) {
         sixel_helper_set_additional_message(
-            "image_buffer_init: given height parameter is too huge.");
+            "image_buffer_allocate: given height parameter is too huge.");
         status = SIXEL_BAD_INPUT;
         goto end;
     }
 
-    size = (size_t)(width) * (size_t)height * sizeof(unsigned char);
-    image->width = width;
-    image->height = height;
+    height = (height + 5) / 6 * 6;
+    size = (size_t)width * (size_t)height;
     image->data = (unsigned char *)sixel_allocator_malloc(allocator, size);
-    image->ncolors = 2;
-
     if (image->data == NULL) {
         sixel_helper_set_additional_message(
-            "sixel_deocde_raw: sixel_allocator_malloc() failed.");
+            "image_buffer_allocate: sixel_allocator_malloc() failed.");
         status = SIXEL_BAD_ALLOCATION;
         goto end;
     }
     memset(image->data, bgindex, size);
+    image->width = width;
+    image->height = height;
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* initialize the palette of the image, pixels are allocated in advance
+   if the size is given as a hint, otherwise the bands are allocated
+   separately while drawing */
+static SIXELSTATUS
+image_buffer_init(
+    image_buffer_t     *image,
+    int                 width,      /* width hint, or 0 */
+    int                 height,     /* height hint, or 0 */
+    int                 bgindex,
+    sixel_allocator_t  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int i;
+    int n;
+    int r;
+    int g;
+    int b;
+    unsigned char mask[sizeof(unsigned long long)];
+
+    image->data = NULL;
+    image->width = 0;
+    image->height = 0;
+    image->ncolors = 2;
+    image->bands = NULL;
+    image->band_widths = NULL;
+    image->nbands = 0;
+    image->bands_capacity = 0;
+    image->band = NULL;
+    image->band_y = 0;
+    image->band_width = 0;
+    image->fn_band = NULL;
+    image->band_priv = NULL;
+    image->emitted_y = 0;
+    image->columns = NULL;
+    image->columns_capacity = 0;
+    image->columns_extent = 0;
+    image->columns_bits = 0;
+    image->scratch_y = (-1);
+    image->coverage_tracked = 0;
+    image->drawn = NULL;
+    image->coverage = NULL;
+    image->coverage_y = (-1);
+    image->coverage_extent = 0;
+
+    /* pixels of a sixel character are masked at once */
+    for (n = 0; n < 64; n++) {
+        memset(mask, 0, sizeof(mask));
+        for (i = 0; i < 6; i++) {
+            if (n & 1 << i) {
+                mask[i] = 0xff;
+            }
+        }
+        memcpy(&image->masks[n], mask, sizeof(mask));
+    }
 
     /* palette initialization */
     for (n = 0; n < 16; n++) {
@@ -247,6 +340,146 @@ image_buffer_init(
         image->palette[n] = SIXEL_RGB(255, 255, 255);
     }
 
+    if (width > 0 && height > 0) {
+        status = image_buffer_allocate(image, width, height, bgindex, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* release the bands and the columns of the image, the contiguous pixels
+   are kept */
+static void
+image_buffer_free_scratch(
+    image_buffer_t     *image,
+    sixel_allocator_t  *allocator)
+{
+    int n;
+
+    for (n = 0; n < image->nbands; ++n) {
+        sixel_allocator_free(allocator, image->bands[n]);
+    }
+    sixel_allocator_free(allocator, image->bands);
+    sixel_allocator_free(allocator, image->band_widths);
+    sixel_allocator_free(allocator, image->columns);
+    sixel_allocator_free(allocator, image->drawn);
+    sixel_allocator_free(allocator, image->coverage);
+    image->bands = NULL;
+    image->band_widths = NULL;
+    image->nbands = 0;
+    image->bands_capacity = 0;
+    image->band = NULL;
+    image->columns = NULL;
+    image->columns_capacity = 0;
+    image->columns_extent = 0;
+    image->drawn = NULL;
+    image->coverage = NULL;
+    image->coverage_y = (-1);
+    image->coverage_extent = 0;
+}
+
+
+/* release pixels of the image */
+static void
+image_buffer_free(
+    image_buffer_t     *image,
+    sixel_allocator_t  *allocator)
+{
+    image_buffer_free_scratch(image, allocator);
+    sixel_allocator_free(allocator, image->data);
+    image->data = NULL;
+}
+
+
+/* extend the table of bands to have band k */
+static SIXELSTATUS
+image_buffer_reserve_bands(
+    image_buffer_t     *image,
+    int                 k,
+    sixel_allocator_t  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char **bands;
+    int *band_widths;
+    int capacity;
+
+    if (k >= image->bands_capacity) {
+        capacity = image->bands_capacity > 0 ? image->bands_capacity * 2 : 16;
+        if (capacity <= k) {
+            capacity = k + 1;
+        }
+        bands = (unsigned char **)sixel_allocator_realloc(
+            allocator, image->bands, sizeof(unsigned char *) * (size_t)capacity);
+        if (bands == NULL) {
+            sixel_helper_set_additional_message(
+                "image_buffer_reserve_bands: sixel_allocator_realloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        image->bands = bands;
+        band_widths = (int *)sixel_allocator_realloc(
+            allocator, image->band_widths, sizeof(int) * (size_t)capacity);
+        if (band_widths == NULL) {
+            sixel_helper_set_additional_message(
+                "image_buffer_reserve_bands: sixel_allocator_realloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        image->band_widths = band_widths;
+        image->bands_capacity = capacity;
+    }
+
+    for (; image->nbands <= k; image->nbands++) {
+        image->bands[image->nbands] = NULL;
+        image->band_widths[image->nbands] = 0;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* move contiguous pixels into separately allocated bands, it is needed
+   only if the image overflows the size given in advance */
+static SIXELSTATUS
+image_buffer_split(
+    image_buffer_t     *image,
+    sixel_allocator_t  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    size_t size;
+    int k;
+
+    status = image_buffer_reserve_bands(image, image->height / 6 - 1, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    size = (size_t)image->width * 6;
+    for (k = 0; k < image->height / 6; ++k) {
+        image->bands[k] = (unsigned char *)sixel_allocator_malloc(allocator, size);
+        if (image->bands[k] == NULL) {
+            sixel_helper_set_additional_message(
+                "image_buffer_split: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        memcpy(image->bands[k], image->data + size * (size_t)k, size);
+        image->band_widths[k] = image->width;
+    }
+
+    sixel_allocator_free(allocator, image->data);
+    image->data = NULL;
+
     status = SIXEL_OK;
 
 end:
@@ -254,98 +487,202 @@ end:
 }
 
 
+/* make the band which starts at row y writable up to the given width,
+   bands grow separately, so the rows drawn so far are never copied when
+   the image is extended downward */
 static SIXELSTATUS
-image_buffer_resize(
+image_buffer_prepare_band(
     image_buffer_t     *image,
+    int                 y,
     int                 width,
-    int                 height,
     int                 bgindex,
     sixel_allocator_t  *allocator)
 {
     SIXELSTATUS status = SIXEL_FALSE;
-    size_t size;
     unsigned char *alt_buffer;
+    int k;
     int n;
-    int min_height;
+    int alt_width;
 
     /* check parameters */
-    if (width <= 0) {
+    if (width > SIXEL_WIDTH_LIMIT) {
         sixel_helper_set_additional_message(
-            "image_buffer_init: an invalid width parameter detected.");
+            "image_buffer_prepare_band: given width parameter is too huge.");
         status = SIXEL_BAD_INPUT;
         goto end;
     }
-    if (height <= 0) {
+    if (y >= SIXEL_HEIGHT_LIMIT) {
         sixel_helper_set_additional_message(
-            "image_buffer_init: an invalid width parameter detected.");
+            "image_buffer_prepare_band: given height parameter is too huge.");
         status = SIXEL_BAD_INPUT;
         goto end;
     }
-    if (height > SIXEL_HEIGHT_LIMIT) {
+
+    if (image->data) {
+        if (width <= image->width && y + 6 <= image->height) {
+            image->band = image->data + (size_t)image->width * (size_t)y;
+            image->band_y = y;
+            image->band_width = image->width;
+            status = SIXEL_OK;
+            goto end;
+        }
+        status = image_buffer_split(image, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    k = y / 6;
+    status = image_buffer_reserve_bands(image, k, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    if (image->band_widths[k] < width) {
+        /* a band is as wide as the previous one at least, so the width is
+           settled after the first band in most cases */
+        alt_width = image->band_widths[k] * 2;
+        if (k > 0 && alt_width < image->band_widths[k - 1]) {
+            alt_width = image->band_widths[k - 1];
+        }
+        if (alt_width < width) {
+            alt_width = width;
+        }
+        if (alt_width > SIXEL_WIDTH_LIMIT) {
+            alt_width = SIXEL_WIDTH_LIMIT;
+        }
+        alt_buffer = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                             (size_t)alt_width * 6);
+        if (alt_buffer == NULL) {
+            sixel_helper_set_additional_message(
+                "image_buffer_prepare_band: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        for (n = 0; n < 6; ++n) {
+            if (image->bands[k]) {
+                memcpy(alt_buffer + (size_t)alt_width * (size_t)n,
+                       image->bands[k] + (size_t)image->band_widths[k] * (size_t)n,
+                       (size_t)image->band_widths[k]);
+            }
+            /* fill extended area with background color */
+            memset(alt_buffer + (size_t)alt_width * (size_t)n + (size_t)image->band_widths[k],
+                   bgindex,
+                   (size_t)(alt_width - image->band_widths[k]));
+        }
+        sixel_allocator_free(allocator, image->bands[k]);
+        image->bands[k] = alt_buffer;
+        image->band_widths[k] = alt_width;
+    }
+
+    image->band = image->bands[k];
+    image->band_y = y;
+    image->band_width = image->band_widths[k];
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* gather the pixels into a contiguous buffer of the final size, pixels
+   allocated in advance are reused as they are if they are large enough */
+static SIXELSTATUS
+image_buffer_finalize(
+    image_buffer_t     *image,
+    int                 width,
+    int                 height,
+    int                 bgindex,
+    sixel_allocator_t  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *alt_buffer;
+    unsigned char *src;
+    int y;
+    int k;
+    int n;
+
+    /* check parameters */
+    if (width <= 0) {
         sixel_helper_set_additional_message(
-            "image_buffer_init: given height parameter is too huge.");
+            "image_buffer_finalize: an invalid width parameter detected.");
         status = SIXEL_BAD_INPUT;
         goto end;
     }
-    if (width > SIXEL_WIDTH_LIMIT) {
+    if (height <= 0) {
         sixel_helper_set_additional_message(
-            "image_buffer_init: given width parameter is too huge.");
+            "image_buffer_finalize: an invalid height parameter detected.");
         status = SIXEL_BAD_INPUT;
         goto end;
     }
-    if (height > SIXEL_HEIGHT_LIMIT) {
+    if (width > SIXEL_WIDTH_LIMIT) {
         sixel_helper_set_additional_message(
-            "image_buffer_init: given height parameter is too huge.");
+            "image_buffer_finalize: given width parameter is too huge.");
         status = SIXEL_BAD_INPUT;
         goto end;
     }
-
-    size = (size_t)width * (size_t)height;
-    alt_buffer = (unsigned char *)sixel_allocator_malloc(allocator, size);
-    if (alt_buffer == NULL || size == 0) {
-        /* free source image */
-        sixel_allocator_free(allocator, image->data);
-        image->data = NULL;
+    if (height > SIXEL_HEIGHT_LIMIT) {
         sixel_helper_set_additional_message(
-            "image_buffer_resize: sixel_allocator_malloc() failed.");
-        status = SIXEL_BAD_ALLOCATION;
+            "image_buffer_finalize: given height parameter is too huge.");
+        status = SIXEL_BAD_INPUT;
         goto end;
     }
 
-    min_height = height > image->height ? image->height: height;
-    if (width > image->width) {  /* if width is extended */
-        for (n = 0; n < min_height; ++n) {
-            /* copy from source image */
-            memcpy(alt_buffer + (size_t)width * (size_t)n,
-                   image->data + (size_t)image->width * (size_t)n,
-                   (size_t)image->width);
-            /* fill extended area with background color */
-            memset(alt_buffer + (size_t)width * (size_t)n + (size_t)image->width,
-                   bgindex,
-                   (size_t)(width - image->width));
+    if (image->data && width <= image->width && height <= image->height) {
+        if (width < image->width) {
+            for (y = 1; y < height; ++y) {
+                memmove(image->data + (size_t)width * (size_t)y,
+                        image->data + (size_t)image->width * (size_t)y,
+                        (size_t)width);
+            }
         }
+        /* the pixels are handed to the caller as they are */
+        image_buffer_free_scratch(image, allocator);
     } else {
-        for (n = 0; n < min_height; ++n) {
-            /* copy from source image */
-            memcpy(alt_buffer + (size_t)width * (size_t)n,
-                   image->data + (size_t)image->width * (size_t)n,
-                   (size_t)width);
+        /* the rows are rounded up to bands, so that the pixels can be
+           reused for the next image */
+        alt_buffer = (unsigned char *)sixel_allocator_malloc(
+            allocator, (size_t)width * (size_t)((height + 5) / 6 * 6));
+        if (alt_buffer == NULL) {
+            sixel_helper_set_additional_message(
+                "image_buffer_finalize: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
         }
+        for (y = 0; y < height; ++y) {
+            src = NULL;
+            n = 0;
+            if (image->data) {
+                if (y < image->height) {
+                    src = image->data + (size_t)image->width * (size_t)y;
+                    n = image->width;
+                }
+            } else {
+                k = y / 6;
+                if (k < image->nbands && image->bands[k]) {
+                    src = image->bands[k] + (size_t)image->band_widths[k] * (size_t)(y % 6);
+                    n = image->band_widths[k];
+                }
+            }
+            if (n > width) {
+                n = width;
+            }
+            if (src) {
+                memcpy(alt_buffer + (size_t)width * (size_t)y, src, (size_t)n);
+            }
+            /* fill the rest with background color */
+            memset(alt_buffer + (size_t)width * (size_t)y + (size_t)n,
+                   bgindex,
+                   (size_t)(width - n));
+        }
+        image_buffer_free(image, allocator);
+        image->data = alt_buffer;
     }
 
-    if (height > image->height) {  /* if height is extended */
-        /* fill extended area with background color */
-        memset(alt_buffer + (size_t)width * (size_t)image->height,
-               bgindex,
-               (size_t)width * (size_t)(height - image->height));
-    }
-
-    /* free source image */
-    sixel_allocator_free(allocator, image->data);
-
-    image->data = alt_buffer;
     image->width = width;
     image->height = height;
+    image->band = NULL;
 
     status = SIXEL_OK;
 
@@ -354,46 +691,102 @@ end:
 }
 
 
-static SIXELSTATUS
-parser_context_init(parser_context_t *context)
+/* clear the pixels to draw the next image into them, the pixels are
+   reused if the next image fits in them, and the palette is kept as
+   color registers of terminals are */
+static void
+image_buffer_reset(
+    image_buffer_t     *image,
+    int                 bgindex)
 {
-    SIXELSTATUS status = SIXEL_FALSE;
+    if (image->data) {
+        image->height = (image->height + 5) / 6 * 6;
+        memset(image->data, bgindex, (size_t)image->width * (size_t)image->height);
+    }
+    image->ncolors = 2;
+    image->band = NULL;
+    image->emitted_y = 0;
+    image->columns_extent = 0;
+    image->columns_bits = 0;
+    image->scratch_y = (-1);
+    image->coverage_y = (-1);
+}
 
-    context->state = PS_GROUND;
-    context->pos_x = 0;
-    context->pos_y = 0;
-    context->max_x = 0;
-    context->max_y = 0;
-    context->attributed_pan = 2;
-    context->attributed_pad = 1;
-    context->attributed_ph = 0;
-    context->attributed_pv = 0;
-    context->repeat_count = 1;
-    context->color_index = 15;
-    context->bgindex = (-1);
-    context->nparams = 0;
-    context->param = 0;
 
-    status = SIXEL_OK;
+/* convert the palette into RGB bytes */
+static void
+image_buffer_export_palette(
+    image_buffer_t     *image,
+    unsigned char      *palette,
+    int                 ncolors)
+{
+    int n;
 
-    return status;
+    for (n = 0; n < ncolors; ++n) {
+        palette[n * 3 + 0] = image->palette[n] >> 16 & 0xff;
+        palette[n * 3 + 1] = image->palette[n] >> 8 & 0xff;
+        palette[n * 3 + 2] = image->palette[n] & 0xff;
+    }
 }
 
 
+/* pass the rows above y_end to fn_band band by band, the buffer of a band
+   is handed over to the next band after that, so only a band is kept
+   while streaming */
 static SIXELSTATUS
-safe_addition_for_params(parser_context_t *context, unsigned char *p)
+image_buffer_emit_bands(
+    image_buffer_t     *image,
+    int                 y_end,
+    int                 width,
+    int                 bgindex,
+    sixel_allocator_t  *allocator)
 {
     SIXELSTATUS status = SIXEL_FALSE;
-    int x;
+    unsigned char palette[SIXEL_PALETTE_MAX * 3];
+    unsigned char *recycled;
+    int recycled_width;
+    int nrows;
+    int y;
+    int k;
 
-    x = *p - '0'; /* 0 <= x <= 9 */
-    if ((context->param > INT_MAX / 10) || (x > INT_MAX - context->param * 10)) {
-        status = SIXEL_BAD_INTEGER_OVERFLOW;
-        sixel_helper_set_additional_message(
-            "safe_addition_for_params: ingeger overflow detected.");
-        goto end;
+    image_buffer_export_palette(image, palette, SIXEL_PALETTE_MAX);
+
+    while (image->emitted_y < y_end) {
+        y = image->emitted_y;
+        nrows = y_end - y < 6 ? y_end - y : 6;
+        status = image_buffer_prepare_band(image, y, width, bgindex, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        status = image->fn_band(image->band, width, image->band_width,
+                                y, nrows, palette, image->band_priv);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        image->emitted_y += nrows;
+        image->band = NULL;
+
+        if (image->data == NULL) {
+            k = y / 6;
+            recycled = image->bands[k];
+            recycled_width = image->band_widths[k];
+            image->bands[k] = NULL;
+            image->band_widths[k] = 0;
+            status = image_buffer_reserve_bands(image, k + 1, allocator);
+            if (SIXEL_FAILED(status)) {
+                sixel_allocator_free(allocator, recycled);
+                goto end;
+            }
+            if (image->bands[k + 1] == NULL) {
+                memset(recycled, bgindex, (size_t)recycled_width * 6);
+                image->bands[k + 1] = recycled;
+                image->band_widths[k + 1] = recycled_width;
+            } else {
+                sixel_allocator_free(allocator, recycled);
+            }
+        }
     }
-    context->param = context->param * 10 + x;
+
     status = SIXEL_OK;
 
 end:
@@ -401,26 +794,263 @@ end:
 }
 
 
-/* convert sixel data into indexed pixel bytes and palette data */
-SIXELAPI SIXELSTATUS
-sixel_decode_raw_impl(
-    unsigned char     *p,         /* sixel bytes */
-    int                len,       /* size of sixel bytes */
-    image_buffer_t    *image,
-    parser_context_t  *context,
-    sixel_allocator_t *allocator) /* allocator object */
+/* extend the columns of the band being drawn to the given width */
+static SIXELSTATUS
+image_buffer_reserve_columns(
+    image_buffer_t     *image,
+    int                 width,
+    int                 bgindex,
+    sixel_allocator_t  *allocator)
 {
     SIXELSTATUS status = SIXEL_FALSE;
-    int n;
-    int i;
-    int y;
-    int bits;
-    int sixel_vertical_mask;
-    int sx;
-    int sy;
-    int c;
-    size_t pos;
-    unsigned char *p0 = p;
+    unsigned long long *columns;
+    unsigned char *drawn;
+    int capacity;
+    int x;
+
+    if (width > SIXEL_WIDTH_LIMIT) {
+        sixel_helper_set_additional_message(
+            "image_buffer_reserve_columns: given width parameter is too huge.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    capacity = image->columns_capacity > 0 ? image->columns_capacity * 2 : 256;
+    if (capacity < width) {
+        capacity = width;
+    }
+    if (capacity > SIXEL_WIDTH_LIMIT) {
+        capacity = SIXEL_WIDTH_LIMIT;
+    }
+    columns = (unsigned long long *)sixel_allocator_realloc(
+        allocator, image->columns, sizeof(unsigned long long) * (size_t)capacity);
+    if (columns == NULL) {
+        sixel_helper_set_additional_message(
+            "image_buffer_reserve_columns: sixel_allocator_realloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    for (x = image->columns_capacity; x < capacity; x++) {
+        columns[x] = SIXEL_COLUMN_BYTES(bgindex);
+    }
+    image->columns = columns;
+
+    if (image->coverage_tracked) {
+        drawn = (unsigned char *)sixel_allocator_realloc(
+            allocator, image->drawn, (size_t)capacity);
+        if (drawn == NULL) {
+            sixel_helper_set_additional_message(
+                "image_buffer_reserve_columns: sixel_allocator_realloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        memset(drawn + image->columns_capacity, 0,
+               (size_t)(capacity - image->columns_capacity));
+        image->drawn = drawn;
+        drawn = (unsigned char *)sixel_allocator_realloc(
+            allocator, image->coverage, (size_t)capacity);
+        if (drawn == NULL) {
+            sixel_helper_set_additional_message(
+                "image_buffer_reserve_columns: sixel_allocator_realloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        image->coverage = drawn;
+    }
+    image->columns_capacity = capacity;
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+static SIXELSTATUS
+parser_context_init(parser_context_t *context)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    context->state = PS_GROUND;
+    context->pos_x = 0;
+    context->pos_y = 0;
+    context->max_x = 0;
+    context->max_y = 0;
+    context->attributed_pan = 2;
+    context->attributed_pad = 1;
+    context->attributed_ph = 0;
+    context->attributed_pv = 0;
+    context->repeat_count = 1;
+    context->color_index = 15;
+    context->bgindex = (-1);
+    context->nparams = 0;
+    context->param = 0;
+    context->terminated = 0;
+    context->bgselect = 0;
+
+    status = SIXEL_OK;
+
+    return status;
+}
+
+
+static SIXELSTATUS
+safe_addition_for_params(parser_context_t *context, unsigned char const *p)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int x;
+
+    x = *p - '0'; /* 0 <= x <= 9 */
+    if ((context->param > INT_MAX / 10) || (x > INT_MAX - context->param * 10)) {
+        status = SIXEL_BAD_INTEGER_OVERFLOW;
+        sixel_helper_set_additional_message(
+            "safe_addition_for_params: ingeger overflow detected.");
+        goto end;
+    }
+    context->param = context->param * 10 + x;
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* select the color of DECGCI with the parameters given so far, the
+   color register is also defined if the color coordinates are given */
+static void
+sixel_decode_select_color(
+    parser_context_t    *context,
+    int                 *palette)
+{
+    if (context->nparams > 0) {
+        context->color_index = context->params[0];
+        if (context->color_index < 0) {
+            context->color_index = 0;
+        } else if (context->color_index >= SIXEL_PALETTE_MAX) {
+            context->color_index = SIXEL_PALETTE_MAX - 1;
+        }
+    }
+
+    if (context->nparams > 4) {
+        if (context->params[1] == 1) {
+            /* HLS */
+            if (context->params[2] > 360) {
+                context->params[2] = 360;
+            }
+            if (context->params[3] > 100) {
+                context->params[3] = 100;
+            }
+            if (context->params[4] > 100) {
+                context->params[4] = 100;
+            }
+            palette[context->color_index]
+                = hls_to_rgb(context->params[2], context->params[3], context->params[4]);
+        } else if (context->params[1] == 2) {
+            /* RGB */
+            if (context->params[2] > 100) {
+                context->params[2] = 100;
+            }
+            if (context->params[3] > 100) {
+                context->params[3] = 100;
+            }
+            if (context->params[4] > 100) {
+                context->params[4] = 100;
+            }
+            palette[context->color_index]
+                = SIXEL_XRGB(context->params[2], context->params[3], context->params[4]);
+        }
+    }
+}
+
+
+/* write the columns of the band being drawn into the image row by row */
+static SIXELSTATUS
+sixel_decode_flush_band(
+    image_buffer_t      *image,
+    parser_context_t    *context,
+    sixel_allocator_t   *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char const *column;
+    unsigned char *row;
+    unsigned char *drawn;
+    int extent = image->columns_extent;
+    int x;
+    int i;
+
+    if (image->scratch_y < 0 || extent == 0) {
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    status = image_buffer_prepare_band(image, image->scratch_y, extent,
+                                       context->bgindex, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    for (i = 0; i < 6; i++) {
+        row = image->band + (size_t)image->band_width * (size_t)i;
+        column = (unsigned char const *)image->columns + i;
+        for (x = 0; x < extent; x++) {
+            row[x] = column[x * sizeof(unsigned long long)];
+        }
+        if (image->columns_bits & 1 << i &&
+            context->max_y < image->scratch_y + i) {
+            context->max_y = image->scratch_y + i;
+        }
+    }
+    if (context->max_x < extent - 1) {
+        context->max_x = extent - 1;
+    }
+
+    for (x = 0; x < extent; x++) {
+        image->columns[x] = SIXEL_COLUMN_BYTES(context->bgindex);
+    }
+    image->columns_extent = 0;
+    image->columns_bits = 0;
+
+    /* the drawn bits are kept until the band is passed to fn_band */
+    if (image->drawn) {
+        drawn = image->coverage;
+        image->coverage = image->drawn;
+        image->drawn = drawn;
+        memset(image->drawn, 0, (size_t)image->columns_capacity);
+        image->coverage_y = image->scratch_y;
+        image->coverage_extent = extent;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* parse sixel data and draw it into the image, the parser state is kept
+   in the context, so the data can be given in several pieces. it stops
+   after the string terminator. */
+static SIXELSTATUS
+sixel_decode_scan(
+    unsigned char const *p,         /* sixel bytes */
+    int                  len,       /* size of sixel bytes */
+    image_buffer_t      *image,
+    parser_context_t    *context,
+    sixel_allocator_t   *allocator, /* allocator object */
+    int                 *pconsumed) /* bytes parsed, or NULL */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int n;
+    int i;
+    int bits;
+    int last;
+    int sx;
+    int sy;
+    unsigned long long color;
+    unsigned long long mask;
+    unsigned long long *columns;
+    unsigned char *drawn;
+    unsigned char const *p0 = p;
 
     while (p < p0 + len) {
         switch (context->state) {
@@ -436,7 +1066,7 @@ sixel_decode_raw_impl(
                 break;
             case 0x9c:
                 p++;
-                goto finalize;
+                goto terminate;
             default:
                 p++;
                 break;
@@ -448,7 +1078,7 @@ sixel_decode_raw_impl(
             case '\\':
             case 0x9c:
                 p++;
-                goto finalize;
+                goto terminate;
             case 'P':
                 context->param = -1;
                 context->state = PS_DCS;
@@ -530,6 +1160,11 @@ sixel_decode_raw_impl(
                     }
                 }
 
+                if (context->nparams > 1) {
+                    /* Pn2 */
+                    context->bgselect = context->params[1];
+                }
+
                 if (context->nparams > 2) {
                     /* Pn3 */
                     if (context->params[2] == 0) {
@@ -592,83 +1227,109 @@ sixel_decode_raw_impl(
             default:
                 if (*p >= '?' && *p <= '~') {  /* sixel characters */
 
-                    sx = image->width;
-                    while (sx < context->pos_x + context->repeat_count) {
-                        sx *= 2;
+                    if (context->color_index > image->ncolors) {
+                        image->ncolors = context->color_index;
                     }
 
-                    sy = image->height;
-                    while (sy < context->pos_y + 6) {
-                        sy *= 2;
+                    if (context->pos_x < 0 || context->pos_y < 0) {
+                        status = SIXEL_BAD_INPUT;
+                        goto end;
                     }
 
-                    if (sx > image->width || sy > image->height) {
-                        status = image_buffer_resize(image, sx, sy, context->bgindex, allocator);
+                    if (image->scratch_y != context->pos_y) {
+                        /* bands above are never drawn again */
+                        status = sixel_decode_flush_band(image, context, allocator);
                         if (SIXEL_FAILED(status)) {
                             goto end;
                         }
+                        if (image->fn_band && image->emitted_y < context->pos_y) {
+                            status = image_buffer_emit_bands(
+                                image,
+                                context->pos_y,
+                                context->max_x + 1 < context->attributed_ph ?
+                                    context->attributed_ph : context->max_x + 1,
+                                context->bgindex,
+                                allocator);
+                            if (SIXEL_FAILED(status)) {
+                                goto end;
+                            }
+                        }
+                        image->scratch_y = context->pos_y;
                     }
 
-                    if (context->color_index > image->ncolors) {
-                        image->ncolors = context->color_index;
-                    }
-
-                    if (context->pos_x < 0 || context->pos_y < 0) {
-                        status = SIXEL_BAD_INPUT;
-                        goto end;
-                    }
-                    bits = *p - '?';
+                    color = SIXEL_COLUMN_BYTES(context->color_index);
 
-                    if (bits == 0) {
-                        context->pos_x += context->repeat_count;
-                    } else {
-                        sixel_vertical_mask = 0x01;
-                        if (context->repeat_count <= 1) {
-                            for (i = 0; i < 6; i++) {
-                                if ((bits & sixel_vertical_mask) != 0) {
-                                    pos = (size_t)image->width * (size_t)(context->pos_y + i) + (size_t)context->pos_x;
-                                    image->data[pos] = context->color_index;
-                                    if (context->max_x < context->pos_x) {
-                                        context->max_x = context->pos_x;
-                                    }
-                                    if (context->max_y < (context->pos_y + i)) {
-                                        context->max_y = context->pos_y + i;
-                                    }
+                    if (context->repeat_count > 1) {
+                        if (context->pos_x > SIXEL_WIDTH_LIMIT - context->repeat_count) {
+                            sixel_helper_set_additional_message(
+                                "sixel_decode_scan: the repeat exceeds the width limit.");
+                            status = SIXEL_BAD_INPUT;
+                            goto end;
+                        }
+                        bits = *p - '?';
+                        if (bits != 0) {
+                            n = context->pos_x + context->repeat_count;
+                            if (image->columns_capacity < n) {
+                                status = image_buffer_reserve_columns(
+                                    image, n, context->bgindex, allocator);
+                                if (SIXEL_FAILED(status)) {
+                                    goto end;
                                 }
-                                sixel_vertical_mask <<= 1;
                             }
-                            context->pos_x += 1;
-                        } else {
-                            /* context->repeat_count > 1 */
-                            for (i = 0; i < 6; i++) {
-                                if ((bits & sixel_vertical_mask) != 0) {
-                                    c = sixel_vertical_mask << 1;
-                                    for (n = 1; (i + n) < 6; n++) {
-                                        if ((bits & c) == 0) {
-                                            break;
-                                        }
-                                        c <<= 1;
-                                    }
-                                    for (y = context->pos_y + i; y < context->pos_y + i + n; ++y) {
-                                        memset(image->data + (size_t)image->width * (size_t)y + (size_t)context->pos_x,
-                                               context->color_index,
-                                               (size_t)context->repeat_count);
-                                    }
-                                    if (context->max_x < (context->pos_x + context->repeat_count - 1)) {
-                                        context->max_x = context->pos_x + context->repeat_count - 1;
-                                    }
-                                    if (context->max_y < (context->pos_y + i + n - 1)) {
-                                        context->max_y = context->pos_y + i + n - 1;
-                                    }
-                                    i += (n - 1);
-                                    sixel_vertical_mask <<= (n - 1);
+                            mask = image->masks[bits];
+                            columns = image->columns + context->pos_x;
+                            for (i = 0; i < context->repeat_count; i++) {
+                                columns[i] = (columns[i] & ~mask) | (color & mask);
+                            }
+                            if (image->drawn) {
+                                drawn = image->drawn + context->pos_x;
+                                for (i = 0; i < context->repeat_count; i++) {
+                                    drawn[i] |= (unsigned char)bits;
                                 }
-                                sixel_vertical_mask <<= 1;
                             }
-                            context->pos_x += context->repeat_count;
+                            if (image->columns_extent < n) {
+                                image->columns_extent = n;
+                            }
+                            image->columns_bits |= bits;
                         }
+                        context->pos_x += context->repeat_count;
+                        context->repeat_count = 1;
+                        p++;
+                        break;
                     }
-                    context->repeat_count = 1;
+
+                    /* a run of sixel characters is drawn at once, the
+                       bounds are checked only once for the run */
+                    for (n = 1; p + n < p0 + len && p[n] >= '?' && p[n] <= '~'; n++) {
+                    }
+                    if (image->columns_capacity < context->pos_x + n) {
+                        status = image_buffer_reserve_columns(
+                            image, context->pos_x + n, context->bgindex, allocator);
+                        if (SIXEL_FAILED(status)) {
+                            goto end;
+                        }
+                    }
+                    columns = image->columns + context->pos_x;
+                    drawn = image->drawn ? image->drawn + context->pos_x : NULL;
+                    last = (-1);
+                    for (i = 0; i < n; i++) {
+                        bits = p[i] - '?';
+                        if (bits != 0) {
+                            mask = image->masks[bits];
+                            columns[i] = (columns[i] & ~mask) | (color & mask);
+                            image->columns_bits |= bits;
+                            last = i;
+                            if (drawn) {
+                                drawn[i] |= (unsigned char)bits;
+                            }
+                        }
+                    }
+                    if (image->columns_extent < context->pos_x + last + 1) {
+                        image->columns_extent = context->pos_x + last + 1;
+                    }
+                    context->pos_x += n;
+                    p += n;
+                    break;
                 }
                 p++;
                 break;
@@ -729,8 +1390,12 @@ sixel_decode_raw_impl(
                     context->attributed_pad = 1;
                 }
 
-                if (image->width < context->attributed_ph ||
-                        image->height < context->attributed_pv) {
+                /* allocate the image of the declared size at once if
+                   nothing is drawn yet */
+                if (image->scratch_y < 0 && image->fn_band == NULL &&
+                        context->attributed_ph > 0 && context->attributed_pv > 0 &&
+                        (image->width < context->attributed_ph ||
+                         image->height < context->attributed_pv)) {
                     sx = context->attributed_ph;
                     if (image->width > context->attributed_ph) {
                         sx = image->width;
@@ -741,7 +1406,8 @@ sixel_decode_raw_impl(
                         sy = image->height;
                     }
 
-                    status = image_buffer_resize(image, sx, sy, context->bgindex, allocator);
+                    image_buffer_free(image, allocator);
+                    status = image_buffer_allocate(image, sx, sy, context->bgindex, allocator);
                     if (SIXEL_FAILED(status)) {
                         goto end;
                     }
@@ -830,44 +1496,7 @@ sixel_decode_raw_impl(
                 }
                 context->param = 0;
 
-                if (context->nparams > 0) {
-                    context->color_index = context->params[0];
-                    if (context->color_index < 0) {
-                        context->color_index = 0;
-                    } else if (context->color_index >= SIXEL_PALETTE_MAX) {
-                        context->color_index = SIXEL_PALETTE_MAX - 1;
-                    }
-                }
-
-                if (context->nparams > 4) {
-                    if (context->params[1] == 1) {
-                        /* HLS */
-                        if (context->params[2] > 360) {
-                            context->params[2] = 360;
-                        }
-                        if (context->params[3] > 100) {
-                            context->params[3] = 100;
-                        }
-                        if (context->params[4] > 100) {
-                            context->params[4] = 100;
-                        }
-                        image->palette[context->color_index]
-                            = hls_to_rgb(context->params[2], context->params[3], context->params[4]);
-                    } else if (context->params[1] == 2) {
-                        /* RGB */
-                        if (context->params[2] > 100) {
-                            context->params[2] = 100;
-                        }
-                        if (context->params[3] > 100) {
-                            context->params[3] = 100;
-                        }
-                        if (context->params[4] > 100) {
-                            context->params[4] = 100;
-                        }
-                        image->palette[context->color_index]
-                            = SIXEL_XRGB(context->params[2], context->params[3], context->params[4]);
-                    }
-                }
+                sixel_decode_select_color(context, image->palette);
                 break;
             }
             break;
@@ -876,7 +1505,36 @@ sixel_decode_raw_impl(
         }
     }
 
-finalize:
+    status = SIXEL_OK;
+    goto end;
+
+terminate:
+    context->terminated = 1;
+    status = SIXEL_OK;
+
+end:
+    if (pconsumed) {
+        *pconsumed = (int)(p - p0);
+    }
+    return status;
+}
+
+
+/* decide the size of the image, and gather the bands into the image, or
+   pass the rest of bands to fn_band */
+static SIXELSTATUS
+sixel_decode_finalize(
+    image_buffer_t      *image,
+    parser_context_t    *context,
+    sixel_allocator_t   *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    status = sixel_decode_flush_band(image, context, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
     if (++context->max_x < context->attributed_ph) {
         context->max_x = context->attributed_ph;
     }
@@ -885,11 +1543,29 @@ finalize:
         context->max_y = context->attributed_pv;
     }
 
-    if (image->width > context->max_x || image->height > context->max_y) {
-        status = image_buffer_resize(image, context->max_x, context->max_y, context->bgindex, allocator);
+    if (image->fn_band) {
+        if (context->max_x > SIXEL_WIDTH_LIMIT || context->max_y > SIXEL_HEIGHT_LIMIT) {
+            sixel_helper_set_additional_message(
+                "sixel_decode_finalize: given size is too huge.");
+            status = SIXEL_BAD_INPUT;
+            goto end;
+        }
+        status = image_buffer_emit_bands(image, context->max_y, context->max_x,
+                                         context->bgindex, allocator);
         if (SIXEL_FAILED(status)) {
             goto end;
         }
+        image_buffer_free(image, allocator);
+        image->width = context->max_x;
+        image->height = context->max_y;
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    status = image_buffer_finalize(image, context->max_x, context->max_y,
+                                   context->bgindex, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
     }
 
     status = SIXEL_OK;
@@ -899,155 +1575,1742 @@ end:
 }
 
 
-/* convert sixel data into indexed pixel bytes and palette data */
-SIXELAPI SIXELSTATUS
-sixel_decode_raw(
-    unsigned char       /* in */  *p,           /* sixel bytes */
-    int                 /* in */  len,          /* size of sixel bytes */
-    unsigned char       /* out */ **pixels,     /* decoded pixels */
-    int                 /* out */ *pwidth,      /* image width */
-    int                 /* out */ *pheight,     /* image height */
-    unsigned char       /* out */ **palette,    /* ARGB palette */
-    int                 /* out */ *ncolors,     /* palette size (<= 256) */
-    sixel_allocator_t   /* in */  *allocator)   /* allocator object or null */
+/* bands are decoded in parallel only if the data is larger than this */
+#define SIXEL_DECODE_PARALLEL_MIN   (64 * 1024)
+
+/* bytes of sixel data decoded by a worker at once at least */
+#define SIXEL_DECODE_SEGMENT_MIN    (16 * 1024)
+
+/* a piece of sixel data which starts at the top of a band, it is decoded
+   by a worker into bands of its own */
+typedef struct sixel_decode_segment {
+    unsigned char const *p;     /* first byte of the segment */
+    int len;                    /* size of the segment */
+    parser_context_t context;   /* parser state at the top of the segment */
+    image_buffer_t image;       /* bands drawn by the worker */
+    SIXELSTATUS status;         /* result of the worker */
+} sixel_decode_segment_t;
+
+/* segments shared by the workers */
+typedef struct sixel_decode_workers {
+    sixel_decode_segment_t *segments;
+    int nsegments;
+    int next;                   /* next segment to be decoded */
+    sixel_mutex_t mutex;
+    sixel_allocator_t *allocator;
+} sixel_decode_workers_t;
+
+
+/* split the sixel data into segments at DECGNL, the color registers are
+   defined into the palette and the selected color is recorded at the top
+   of each segment. *nsegments is set to 0 if the data contains sequences
+   which can be decoded only in order, the palette is left as it is then */
+static SIXELSTATUS
+sixel_decode_prescan(
+    unsigned char const     *p,         /* sixel bytes following a DECGNL */
+    int                      len,       /* size of sixel bytes */
+    int                      nthreads,  /* number of threads */
+    parser_context_t        *context,   /* parser state at the top of p */
+    int                     *palette,   /* palette to be updated */
+    sixel_decode_segment_t **segments,  /* segments to be created */
+    int                     *nsegments, /* number of segments */
+    sixel_allocator_t       *allocator) /* allocator object */
 {
     SIXELSTATUS status = SIXEL_FALSE;
-    parser_context_t context;
-    image_buffer_t image;
-    int n;
-
-    image.data = NULL;
-
-    if (allocator) {
-        sixel_allocator_ref(allocator);
-    } else {
-        status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
-        if (SIXEL_FAILED(status)) {
-            allocator = NULL;
-            goto error;
-        }
+    parser_context_t scan = *context;
+    sixel_decode_segment_t *segment;
+    unsigned char const *q = p;
+    unsigned char const *end = p + len;
+    unsigned char const *top = p;
+    int *defined = NULL;
+    int capacity;
+    int chunk;
+
+    *segments = NULL;
+    *nsegments = 0;
+
+    chunk = len / (nthreads * 4);
+    if (chunk < SIXEL_DECODE_SEGMENT_MIN) {
+        chunk = SIXEL_DECODE_SEGMENT_MIN;
     }
-
-    /* parser context initialization */
-    status = parser_context_init(&context);
-    if (SIXEL_FAILED(status)) {
-        goto error;
-    }
-
-    /* buffer initialization */
-    status = image_buffer_init(&image, 1, 1, context.bgindex, allocator);
-    if (SIXEL_FAILED(status)) {
-        goto error;
-    }
-
-    status = sixel_decode_raw_impl(p, len, &image, &context, allocator);
-    if (SIXEL_FAILED(status)) {
-        goto error;
-    }
-
-    *ncolors = image.ncolors + 1;
-    int alloc_size = *ncolors;
-    if (alloc_size < SIXEL_PALETTE_MAX) {
-        /* memory access range should be 0 <= 255 */
-        alloc_size = SIXEL_PALETTE_MAX;
-    }
-    *palette = (unsigned char *)sixel_allocator_malloc(allocator, (size_t)(alloc_size * 3));
-    if (palette == NULL) {
-        sixel_allocator_free(allocator, image.data);
+    capacity = len / chunk + 1;
+    *segments = (sixel_decode_segment_t *)sixel_allocator_calloc(
+        allocator, (size_t)capacity, sizeof(sixel_decode_segment_t));
+    if (*segments == NULL) {
         sixel_helper_set_additional_message(
-            "sixel_deocde_raw: sixel_allocator_malloc() failed.");
+            "sixel_decode_prescan: sixel_allocator_calloc() failed.");
         status = SIXEL_BAD_ALLOCATION;
-        goto error;
+        goto end;
     }
-    for (n = 0; n < *ncolors; ++n) {
-        (*palette)[n * 3 + 0] = image.palette[n] >> 16 & 0xff;
-        (*palette)[n * 3 + 1] = image.palette[n] >> 8 & 0xff;
-        (*palette)[n * 3 + 2] = image.palette[n] & 0xff;
+    defined = (int *)sixel_allocator_malloc(allocator,
+                                            sizeof(int) * SIXEL_PALETTE_MAX);
+    if (defined == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_decode_prescan: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    memcpy(defined, palette, sizeof(int) * SIXEL_PALETTE_MAX);
+
+    (*segments)[0].p = p;
+    (*segments)[0].context = scan;
+    *nsegments = 1;
+
+    while (q < end) {
+        switch (*q) {
+        case '#':
+            scan.param = 0;
+            scan.nparams = 0;
+            for (++q; q < end && ((*q >= '0' && *q <= '9') || *q == ';'); ++q) {
+                if (*q == ';') {
+                    if (scan.nparams < DECSIXEL_PARAMS_MAX) {
+                        scan.params[scan.nparams++] = scan.param;
+                    }
+                    scan.param = 0;
+                } else if (SIXEL_FAILED(safe_addition_for_params(&scan, q))) {
+                    /* the worker reports it */
+                    goto unsplittable;
+                }
+            }
+            if (q == end || *q == 0x1b) {
+                /* the parameters are not applied */
+                break;
+            }
+            if (scan.nparams < DECSIXEL_PARAMS_MAX) {
+                scan.params[scan.nparams++] = scan.param;
+            }
+            scan.param = 0;
+            sixel_decode_select_color(&scan, defined);
+            break;
+        case '!':
+            scan.param = 0;
+            for (++q; q < end && *q >= '0' && *q <= '9'; ++q) {
+                if (SIXEL_FAILED(safe_addition_for_params(&scan, q))) {
+                    goto unsplittable;
+                }
+            }
+            scan.repeat_count = scan.param == 0 ? 1 : scan.param;
+            scan.param = 0;
+            break;
+        case '-':
+            scan.pos_y += 6;
+            ++q;
+            /* the band is left to the next worker unless a repeat
+               introducer is carried over to it */
+            if (scan.repeat_count == 1 && q - top >= chunk && q < end &&
+                    *nsegments < capacity) {
+                segment = *segments + *nsegments - 1;
+                segment->len = (int)(q - segment->p);
+                segment = *segments + (*nsegments)++;
+                segment->p = q;
+                segment->context = scan;
+                top = q;
+            }
+            break;
+        case '"':
+            /* raster attributes change the size of the image */
+            goto unsplittable;
+        case 0x1b:
+            if (q + 1 < end && q[1] != '\\' && q[1] != 0x9c) {
+                /* another control sequence follows */
+                goto unsplittable;
+            }
+            /* the last worker stops at the string terminator */
+            end = q + 2 < end ? q + 2 : end;
+            q = end;
+            break;
+        default:
+            if (*q >= '?' && *q <= '~') {
+                scan.repeat_count = 1;
+            }
+            ++q;
+            break;
+        }
     }
 
-    *pwidth = image.width;
-    *pheight = image.height;
-    *pixels = image.data;
+    segment = *segments + *nsegments - 1;
+    segment->len = (int)(end - segment->p);
+    memcpy(palette, defined, sizeof(int) * SIXEL_PALETTE_MAX);
 
     status = SIXEL_OK;
     goto end;
 
-error:
-    free(image.data);
-    image.data = NULL;
+unsplittable:
+    *nsegments = 0;
+    status = SIXEL_OK;
 
 end:
-    sixel_allocator_unref(allocator);
+    sixel_allocator_free(allocator, defined);
     return status;
 }
 
 
-/* deprecated */
-SIXELAPI SIXELSTATUS
-sixel_decode(unsigned char              /* in */  *p,         /* sixel bytes */
-             int                        /* in */  len,        /* size of sixel bytes */
-             unsigned char              /* out */ **pixels,   /* decoded pixels */
-             int                        /* out */ *pwidth,    /* image width */
-             int                        /* out */ *pheight,   /* image height */
-             unsigned char              /* out */ **palette,  /* ARGB palette */
-             int                        /* out */ *ncolors,   /* palette size (<= 256) */
-             sixel_allocator_function   /* in */  fn_malloc)  /* malloc function */
+/* decode segments picked up from the shared list until all segments are
+   taken */
+static void
+sixel_decode_worker(void *arg)
+{
+    sixel_decode_workers_t *workers = (sixel_decode_workers_t *)arg;
+    sixel_decode_segment_t *segment;
+    SIXELSTATUS status;
+    int n;
+
+    for (;;) {
+        sixel_mutex_lock(&workers->mutex);
+        n = workers->next++;
+        sixel_mutex_unlock(&workers->mutex);
+        if (n >= workers->nsegments) {
+            break;
+        }
+        segment = workers->segments + n;
+        segment->context.pos_x = 0;
+        segment->context.max_x = 0;
+        segment->context.max_y = 0;
+        status = image_buffer_init(&segment->image, 0, 0,
+                                   segment->context.bgindex,
+                                   workers->allocator);
+        if (SIXEL_SUCCEEDED(status)) {
+            status = sixel_decode_scan(segment->p, segment->len,
+                                       &segment->image, &segment->context,
+                                       workers->allocator, NULL);
+        }
+        if (SIXEL_SUCCEEDED(status)) {
+            status = sixel_decode_flush_band(&segment->image, &segment->context,
+                                             workers->allocator);
+        }
+        segment->status = status;
+    }
+}
+
+
+/* move the bands drawn by a worker into the image, they are handed over
+   as they are if the image is stored in bands */
+static SIXELSTATUS
+sixel_decode_merge_segment(
+    image_buffer_t          *image,
+    parser_context_t        *context,
+    sixel_decode_segment_t  *segment,
+    sixel_allocator_t       *allocator)
 {
     SIXELSTATUS status = SIXEL_FALSE;
-    sixel_allocator_t *allocator = NULL;
-    parser_context_t context;
-    image_buffer_t image;
+    image_buffer_t *source = &segment->image;
+    int width;
+    int k;
     int n;
 
-    status = sixel_allocator_new(&allocator, fn_malloc, NULL, NULL, NULL);
+    if (image->ncolors < source->ncolors) {
+        image->ncolors = source->ncolors;
+    }
+    if (context->max_x < segment->context.max_x) {
+        context->max_x = segment->context.max_x;
+    }
+    if (context->max_y < segment->context.max_y) {
+        context->max_y = segment->context.max_y;
+    }
+
+    for (k = 0; k < source->nbands; ++k) {
+        if (source->bands[k] == NULL) {
+            continue;
+        }
+        if (image->data == NULL) {
+            status = image_buffer_reserve_bands(image, k, allocator);
+            if (SIXEL_FAILED(status)) {
+                goto end;
+            }
+            if (image->bands[k] == NULL) {
+                image->bands[k] = source->bands[k];
+                image->band_widths[k] = source->band_widths[k];
+                source->bands[k] = NULL;
+                continue;
+            }
+        }
+        width = source->band_widths[k];
+        if (width > segment->context.max_x + 1) {
+            width = segment->context.max_x + 1;
+        }
+        status = image_buffer_prepare_band(image, k * 6, width,
+                                           context->bgindex, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        for (n = 0; n < 6; ++n) {
+            memcpy(image->band + (size_t)image->band_width * (size_t)n,
+                   source->bands[k] + (size_t)source->band_widths[k] * (size_t)n,
+                   (size_t)width);
+        }
+    }
+    image->band = NULL;
+
+    status = SIXEL_OK;
+
+end:
+    image_buffer_free(source, allocator);
+    return status;
+}
+
+
+/* parse sixel data with several threads, the first band is decoded in
+   order to read the header, then the rest of bands are split into
+   segments and decoded in parallel. the data is decoded in order if it
+   is small or it contains sequences which can not be split */
+static SIXELSTATUS
+sixel_decode_scan_parallel(
+    unsigned char const *p,         /* sixel bytes */
+    int                  len,       /* size of sixel bytes */
+    int                  nthreads,  /* number of threads */
+    image_buffer_t      *image,
+    parser_context_t    *context,
+    sixel_allocator_t   *allocator) /* allocator object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_decode_workers_t workers;
+    unsigned char const *first;
+    int head;
+    int max_x;
+    int max_y;
+    int n;
+
+    workers.segments = NULL;
+    workers.nsegments = 0;
+
+    first = (unsigned char const *)memchr(p, '-', (size_t)len);
+    head = first ? (int)(first - p) + 1 : len;
+    status = sixel_decode_scan(p, head, image, context, allocator, NULL);
     if (SIXEL_FAILED(status)) {
-        allocator = NULL;
+        goto end;
+    }
+    p += head;
+    len -= head;
+
+    if (nthreads > 1 && len >= SIXEL_DECODE_PARALLEL_MIN &&
+            !context->terminated && context->state == PS_DECSIXEL) {
+        status = sixel_decode_prescan(p, len, nthreads, context, image->palette,
+                                      &workers.segments, &workers.nsegments,
+                                      allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    if (workers.nsegments < 2) {
+        status = sixel_decode_scan(p, len, image, context, allocator, NULL);
         goto end;
     }
 
-    /* parser context initialization */
-    status = parser_context_init(&context);
+    status = sixel_decode_flush_band(image, context, allocator);
     if (SIXEL_FAILED(status)) {
         goto end;
     }
 
-    /* buffer initialization */
-    status = image_buffer_init(&image, 2048, 2048, context.bgindex, allocator);
+    status = sixel_mutex_init(&workers.mutex);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    workers.next = 0;
+    workers.allocator = allocator;
+    status = sixel_thread_run(nthreads, sixel_decode_worker, &workers);
+    sixel_mutex_destroy(&workers.mutex);
     if (SIXEL_FAILED(status)) {
         goto end;
     }
 
-    status = sixel_decode_raw_impl(p, len, &image, &context, allocator);
+    /* the result does not depend on the number of threads */
+    for (n = 0; n < workers.nsegments; ++n) {
+        status = workers.segments[n].status;
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        status = sixel_decode_merge_segment(image, context,
+                                            workers.segments + n, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+    /* the parser state is taken over from the last segment */
+    max_x = context->max_x;
+    max_y = context->max_y;
+    *context = workers.segments[workers.nsegments - 1].context;
+    context->max_x = max_x;
+    context->max_y = max_y;
+
+    status = SIXEL_OK;
+
+end:
+    for (n = 0; n < workers.nsegments; ++n) {
+        image_buffer_free(&workers.segments[n].image, allocator);
+    }
+    sixel_allocator_free(allocator, workers.segments);
+    return status;
+}
+
+
+/* convert sixel data into indexed pixel bytes and palette data */
+SIXELAPI SIXELSTATUS
+sixel_decode_raw_impl(
+    unsigned char     *p,         /* sixel bytes */
+    int                len,       /* size of sixel bytes */
+    image_buffer_t    *image,
+    parser_context_t  *context,
+    sixel_allocator_t *allocator) /* allocator object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    status = sixel_decode_scan(p, len, image, context, allocator, NULL);
     if (SIXEL_FAILED(status)) {
         goto end;
     }
 
-    *ncolors = image.ncolors + 1;
-    *palette = (unsigned char *)sixel_allocator_malloc(allocator, (size_t)(*ncolors * 3));
-    if (palette == NULL) {
-        sixel_allocator_free(allocator, image.data);
+    status = sixel_decode_finalize(image, context, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+end:
+    return status;
+}
+
+
+/* decoder state for sixel data given in pieces */
+struct sixel_decode_stream {
+    parser_context_t context;
+    image_buffer_t image;
+    sixel_allocator_t *allocator;
+    int nthreads;               /* number of threads, 0 to decode in order */
+    unsigned char *pending;     /* data kept to be decoded in parallel */
+    int pending_size;           /* size of pending data */
+    int pending_capacity;       /* allocated size of pending */
+};
+
+
+/* create a decoder state, completed bands are passed to fn_band if it
+   is given, otherwise the whole image is returned when it is finished */
+SIXELSTATUS
+sixel_decode_stream_new(
+    sixel_decode_stream_t   /* out */ **ppstream,   /* decoder state to be created */
+    sixel_band_function     /* in */  fn_band,      /* callback for bands, or NULL */
+    void                    /* in */  *priv,        /* private data for fn_band */
+    sixel_allocator_t       /* in */  *allocator)   /* allocator object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    *ppstream = (sixel_decode_stream_t *)sixel_allocator_malloc(
+        allocator, sizeof(sixel_decode_stream_t));
+    if (*ppstream == NULL) {
         sixel_helper_set_additional_message(
-            "sixel_deocde_raw: sixel_allocator_malloc() failed.");
+            "sixel_decode_stream_new: sixel_allocator_malloc() failed.");
         status = SIXEL_BAD_ALLOCATION;
         goto end;
     }
-    for (n = 0; n < *ncolors; ++n) {
-        (*palette)[n * 3 + 0] = image.palette[n] >> 16 & 0xff;
-        (*palette)[n * 3 + 1] = image.palette[n] >> 8 & 0xff;
-        (*palette)[n * 3 + 2] = image.palette[n] & 0xff;
+
+    status = parser_context_init(&(*ppstream)->context);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = image_buffer_init(&(*ppstream)->image, 0, 0,
+                               (*ppstream)->context.bgindex, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
     }
+    (*ppstream)->image.fn_band = fn_band;
+    (*ppstream)->image.band_priv = priv;
+    (*ppstream)->nthreads = 0;
+    (*ppstream)->pending = NULL;
+    (*ppstream)->pending_size = 0;
+    (*ppstream)->pending_capacity = 0;
 
-    *pwidth = image.width;
-    *pheight = image.height;
-    *pixels = image.data;
+    sixel_allocator_ref(allocator);
+    (*ppstream)->allocator = allocator;
+
+    status = SIXEL_OK;
+
+end:
+    if (SIXEL_FAILED(status)) {
+        sixel_allocator_free(allocator, *ppstream);
+        *ppstream = NULL;
+    }
+    return status;
+}
+
+
+/* destroy a decoder state */
+void
+sixel_decode_stream_destroy(
+    sixel_decode_stream_t   /* in */ *stream)   /* decoder state */
+{
+    sixel_allocator_t *allocator;
+
+    if (stream) {
+        allocator = stream->allocator;
+        image_buffer_free(&stream->image, allocator);
+        sixel_allocator_free(allocator, stream->pending);
+        sixel_allocator_free(allocator, stream);
+        sixel_allocator_unref(allocator);
+    }
+}
+
+
+/* decode sixel data given with several threads, the data is kept until
+   the stream is finished */
+void
+sixel_decode_stream_set_threads(
+    sixel_decode_stream_t   /* in */ *stream,   /* decoder state */
+    int                     /* in */ nthreads)  /* number of threads */
+{
+    stream->nthreads = nthreads;
+}
+
+
+/* decode the data kept so far */
+static SIXELSTATUS
+sixel_decode_stream_flush(sixel_decode_stream_t *stream)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    if (stream->pending_size == 0) {
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    status = sixel_decode_scan_parallel(stream->pending, stream->pending_size,
+                                        stream->nthreads, &stream->image,
+                                        &stream->context, stream->allocator);
+    sixel_allocator_free(stream->allocator, stream->pending);
+    stream->pending = NULL;
+    stream->pending_size = 0;
+    stream->pending_capacity = 0;
+
+end:
+    return status;
+}
+
+
+/* parse a piece of sixel data, data after the string terminator is
+   ignored */
+SIXELSTATUS
+sixel_decode_stream_feed(
+    sixel_decode_stream_t   /* in */ *stream,   /* decoder state */
+    unsigned char const     /* in */ *p,        /* sixel bytes */
+    int                     /* in */ len)       /* size of sixel bytes */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *pending;
+    int capacity;
+
+    if (stream->context.terminated) {
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    if (stream->nthreads > 1 && stream->image.fn_band == NULL &&
+            len <= INT_MAX - stream->pending_size) {
+        /* the whole data is needed to split it into bands */
+        if (stream->pending_size + len > stream->pending_capacity) {
+            capacity = stream->pending_capacity > 0 ? stream->pending_capacity : len;
+            while (capacity < stream->pending_size + len) {
+                capacity = capacity <= INT_MAX / 2 ? capacity * 2 : INT_MAX;
+            }
+            pending = (unsigned char *)sixel_allocator_realloc(
+                stream->allocator, stream->pending, (size_t)capacity);
+            if (pending == NULL) {
+                sixel_helper_set_additional_message(
+                    "sixel_decode_stream_feed: sixel_allocator_realloc() failed.");
+                status = SIXEL_BAD_ALLOCATION;
+                goto end;
+            }
+            stream->pending = pending;
+            stream->pending_capacity = capacity;
+        }
+        memcpy(stream->pending + stream->pending_size, p, (size_t)len);
+        stream->pending_size += len;
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    /* too large to be kept, the data is decoded in order from here */
+    stream->nthreads = 0;
+    status = sixel_decode_stream_flush(stream);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_decode_scan(p, len, &stream->image, &stream->context,
+                               stream->allocator, NULL);
+
+end:
+    return status;
+}
+
+
+/* parse the whole sixel data at once, the data is not copied to be
+   decoded with several threads */
+SIXELSTATUS
+sixel_decode_stream_feed_all(
+    sixel_decode_stream_t   /* in */ *stream,   /* decoder state */
+    unsigned char const     /* in */ *p,        /* sixel bytes */
+    int                     /* in */ len)       /* size of sixel bytes */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    if (stream->nthreads > 1 && stream->image.fn_band == NULL &&
+            stream->pending_size == 0 && !stream->context.terminated) {
+        status = sixel_decode_scan_parallel(p, len, stream->nthreads,
+                                            &stream->image, &stream->context,
+                                            stream->allocator);
+        /* data given after this is decoded in order */
+        stream->nthreads = 0;
+        goto end;
+    }
+
+    status = sixel_decode_stream_feed(stream, p, len);
+
+end:
+    return status;
+}
+
+
+/* finish decoding, the rest of bands are passed to the callback, or the
+   whole image is returned if no callback is given */
+SIXELSTATUS
+sixel_decode_stream_finish(
+    sixel_decode_stream_t   /* in */  *stream,      /* decoder state */
+    unsigned char           /* out */ **pixels,     /* decoded pixels, or NULL */
+    int                     /* out */ *pwidth,      /* image width */
+    int                     /* out */ *pheight,     /* image height */
+    unsigned char           /* out */ **palette,    /* RGB palette, or NULL */
+    int                     /* out */ *ncolors)     /* palette size (<= 256) */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    image_buffer_t *image = &stream->image;
+
+    *pixels = NULL;
+    *palette = NULL;
+
+    status = sixel_decode_stream_flush(stream);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_decode_finalize(image, &stream->context, stream->allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    *pwidth = image->width;
+    *pheight = image->height;
+    *ncolors = image->ncolors + 1;
+
+    if (image->fn_band == NULL) {
+        *palette = (unsigned char *)sixel_allocator_malloc(stream->allocator,
+                                                           SIXEL_PALETTE_MAX * 3);
+        if (*palette == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_decode_stream_finish: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        image_buffer_export_palette(image, *palette, *ncolors);
+        *pixels = image->data;
+        image->data = NULL;
+    }
 
     status = SIXEL_OK;
 
 end:
-    sixel_allocator_unref(allocator);
     return status;
 }
 
+
+/* convert sixel data into indexed pixel bytes and palette data */
+SIXELAPI SIXELSTATUS
+sixel_decode_raw(
+    unsigned char       /* in */  *p,           /* sixel bytes */
+    int                 /* in */  len,          /* size of sixel bytes */
+    unsigned char       /* out */ **pixels,     /* decoded pixels */
+    int                 /* out */ *pwidth,      /* image width */
+    int                 /* out */ *pheight,     /* image height */
+    unsigned char       /* out */ **palette,    /* ARGB palette */
+    int                 /* out */ *ncolors,     /* palette size (<= 256) */
+    sixel_allocator_t   /* in */  *allocator)   /* allocator object or null */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    parser_context_t context;
+    image_buffer_t image;
+
+    image.data = NULL;
+    image.bands = NULL;
+    image.band_widths = NULL;
+    image.nbands = 0;
+
+    if (allocator) {
+        sixel_allocator_ref(allocator);
+    } else {
+        status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+        if (SIXEL_FAILED(status)) {
+            allocator = NULL;
+            goto error;
+        }
+    }
+
+    /* parser context initialization */
+    status = parser_context_init(&context);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    /* buffer initialization, the size is decided by the raster attributes
+       or while drawing */
+    status = image_buffer_init(&image, 0, 0, context.bgindex, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_decode_raw_impl(p, len, &image, &context, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    *ncolors = image.ncolors + 1;
+    int alloc_size = *ncolors;
+    if (alloc_size < SIXEL_PALETTE_MAX) {
+        /* memory access range should be 0 <= 255 */
+        alloc_size = SIXEL_PALETTE_MAX;
+    }
+    *palette = (unsigned char *)sixel_allocator_malloc(allocator, (size_t)(alloc_size * 3));
+    if (*palette == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_deocde_raw: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto error;
+    }
+    image_buffer_export_palette(&image, *palette, *ncolors);
+
+    *pwidth = image.width;
+    *pheight = image.height;
+    *pixels = image.data;
+
+    status = SIXEL_OK;
+    goto end;
+
+error:
+    if (allocator) {
+        image_buffer_free(&image, allocator);
+    }
+
+end:
+    sixel_allocator_unref(allocator);
+    return status;
+}
+
+
+/* destination of sixel_decode_direct() */
+typedef struct sixel_direct_target {
+    unsigned char *pixels;      /* buffer given by the caller */
+    int width;                  /* width of the buffer */
+    int height;                 /* height of the buffer */
+    int stride;                 /* bytes of a row of the buffer */
+    int depth;                  /* 3 for RGB888, 4 for RGBA8888 */
+    int filled_y;               /* rows of the buffer written so far */
+    parser_context_t *context;  /* parser state of the stream */
+    image_buffer_t *image;      /* image of the stream */
+} sixel_direct_target_t;
+
+
+/* expand rows of color indexes into the buffer, the rest of each row is
+   filled with the background */
+static void
+sixel_direct_expand_rows(
+    sixel_direct_target_t   *target,
+    unsigned char const     *indexes,   /* color indexes, or NULL for
+                                           rows of the background */
+    int                      width,     /* number of color indexes */
+    int                      stride,    /* bytes of a row of indexes */
+    int                      y,         /* top row */
+    int                      nrows,     /* number of rows */
+    unsigned char const     *palette,   /* RGB palette */
+    unsigned char const     *drawn,     /* sixel bits drawn in each column,
+                                           or NULL if nothing is drawn */
+    int                      ndrawn)    /* entries of drawn */
+{
+    unsigned char const *color;
+    unsigned char *dst;
+    unsigned char background = (unsigned char)target->context->bgindex;
+    unsigned char background_alpha;
+    int depth = target->depth;
+    int x;
+    int i;
+
+    /* the area out of the buffer is clipped */
+    if (width > target->width || indexes == NULL) {
+        width = indexes == NULL ? 0 : target->width;
+    }
+    if (nrows > target->height - y) {
+        nrows = target->height - y;
+    }
+
+    /* undrawn pixels are transparent in background select mode, they are
+       told by the drawn bits, as the background shares a color index with
+       the color registers */
+    background_alpha = target->context->bgselect == 1 ? 0 : 0xff;
+    if (ndrawn > width) {
+        ndrawn = width;
+    }
+    if (drawn == NULL) {
+        ndrawn = 0;
+    }
+
+    for (i = 0; i < nrows; ++i) {
+        dst = target->pixels + (size_t)target->stride * (size_t)(y + i);
+        for (x = 0; x < width; ++x) {
+            color = palette + indexes[(size_t)stride * (size_t)i + (size_t)x] * 3;
+            dst[0] = color[0];
+            dst[1] = color[1];
+            dst[2] = color[2];
+            if (depth == 4) {
+                dst[3] = x < ndrawn && drawn[x] & 1 << i ? 0xff : background_alpha;
+            }
+            dst += depth;
+        }
+        color = palette + background * 3;
+        for (; x < target->width; ++x) {
+            dst[0] = color[0];
+            dst[1] = color[1];
+            dst[2] = color[2];
+            if (depth == 4) {
+                dst[3] = background_alpha;
+            }
+            dst += depth;
+        }
+    }
+    if (target->filled_y < y + nrows) {
+        target->filled_y = y + nrows;
+    }
+}
+
+
+/* band function of sixel_decode_direct() */
+static SIXELSTATUS
+sixel_direct_write_band(
+    unsigned char   /* in */ *pixels,   /* color indexes of the band */
+    int             /* in */ width,     /* width of the band */
+    int             /* in */ stride,    /* bytes of a row of the band */
+    int             /* in */ y,         /* top row of the band */
+    int             /* in */ height,    /* rows of the band */
+    unsigned char   /* in */ *palette,  /* RGB palette */
+    void            /* in */ *priv)     /* destination */
+{
+    sixel_direct_target_t *target = (sixel_direct_target_t *)priv;
+    image_buffer_t *image = target->image;
+
+    if (image->coverage_y == y) {
+        sixel_direct_expand_rows(target, pixels, width, stride, y, height,
+                                 palette, image->coverage, image->coverage_extent);
+    } else {
+        sixel_direct_expand_rows(target, pixels, width, stride, y, height,
+                                 palette, NULL, 0);
+    }
+
+    return SIXEL_OK;
+}
+
+
+/* convert sixel data into RGB888 or RGBA8888 pixels in the buffer given
+   by the caller, each band is expanded as soon as it is decoded, so no
+   image of color indexes is allocated. colors are resolved with the
+   palette defined when each band is completed. the image is clipped by
+   the buffer, and the rest of the buffer is filled with the background,
+   which is transparent in RGBA8888 if the background select parameter
+   of the sixel data is 1 */
+SIXELAPI SIXELSTATUS
+sixel_decode_direct(
+    unsigned char       /* in */  *p,           /* sixel bytes */
+    int                 /* in */  len,          /* size of sixel bytes */
+    unsigned char       /* out */ *pixels,      /* buffer of decoded pixels */
+    int                 /* in */  width,        /* width of the buffer */
+    int                 /* in */  height,       /* height of the buffer */
+    int                 /* in */  stride,       /* bytes of a row of the buffer */
+    int                 /* in */  pixelformat,  /* SIXEL_PIXELFORMAT_RGB888 or
+                                                   SIXEL_PIXELFORMAT_RGBA8888 */
+    int                 /* out */ *pwidth,      /* image width */
+    int                 /* out */ *pheight,     /* image height */
+    sixel_allocator_t   /* in */  *allocator)   /* allocator object or null */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_decode_stream_t *stream = NULL;
+    sixel_direct_target_t target;
+    unsigned char palette[SIXEL_PALETTE_MAX * 3];
+    unsigned char *indexes;
+    unsigned char *rgbpalette;
+    int ncolors;
+
+    if (allocator) {
+        sixel_allocator_ref(allocator);
+    } else {
+        status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+        if (SIXEL_FAILED(status)) {
+            allocator = NULL;
+            goto end;
+        }
+    }
+
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_RGB888:
+        target.depth = 3;
+        break;
+    case SIXEL_PIXELFORMAT_RGBA8888:
+        target.depth = 4;
+        break;
+    default:
+        sixel_helper_set_additional_message(
+            "sixel_decode_direct: unsupported pixelformat.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+    if (width < 0 || height < 0 || (width > 0 && stride < width * target.depth)) {
+        sixel_helper_set_additional_message(
+            "sixel_decode_direct: an invalid buffer size detected.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    target.pixels = pixels;
+    target.width = width;
+    target.height = height;
+    target.stride = stride;
+    target.filled_y = 0;
+
+    status = sixel_decode_stream_new(&stream, sixel_direct_write_band,
+                                     &target, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    target.context = &stream->context;
+    target.image = &stream->image;
+    stream->image.coverage_tracked = target.depth == 4;
+
+    status = sixel_decode_stream_feed(stream, p, len);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_decode_stream_finish(stream, &indexes, pwidth, pheight,
+                                        &rgbpalette, &ncolors);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    /* rows below the image */
+    if (target.filled_y < height) {
+        image_buffer_export_palette(&stream->image, palette, SIXEL_PALETTE_MAX);
+        sixel_direct_expand_rows(&target, NULL, 0, 0, target.filled_y,
+                                 height - target.filled_y, palette, NULL, 0);
+    }
+
+    status = SIXEL_OK;
+
+end:
+    sixel_decode_stream_destroy(stream);
+    sixel_allocator_unref(allocator);
+    return status;
+}
+
+
+/* iterator over the images of sixel data */
+struct sixel_decode_iterator {
+    unsigned int ref;                   /* reference counter */
+    unsigned char const *p;             /* sixel bytes */
+    int len;                            /* size of sixel bytes */
+    int offset;                         /* bytes parsed so far */
+    image_buffer_t image;               /* the last image */
+    unsigned char palette[SIXEL_PALETTE_MAX * 3];  /* palette of the last image */
+    sixel_allocator_t *allocator;       /* allocator object */
+};
+
+
+/* create an iterator over the images of sixel data, each DCS sequence is
+   decoded as an image. the data is not copied, it must be kept until the
+   iterator is released */
+SIXELAPI SIXELSTATUS
+sixel_decode_iterator_new(
+    sixel_decode_iterator_t /* out */ **ppiterator, /* iterator to be created */
+    unsigned char const     /* in */  *p,           /* sixel bytes */
+    int                     /* in */  len,          /* size of sixel bytes */
+    sixel_allocator_t       /* in */  *allocator)   /* allocator object or null */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    *ppiterator = NULL;
+
+    if (allocator) {
+        sixel_allocator_ref(allocator);
+    } else {
+        status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    *ppiterator = (sixel_decode_iterator_t *)sixel_allocator_malloc(
+        allocator, sizeof(sixel_decode_iterator_t));
+    if (*ppiterator == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_decode_iterator_new: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        sixel_allocator_unref(allocator);
+        goto end;
+    }
+
+    (*ppiterator)->ref = 1;
+    (*ppiterator)->p = p;
+    (*ppiterator)->len = len;
+    (*ppiterator)->offset = 0;
+    (*ppiterator)->allocator = allocator;
+
+    status = image_buffer_init(&(*ppiterator)->image, 0, 0, (-1), allocator);
+    if (SIXEL_FAILED(status)) {
+        sixel_allocator_free(allocator, *ppiterator);
+        sixel_allocator_unref(allocator);
+        *ppiterator = NULL;
+        goto end;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* increase reference count of iterator object (thread-unsafe) */
+SIXELAPI void
+sixel_decode_iterator_ref(sixel_decode_iterator_t *iterator)
+{
+    /* TODO: be thread safe */
+    ++iterator->ref;
+}
+
+
+/* decrease reference count of iterator object (thread-unsafe) */
+SIXELAPI void
+sixel_decode_iterator_unref(sixel_decode_iterator_t *iterator)
+{
+    sixel_allocator_t *allocator;
+
+    /* TODO: be thread safe */
+    if (iterator != NULL && --iterator->ref == 0) {
+        allocator = iterator->allocator;
+        image_buffer_free(&iterator->image, allocator);
+        sixel_allocator_free(allocator, iterator);
+        sixel_allocator_unref(allocator);
+    }
+}
+
+
+/* decode the next image, *pixels is set to NULL if no image is left.
+   the pixels and the palette are owned by the iterator, they are valid
+   until the next image is decoded */
+SIXELAPI SIXELSTATUS
+sixel_decode_iterator_next(
+    sixel_decode_iterator_t /* in */  *iterator,    /* iterator object */
+    unsigned char           /* out */ **pixels,     /* decoded pixels */
+    int                     /* out */ *pwidth,      /* image width */
+    int                     /* out */ *pheight,     /* image height */
+    unsigned char           /* out */ **palette,    /* RGB palette */
+    int                     /* out */ *ncolors)     /* palette size (<= 256) */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    image_buffer_t *image = &iterator->image;
+    parser_context_t context;
+    int consumed;
+
+    *pixels = NULL;
+    *palette = NULL;
+
+    while (iterator->offset < iterator->len) {
+        status = parser_context_init(&context);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        image_buffer_reset(image, context.bgindex);
+
+        status = sixel_decode_scan(iterator->p + iterator->offset,
+                                   iterator->len - iterator->offset,
+                                   image, &context, iterator->allocator,
+                                   &consumed);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        iterator->offset += consumed;
+
+        /* sequences between images are skipped */
+        if (image->scratch_y < 0 &&
+            (context.attributed_ph <= 0 || context.attributed_pv <= 0)) {
+            continue;
+        }
+
+        status = sixel_decode_finalize(image, &context, iterator->allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+
+        *pixels = image->data;
+        *pwidth = image->width;
+        *pheight = image->height;
+        *ncolors = image->ncolors + 1;
+        image_buffer_export_palette(image, iterator->palette, *ncolors);
+        *palette = iterator->palette;
+        break;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* deprecated */
+SIXELAPI SIXELSTATUS
+sixel_decode(unsigned char              /* in */  *p,         /* sixel bytes */
+             int                        /* in */  len,        /* size of sixel bytes */
+             unsigned char              /* out */ **pixels,   /* decoded pixels */
+             int                        /* out */ *pwidth,    /* image width */
+             int                        /* out */ *pheight,   /* image height */
+             unsigned char              /* out */ **palette,  /* ARGB palette */
+             int                        /* out */ *ncolors,   /* palette size (<= 256) */
+             sixel_allocator_function   /* in */  fn_malloc)  /* malloc function */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_allocator_t *allocator = NULL;
+    parser_context_t context;
+    image_buffer_t image;
+
+    status = sixel_allocator_new(&allocator, fn_malloc, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        allocator = NULL;
+        goto end;
+    }
+
+    /* parser context initialization */
+    status = parser_context_init(&context);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    /* buffer initialization */
+    status = image_buffer_init(&image, 2048, 2048, context.bgindex, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_decode_raw_impl(p, len, &image, &context, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    *ncolors = image.ncolors + 1;
+    *palette = (unsigned char *)sixel_allocator_malloc(allocator, (size_t)(*ncolors * 3));
+    if (palette == NULL) {
+        sixel_allocator_free(allocator, image.data);
+        sixel_helper_set_additional_message(
+            "sixel_deocde_raw: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    image_buffer_export_palette(&image, *palette, *ncolors);
+
+    *pwidth = image.width;
+    *pheight = image.height;
+    *pixels = image.data;
+
+    status = SIXEL_OK;
+
+end:
+    sixel_allocator_unref(allocator);
+    return status;
+}
+
+#if HAVE_TESTS
+/* decode sixel data into an image, *pixels must be released by caller */
+static SIXELSTATUS
+test_decode(
+    char const          /* in */  *sixel,
+    int                 /* in */  len,
+    unsigned char       /* out */ **pixels,
+    int                 /* out */ *width,
+    int                 /* out */ *height,
+    sixel_allocator_t   /* in */  *allocator)
+{
+    SIXELSTATUS status;
+    unsigned char *palette = NULL;
+    int ncolors;
+
+    status = sixel_decode_raw((unsigned char *)sixel, len, pixels,
+                              width, height, &palette, &ncolors,
+                              allocator);
+    sixel_allocator_free(allocator, palette);
+
+    return status;
+}
+
+
+/* images with and without raster attributes are the same */
+static int
+test1(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char *pixels[3] = { NULL, NULL, NULL };
+    int width[3];
+    int height[3];
+    /* no raster attributes, exact size, and smaller than the image */
+    static char const *headers[] = { "", "\"1;1;200;19", "\"1;1;10;10" };
+    static char const body[] = "#1;2;100;0;0#2;2;0;100;0"
+                               "#1!150~$#2!20?!30N-"
+                               "~~~~-"
+                               "-"
+                               "#1!200@";
+    char sixel[256];
+    int i;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (i = 0; i < 3; i++) {
+        sprintf(sixel, "\033Pq%s%s\033\\", headers[i], body);
+        status = test_decode(sixel, (int)strlen(sixel), &pixels[i],
+                             &width[i], &height[i], allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (width[i] != 200 || height[i] != 19) {
+            goto error;
+        }
+        if (i > 0 && memcmp(pixels[0], pixels[i], 200 * 19) != 0) {
+            goto error;
+        }
+    }
+
+    if (pixels[0][0] != 1 || pixels[0][200 * 5 + 149] != 1 ||
+        pixels[0][150] != 255) {
+        goto error;
+    }
+    if (pixels[0][200 * 2 + 25] != 2 || pixels[0][200 * 5 + 25] != 1) {
+        goto error;
+    }
+    if (pixels[0][200 * 6 + 3] != 2 || pixels[0][200 * 6 + 4] != 255) {
+        goto error;
+    }
+    if (pixels[0][200 * 12 + 0] != 255 || pixels[0][200 * 18 + 199] != 1) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    for (i = 0; i < 3; i++) {
+        sixel_allocator_free(allocator, pixels[i]);
+    }
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* bands of various widths are gathered into the same image regardless
+   of the size declared in advance */
+static int
+test2(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char *pixels[3] = { NULL, NULL, NULL };
+    int width[3];
+    int height[3];
+    char *sixel = NULL;
+    int len;
+    int i;
+    int k;
+    int x;
+    unsigned int seed = 1;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    sixel = (char *)sixel_allocator_malloc(allocator, 64 * 1024);
+    if (sixel == NULL) {
+        goto error;
+    }
+
+    for (i = 0; i < 3; i++) {
+        len = sprintf(sixel, "\033Pq");
+        if (i == 1) {
+            len += sprintf(sixel + len, "\"1;1;%d;%d", width[0], height[0]);
+        } else if (i == 2) {
+            len += sprintf(sixel + len, "\"1;1;300;100");
+        }
+        seed = 1;
+        for (k = 0; k < 40; k++) {
+            for (x = 0; x < 20; x++) {
+                seed = seed * 1103515245 + 12345;
+                len += sprintf(sixel + len, "#%u!%u%c",
+                               seed >> 8 & 0xff,
+                               (seed >> 16 & 0x1f) + 1,
+                               (char)('?' + (seed >> 21 & 0x3f)));
+            }
+            if (k % 3 == 0) {
+                len += sprintf(sixel + len, "$!%d~", k * 17 % 700);
+            }
+            len += sprintf(sixel + len, "-");
+        }
+        len += sprintf(sixel + len, "\033\\");
+
+        status = test_decode(sixel, len, &pixels[i],
+                             &width[i], &height[i], allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (width[i] != width[0] || height[i] != height[0]) {
+            goto error;
+        }
+        if (memcmp(pixels[0], pixels[i], (size_t)(width[0] * height[0])) != 0) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    for (i = 0; i < 3; i++) {
+        sixel_allocator_free(allocator, pixels[i]);
+    }
+    sixel_allocator_free(allocator, sixel);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* runs of sixel characters, repeats and overprinted bands are drawn
+   pixel by pixel */
+static int
+test3(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char *pixels = NULL;
+    int width;
+    int height;
+    /* blank characters at the end of a line are not a part of the image */
+    static char const sixel[] = "\033Pq#1;2;100;0;0#2;2;0;100;0"
+                                "#1~~@@!3~??$"
+                                "#2?A!2C~??????"
+                                "-"
+                                "#2!2?@";
+    static unsigned char const expected[] = {
+        1, 1,   1,   1,   2,   1,   1,
+        1, 2,   255, 255, 2,   1,   1,
+        1, 1,   2,   2,   2,   1,   1,
+        1, 1,   255, 255, 2,   1,   1,
+        1, 1,   255, 255, 2,   1,   1,
+        1, 1,   255, 255, 2,   1,   1,
+        255, 255, 2, 255, 255, 255, 255,
+    };
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = test_decode(sixel, (int)sizeof(sixel) - 1, &pixels,
+                         &width, &height, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (width != 7 || height != 7) {
+        goto error;
+    }
+    if (memcmp(pixels, expected, sizeof(expected)) != 0) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_free(allocator, pixels);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* bands decoded in parallel are the same as bands decoded in order */
+static int
+test4(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    sixel_decode_stream_t *stream = NULL;
+    unsigned char *pixels[3] = { NULL, NULL, NULL };
+    unsigned char *palette[3] = { NULL, NULL, NULL };
+    int width[3];
+    int height[3];
+    int ncolors[3];
+    static int const nthreads[] = { 0, 4, 3 };
+    char *sixel = NULL;
+    int len;
+    int i;
+    int k;
+    int x;
+    int n;
+    unsigned int seed = 1;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    sixel = (char *)sixel_allocator_malloc(allocator, 512 * 1024);
+    if (sixel == NULL) {
+        goto error;
+    }
+
+    /* colors are defined and repeats are carried over across bands */
+    len = sprintf(sixel, "\033P0;0;8q\"1;1;100;100#1;2;0;0;100");
+    for (k = 0; k < 1000; k++) {
+        for (x = 0; x < 30; x++) {
+            seed = seed * 1103515245 + 12345;
+            if ((seed >> 4 & 0xf) == 0) {
+                len += sprintf(sixel + len, "#%u;2;%u;%u;%u",
+                               seed >> 8 & 0xff, seed >> 12 & 0x3f,
+                               seed >> 16 & 0x3f, seed >> 20 & 0x3f);
+            } else if ((seed >> 4 & 0xf) == 1) {
+                len += sprintf(sixel + len, "#%u", seed >> 8 & 0xff);
+            }
+            len += sprintf(sixel + len, "!%u%c%c",
+                           (seed >> 16 & 0x1f) + 1,
+                           (char)('?' + (seed >> 21 & 0x3f)),
+                           (char)('?' + (seed >> 25 & 0x3f)));
+        }
+        if (k % 7 == 0) {
+            len += sprintf(sixel + len, "$#%d!%d~", k % 256, k * 17 % 1400);
+        }
+        len += sprintf(sixel + len, k % 11 == 0 ? "!3-" : "-");
+    }
+    len += sprintf(sixel + len, "\033\\");
+
+    for (i = 0; i < 3; i++) {
+        status = sixel_decode_stream_new(&stream, NULL, NULL, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        sixel_decode_stream_set_threads(stream, nthreads[i]);
+        for (x = 0; x < len; x += n) {
+            n = len - x < 10000 ? len - x : 10000;
+            status = sixel_decode_stream_feed(stream, (unsigned char *)sixel + x, n);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+        }
+        status = sixel_decode_stream_finish(stream, &pixels[i], &width[i],
+                                            &height[i], &palette[i],
+                                            &ncolors[i]);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        sixel_decode_stream_destroy(stream);
+        stream = NULL;
+
+        if (width[i] != width[0] || height[i] != height[0] ||
+            ncolors[i] != ncolors[0]) {
+            goto error;
+        }
+        if (memcmp(pixels[0], pixels[i], (size_t)(width[0] * height[0])) != 0) {
+            goto error;
+        }
+        if (memcmp(palette[0], palette[i], (size_t)(ncolors[0] * 3)) != 0) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_decode_stream_destroy(stream);
+    for (i = 0; i < 3; i++) {
+        sixel_allocator_free(allocator, pixels[i]);
+        sixel_allocator_free(allocator, palette[i]);
+    }
+    sixel_allocator_free(allocator, sixel);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* pixels decoded into a buffer are the same as the indexed image,
+   undrawn pixels are transparent in background select mode */
+static int
+test5(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char *pixels = NULL;
+    unsigned char *palette = NULL;
+    unsigned char rgba[12 * 9 * 4 + 4];
+    unsigned char const *color;
+    unsigned char const *dst;
+    int ncolors;
+    int width;
+    int height;
+    int sx;
+    int sy;
+    int x;
+    int y;
+    static char const sixel[] = "\033P0;1q#1;2;100;0;0#2;2;0;100;0"
+                                "#1~~@@!3~??$"
+                                "#2?A!2C~-"
+                                "#2!2?@\033\\";
+    static char const sixel255[] = "\033P0;1;0q#255;2;100;0;0~~~~\033\\";
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_decode_raw((unsigned char *)sixel, (int)sizeof(sixel) - 1,
+                              &pixels, &width, &height, &palette, &ncolors,
+                              allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    /* the buffer is wider and lower than the image */
+    memset(rgba, 0x55, sizeof(rgba));
+    status = sixel_decode_direct((unsigned char *)sixel, (int)sizeof(sixel) - 1,
+                                 rgba, 12, 6, 12 * 4 + 4,
+                                 SIXEL_PIXELFORMAT_RGBA8888,
+                                 &sx, &sy, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (sx != width || sy != height || sx != 7 || sy != 7) {
+        goto error;
+    }
+    for (y = 0; y < 6; ++y) {
+        for (x = 0; x < 12; ++x) {
+            dst = rgba + (12 * 4 + 4) * y + x * 4;
+            if (x >= width || pixels[width * y + x] == 255) {
+                if (dst[3] != 0) {
+                    goto error;
+                }
+                continue;
+            }
+            color = palette + pixels[width * y + x] * 3;
+            if (dst[0] != color[0] || dst[1] != color[1] ||
+                dst[2] != color[2] || dst[3] != 0xff) {
+                goto error;
+            }
+        }
+        if (y < 5 && memcmp(dst + 4, "\x55\x55\x55\x55", 4) != 0) {
+            goto error;
+        }
+    }
+    if (rgba[(12 * 4 + 4) * 6] != 0x55) {
+        goto error;
+    }
+
+    /* pixelformats other than RGB888 and RGBA8888 are not supported */
+    status = sixel_decode_direct((unsigned char *)sixel, (int)sizeof(sixel) - 1,
+                                 rgba, 12, 6, 12 * 4 + 4,
+                                 SIXEL_PIXELFORMAT_PAL8,
+                                 &sx, &sy, allocator);
+    if (status != SIXEL_BAD_ARGUMENT) {
+        goto error;
+    }
+
+    /* pixels drawn with the color register of the background are opaque */
+    memset(rgba, 0x55, sizeof(rgba));
+    status = sixel_decode_direct((unsigned char *)sixel255, (int)sizeof(sixel255) - 1,
+                                 rgba, 12, 6, 12 * 4 + 4,
+                                 SIXEL_PIXELFORMAT_RGBA8888,
+                                 &sx, &sy, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (sx != 4 || sy != 6) {
+        goto error;
+    }
+    for (y = 0; y < 6; ++y) {
+        for (x = 0; x < 12; ++x) {
+            dst = rgba + (12 * 4 + 4) * y + x * 4;
+            if (x >= 4) {
+                if (dst[3] != 0) {
+                    goto error;
+                }
+            } else if (memcmp(dst, "\xff\x00\x00\xff", 4) != 0) {
+                goto error;
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_free(allocator, pixels);
+    sixel_allocator_free(allocator, palette);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* each DCS sequence of a stream is decoded as an image, bytes between
+   the sequences are ignored */
+static int
+test6(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_decode_iterator_t *iterator = NULL;
+    unsigned char *pixels = NULL;
+    unsigned char *palette = NULL;
+    int ncolors;
+    int width;
+    int height;
+    static char const sixel[] = "\033Pq#1;2;100;0;0#1!4~-~\033\\"
+                                "junk\r\n"
+                                "\033Pq\"1;1;2;3#0\033\\"
+                                "\033Pq#2;2;0;100;0#2@\033\\";
+
+    status = sixel_decode_iterator_new(&iterator, (unsigned char *)sixel,
+                                       (int)sizeof(sixel) - 1, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_decode_iterator_next(iterator, &pixels, &width, &height,
+                                        &palette, &ncolors);
+    if (SIXEL_FAILED(status) || pixels == NULL) {
+        goto error;
+    }
+    if (width != 4 || height != 12 || pixels[0] != 1 || palette[3] != 255) {
+        goto error;
+    }
+
+    /* raster attributes make an image without any sixel */
+    status = sixel_decode_iterator_next(iterator, &pixels, &width, &height,
+                                        &palette, &ncolors);
+    if (SIXEL_FAILED(status) || pixels == NULL) {
+        goto error;
+    }
+    if (width != 2 || height != 3 || pixels[0] != 255) {
+        goto error;
+    }
+
+    status = sixel_decode_iterator_next(iterator, &pixels, &width, &height,
+                                        &palette, &ncolors);
+    if (SIXEL_FAILED(status) || pixels == NULL) {
+        goto error;
+    }
+    if (width != 1 || height != 1 || pixels[0] != 2 || palette[7] != 255) {
+        goto error;
+    }
+
+    status = sixel_decode_iterator_next(iterator, &pixels, &width, &height,
+                                        &palette, &ncolors);
+    if (SIXEL_FAILED(status) || pixels != NULL) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_decode_iterator_unref(iterator);
+    return nret;
+}
+
+
+/* repeats of empty sixels beyond the width limit are rejected */
+static int
+test7(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char *pixels = NULL;
+    unsigned char sixel[3 + 7 * 32 + 2];
+    int width;
+    int height;
+    int len;
+    int i;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    /* 32 * 65535 columns are more than SIXEL_WIDTH_LIMIT, nothing is
+       drawn after them */
+    memcpy(sixel, "\033Pq", 3);
+    len = 3;
+    for (i = 0; i < 32; i++) {
+        memcpy(sixel + len, "!65535?", 7);
+        len += 7;
+    }
+    memcpy(sixel + len, "\033\\", 2);
+    len += 2;
+
+    status = test_decode((char const *)sixel, len, &pixels, &width, &height,
+                         allocator);
+    if (status != SIXEL_BAD_INPUT) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_free(allocator, pixels);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+SIXELAPI int
+sixel_fromsixel_tests_main(void)
+{
+    int nret = EXIT_FAILURE;
+    size_t i;
+    typedef int (* testcase)(void);
+
+    static testcase const testcases[] = {
+        test1,
+        test2,
+        test3,
+        test4,
+        test5,
+        test6,
+        test7,
+    };
+
+    for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
+        nret = testcases[i]();
+        if (nret != EXIT_SUCCESS) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
+}
+#endif  /* HAVE_TESTS */
+
 /* emacs Local Variables:      */
 /* emacs mode: c               */
 /* emacs tab-width: 4          */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2014-2020 Hayaki Saito
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBSIXEL_FROMSIXEL_H
+#define LIBSIXEL_FROMSIXEL_H
+
+#include <sixel.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* decoder state for sixel data given in pieces */
+struct sixel_decode_stream;
+typedef struct sixel_decode_stream sixel_decode_stream_t;
+
+/* create a decoder state, completed bands are passed to fn_band if it
+   is given, otherwise the whole image is returned when it is finished */
+SIXELSTATUS
+sixel_decode_stream_new(
+    sixel_decode_stream_t   /* out */ **ppstream,   /* decoder state to be created */
+    sixel_band_function     /* in */  fn_band,      /* callback for bands, or NULL */
+    void                    /* in */  *priv,        /* private data for fn_band */
+    sixel_allocator_t       /* in */  *allocator);  /* allocator object */
+
+/* destroy a decoder state */
+void
+sixel_decode_stream_destroy(
+    sixel_decode_stream_t   /* in */ *stream);  /* decoder state */
+
+/* decode sixel data given with several threads, the data is kept until
+   the stream is finished */
+void
+sixel_decode_stream_set_threads(
+    sixel_decode_stream_t   /* in */ *stream,   /* decoder state */
+    int                     /* in */ nthreads); /* number of threads */
+
+/* parse a piece of sixel data, data after the string terminator is
+   ignored */
+SIXELSTATUS
+sixel_decode_stream_feed(
+    sixel_decode_stream_t   /* in */ *stream,   /* decoder state */
+    unsigned char const     /* in */ *p,        /* sixel bytes */
+    int                     /* in */ len);      /* size of sixel bytes */
+
+/* parse the whole sixel data at once, the data is not copied to be
+   decoded with several threads */
+SIXELSTATUS
+sixel_decode_stream_feed_all(
+    sixel_decode_stream_t   /* in */ *stream,   /* decoder state */
+    unsigned char const     /* in */ *p,        /* sixel bytes */
+    int                     /* in */ len);      /* size of sixel bytes */
+
+/* finish decoding, the rest of bands are passed to the callback, or the
+   whole image is returned if no callback is given */
+SIXELSTATUS
+sixel_decode_stream_finish(
+    sixel_decode_stream_t   /* in */  *stream,      /* decoder state */
+    unsigned char           /* out */ **pixels,     /* decoded pixels, or NULL */
+    int                     /* out */ *pwidth,      /* image width */
+    int                     /* out */ *pheight,     /* image height */
+    unsigned char           /* out */ **palette,    /* RGB palette, or NULL */
+    int                     /* out */ *ncolors);    /* palette size (<= 256) */
+
+#if HAVE_TESTS
+int
+sixel_fromsixel_tests_main(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSIXEL_FROMSIXEL_H */
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
@@ -64,6 +64,7 @@
 #include "frompnm.h"
 #include "fromgif.h"
 #include "allocator.h"
+#include "loader.h"
 
 sixel_allocator_t *stbi_allocator;
 
@@ -156,6 +157,8 @@ load_jpeg(unsigned char **result,
           int *pwidth,
           int *pheight,
           int *ppixelformat,
+          int hint_width,
+          int hint_height,
           sixel_allocator_t *allocator)
 {
     SIXELSTATUS status = SIXEL_JPEG_ERROR;
@@ -164,6 +167,7 @@ load_jpeg(unsigned char **result,
     JSAMPARRAY buffer;
     struct jpeg_decompress_struct cinfo;
     struct jpeg_error_mgr pub;
+    unsigned int denom;
 
     cinfo.err = jpeg_std_error(&pub);
 
@@ -171,6 +175,21 @@ load_jpeg(unsigned char **result,
     jpeg_mem_src(&cinfo, data, datasize);
     jpeg_read_header(&cinfo, TRUE);
 
+    /* decode at 1/2, 1/4 or 1/8 scale in DCT domain, as long as
+       the image does not get smaller than the requested size */
+    if (hint_width > 0 || hint_height > 0) {
+        for (denom = 8; denom > 1; denom /= 2) {
+            if ((hint_width <= 0 ||
+                 (cinfo.image_width + denom - 1) / denom >= (unsigned int)hint_width) &&
+                (hint_height <= 0 ||
+                 (cinfo.image_height + denom - 1) / denom >= (unsigned int)hint_height)) {
+                break;
+            }
+        }
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = denom;
+    }
+
     /* disable colormap (indexed color), grayscale -> rgb */
     cinfo.quantize_colors = FALSE;
     cinfo.out_color_space = JCS_RGB;
@@ -716,7 +735,7 @@ chunk_is_sixel(sixel_chunk_t const *chunk)
         return 0;
     }
     if (*(p - 1) == 0x90 || (*(p - 1) == 0x1b && *p == 0x50)) {
-        while (p++ < end) {
+        while (++p < end) {
             if (*p == 0x71) {
                 return 1;
             } else if (*p == 0x18 || *p == 0x1a) {
@@ -800,6 +819,128 @@ chunk_is_jpeg(sixel_chunk_t const *chunk)
 }
 #endif  /* HAVE_JPEG */
 
+/* detect the format of given chunk from its magic bytes, returns one of
+   SIXEL_FORMAT_* or -1 if unknown */
+static int
+detect_file_format(sixel_chunk_t const *chunk)
+{
+    unsigned char const *data = chunk->buffer;
+    size_t len = chunk->size;
+
+    if (len < 2) {
+        return (-1);
+    }
+
+    if (len >= 18 && memcmp("TRUEVISION", data + len - 18, 10) == 0) {
+        return SIXEL_FORMAT_TGA;
+    }
+
+    if (len >= 3 && memcmp("GIF", data, 3) == 0) {
+        return SIXEL_FORMAT_GIF;
+    }
+
+    if (len >= 8 && memcmp("\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", data, 8) == 0) {
+        return SIXEL_FORMAT_PNG;
+    }
+
+    if (memcmp("BM", data, 2) == 0) {
+        return SIXEL_FORMAT_BMP;
+    }
+
+    if (memcmp("\xFF\xD8", data, 2) == 0) {
+        return SIXEL_FORMAT_JPG;
+    }
+
+    if (memcmp("\x00\x00", data, 2) == 0) {
+        return SIXEL_FORMAT_WBMP;
+    }
+
+    if (memcmp("\x4D\x4D", data, 2) == 0) {
+        return SIXEL_FORMAT_TIFF;
+    }
+
+    if (memcmp("\x49\x49", data, 2) == 0) {
+        return SIXEL_FORMAT_TIFF;
+    }
+
+    if (memcmp("\033P", data, 2) == 0) {
+        return SIXEL_FORMAT_SIXEL;
+    }
+
+    if (data[0] == 0x90  && (data[len-1] == 0x9C || data[len-2] == 0x9C)) {
+        return SIXEL_FORMAT_SIXEL;
+    }
+
+    if (data[0] == 'P' && data[1] >= '1' && data[1] <= '6') {
+        return SIXEL_FORMAT_PNM;
+    }
+
+    if (len >= 3 && memcmp("gd2", data, 3) == 0) {
+        return SIXEL_FORMAT_GD2;
+    }
+
+    if (len >= 4 && memcmp("8BPS", data, 4) == 0) {
+        return SIXEL_FORMAT_PSD;
+    }
+
+    if (len >= 11 && memcmp("#?RADIANCE\n", data, 11) == 0) {
+        return SIXEL_FORMAT_HDR;
+    }
+
+    return (-1);
+}
+
+
+/* image loader backends */
+enum loader_backend {
+    LOADER_END = 0,         /* terminator of a list of backends */
+    LOADER_BUILTIN,         /* builtin loaders */
+    LOADER_GDKPIXBUF,       /* gdk-pixbuf */
+    LOADER_GD               /* libgd */
+};
+
+/* backends to be tried in order for each format. each failed attempt
+   parses the whole input, so formats which only builtin loaders read
+   do not go through the others. builtin loaders are always the last
+   resort */
+static struct loader_preference {
+    int format;
+    int backends[4];
+} const loader_preferences[] = {
+    { SIXEL_FORMAT_SIXEL,   { LOADER_BUILTIN } },
+    { SIXEL_FORMAT_PNM,     { LOADER_BUILTIN } },
+    { SIXEL_FORMAT_PSD,     { LOADER_BUILTIN } },
+    { SIXEL_FORMAT_HDR,     { LOADER_BUILTIN } },
+    { SIXEL_FORMAT_GIF,     { LOADER_GDKPIXBUF, LOADER_BUILTIN } },
+    /* ICO and CUR also start with two zero bytes */
+    { SIXEL_FORMAT_WBMP,    { LOADER_GD, LOADER_GDKPIXBUF, LOADER_BUILTIN } },
+    { SIXEL_FORMAT_GD2,     { LOADER_GD, LOADER_BUILTIN } },
+};
+
+/* backends for the other formats */
+static int const loader_default_backends[] = {
+    LOADER_GDKPIXBUF, LOADER_GD, LOADER_BUILTIN, LOADER_END
+};
+
+
+/* get the list of backends to be tried for given chunk */
+static int const *
+lookup_backends(sixel_chunk_t const *chunk)
+{
+    int format;
+    size_t i;
+
+    format = detect_file_format(chunk);
+    for (i = 0; i < sizeof(loader_preferences) / sizeof(loader_preferences[0]); ++i) {
+        if (loader_preferences[i].format == format) {
+            return loader_preferences[i].backends;
+        }
+    }
+
+    return loader_default_backends;
+}
+
+
 typedef union _fn_pointer {
     sixel_load_image_function fn;
     void *                    p;
@@ -814,6 +955,8 @@ load_with_builtin(
     int                       /* in */     reqcolors,    /* reqcolors */
     unsigned char             /* in */     *bgcolor,     /* background color */
     int                       /* in */     loop_control, /* one of enum loop_control */
+    int                       /* in */     hint_width,   /* requested width, 0 if not specified */
+    int                       /* in */     hint_height,  /* requested height, 0 if not specified */
     sixel_load_image_function /* in */     fn_load,      /* callback */
     void                      /* in/out */ *context      /* private data for callback */
 )
@@ -873,6 +1016,8 @@ load_with_builtin(
                            &frame->width,
                            &frame->height,
                            &frame->pixelformat,
+                           hint_width,
+                           hint_height,
                            pchunk->allocator);
 
         if (SIXEL_FAILED(status)) {
@@ -1146,69 +1291,6 @@ end:
 #endif  /* HAVE_GDK_PIXBUF2 */
 
 #ifdef HAVE_GD
-static int
-detect_file_format(int len, unsigned char *data)
-{
-    if (memcmp("TRUEVISION", data + len - 18, 10) == 0) {
-        return SIXEL_FORMAT_TGA;
-    }
-
-    if (memcmp("GIF", data, 3) == 0) {
-        return SIXEL_FORMAT_GIF;
-    }
-
-    if (memcmp("\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", data, 8) == 0) {
-        return SIXEL_FORMAT_PNG;
-    }
-
-    if (memcmp("BM", data, 2) == 0) {
-        return SIXEL_FORMAT_BMP;
-    }
-
-    if (memcmp("\xFF\xD8", data, 2) == 0) {
-        return SIXEL_FORMAT_JPG;
-    }
-
-    if (memcmp("\x00\x00", data, 2) == 0) {
-        return SIXEL_FORMAT_WBMP;
-    }
-
-    if (memcmp("\x4D\x4D", data, 2) == 0) {
-        return SIXEL_FORMAT_TIFF;
-    }
-
-    if (memcmp("\x49\x49", data, 2) == 0) {
-        return SIXEL_FORMAT_TIFF;
-    }
-
-    if (memcmp("\033P", data, 2) == 0) {
-        return SIXEL_FORMAT_SIXEL;
-    }
-
-    if (data[0] == 0x90  && (data[len-1] == 0x9C || data[len-2] == 0x9C)) {
-        return SIXEL_FORMAT_SIXEL;
-    }
-
-    if (data[0] == 'P' && data[1] >= '1' && data[1] <= '6') {
-        return SIXEL_FORMAT_PNM;
-    }
-
-    if (memcmp("gd2", data, 3) == 0) {
-        return SIXEL_FORMAT_GD2;
-    }
-
-    if (memcmp("8BPS", data, 4) == 0) {
-        return SIXEL_FORMAT_PSD;
-    }
-
-    if (memcmp("#?RADIANCE\n", data, 11) == 0) {
-        return SIXEL_FORMAT_HDR;
-    }
-
-    return (-1);
-}
-
-
 static SIXELSTATUS
 load_with_gd(
     sixel_chunk_t const       /* in */     *pchunk,      /* image data */
@@ -1239,7 +1321,7 @@ load_with_gd(
         goto end;
     }
 
-    switch (detect_file_format(pchunk->size, pchunk->buffer)) {
+    switch (detect_file_format(pchunk)) {
 #if 0
 # if HAVE_DECL_GDIMAGECREATEFROMGIFPTR
         case SIXEL_FORMAT_GIF:
@@ -1346,16 +1428,20 @@ end:
 #endif  /* HAVE_GD */
 
 
-/* load image from file */
+/* load image from file, with a hint of the size which the image will be
+   resized to. decoders which can reduce the image while decoding may
+   produce an image smaller than the original, but not smaller than the hint */
 
-SIXELAPI SIXELSTATUS
-sixel_helper_load_image_file(
+SIXELSTATUS
+sixel_loader_load_file(
     char const                /* in */     *filename,     /* source file name */
     int                       /* in */     fstatic,       /* whether to extract static image from animated gif */
     int                       /* in */     fuse_palette,  /* whether to use paletted image, set non-zero value to try to get paletted image */
     int                       /* in */     reqcolors,     /* requested number of colors, should be equal or less than SIXEL_PALETTE_MAX */
     unsigned char             /* in */     *bgcolor,      /* background color, may be NULL */
     int                       /* in */     loop_control,  /* one of enum loopControl */
+    int                       /* in */     hint_width,    /* requested width, 0 if not specified */
+    int                       /* in */     hint_height,   /* requested height, 0 if not specified */
     sixel_load_image_function /* in */     fn_load,       /* callback */
     int                       /* in */     finsecure,     /* true if do not verify SSL */
     int const                 /* in */     *cancel_flag,  /* cancel flag, may be NULL */
@@ -1365,6 +1451,7 @@ sixel_helper_load_image_file(
 {
     SIXELSTATUS status = SIXEL_FALSE;
     sixel_chunk_t *pchunk = NULL;
+    int const *backends;
 
     /* normalize reqested colors */
     if (reqcolors > SIXEL_PALETTE_MAX) {
@@ -1389,40 +1476,54 @@ sixel_helper_load_image_file(
         goto end;
     }
 
+    /* try the backends for the format of the chunk until one of them
+       succeeds */
     status = SIXEL_FALSE;
+    for (backends = lookup_backends(pchunk); *backends != LOADER_END; ++backends) {
+        switch (*backends) {
 #ifdef HAVE_GDK_PIXBUF2
-    if (SIXEL_FAILED(status)) {
-        status = load_with_gdkpixbuf(pchunk,
-                                     fstatic,
-                                     fuse_palette,
-                                     reqcolors,
-                                     bgcolor,
-                                     loop_control,
-                                     fn_load,
-                                     context);
-    }
+        case LOADER_GDKPIXBUF:
+            status = load_with_gdkpixbuf(pchunk,
+                                         fstatic,
+                                         fuse_palette,
+                                         reqcolors,
+                                         bgcolor,
+                                         loop_control,
+                                         fn_load,
+                                         context);
+            break;
 #endif  /* HAVE_GDK_PIXBUF2 */
 #if HAVE_GD
-    if (SIXEL_FAILED(status)) {
-        status = load_with_gd(pchunk,
-                              fstatic,
-                              fuse_palette,
-                              reqcolors,
-                              bgcolor,
-                              loop_control,
-                              fn_load,
-                              context);
-    }
+        case LOADER_GD:
+            status = load_with_gd(pchunk,
+                                  fstatic,
+                                  fuse_palette,
+                                  reqcolors,
+                                  bgcolor,
+                                  loop_control,
+                                  fn_load,
+                                  context);
+            break;
 #endif  /* HAVE_GD */
-    if (SIXEL_FAILED(status)) {
-        status = load_with_builtin(pchunk,
-                                   fstatic,
-                                   fuse_palette,
-                                   reqcolors,
-                                   bgcolor,
-                                   loop_control,
-                                   fn_load,
-                                   context);
+        case LOADER_BUILTIN:
+            status = load_with_builtin(pchunk,
+                                       fstatic,
+                                       fuse_palette,
+                                       reqcolors,
+                                       bgcolor,
+                                       loop_control,
+                                       hint_width,
+                                       hint_height,
+                                       fn_load,
+                                       context);
+            break;
+        default:
+            /* the backend is not available in this build */
+            break;
+        }
+        if (SIXEL_SUCCEEDED(status)) {
+            break;
+        }
     }
     if (SIXEL_FAILED(status)) {
         goto end;
@@ -1435,6 +1536,29 @@ end:
 }
 
 
+/* load image from file */
+
+SIXELAPI SIXELSTATUS
+sixel_helper_load_image_file(
+    char const                /* in */     *filename,     /* source file name */
+    int                       /* in */     fstatic,       /* whether to extract static image from animated gif */
+    int                       /* in */     fuse_palette,  /* whether to use paletted image, set non-zero value to try to get paletted image */
+    int                       /* in */     reqcolors,     /* requested number of colors, should be equal or less than SIXEL_PALETTE_MAX */
+    unsigned char             /* in */     *bgcolor,      /* background color, may be NULL */
+    int                       /* in */     loop_control,  /* one of enum loopControl */
+    sixel_load_image_function /* in */     fn_load,       /* callback */
+    int                       /* in */     finsecure,     /* true if do not verify SSL */
+    int const                 /* in */     *cancel_flag,  /* cancel flag, may be NULL */
+    void                      /* in/out */ *context,      /* private data which is passed to callback function as an argument, may be NULL */
+    sixel_allocator_t         /* in */     *allocator     /* allocator object, may be NULL */
+)
+{
+    return sixel_loader_load_file(filename, fstatic, fuse_palette, reqcolors,
+                                  bgcolor, loop_control, 0, 0, fn_load,
+                                  finsecure, cancel_flag, context, allocator);
+}
+
+
 #if HAVE_TESTS
 static int
 test1(void)
@@ -1453,6 +1577,144 @@ error:
 }
 
 
+#if HAVE_JPEG
+static SIXELSTATUS
+test2_callback(sixel_frame_t *frame, void *context)
+{
+    int *size = (int *)context;
+
+    size[0] = sixel_frame_get_width(frame);
+    size[1] = sixel_frame_get_height(frame);
+
+    return SIXEL_OK;
+}
+#endif  /* HAVE_JPEG */
+
+
+/* JPEG is decoded in reduced size if a size hint is given */
+static int
+test2(void)
+{
+    int nret = EXIT_FAILURE;
+#if HAVE_JPEG
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    int size[2];
+    size_t i;
+    int const cases[][4] = {
+        /* hint_width, hint_height, width, height (egret.jpg is 600x450) */
+        {   0,   0, 600, 450 },
+        { 100,   0, 150, 113 },
+        {   0, 300, 600, 450 },
+        { 200, 100, 300, 225 },
+    };
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        status = sixel_loader_load_file("../images/egret.jpg", 1, 0, 256, NULL,
+                                        SIXEL_LOOP_AUTO, cases[i][0], cases[i][1],
+                                        test2_callback, 0, NULL, size, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (size[0] != cases[i][2] || size[1] != cases[i][3]) {
+            goto error;
+        }
+    }
+#endif  /* HAVE_JPEG */
+
+    nret = EXIT_SUCCESS;
+
+#if HAVE_JPEG
+error:
+    sixel_allocator_unref(allocator);
+#endif  /* HAVE_JPEG */
+    return nret;
+}
+
+
+/* formats are detected from magic bytes, and formats only builtin
+   loaders read are routed to them directly */
+static int
+test3(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    sixel_chunk_t *chunk = NULL;
+    sixel_chunk_t empty = {(unsigned char *)"P", 1, 1, NULL, 0};
+    sixel_chunk_t icon = {(unsigned char *)"\x00\x00\x01\x00\x01\x00", 6, 6, NULL, 0};
+    int const *backends;
+    size_t i;
+    static struct {
+        char const *path;
+        int format;
+    } const cases[] = {
+        { "../images/snake.six",  SIXEL_FORMAT_SIXEL },
+        { "../images/snake.ppm",  SIXEL_FORMAT_PNM },
+        { "../images/snake.png",  SIXEL_FORMAT_PNG },
+        { "../images/snake.jpg",  SIXEL_FORMAT_JPG },
+        { "../images/snake.gif",  SIXEL_FORMAT_GIF },
+        { "../images/snake.bmp",  SIXEL_FORMAT_BMP },
+    };
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        status = sixel_chunk_new(&chunk, cases[i].path, 0, NULL, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (detect_file_format(chunk) != cases[i].format) {
+            goto error;
+        }
+        sixel_chunk_destroy(chunk);
+        chunk = NULL;
+    }
+
+    /* too short to be detected */
+    if (detect_file_format(&empty) != (-1)) {
+        goto error;
+    }
+    if (lookup_backends(&empty) != loader_default_backends) {
+        goto error;
+    }
+
+    /* ICO looks like WBMP, it is still given to gdk-pixbuf */
+    for (backends = lookup_backends(&icon); *backends != LOADER_END; ++backends) {
+        if (*backends == LOADER_GDKPIXBUF) {
+            break;
+        }
+    }
+    if (*backends != LOADER_GDKPIXBUF) {
+        goto error;
+    }
+
+    status = sixel_chunk_new(&chunk, "../images/map8.six", 0, NULL, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (lookup_backends(chunk)[0] != LOADER_BUILTIN ||
+        lookup_backends(chunk)[1] != LOADER_END) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_chunk_destroy(chunk);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_loader_tests_main(void)
 {
@@ -1462,6 +1724,8 @@ sixel_loader_tests_main(void)
 
     static testcase const testcases[] = {
         test1,
+        test2,
+        test3,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
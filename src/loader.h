@@ -22,10 +22,30 @@
 #ifndef LIBSIXEL_LOADER_H
 #define LIBSIXEL_LOADER_H
 
+#include <sixel.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* load image from file, same as sixel_helper_load_image_file() but
+   decoders may reduce the image down to hint_width x hint_height */
+SIXELSTATUS
+sixel_loader_load_file(
+    char const                /* in */     *filename,     /* source file name */
+    int                       /* in */     fstatic,       /* whether to extract static image from animated gif */
+    int                       /* in */     fuse_palette,  /* whether to use paletted image */
+    int                       /* in */     reqcolors,     /* requested number of colors */
+    unsigned char             /* in */     *bgcolor,      /* background color, may be NULL */
+    int                       /* in */     loop_control,  /* one of enum loopControl */
+    int                       /* in */     hint_width,    /* requested width, 0 if not specified */
+    int                       /* in */     hint_height,   /* requested height, 0 if not specified */
+    sixel_load_image_function /* in */     fn_load,       /* callback */
+    int                       /* in */     finsecure,     /* true if do not verify SSL */
+    int const                 /* in */     *cancel_flag,  /* cancel flag, may be NULL */
+    void                      /* in/out */ *context,      /* private data for callback */
+    sixel_allocator_t         /* in */     *allocator);   /* allocator object, may be NULL */
+
 #if HAVE_TESTS
 int
 sixel_loader_tests_main(void);
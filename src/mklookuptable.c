@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2014-2020 Hayaki Saito
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * generates lookuptable.h, the nearest color lookup tables of builtin
+ * palettes. run "make gen-lookuptable" in src/ to update it.
+ *
+ * color palettes are indexed by RGB555 hash like the cache table of
+ * lookup_fast() in quant.c, and each entry holds the nearest color of
+ * the center of the cell. gray palettes are indexed by R + G + B,
+ * which determines the nearest gray exactly.
+ * both of them assume the complexion score is 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "palette.h"
+
+#define LUT_RGB555_SIZE     (1 << 3 * 5)
+#define LUT_GRAYSUM_SIZE    (255 * 3 + 1)
+
+
+static int
+nearest_color(
+    unsigned char const /* in */ *palette,
+    int                 /* in */ ncolors,
+    int                 /* in */ r,
+    int                 /* in */ g,
+    int                 /* in */ b)
+{
+    int i;
+    int diff = INT_MAX;
+    int distant;
+    int result = 0;
+
+    /* same as lookup_fast(), the first one wins on a tie */
+    for (i = 0; i < ncolors; ++i) {
+        distant = (r - palette[i * 3 + 0]) * (r - palette[i * 3 + 0])
+                + (g - palette[i * 3 + 1]) * (g - palette[i * 3 + 1])
+                + (b - palette[i * 3 + 2]) * (b - palette[i * 3 + 2]);
+        if (distant < diff) {
+            diff = distant;
+            result = i;
+        }
+    }
+
+    return result;
+}
+
+
+static int
+nearest_gray(
+    unsigned char const /* in */ *palette,
+    int                 /* in */ ncolors,
+    int                 /* in */ sum)
+{
+    int i;
+    int diff = INT_MAX;
+    int distant;
+    int result = 0;
+
+    /* (r - v)^2 + (g - v)^2 + (b - v)^2 = 3v^2 - 2v(r + g + b) + const */
+    for (i = 0; i < ncolors; ++i) {
+        distant = 3 * palette[i * 3] * palette[i * 3] - 2 * palette[i * 3] * sum;
+        if (distant < diff) {
+            diff = distant;
+            result = i;
+        }
+    }
+
+    return result;
+}
+
+
+static void
+print_entries(
+    int const   /* in */ *entries,
+    int         /* in */ size)
+{
+    int i;
+
+    for (i = 0; i < size; ++i) {
+        printf(i % 16 == 0 ? "    %d,": " %d,", entries[i]);
+        if (i % 16 == 15 || i == size - 1) {
+            printf("\n");
+        }
+    }
+}
+
+
+static void
+print_rgb555_table(
+    char const          /* in */ *name,
+    unsigned char const /* in */ *palette,
+    int                 /* in */ ncolors)
+{
+    static int entries[LUT_RGB555_SIZE];
+    int hash;
+
+    for (hash = 0; hash < LUT_RGB555_SIZE; ++hash) {
+        entries[hash] = nearest_color(palette, ncolors,
+                                      (hash >> 10 & 0x1f) << 3 | 0x4,
+                                      (hash >> 5 & 0x1f) << 3 | 0x4,
+                                      (hash & 0x1f) << 3 | 0x4);
+    }
+    printf("\nstatic const unsigned char %s[%d] = {\n", name, LUT_RGB555_SIZE);
+    print_entries(entries, LUT_RGB555_SIZE);
+    printf("};\n\n");
+}
+
+
+static void
+print_graysum_table(
+    char const          /* in */ *name,
+    unsigned char const /* in */ *palette,
+    int                 /* in */ ncolors)
+{
+    static int entries[LUT_GRAYSUM_SIZE];
+    int i;
+
+    for (i = 0; i < ncolors; ++i) {
+        if (palette[i * 3] != palette[i * 3 + 1] || palette[i * 3] != palette[i * 3 + 2]) {
+            fprintf(stderr, "%s: not a gray palette.\n", name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < LUT_GRAYSUM_SIZE; ++i) {
+        entries[i] = nearest_gray(palette, ncolors, i);
+    }
+    printf("\nstatic const unsigned char %s[%d] = {\n", name, LUT_GRAYSUM_SIZE);
+    print_entries(entries, LUT_GRAYSUM_SIZE);
+    printf("};\n\n");
+}
+
+
+int
+main(void)
+{
+    printf("/* generated by mklookuptable.c, do not edit. */\n"
+           "\n"
+           "#ifndef LIBSIXEL_LOOKUPTABLE_H\n"
+           "#define LIBSIXEL_LOOKUPTABLE_H\n"
+           "\n"
+           "/* nearest color for each RGB555 cell */\n");
+    print_rgb555_table("lut_xterm16", pal_xterm256, 16);
+    print_rgb555_table("lut_xterm256", pal_xterm256, 256);
+    print_rgb555_table("lut_vt340_color", pal_vt340_color, 16);
+    printf("/* nearest gray for each value of R + G + B */\n");
+    print_graysum_table("lut_gray_2bit", pal_gray_2bit, 4);
+    print_graysum_table("lut_gray_4bit", pal_gray_4bit, 16);
+    print_graysum_table("lut_gray_8bit", pal_gray_8bit, 256);
+    print_graysum_table("lut_vt340_mono", pal_vt340_mono, 16);
+    printf("#endif /* LIBSIXEL_LOOKUPTABLE_H */\n");
+
+    return EXIT_SUCCESS;
+}
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
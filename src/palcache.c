@@ -0,0 +1,839 @@
+/*
+ * Copyright (c) 2014-2020 Hayaki Saito
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * palette file format (all multi-byte fields are little endian)
+ *
+ * This format is shared by the palette cache (-K) and the mapfile
+ * written by sixel_dither_write_palette_file() (-M), which can be
+ * given to -m without decoding and quantizing the map image again.
+ *
+ *   offset  size  description
+ *   0       4     magic "SXPL"
+ *   4       1     format version (1)
+ *   5       1     flags (bit 0: nearest color lookup table is embedded)
+ *   6       2     number of palette colors (1 - 256)
+ *   8       4     number of histogram colors
+ *   12      2     complexion score used to build the lookup table
+ *   14      2     reserved (0)
+ *   16      3n    palette entries (R, G, B)
+ *   16+3n   2^16  lookup table, 2^15 entries indexed by RGB555 hash,
+ *                 each entry holds (palette index + 1) or 0 if not computed
+ */
+
+#include "config.h"
+
+#if STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+#endif  /* STDC_HEADERS */
+#if HAVE_STRING_H
+# include <string.h>
+#endif  /* HAVE_STRING_H */
+#if HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif  /* HAVE_SYS_TYPES_H */
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif  /* HAVE_UNISTD_H */
+#if HAVE_LIMITS_H
+# include <limits.h>
+#endif  /* HAVE_LIMITS_H */
+
+#include <sixel.h>
+#include "dither.h"
+#include "palcache.h"
+
+#define PALCACHE_HEADER_SIZE    16
+#define PALCACHE_VERSION        1
+#define PALCACHE_FLAG_LUT       0x1
+#define PALCACHE_SUFFIX         ".pal"
+
+
+/* FNV-1a 64bit hash */
+static unsigned long long
+palcache_hash_bytes(
+    unsigned long long      /* in */ hash,
+    unsigned char const     /* in */ *p,
+    size_t                  /* in */ size)
+{
+    while (size--) {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+
+static unsigned long long
+palcache_hash_int(
+    unsigned long long      /* in */ hash,
+    int                     /* in */ value)
+{
+    unsigned char buf[4];
+
+    buf[0] = (unsigned char)(value & 0xff);
+    buf[1] = (unsigned char)(value >> 8 & 0xff);
+    buf[2] = (unsigned char)(value >> 16 & 0xff);
+    buf[3] = (unsigned char)(value >> 24 & 0xff);
+
+    return palcache_hash_bytes(hash, buf, sizeof(buf));
+}
+
+
+void
+sixel_palcache_compute_key(
+    char                /* out */ *key,
+    unsigned char const /* in */  *pixels,
+    int                 /* in */  width,
+    int                 /* in */  height,
+    int                 /* in */  pixelformat,
+    int                 /* in */  reqcolors,
+    int                 /* in */  method_for_largest,
+    int                 /* in */  method_for_rep,
+    int                 /* in */  quality_mode)
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    int depth;
+
+    depth = sixel_helper_compute_depth(pixelformat);
+
+    hash = palcache_hash_int(hash, PALCACHE_VERSION);
+    hash = palcache_hash_int(hash, width);
+    hash = palcache_hash_int(hash, height);
+    hash = palcache_hash_int(hash, pixelformat);
+    hash = palcache_hash_int(hash, reqcolors);
+    hash = palcache_hash_int(hash, method_for_largest);
+    hash = palcache_hash_int(hash, method_for_rep);
+    hash = palcache_hash_int(hash, quality_mode);
+    if (depth > 0) {
+        hash = palcache_hash_bytes(hash, pixels,
+                                   (size_t)width * (size_t)height * (size_t)depth);
+    }
+
+    sprintf(key, "%08lx%08lx",
+            (unsigned long)(hash >> 32 & 0xffffffff),
+            (unsigned long)(hash & 0xffffffff));
+}
+
+
+SIXELSTATUS
+sixel_palcache_read(
+    char const          /* in */  *path,
+    unsigned char       /* out */ *palette,
+    int                 /* out */ *ncolors,
+    int                 /* out */ *origcolors,
+    int                 /* out */ *complexion,
+    unsigned short      /* out */ **cachetable,
+    sixel_allocator_t   /* in */  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    FILE *f = NULL;
+    unsigned char header[PALCACHE_HEADER_SIZE];
+    unsigned char *lut = NULL;
+    int i;
+
+    *cachetable = NULL;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_read: fopen() failed.");
+        status = SIXEL_LIBC_ERROR;
+        goto end;
+    }
+
+    if (fread(header, 1, sizeof(header), f) != sizeof(header)) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_read: unexpected end of file.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    if (memcmp(header, "SXPL", 4) != 0 || header[4] != PALCACHE_VERSION) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_read: unknown file format.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    *ncolors = header[6] | header[7] << 8;
+    *origcolors = (int)((unsigned int)header[8]
+                        | (unsigned int)header[9] << 8
+                        | (unsigned int)header[10] << 16
+                        | (unsigned int)header[11] << 24);
+    *complexion = header[12] | header[13] << 8;
+    if (*ncolors < 1 || *ncolors > SIXEL_PALETTE_MAX) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_read: invalid number of colors.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    if (fread(palette, 3, (size_t)*ncolors, f) != (size_t)*ncolors) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_read: unexpected end of file.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    if (header[5] & PALCACHE_FLAG_LUT) {
+        lut = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                      SIXEL_PALCACHE_LUT_SIZE * 2);
+        if (lut == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_palcache_read: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        if (fread(lut, 2, SIXEL_PALCACHE_LUT_SIZE, f) != SIXEL_PALCACHE_LUT_SIZE) {
+            sixel_helper_set_additional_message(
+                "sixel_palcache_read: unexpected end of file.");
+            status = SIXEL_BAD_INPUT;
+            goto end;
+        }
+        *cachetable = (unsigned short *)sixel_allocator_malloc(
+            allocator, SIXEL_PALCACHE_LUT_SIZE * sizeof(unsigned short));
+        if (*cachetable == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_palcache_read: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        for (i = 0; i < SIXEL_PALCACHE_LUT_SIZE; ++i) {
+            (*cachetable)[i] = (unsigned short)(lut[i * 2] | lut[i * 2 + 1] << 8);
+            if ((*cachetable)[i] > *ncolors) {
+                sixel_helper_set_additional_message(
+                    "sixel_palcache_read: broken lookup table.");
+                status = SIXEL_BAD_INPUT;
+                goto end;
+            }
+        }
+    }
+
+    status = SIXEL_OK;
+
+end:
+    if (SIXEL_FAILED(status)) {
+        sixel_allocator_free(allocator, *cachetable);
+        *cachetable = NULL;
+    }
+    sixel_allocator_free(allocator, lut);
+    if (f) {
+        fclose(f);
+    }
+    return status;
+}
+
+
+SIXELSTATUS
+sixel_palcache_write(
+    char const          /* in */  *path,
+    unsigned char const /* in */  *palette,
+    int                 /* in */  ncolors,
+    int                 /* in */  origcolors,
+    int                 /* in */  complexion,
+    unsigned short const /* in */ *cachetable,
+    sixel_allocator_t   /* in */  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    FILE *f = NULL;
+    unsigned char *buf = NULL;
+    unsigned char *p;
+    size_t size;
+    int i;
+
+    if (ncolors < 1 || ncolors > SIXEL_PALETTE_MAX) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_write: invalid number of colors.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    size = PALCACHE_HEADER_SIZE + (size_t)ncolors * 3;
+    if (cachetable) {
+        size += SIXEL_PALCACHE_LUT_SIZE * 2;
+    }
+
+    buf = (unsigned char *)sixel_allocator_malloc(allocator, size);
+    if (buf == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_write: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    p = buf;
+    memcpy(p, "SXPL", 4);
+    p[4] = PALCACHE_VERSION;
+    p[5] = cachetable ? PALCACHE_FLAG_LUT: 0;
+    p[6] = (unsigned char)(ncolors & 0xff);
+    p[7] = (unsigned char)(ncolors >> 8 & 0xff);
+    p[8] = (unsigned char)(origcolors & 0xff);
+    p[9] = (unsigned char)(origcolors >> 8 & 0xff);
+    p[10] = (unsigned char)(origcolors >> 16 & 0xff);
+    p[11] = (unsigned char)(origcolors >> 24 & 0xff);
+    p[12] = (unsigned char)(complexion & 0xff);
+    p[13] = (unsigned char)(complexion >> 8 & 0xff);
+    p[14] = p[15] = 0;
+    p += PALCACHE_HEADER_SIZE;
+
+    memcpy(p, palette, (size_t)ncolors * 3);
+    p += ncolors * 3;
+
+    if (cachetable) {
+        for (i = 0; i < SIXEL_PALCACHE_LUT_SIZE; ++i) {
+            *p++ = (unsigned char)(cachetable[i] & 0xff);
+            *p++ = (unsigned char)(cachetable[i] >> 8 & 0xff);
+        }
+    }
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_write: fopen() failed.");
+        status = SIXEL_LIBC_ERROR;
+        goto end;
+    }
+
+    if (fwrite(buf, 1, size, f) != size) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_write: fwrite() failed.");
+        status = SIXEL_LIBC_ERROR;
+        goto end;
+    }
+
+    if (fclose(f) != 0) {
+        f = NULL;
+        sixel_helper_set_additional_message(
+            "sixel_palcache_write: fclose() failed.");
+        status = SIXEL_LIBC_ERROR;
+        goto end;
+    }
+    f = NULL;
+
+    status = SIXEL_OK;
+
+end:
+    if (f) {
+        fclose(f);
+    }
+    sixel_allocator_free(allocator, buf);
+    return status;
+}
+
+
+void
+sixel_palcache_build_lut(
+    unsigned short      /* out */ *cachetable,
+    unsigned char const /* in */  *palette,
+    int                 /* in */  ncolors,
+    int                 /* in */  complexion)
+{
+    int hash;
+    int r;
+    int g;
+    int b;
+    int i;
+    int diff;
+    int distant;
+    int result;
+
+    for (hash = 0; hash < SIXEL_PALCACHE_LUT_SIZE; ++hash) {
+        /* the center of the RGB555 cell, see computeHash() in quant.c */
+        r = (hash >> 10 & 0x1f) << 3 | 0x4;
+        g = (hash >> 5 & 0x1f) << 3 | 0x4;
+        b = (hash & 0x1f) << 3 | 0x4;
+        diff = INT_MAX;
+        result = 0;
+        for (i = 0; i < ncolors; ++i) {
+            distant = (r - palette[i * 3 + 0]) * (r - palette[i * 3 + 0]) * complexion
+                    + (g - palette[i * 3 + 1]) * (g - palette[i * 3 + 1])
+                    + (b - palette[i * 3 + 2]) * (b - palette[i * 3 + 2]);
+            if (distant < diff) {
+                diff = distant;
+                result = i;
+            }
+        }
+        cachetable[hash] = (unsigned short)(result + 1);
+    }
+}
+
+
+SIXELSTATUS
+sixel_palcache_load_file(
+    sixel_dither_t      /* out */ **dither,
+    char const          /* in */  *path,
+    int                 /* in */  complexion,
+    sixel_allocator_t   /* in */  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    FILE *f;
+    unsigned char magic[4];
+    size_t n;
+    unsigned char palette[SIXEL_PALETTE_MAX * 3];
+    unsigned short *cachetable = NULL;
+    int ncolors;
+    int origcolors;
+    int lut_complexion;
+
+    *dither = NULL;
+
+    /* leave stdin and unreadable paths (e.g. URLs) to the image loader */
+    if (strcmp(path, "-") == 0) {
+        status = SIXEL_OK;
+        goto end;
+    }
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        status = SIXEL_OK;
+        goto end;
+    }
+    n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    if (n != sizeof(magic) || memcmp(magic, "SXPL", 4) != 0) {
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    status = sixel_palcache_read(path, palette, &ncolors, &origcolors,
+                                 &lut_complexion, &cachetable, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    /* the lookup table depends on the complexion score */
+    if (cachetable && lut_complexion != complexion) {
+        sixel_allocator_free(allocator, cachetable);
+        cachetable = NULL;
+    }
+
+    status = sixel_dither_new(dither, ncolors, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_dither_initialize_with_palette(*dither,
+                                                  palette,
+                                                  ncolors,
+                                                  origcolors,
+                                                  cachetable,
+                                                  SIXEL_LARGE_AUTO,
+                                                  SIXEL_REP_AUTO,
+                                                  SIXEL_QUALITY_AUTO);
+    if (SIXEL_FAILED(status)) {
+        sixel_dither_unref(*dither);
+        *dither = NULL;
+        goto end;
+    }
+    cachetable = NULL;  /* owned by the dither object */
+
+    status = SIXEL_OK;
+
+end:
+    sixel_allocator_free(allocator, cachetable);
+    return status;
+}
+
+
+/* build "<dirname>/<key>.pal" */
+static char *
+palcache_make_path(
+    char const          /* in */ *dirname,
+    char const          /* in */ *key,
+    sixel_allocator_t   /* in */ *allocator)
+{
+    char *path;
+    size_t size;
+
+    size = strlen(dirname) + 1 + strlen(key) + sizeof(PALCACHE_SUFFIX);
+    path = (char *)sixel_allocator_malloc(allocator, size);
+    if (path) {
+        sprintf(path, "%s/%s" PALCACHE_SUFFIX, dirname, key);
+    }
+
+    return path;
+}
+
+
+SIXELSTATUS
+sixel_palcache_load(
+    sixel_dither_t      /* out */ **dither,
+    char const          /* in */  *dirname,
+    char const          /* in */  *key,
+    int                 /* in */  reqcolors,
+    int                 /* in */  method_for_largest,
+    int                 /* in */  method_for_rep,
+    int                 /* in */  quality_mode,
+    int                 /* in */  complexion,
+    sixel_allocator_t   /* in */  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    char *path = NULL;
+    unsigned char palette[SIXEL_PALETTE_MAX * 3];
+    unsigned short *cachetable = NULL;
+    int ncolors;
+    int origcolors;
+    int lut_complexion;
+
+    *dither = NULL;
+
+    path = palcache_make_path(dirname, key, allocator);
+    if (path == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_load: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    /* any trouble with the cache file is treated as a cache miss */
+    status = sixel_palcache_read(path, palette, &ncolors, &origcolors,
+                                 &lut_complexion, &cachetable, allocator);
+    if (SIXEL_FAILED(status) || ncolors > reqcolors) {
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    /* the lookup table depends on the complexion score */
+    if (cachetable && lut_complexion != complexion) {
+        sixel_allocator_free(allocator, cachetable);
+        cachetable = NULL;
+    }
+
+    status = sixel_dither_new(dither, reqcolors, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_dither_initialize_with_palette(*dither,
+                                                  palette,
+                                                  ncolors,
+                                                  origcolors,
+                                                  cachetable,
+                                                  method_for_largest,
+                                                  method_for_rep,
+                                                  quality_mode);
+    if (SIXEL_FAILED(status)) {
+        sixel_dither_unref(*dither);
+        *dither = NULL;
+        goto end;
+    }
+    cachetable = NULL;  /* owned by the dither object */
+
+    status = SIXEL_OK;
+
+end:
+    sixel_allocator_free(allocator, cachetable);
+    sixel_allocator_free(allocator, path);
+    return status;
+}
+
+
+SIXELSTATUS
+sixel_palcache_store(
+    sixel_dither_t      /* in */  *dither,
+    unsigned char const /* in */  *palette,
+    int                 /* in */  ncolors,
+    char const          /* in */  *dirname,
+    char const          /* in */  *key,
+    int                 /* in */  complexion)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_allocator_t *allocator = dither->allocator;
+    char *path = NULL;
+    char *tmppath = NULL;
+    size_t size;
+
+    path = palcache_make_path(dirname, key, allocator);
+    if (path == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_store: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    /* write into a temporary file and rename it, so that concurrent
+       encoders never observe a partially written cache entry */
+    size = strlen(path) + 32;
+    tmppath = (char *)sixel_allocator_malloc(allocator, size);
+    if (tmppath == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_palcache_store: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+#if HAVE_UNISTD_H
+    sprintf(tmppath, "%s.%lu.tmp", path, (unsigned long)getpid());
+#else
+    sprintf(tmppath, "%s.tmp", path);
+#endif
+
+    status = sixel_palcache_write(tmppath,
+                                  palette,
+                                  ncolors,
+                                  dither->origcolors,
+                                  complexion,
+                                  dither->cachetable,
+                                  allocator);
+    if (SIXEL_FAILED(status)) {
+        (void) remove(tmppath);
+        goto end;
+    }
+
+    if (rename(tmppath, path) != 0) {
+        /* some platforms refuse to overwrite an existing file */
+        (void) remove(path);
+        if (rename(tmppath, path) != 0) {
+            (void) remove(tmppath);
+            sixel_helper_set_additional_message(
+                "sixel_palcache_store: rename() failed.");
+            status = SIXEL_LIBC_ERROR;
+            goto end;
+        }
+    }
+
+    status = SIXEL_OK;
+
+end:
+    sixel_allocator_free(allocator, tmppath);
+    sixel_allocator_free(allocator, path);
+    return status;
+}
+
+
+#if HAVE_TESTS
+static int
+test1(void)
+{
+    int nret = EXIT_FAILURE;
+    char key1[SIXEL_PALCACHE_KEY_LENGTH + 1];
+    char key2[SIXEL_PALCACHE_KEY_LENGTH + 1];
+    unsigned char pixels[] = { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc };
+
+    sixel_palcache_compute_key(key1, pixels, 2, 1, SIXEL_PIXELFORMAT_RGB888,
+                               256, SIXEL_LARGE_AUTO, SIXEL_REP_AUTO,
+                               SIXEL_QUALITY_AUTO);
+    if (strlen(key1) != SIXEL_PALCACHE_KEY_LENGTH) {
+        goto error;
+    }
+
+    /* same input produces same key */
+    sixel_palcache_compute_key(key2, pixels, 2, 1, SIXEL_PIXELFORMAT_RGB888,
+                               256, SIXEL_LARGE_AUTO, SIXEL_REP_AUTO,
+                               SIXEL_QUALITY_AUTO);
+    if (strcmp(key1, key2) != 0) {
+        goto error;
+    }
+
+    /* quantization parameters are a part of the key */
+    sixel_palcache_compute_key(key2, pixels, 2, 1, SIXEL_PIXELFORMAT_RGB888,
+                               16, SIXEL_LARGE_AUTO, SIXEL_REP_AUTO,
+                               SIXEL_QUALITY_AUTO);
+    if (strcmp(key1, key2) == 0) {
+        goto error;
+    }
+
+    /* pixel contents are a part of the key */
+    pixels[5] ^= 1;
+    sixel_palcache_compute_key(key2, pixels, 2, 1, SIXEL_PIXELFORMAT_RGB888,
+                               256, SIXEL_LARGE_AUTO, SIXEL_REP_AUTO,
+                               SIXEL_QUALITY_AUTO);
+    if (strcmp(key1, key2) == 0) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
+}
+
+
+static int
+test2(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char palette[] = { 0x00, 0x00, 0x00, 0xff, 0x80, 0x40 };
+    unsigned char result[SIXEL_PALETTE_MAX * 3];
+    unsigned short *cachetable = NULL;
+    unsigned short *loaded = NULL;
+    int ncolors;
+    int origcolors;
+    int complexion;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    cachetable = (unsigned short *)sixel_allocator_calloc(allocator,
+                                                          SIXEL_PALCACHE_LUT_SIZE,
+                                                          sizeof(unsigned short));
+    if (cachetable == NULL) {
+        goto error;
+    }
+    cachetable[0] = 1;
+    cachetable[SIXEL_PALCACHE_LUT_SIZE - 1] = 2;
+
+    status = sixel_palcache_write("test-output.pal", palette, 2, 1234, 3,
+                                  cachetable, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_palcache_read("test-output.pal", result, &ncolors,
+                                 &origcolors, &complexion, &loaded, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (ncolors != 2 || origcolors != 1234 || complexion != 3) {
+        goto error;
+    }
+    if (memcmp(result, palette, sizeof(palette)) != 0) {
+        goto error;
+    }
+    if (loaded == NULL) {
+        goto error;
+    }
+    if (memcmp(loaded, cachetable,
+               SIXEL_PALCACHE_LUT_SIZE * sizeof(unsigned short)) != 0) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_free(allocator, cachetable);
+    sixel_allocator_free(allocator, loaded);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+static int
+test3(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    sixel_dither_t *dither = NULL;
+    unsigned char palette[] = { 0x00, 0x00, 0x00, 0xff, 0xff, 0xff };
+    FILE *f;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    /* a file without the magic is not a palette file */
+    f = fopen("test-output.pal", "wb");
+    if (f == NULL) {
+        goto error;
+    }
+    fputs("P6\n1 1\n255\n", f);
+    fclose(f);
+    status = sixel_palcache_load_file(&dither, "test-output.pal", 1, allocator);
+    if (SIXEL_FAILED(status) || dither != NULL) {
+        goto error;
+    }
+
+    status = sixel_dither_new(&dither, 2, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    sixel_dither_set_palette(dither, palette);
+    status = sixel_dither_write_palette_file(dither, "test-output.pal", 1);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    sixel_dither_unref(dither);
+    dither = NULL;
+
+    status = sixel_palcache_load_file(&dither, "test-output.pal", 1, allocator);
+    if (SIXEL_FAILED(status) || dither == NULL) {
+        goto error;
+    }
+    if (dither->ncolors != 2 || memcmp(dither->palette, palette, sizeof(palette)) != 0) {
+        goto error;
+    }
+    if (dither->cachetable == NULL) {
+        goto error;
+    }
+    /* darkest and brightest cells map to black and white */
+    if (dither->cachetable[0] != 1 || dither->cachetable[SIXEL_PALCACHE_LUT_SIZE - 1] != 2) {
+        goto error;
+    }
+    sixel_dither_unref(dither);
+    dither = NULL;
+
+    /* the lookup table is dropped if the complexion score differs */
+    status = sixel_palcache_load_file(&dither, "test-output.pal", 2, allocator);
+    if (SIXEL_FAILED(status) || dither == NULL || dither->cachetable != NULL) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_dither_unref(dither);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+SIXELAPI int
+sixel_palcache_tests_main(void)
+{
+    int nret = EXIT_FAILURE;
+    size_t i;
+    typedef int (* testcase)(void);
+
+    static testcase const testcases[] = {
+        test1,
+        test2,
+        test3,
+    };
+
+    for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
+        nret = testcases[i]();
+        if (nret != EXIT_SUCCESS) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
+}
+#endif  /* HAVE_TESTS */
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
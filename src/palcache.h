@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2014-2020 Hayaki Saito
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBSIXEL_PALCACHE_H
+#define LIBSIXEL_PALCACHE_H
+
+#include <sixel.h>
+
+/* length of cache key (hexadecimal representation of 64bit hash) */
+#define SIXEL_PALCACHE_KEY_LENGTH   16
+
+/* number of entries of nearest color lookup table (RGB555) */
+#define SIXEL_PALCACHE_LUT_SIZE     (1 << 3 * 5)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* compute a cache key from frame contents and quantization parameters */
+void
+sixel_palcache_compute_key(
+    char                /* out */ *key,                 /* SIXEL_PALCACHE_KEY_LENGTH + 1 bytes */
+    unsigned char const /* in */  *pixels,              /* pixel buffer */
+    int                 /* in */  width,                /* image width */
+    int                 /* in */  height,               /* image height */
+    int                 /* in */  pixelformat,          /* one of enum pixelFormat */
+    int                 /* in */  reqcolors,            /* requested colors */
+    int                 /* in */  method_for_largest,   /* method for finding the largest dimention */
+    int                 /* in */  method_for_rep,       /* method for choosing a color from the box */
+    int                 /* in */  quality_mode);        /* quality of histogram */
+
+/* read a palette file */
+SIXELSTATUS
+sixel_palcache_read(
+    char const          /* in */  *path,        /* palette file path */
+    unsigned char       /* out */ *palette,     /* SIXEL_PALETTE_MAX * 3 bytes */
+    int                 /* out */ *ncolors,     /* number of palette colors */
+    int                 /* out */ *origcolors,  /* number of histogram colors */
+    int                 /* out */ *complexion,  /* complexion score of lookup table */
+    unsigned short      /* out */ **cachetable, /* lookup table, or NULL if absent */
+    sixel_allocator_t   /* in */  *allocator);  /* allocator object */
+
+/* write a palette file */
+SIXELSTATUS
+sixel_palcache_write(
+    char const          /* in */  *path,        /* palette file path */
+    unsigned char const /* in */  *palette,     /* palette definition */
+    int                 /* in */  ncolors,      /* number of palette colors */
+    int                 /* in */  origcolors,   /* number of histogram colors */
+    int                 /* in */  complexion,   /* complexion score of lookup table */
+    unsigned short const /* in */ *cachetable,  /* lookup table, or NULL */
+    sixel_allocator_t   /* in */  *allocator);  /* allocator object */
+
+/* fill all entries of a nearest color lookup table for the palette */
+void
+sixel_palcache_build_lut(
+    unsigned short      /* out */ *cachetable,  /* SIXEL_PALCACHE_LUT_SIZE entries */
+    unsigned char const /* in */  *palette,     /* palette definition */
+    int                 /* in */  ncolors,      /* number of palette colors */
+    int                 /* in */  complexion);  /* complexion score */
+
+/* create a dither object from a palette file given as a mapfile,
+   *dither is set to NULL if the file is not a palette file */
+SIXELSTATUS
+sixel_palcache_load_file(
+    sixel_dither_t      /* out */ **dither,     /* dither object to be created */
+    char const          /* in */  *path,        /* mapfile path */
+    int                 /* in */  complexion,   /* complexion score */
+    sixel_allocator_t   /* in */  *allocator);  /* allocator object */
+
+/* restore a dither object from the cache directory,
+   *dither is set to NULL if the cache entry is not available */
+SIXELSTATUS
+sixel_palcache_load(
+    sixel_dither_t      /* out */ **dither,             /* dither object to be created */
+    char const          /* in */  *dirname,             /* cache directory */
+    char const          /* in */  *key,                 /* cache key */
+    int                 /* in */  reqcolors,            /* requested colors */
+    int                 /* in */  method_for_largest,   /* method for finding the largest dimention */
+    int                 /* in */  method_for_rep,       /* method for choosing a color from the box */
+    int                 /* in */  quality_mode,         /* quality of histogram */
+    int                 /* in */  complexion,           /* complexion score */
+    sixel_allocator_t   /* in */  *allocator);          /* allocator object */
+
+/* save the palette and the lookup table of a dither object into the cache directory */
+SIXELSTATUS
+sixel_palcache_store(
+    sixel_dither_t      /* in */  *dither,      /* dither object */
+    unsigned char const /* in */  *palette,     /* palette before optimization */
+    int                 /* in */  ncolors,      /* number of palette colors */
+    char const          /* in */  *dirname,     /* cache directory */
+    char const          /* in */  *key,         /* cache key */
+    int                 /* in */  complexion);  /* complexion score */
+
+#if HAVE_TESTS
+int
+sixel_palcache_tests_main(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSIXEL_PALCACHE_H */
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
@@ -25,105 +25,32 @@
 # include <stdio.h>
 # include <stdlib.h>
 #endif  /* STDC_HEADERS */
+#if HAVE_STRING_H
+# include <string.h>
+#endif  /* HAVE_STRING_H */
 #if HAVE_MEMORY_H
 # include <memory.h>
 #endif  /* HAVE_MEMORY_H */
 
-#include <sixel.h>
-
-static void
-get_rgb(unsigned char const *data,
-        int const pixelformat,
-        int depth,
-        unsigned char *r,
-        unsigned char *g,
-        unsigned char *b)
-{
-    unsigned int pixels = 0;
-#if SWAP_BYTES
-    unsigned int low;
-    unsigned int high;
-#endif
-    int count = 0;
+#if HAVE_AVX2_DISPATCH
+# include <immintrin.h>
+#endif  /* HAVE_AVX2_DISPATCH */
+#if HAVE_ARM_NEON_H && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+# include <arm_neon.h>
+# define PIXELFORMAT_USE_NEON 1
+#endif  /* HAVE_ARM_NEON_H */
 
-    while (count < depth) {
-        pixels = *(data + count) | (pixels << 8);
-        count++;
-    }
+#include <sixel.h>
+#include "pixelformat.h"
 
-    /* TODO: we should swap bytes (only necessary on LSByte first hardware?) */
+/* two bytes of 16bpp formats are read as a big-endian word */
 #if SWAP_BYTES
-    if (depth == 2) {
-        low    = pixels & 0xff;
-        high   = (pixels >> 8) & 0xff;
-        pixels = (low << 8) | high;
-    }
+# define PIXELFORMAT_HIGH_BYTE  1
+#else
+# define PIXELFORMAT_HIGH_BYTE  0
 #endif
-
-    switch (pixelformat) {
-    case SIXEL_PIXELFORMAT_RGB555:
-        *r = ((pixels >> 10) & 0x1f) << 3;
-        *g = ((pixels >>  5) & 0x1f) << 3;
-        *b = ((pixels >>  0) & 0x1f) << 3;
-        break;
-    case SIXEL_PIXELFORMAT_RGB565:
-        *r = ((pixels >> 11) & 0x1f) << 3;
-        *g = ((pixels >>  5) & 0x3f) << 2;
-        *b = ((pixels >>  0) & 0x1f) << 3;
-        break;
-    case SIXEL_PIXELFORMAT_RGB888:
-        *r = (pixels >> 16) & 0xff;
-        *g = (pixels >>  8) & 0xff;
-        *b = (pixels >>  0) & 0xff;
-        break;
-    case SIXEL_PIXELFORMAT_BGR555:
-        *r = ((pixels >>  0) & 0x1f) << 3;
-        *g = ((pixels >>  5) & 0x1f) << 3;
-        *b = ((pixels >> 10) & 0x1f) << 3;
-        break;
-    case SIXEL_PIXELFORMAT_BGR565:
-        *r = ((pixels >>  0) & 0x1f) << 3;
-        *g = ((pixels >>  5) & 0x3f) << 2;
-        *b = ((pixels >> 11) & 0x1f) << 3;
-        break;
-    case SIXEL_PIXELFORMAT_BGR888:
-        *r = (pixels >>  0) & 0xff;
-        *g = (pixels >>  8) & 0xff;
-        *b = (pixels >> 16) & 0xff;
-        break;
-    case SIXEL_PIXELFORMAT_RGBA8888:
-        *r = (pixels >> 24) & 0xff;
-        *g = (pixels >> 16) & 0xff;
-        *b = (pixels >>  8) & 0xff;
-        break;
-    case SIXEL_PIXELFORMAT_ARGB8888:
-        *r = (pixels >> 16) & 0xff;
-        *g = (pixels >>  8) & 0xff;
-        *b = (pixels >>  0) & 0xff;
-        break;
-    case SIXEL_PIXELFORMAT_BGRA8888:
-        *r = (pixels >>  8) & 0xff;
-        *g = (pixels >> 16) & 0xff;
-        *b = (pixels >> 24) & 0xff;
-        break;
-    case SIXEL_PIXELFORMAT_ABGR8888:
-        *r = (pixels >>  0) & 0xff;
-        *g = (pixels >>  8) & 0xff;
-        *b = (pixels >> 16) & 0xff;
-        break;
-    case SIXEL_PIXELFORMAT_GA88:
-        *r = *g = *b = (pixels >> 8) & 0xff;
-        break;
-    case SIXEL_PIXELFORMAT_G8:
-    case SIXEL_PIXELFORMAT_AG88:
-        *r = *g = *b = pixels & 0xff;
-        break;
-    default:
-        *r = *g = *b = 0;
-        break;
-    }
-}
-
+#define PIXELFORMAT_GET16(p) \
+    ((unsigned int)(p)[PIXELFORMAT_HIGH_BYTE] << 8 | (p)[1 - PIXELFORMAT_HIGH_BYTE])
 
 SIXELAPI int
 sixel_helper_compute_depth(int pixelformat)
@@ -167,41 +94,508 @@ sixel_helper_compute_depth(int pixelformat)
 }
 
 
+/* compute the number of bytes of a tightly packed row */
+int
+sixel_pixelformat_compute_stride(int pixelformat, int width)
+{
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_PAL1:
+    case SIXEL_PIXELFORMAT_G1:
+        return (width + 7) / 8;
+    case SIXEL_PIXELFORMAT_PAL2:
+    case SIXEL_PIXELFORMAT_G2:
+        return (width + 3) / 4;
+    case SIXEL_PIXELFORMAT_PAL4:
+    case SIXEL_PIXELFORMAT_G4:
+        return (width + 1) / 2;
+    default:
+        break;
+    }
+
+    if (sixel_helper_compute_depth(pixelformat) < 0) {
+        return (-1);
+    }
+
+    return width * sixel_helper_compute_depth(pixelformat);
+}
+
+
+#if HAVE_AVX2_DISPATCH
+/* shuffle the channels of 16 / depth pixels at once, returns the number
+   of converted pixels; stores are 16 bytes wide, so the loop stops while
+   a few pixels are left for the scalar tail.
+   the bytes after the channels are copied from the same positions of the
+   source, which keeps them intact when dst is the same as src */
+__attribute__((target("avx2")))
+static int
+expand_bytes_avx2(
+    unsigned char *dst,
+    unsigned char const *src,
+    int width,
+    int depth,
+    int ri,
+    int gi,
+    int bi)
+{
+    int const n = 16 / depth;
+    unsigned char mask[16];
+    __m128i shuffle;
+    __m128i v;
+    int i;
+    int x;
+
+    for (i = 0; i < 16; i++) {
+        mask[i] = (unsigned char)i;
+    }
+    for (i = 0; i < n; i++) {
+        mask[i * 3 + 0] = (unsigned char)(i * depth + ri);
+        mask[i * 3 + 1] = (unsigned char)(i * depth + gi);
+        mask[i * 3 + 2] = (unsigned char)(i * depth + bi);
+    }
+    shuffle = _mm_loadu_si128((__m128i const *)mask);
+
+    for (x = 0; x + n + 2 <= width; x += n) {
+        v = _mm_loadu_si128((__m128i const *)src);
+        _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(v, shuffle));
+        src += n * depth;
+        dst += n * 3;
+    }
+
+    return x;
+}
+#endif  /* HAVE_AVX2_DISPATCH */
+
+
+#if PIXELFORMAT_USE_NEON
+/* de-interleave 16 pixels at once, returns the number of converted pixels */
+static int
+expand_bytes_neon(
+    unsigned char *dst,
+    unsigned char const *src,
+    int width,
+    int depth,
+    int ri,
+    int gi,
+    int bi)
+{
+    uint8x16x4_t v4;
+    uint8x16x3_t v3;
+    uint8x16x3_t out;
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        if (depth == 4) {
+            v4 = vld4q_u8(src);
+            out.val[0] = v4.val[ri];
+            out.val[1] = v4.val[gi];
+            out.val[2] = v4.val[bi];
+        } else {
+            v3 = vld3q_u8(src);
+            out.val[0] = v3.val[ri];
+            out.val[1] = v3.val[gi];
+            out.val[2] = v3.val[bi];
+        }
+        vst3q_u8(dst, out);
+        src += 16 * depth;
+        dst += 16 * 3;
+    }
+
+    return x;
+}
+#endif  /* PIXELFORMAT_USE_NEON */
+
+
+/* convert a row of pixels whose channels are bytes at fixed offsets,
+   dst may be the same as src if depth is 3 or more */
+static void
+expand_bytes(
+    unsigned char *dst,
+    unsigned char const *src,
+    int width,
+    int depth,
+    int ri,
+    int gi,
+    int bi)
+{
+    int x = 0;
+    unsigned char r, g, b;
+
+#if HAVE_AVX2_DISPATCH
+    if ((depth == 3 || depth == 4) && __builtin_cpu_supports("avx2")) {
+        x = expand_bytes_avx2(dst, src, width, depth, ri, gi, bi);
+    }
+#elif PIXELFORMAT_USE_NEON
+    if (depth == 3 || depth == 4) {
+        x = expand_bytes_neon(dst, src, width, depth, ri, gi, bi);
+    }
+#endif
+    src += x * depth;
+    dst += x * 3;
+
+    for (; x < width; x++) {
+        r = src[ri];
+        g = src[gi];
+        b = src[bi];
+        *dst++ = r;
+        *dst++ = g;
+        *dst++ = b;
+        src += depth;
+    }
+}
+
+
+/* convert a row of 15/16bpp pixels */
+static void
+expand_rgb16(
+    unsigned char *dst,
+    unsigned char const *src,
+    int width,
+    int pixelformat)
+{
+    int x;
+    unsigned int pixels;
+
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_RGB555:
+        for (x = 0; x < width; x++, src += 2) {
+            pixels = PIXELFORMAT_GET16(src);
+            *dst++ = (unsigned char)(((pixels >> 10) & 0x1f) << 3);
+            *dst++ = (unsigned char)(((pixels >>  5) & 0x1f) << 3);
+            *dst++ = (unsigned char)(((pixels >>  0) & 0x1f) << 3);
+        }
+        break;
+    case SIXEL_PIXELFORMAT_RGB565:
+        for (x = 0; x < width; x++, src += 2) {
+            pixels = PIXELFORMAT_GET16(src);
+            *dst++ = (unsigned char)(((pixels >> 11) & 0x1f) << 3);
+            *dst++ = (unsigned char)(((pixels >>  5) & 0x3f) << 2);
+            *dst++ = (unsigned char)(((pixels >>  0) & 0x1f) << 3);
+        }
+        break;
+    case SIXEL_PIXELFORMAT_BGR555:
+        for (x = 0; x < width; x++, src += 2) {
+            pixels = PIXELFORMAT_GET16(src);
+            *dst++ = (unsigned char)(((pixels >>  0) & 0x1f) << 3);
+            *dst++ = (unsigned char)(((pixels >>  5) & 0x1f) << 3);
+            *dst++ = (unsigned char)(((pixels >> 10) & 0x1f) << 3);
+        }
+        break;
+    case SIXEL_PIXELFORMAT_BGR565:
+        for (x = 0; x < width; x++, src += 2) {
+            pixels = PIXELFORMAT_GET16(src);
+            *dst++ = (unsigned char)(((pixels >>  0) & 0x1f) << 3);
+            *dst++ = (unsigned char)(((pixels >>  5) & 0x3f) << 2);
+            *dst++ = (unsigned char)(((pixels >> 11) & 0x1f) << 3);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+
+/* byte offsets of the color channels and the alpha channel of 32bpp
+   formats, returns nonzero if the format has no alpha channel */
+static int
+get_alpha_offsets(int pixelformat, int *offsets)
+{
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_RGBA8888:
+        offsets[0] = 0;
+        offsets[1] = 1;
+        offsets[2] = 2;
+        offsets[3] = 3;
+        break;
+    case SIXEL_PIXELFORMAT_ARGB8888:
+        offsets[0] = 1;
+        offsets[1] = 2;
+        offsets[2] = 3;
+        offsets[3] = 0;
+        break;
+    case SIXEL_PIXELFORMAT_BGRA8888:
+        offsets[0] = 2;
+        offsets[1] = 1;
+        offsets[2] = 0;
+        offsets[3] = 3;
+        break;
+    case SIXEL_PIXELFORMAT_ABGR8888:
+        offsets[0] = 3;
+        offsets[1] = 2;
+        offsets[2] = 1;
+        offsets[3] = 0;
+        break;
+    default:
+        return (-1);
+    }
+
+    return 0;
+}
+
+
+#if HAVE_AVX2_DISPATCH
+/* blend four pixels at once in 16bit lanes, returns the number of
+   composited pixels; see expand_bytes_avx2() for the width of stores */
+__attribute__((target("avx2")))
+static int
+composite_avx2(
+    unsigned char *dst,
+    unsigned char const *src,
+    unsigned char const *bg,
+    int bgstep,
+    int width,
+    int const *offsets)
+{
+    unsigned char mask[16];
+    __m128i canonical;
+    __m128i compact;
+    __m128i const alpha_lo = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1,
+                                           7, -1, 7, -1, 7, -1, 7, -1);
+    __m128i const alpha_hi = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1,
+                                           15, -1, 15, -1, 15, -1, 15, -1);
+    __m128i const bg_lo = _mm_setr_epi8(0, -1, 1, -1, 2, -1, -1, -1,
+                                        3, -1, 4, -1, 5, -1, -1, -1);
+    __m128i const bg_hi = _mm_setr_epi8(6, -1, 7, -1, 8, -1, -1, -1,
+                                        9, -1, 10, -1, 11, -1, -1, -1);
+    __m128i const full = _mm_set1_epi16(0xff);
+    __m128i v;
+    __m128i b;
+    __m128i lo;
+    __m128i hi;
+    __m128i blo;
+    __m128i bhi;
+    __m128i alo;
+    __m128i ahi;
+    int i;
+    int x;
+
+    /* reorder channels to R, G, B, A */
+    for (i = 0; i < 16; i++) {
+        mask[i] = (unsigned char)(i / 4 * 4 + offsets[i % 4]);
+    }
+    canonical = _mm_loadu_si128((__m128i const *)mask);
+    for (i = 0; i < 16; i++) {
+        mask[i] = (unsigned char)(i < 12 ? i / 3 * 4 + i % 3 : i);
+    }
+    compact = _mm_loadu_si128((__m128i const *)mask);
+
+    /* a single background color */
+    b = _mm_setr_epi8((char)bg[0], (char)bg[1], (char)bg[2], 0,
+                      (char)bg[0], (char)bg[1], (char)bg[2], 0,
+                      (char)bg[0], (char)bg[1], (char)bg[2], 0,
+                      (char)bg[0], (char)bg[1], (char)bg[2], 0);
+    blo = bhi = _mm_cvtepu8_epi16(b);
+
+    for (x = 0; x + 6 <= width; x += 4) {
+        v = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)src), canonical);
+        lo = _mm_cvtepu8_epi16(v);
+        hi = _mm_cvtepu8_epi16(_mm_srli_si128(v, 8));
+        alo = _mm_shuffle_epi8(v, alpha_lo);
+        ahi = _mm_shuffle_epi8(v, alpha_hi);
+        if (bgstep) {
+            b = _mm_loadu_si128((__m128i const *)bg);
+            blo = _mm_shuffle_epi8(b, bg_lo);
+            bhi = _mm_shuffle_epi8(b, bg_hi);
+            bg += 4 * 3;
+        }
+        /* (c * a + bg * (0xff - a)) >> 8 does not exceed 16 bits */
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, alo),
+                                          _mm_mullo_epi16(blo, _mm_sub_epi16(full, alo))),
+                            8);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, ahi),
+                                          _mm_mullo_epi16(bhi, _mm_sub_epi16(full, ahi))),
+                            8);
+        v = _mm_shuffle_epi8(_mm_packus_epi16(lo, hi), compact);
+        _mm_storeu_si128((__m128i *)dst, v);
+        src += 4 * 4;
+        dst += 4 * 3;
+    }
+
+    return x;
+}
+#endif  /* HAVE_AVX2_DISPATCH */
+
+
+#if PIXELFORMAT_USE_NEON
+/* blend one channel of 8 pixels */
+static uint8x8_t
+composite_neon_channel(uint8x8_t c, uint8x8_t b, uint8x8_t a)
+{
+    return vshrn_n_u16(vmlal_u8(vmull_u8(c, a), b, vmvn_u8(a)), 8);
+}
+
+
+/* blend 16 pixels at once, returns the number of composited pixels */
+static int
+composite_neon(
+    unsigned char *dst,
+    unsigned char const *src,
+    unsigned char const *bg,
+    int bgstep,
+    int width,
+    int const *offsets)
+{
+    uint8x16x4_t v;
+    uint8x16x3_t b;
+    uint8x16x3_t out;
+    uint8x16_t a;
+    int i;
+    int x;
+
+    for (i = 0; i < 3; i++) {
+        b.val[i] = vdupq_n_u8(bg[i]);
+    }
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        v = vld4q_u8(src);
+        if (bgstep) {
+            b = vld3q_u8(bg);
+            bg += 16 * 3;
+        }
+        a = v.val[offsets[3]];
+        for (i = 0; i < 3; i++) {
+            out.val[i] = vcombine_u8(
+                composite_neon_channel(vget_low_u8(v.val[offsets[i]]),
+                                       vget_low_u8(b.val[i]),
+                                       vget_low_u8(a)),
+                composite_neon_channel(vget_high_u8(v.val[offsets[i]]),
+                                       vget_high_u8(b.val[i]),
+                                       vget_high_u8(a)));
+        }
+        vst3q_u8(dst, out);
+        src += 16 * 4;
+        dst += 16 * 3;
+    }
+
+    return x;
+}
+#endif  /* PIXELFORMAT_USE_NEON */
+
+
+/* composite a row of 32bpp pixels over the background into RGB888,
+   bgstep is 0 for a single background color or 3 for a row of RGB888
+   background pixels, dst may be the same as src */
+SIXELSTATUS
+sixel_pixelformat_composite_row(
+    unsigned char       /* out */ *dst,
+    unsigned char const /* in */  *src,
+    unsigned char const /* in */  *bg,
+    int                 /* in */  bgstep,
+    int                 /* in */  width,
+    int                 /* in */  pixelformat)
+{
+    int offsets[4];
+    int x = 0;
+    int alpha;
+    unsigned char r, g, b;
+
+    if (get_alpha_offsets(pixelformat, offsets) != 0) {
+        sixel_helper_set_additional_message(
+            "sixel_pixelformat_composite_row: invalid pixelformat.");
+        return SIXEL_BAD_ARGUMENT;
+    }
+
+#if HAVE_AVX2_DISPATCH
+    if (__builtin_cpu_supports("avx2")) {
+        x = composite_avx2(dst, src, bg, bgstep, width, offsets);
+    }
+#elif PIXELFORMAT_USE_NEON
+    x = composite_neon(dst, src, bg, bgstep, width, offsets);
+#endif
+    src += x * 4;
+    dst += x * 3;
+    bg += x * bgstep;
+
+    for (; x < width; x++) {
+        alpha = src[offsets[3]];
+        r = (unsigned char)((src[offsets[0]] * alpha + bg[0] * (0xff - alpha)) >> 8);
+        g = (unsigned char)((src[offsets[1]] * alpha + bg[1] * (0xff - alpha)) >> 8);
+        b = (unsigned char)((src[offsets[2]] * alpha + bg[2] * (0xff - alpha)) >> 8);
+        *dst++ = r;
+        *dst++ = g;
+        *dst++ = b;
+        src += 4;
+        bg += bgstep;
+    }
+
+    return SIXEL_OK;
+}
+
+
+/* convert pixelformat into RGB888 row by row */
 static void
 expand_rgb(unsigned char *dst,
            unsigned char const *src,
-           int width, int height,
-           int pixelformat, int depth)
+           int width, int height, int stride,
+           int pixelformat)
 {
-    int x;
     int y;
-    int dst_offset;
-    int src_offset;
-    unsigned char r, g, b;
+    int depth = sixel_helper_compute_depth(pixelformat);
+    int ri = 0;
+    int gi = 0;
+    int bi = 0;
+
+    /* byte offsets of channels */
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_GA88:
+        ri = gi = bi = PIXELFORMAT_HIGH_BYTE;
+        break;
+    case SIXEL_PIXELFORMAT_AG88:
+        ri = gi = bi = 1 - PIXELFORMAT_HIGH_BYTE;
+        break;
+    case SIXEL_PIXELFORMAT_RGB888:
+    case SIXEL_PIXELFORMAT_RGBA8888:
+        ri = 0;
+        gi = 1;
+        bi = 2;
+        break;
+    case SIXEL_PIXELFORMAT_BGR888:
+    case SIXEL_PIXELFORMAT_BGRA8888:
+        ri = 2;
+        gi = 1;
+        bi = 0;
+        break;
+    case SIXEL_PIXELFORMAT_ARGB8888:
+        ri = 1;
+        gi = 2;
+        bi = 3;
+        break;
+    case SIXEL_PIXELFORMAT_ABGR8888:
+        ri = 3;
+        gi = 2;
+        bi = 1;
+        break;
+    default:
+        break;
+    }
 
     for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            src_offset = depth * (y * width + x);
-            dst_offset = 3 * (y * width + x);
-            get_rgb(src + src_offset, pixelformat, depth, &r, &g, &b);
-
-            *(dst + dst_offset + 0) = r;
-            *(dst + dst_offset + 1) = g;
-            *(dst + dst_offset + 2) = b;
+        switch (pixelformat) {
+        case SIXEL_PIXELFORMAT_RGB555:
+        case SIXEL_PIXELFORMAT_RGB565:
+        case SIXEL_PIXELFORMAT_BGR555:
+        case SIXEL_PIXELFORMAT_BGR565:
+            expand_rgb16(dst, src, width, pixelformat);
+            break;
+        default:
+            expand_bytes(dst, src, width, depth, ri, gi, bi);
+            break;
         }
+        dst += width * 3;
+        src += stride;
     }
 }
 
 
 static SIXELSTATUS
 expand_palette(unsigned char *dst, unsigned char const *src,
-               int width, int height, int const pixelformat)
+               int width, int height, int stride, int const pixelformat)
 {
     SIXELSTATUS status = SIXEL_FALSE;
     int x;
     int y;
     int i;
     int bpp;  /* bit per plane */
+    unsigned char const *p;
 
     switch (pixelformat) {
     case SIXEL_PIXELFORMAT_PAL1:
@@ -218,8 +612,9 @@ expand_palette(unsigned char *dst, unsigned char const *src,
         break;
     case SIXEL_PIXELFORMAT_PAL8:
     case SIXEL_PIXELFORMAT_G8:
-        for (i = 0; i < width * height; ++i, ++src) {
-            *dst++ = *src;
+        for (y = 0; y < height; ++y) {
+            memmove(dst, src + y * stride, (size_t)width);
+            dst += width;
         }
         status = SIXEL_OK;
         goto end;
@@ -235,18 +630,18 @@ expand_palette(unsigned char *dst, unsigned char const *src,
 #endif
 
     for (y = 0; y < height; ++y) {
+        p = src + y * stride;
         for (x = 0; x < width * bpp / 8; ++x) {
             for (i = 0; i < 8 / bpp; ++i) {
-                *dst++ = *src >> (8 / bpp - 1 - i) * bpp & ((1 << bpp) - 1);
+                *dst++ = *p >> (8 / bpp - 1 - i) * bpp & ((1 << bpp) - 1);
             }
-            src++;
+            p++;
         }
         x = width - x * 8 / bpp;
         if (x > 0) {
             for (i = 0; i < x; ++i) {
-                *dst++ = *src >> (8 - (i + 1) * bpp) & ((1 << bpp) - 1);
+                *dst++ = *p >> (8 - (i + 1) * bpp) & ((1 << bpp) - 1);
             }
-            src++;
         }
     }
 
@@ -265,12 +660,37 @@ sixel_helper_normalize_pixelformat(
     int                 /* in */  src_pixelformat,  /* format of source image */
     int                 /* in */  width,            /* width of source image */
     int                 /* in */  height)           /* height of source image */
+{
+    return sixel_helper_normalize_pixelformat_with_stride(
+        dst, dst_pixelformat, src, src_pixelformat, width, height,
+        sixel_pixelformat_compute_stride(src_pixelformat, width));
+}
+
+
+/* same as sixel_helper_normalize_pixelformat(), but the rows of the source
+   are stride bytes apart */
+SIXELAPI SIXELSTATUS
+sixel_helper_normalize_pixelformat_with_stride(
+    unsigned char       /* out */ *dst,             /* destination buffer */
+    int                 /* out */ *dst_pixelformat, /* converted pixelformat */
+    unsigned char const /* in */  *src,             /* source pixels */
+    int                 /* in */  src_pixelformat,  /* format of source image */
+    int                 /* in */  width,            /* width of source image */
+    int                 /* in */  height,           /* height of source image */
+    int                 /* in */  stride)           /* bytes per source row */
 {
     SIXELSTATUS status = SIXEL_FALSE;
 
+    if (stride < sixel_pixelformat_compute_stride(src_pixelformat, width)) {
+        sixel_helper_set_additional_message(
+            "sixel_helper_normalize_pixelformat: invalid stride.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
     switch (src_pixelformat) {
     case SIXEL_PIXELFORMAT_G8:
-        expand_rgb(dst, src, width, height, src_pixelformat, 1);
+        expand_rgb(dst, src, width, height, stride, src_pixelformat);
         *dst_pixelformat = SIXEL_PIXELFORMAT_RGB888;
         break;
     case SIXEL_PIXELFORMAT_RGB565:
@@ -279,26 +699,26 @@ sixel_helper_normalize_pixelformat(
     case SIXEL_PIXELFORMAT_BGR555:
     case SIXEL_PIXELFORMAT_GA88:
     case SIXEL_PIXELFORMAT_AG88:
-        expand_rgb(dst, src, width, height, src_pixelformat, 2);
+        expand_rgb(dst, src, width, height, stride, src_pixelformat);
         *dst_pixelformat = SIXEL_PIXELFORMAT_RGB888;
         break;
     case SIXEL_PIXELFORMAT_RGB888:
     case SIXEL_PIXELFORMAT_BGR888:
-        expand_rgb(dst, src, width, height, src_pixelformat, 3);
+        expand_rgb(dst, src, width, height, stride, src_pixelformat);
         *dst_pixelformat = SIXEL_PIXELFORMAT_RGB888;
         break;
     case SIXEL_PIXELFORMAT_RGBA8888:
     case SIXEL_PIXELFORMAT_ARGB8888:
     case SIXEL_PIXELFORMAT_BGRA8888:
     case SIXEL_PIXELFORMAT_ABGR8888:
-        expand_rgb(dst, src, width, height, src_pixelformat, 4);
+        expand_rgb(dst, src, width, height, stride, src_pixelformat);
         *dst_pixelformat = SIXEL_PIXELFORMAT_RGB888;
         break;
     case SIXEL_PIXELFORMAT_PAL1:
     case SIXEL_PIXELFORMAT_PAL2:
     case SIXEL_PIXELFORMAT_PAL4:
         *dst_pixelformat = SIXEL_PIXELFORMAT_PAL8;
-        status = expand_palette(dst, src, width, height, src_pixelformat);
+        status = expand_palette(dst, src, width, height, stride, src_pixelformat);
         if (SIXEL_FAILED(status)) {
             goto end;
         }
@@ -307,13 +727,16 @@ sixel_helper_normalize_pixelformat(
     case SIXEL_PIXELFORMAT_G2:
     case SIXEL_PIXELFORMAT_G4:
         *dst_pixelformat = SIXEL_PIXELFORMAT_G8;
-        status = expand_palette(dst, src, width, height, src_pixelformat);
+        status = expand_palette(dst, src, width, height, stride, src_pixelformat);
         if (SIXEL_FAILED(status)) {
             goto end;
         }
         break;
     case SIXEL_PIXELFORMAT_PAL8:
-        memcpy(dst, src, (size_t)(width * height));
+        status = expand_palette(dst, src, width, height, stride, src_pixelformat);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
         *dst_pixelformat = src_pixelformat;
         break;
     default:
@@ -328,6 +751,40 @@ end:
 }
 
 
+/* convert pixels into RGB888 in place, the rows of the result are packed
+   from the head of the buffer, it is available if the result fits in the
+   source buffer, that is, the source has 3 or more bytes per pixel */
+SIXELSTATUS
+sixel_pixelformat_normalize_in_place(
+    unsigned char       /* in/out */ *pixels,       /* pixel buffer */
+    int                 /* in/out */ *pixelformat,  /* format of pixels */
+    int                 /* in */     width,         /* width of image */
+    int                 /* in */     height,        /* height of image */
+    int                 /* in */     stride)        /* bytes per source row */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    if (sixel_helper_compute_depth(*pixelformat) < 3) {
+        sixel_helper_set_additional_message(
+            "sixel_pixelformat_normalize_in_place: "
+            "the result does not fit in the source buffer.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    status = sixel_helper_normalize_pixelformat_with_stride(pixels,
+                                                            pixelformat,
+                                                            pixels,
+                                                            *pixelformat,
+                                                            width,
+                                                            height,
+                                                            stride);
+
+end:
+    return status;
+}
+
+
 #if HAVE_TESTS
 static int
 test1(void)
@@ -681,6 +1138,149 @@ error:
 }
 
 
+/* rows of the source are stride bytes apart */
+static int
+test11(void)
+{
+    unsigned char dst[3 * 2 * 3];
+    int dst_pixelformat = SIXEL_PIXELFORMAT_RGB888;
+    unsigned char src[] = {
+        0x10, 0x20, 0x30, 0xff, 0xff,
+        0x40, 0x50, 0x60, 0xff, 0xff,
+    };
+    unsigned char pal[3 * 2];
+    int i;
+    int ret = 0;
+
+    int nret = EXIT_FAILURE;
+
+    ret = sixel_helper_normalize_pixelformat_with_stride(dst,
+                                                         &dst_pixelformat,
+                                                         src,
+                                                         SIXEL_PIXELFORMAT_G8,
+                                                         3, 2, 5);
+    if (ret != 0) {
+        goto error;
+    }
+    if (dst_pixelformat != SIXEL_PIXELFORMAT_RGB888) {
+        goto error;
+    }
+    for (i = 0; i < 3 * 2; i++) {
+        if (dst[i * 3] != src[i / 3 * 5 + i % 3]) {
+            goto error;
+        }
+    }
+
+    ret = sixel_helper_normalize_pixelformat_with_stride(pal,
+                                                         &dst_pixelformat,
+                                                         src,
+                                                         SIXEL_PIXELFORMAT_PAL4,
+                                                         3, 2, 5);
+    if (ret != 0) {
+        goto error;
+    }
+    if (dst_pixelformat != SIXEL_PIXELFORMAT_PAL8) {
+        goto error;
+    }
+    if (pal[2] != 0x2 || pal[3] != 0x4 || pal[5] != 0x5) {
+        goto error;
+    }
+
+    /* stride shorter than a row */
+    ret = sixel_helper_normalize_pixelformat_with_stride(dst,
+                                                         &dst_pixelformat,
+                                                         src,
+                                                         SIXEL_PIXELFORMAT_G8,
+                                                         3, 2, 2);
+    if (ret != SIXEL_BAD_ARGUMENT) {
+        goto error;
+    }
+    return EXIT_SUCCESS;
+
+error:
+    perror("test11");
+    return nret;
+}
+
+
+/* byte ordered formats are converted alike with and without SIMD, also
+   in place */
+static int
+test12(void)
+{
+    static struct {
+        int pixelformat;
+        int depth;
+        int offsets[3];
+    } const formats[] = {
+        { SIXEL_PIXELFORMAT_RGB888,   3, { 0, 1, 2 } },
+        { SIXEL_PIXELFORMAT_BGR888,   3, { 2, 1, 0 } },
+        { SIXEL_PIXELFORMAT_RGBA8888, 4, { 0, 1, 2 } },
+        { SIXEL_PIXELFORMAT_ARGB8888, 4, { 1, 2, 3 } },
+        { SIXEL_PIXELFORMAT_BGRA8888, 4, { 2, 1, 0 } },
+        { SIXEL_PIXELFORMAT_ABGR8888, 4, { 3, 2, 1 } },
+    };
+    unsigned char src[3 * (37 * 4 + 3)];
+    unsigned char work[3 * (37 * 4 + 3)];
+    unsigned char dst[3 * 37 * 3];
+    int dst_pixelformat;
+    int pixelformat;
+    int stride;
+    size_t i;
+    int j;
+    int k;
+    int ret = 0;
+
+    int nret = EXIT_FAILURE;
+
+    for (k = 0; k < (int)sizeof(src); k++) {
+        src[k] = (unsigned char)(k * 7 + k / 13);
+    }
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        stride = 37 * formats[i].depth + 3;
+        ret = sixel_helper_normalize_pixelformat_with_stride(dst,
+                                                             &dst_pixelformat,
+                                                             src,
+                                                             formats[i].pixelformat,
+                                                             37, 3, stride);
+        if (ret != 0 || dst_pixelformat != SIXEL_PIXELFORMAT_RGB888) {
+            goto error;
+        }
+        memcpy(work, src, sizeof(work));
+        pixelformat = formats[i].pixelformat;
+        ret = sixel_pixelformat_normalize_in_place(work, &pixelformat,
+                                                   37, 3, stride);
+        if (ret != 0 || pixelformat != SIXEL_PIXELFORMAT_RGB888) {
+            goto error;
+        }
+        for (j = 0; j < 3 * 37; j++) {
+            for (k = 0; k < 3; k++) {
+                if (dst[j * 3 + k] != src[j / 37 * stride + j % 37 * formats[i].depth
+                                          + formats[i].offsets[k]]) {
+                    goto error;
+                }
+            }
+        }
+        if (memcmp(work, dst, sizeof(dst)) != 0) {
+            goto error;
+        }
+    }
+
+    /* RGB888 does not fit in G8 pixels */
+    pixelformat = SIXEL_PIXELFORMAT_G8;
+    ret = sixel_pixelformat_normalize_in_place(work, &pixelformat, 37, 3, 37);
+    if (ret != SIXEL_BAD_ARGUMENT) {
+        goto error;
+    }
+    return EXIT_SUCCESS;
+
+error:
+    perror("test12");
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_pixelformat_tests_main(void)
 {
@@ -699,6 +1299,8 @@ sixel_pixelformat_tests_main(void)
         test8,
         test9,
         test10,
+        test11,
+        test12,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
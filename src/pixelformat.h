@@ -22,10 +22,41 @@
 #ifndef LIBSIXEL_PIXELFORMAT_H
 #define LIBSIXEL_PIXELFORMAT_H
 
+#include <sixel.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* compute the number of bytes of a tightly packed row, or (-1) if the
+   pixelformat is unknown */
+int
+sixel_pixelformat_compute_stride(
+    int /* in */ pixelformat,   /* one of enum pixelFormat */
+    int /* in */ width);        /* number of pixels of a row */
+
+/* convert pixels into RGB888 in place, the source must have 3 or more
+   bytes per pixel */
+SIXELSTATUS
+sixel_pixelformat_normalize_in_place(
+    unsigned char       /* in/out */ *pixels,       /* pixel buffer */
+    int                 /* in/out */ *pixelformat,  /* format of pixels */
+    int                 /* in */     width,         /* width of image */
+    int                 /* in */     height,        /* height of image */
+    int                 /* in */     stride);       /* bytes per source row */
+
+/* composite a row of 32bpp pixels over the background into RGB888,
+   bgstep is 0 for a single background color or 3 for a row of RGB888
+   background pixels, dst may be the same as src */
+SIXELSTATUS
+sixel_pixelformat_composite_row(
+    unsigned char       /* out */ *dst,         /* RGB888 pixels */
+    unsigned char const /* in */  *src,         /* 32bpp pixels with alpha */
+    unsigned char const /* in */  *bg,          /* background pixels */
+    int                 /* in */  bgstep,       /* 0 or 3 */
+    int                 /* in */  width,        /* number of pixels */
+    int                 /* in */  pixelformat); /* format of src */
+
 #if HAVE_TESTS
 int
 sixel_pixelformat_tests_main(void);
@@ -64,6 +64,7 @@
 #endif  /* HAVE_MATH_H */
 
 #include "quant.h"
+#include "thread.h"
 
 #if HAVE_DEBUG
 #define quant_trace fprintf
@@ -1055,6 +1056,7 @@ lookup_normal(unsigned char const * const pixel,
               unsigned char const * const palette,
               int const reqcolor,
               unsigned short * const cachetable,
+              unsigned char const * const lut,
               int const complexion)
 {
     int result;
@@ -1069,6 +1071,7 @@ lookup_normal(unsigned char const * const pixel,
 
     /* don't use cachetable in 'normal' strategy */
     (void) cachetable;
+    (void) lut;
 
     for (i = 0; i < reqcolor; i++) {
         distant = 0;
@@ -1095,6 +1098,7 @@ lookup_fast(unsigned char const * const pixel,
             unsigned char const * const palette,
             int const reqcolor,
             unsigned short * const cachetable,
+            unsigned char const * const lut,
             int const complexion)
 {
     int result;
@@ -1106,6 +1110,7 @@ lookup_fast(unsigned char const * const pixel,
 
     /* don't use depth in 'fast' strategy because it's always 3 */
     (void) depth;
+    (void) lut;
 
     result = (-1);
     diff = INT_MAX;
@@ -1146,6 +1151,7 @@ lookup_mono_darkbg(unsigned char const * const pixel,
                    unsigned char const * const palette,
                    int const reqcolor,
                    unsigned short * const cachetable,
+                   unsigned char const * const lut,
                    int const complexion)
 {
     int n;
@@ -1153,6 +1159,7 @@ lookup_mono_darkbg(unsigned char const * const pixel,
 
     /* unused */ (void) palette;
     /* unused */ (void) cachetable;
+    /* unused */ (void) lut;
     /* unused */ (void) complexion;
 
     distant = 0;
@@ -1169,6 +1176,7 @@ lookup_mono_lightbg(unsigned char const * const pixel,
                     unsigned char const * const palette,
                     int const reqcolor,
                     unsigned short * const cachetable,
+                    unsigned char const * const lut,
                     int const complexion)
 {
     int n;
@@ -1176,6 +1184,7 @@ lookup_mono_lightbg(unsigned char const * const pixel,
 
     /* unused */ (void) palette;
     /* unused */ (void) cachetable;
+    /* unused */ (void) lut;
     /* unused */ (void) complexion;
 
     distant = 0;
@@ -1186,6 +1195,161 @@ lookup_mono_lightbg(unsigned char const * const pixel,
 }
 
 
+/* lookup closest color from precomputed table indexed by RGB555 hash */
+static int
+lookup_lut_rgb555(unsigned char const * const pixel,
+                  int const depth,
+                  unsigned char const * const palette,
+                  int const reqcolor,
+                  unsigned short * const cachetable,
+                  unsigned char const * const lut,
+                  int const complexion)
+{
+    /* unused */ (void) depth;
+    /* unused */ (void) palette;
+    /* unused */ (void) reqcolor;
+    /* unused */ (void) cachetable;
+    /* unused */ (void) complexion;
+
+    return lut[computeHash(pixel, 3)];
+}
+
+
+/* lookup closest gray from precomputed table indexed by R + G + B */
+static int
+lookup_lut_graysum(unsigned char const * const pixel,
+                   int const depth,
+                   unsigned char const * const palette,
+                   int const reqcolor,
+                   unsigned short * const cachetable,
+                   unsigned char const * const lut,
+                   int const complexion)
+{
+    /* unused */ (void) depth;
+    /* unused */ (void) palette;
+    /* unused */ (void) reqcolor;
+    /* unused */ (void) cachetable;
+    /* unused */ (void) complexion;
+
+    return lut[pixel[0] + pixel[1] + pixel[2]];
+}
+
+
+/* function to choose a palette index for a pixel */
+typedef int (*quant_lookup_fn_t)(unsigned char const * const pixel,
+                                 int const depth,
+                                 unsigned char const * const palette,
+                                 int const reqcolor,
+                                 unsigned short * const cachetable,
+                                 unsigned char const * const lut,
+                                 int const complexion);
+
+
+/* choose the error diffusion function or the mask function */
+static void
+quant_select_diffuse(
+    int methodForDiffuse,
+    int depth,
+    void (**f_diffuse)(unsigned char *data, int width, int height,
+                       int x, int y, int depth, int offset),
+    float (**f_mask)(int x, int y, int c))
+{
+    *f_mask = NULL;
+
+    if (depth != 3) {
+        *f_diffuse = diffuse_none;
+    } else {
+        switch (methodForDiffuse) {
+        case SIXEL_DIFFUSE_NONE:
+            *f_diffuse = diffuse_none;
+            break;
+        case SIXEL_DIFFUSE_ATKINSON:
+            *f_diffuse = diffuse_atkinson;
+            break;
+        case SIXEL_DIFFUSE_FS:
+            *f_diffuse = diffuse_fs;
+            break;
+        case SIXEL_DIFFUSE_JAJUNI:
+            *f_diffuse = diffuse_jajuni;
+            break;
+        case SIXEL_DIFFUSE_STUCKI:
+            *f_diffuse = diffuse_stucki;
+            break;
+        case SIXEL_DIFFUSE_BURKES:
+            *f_diffuse = diffuse_burkes;
+            break;
+        case SIXEL_DIFFUSE_A_DITHER:
+            *f_diffuse = diffuse_none;
+            *f_mask = mask_a;
+            break;
+        case SIXEL_DIFFUSE_X_DITHER:
+            *f_diffuse = diffuse_none;
+            *f_mask = mask_x;
+            break;
+        default:
+            quant_trace(stderr, "Internal error: invalid value of"
+                                " methodForDiffuse: %d\n",
+                        methodForDiffuse);
+            *f_diffuse = diffuse_none;
+            break;
+        }
+    }
+}
+
+
+/* choose the fastest lookup function for the palette */
+static quant_lookup_fn_t
+quant_select_lookup(
+    unsigned char const *palette,
+    int depth,
+    int reqcolor,
+    int foptimize,
+    int complexion,
+    unsigned char const *lut,
+    int lut_type)
+{
+    quant_lookup_fn_t f_lookup;
+    int n;
+    int sum1;
+    int sum2;
+
+    f_lookup = NULL;
+    if (reqcolor == 2) {
+        sum1 = 0;
+        sum2 = 0;
+        for (n = 0; n < depth; ++n) {
+            sum1 += palette[n];
+        }
+        for (n = depth; n < depth + depth; ++n) {
+            sum2 += palette[n];
+        }
+        if (sum1 == 0 && sum2 == 255 * 3) {
+            f_lookup = lookup_mono_darkbg;
+        } else if (sum1 == 255 * 3 && sum2 == 0) {
+            f_lookup = lookup_mono_lightbg;
+        }
+    }
+    /* precomputed tables of builtin palettes assume complexion score 1,
+       RGB555 tables are approximate, so they obey foptimize */
+    if (f_lookup == NULL && lut && depth == 3 && complexion == 1) {
+        if (lut_type == SIXEL_LUT_GRAYSUM) {
+            f_lookup = lookup_lut_graysum;
+        } else if (lut_type == SIXEL_LUT_RGB555 && foptimize) {
+            f_lookup = lookup_lut_rgb555;
+        }
+    }
+    if (f_lookup == NULL) {
+        if (foptimize && depth == 3) {
+            f_lookup = lookup_fast;
+        } else {
+            f_lookup = lookup_normal;
+        }
+    }
+
+    return f_lookup;
+}
+
+
 /* choose colors using median-cut method */
 SIXELSTATUS
 sixel_quant_make_palette(
@@ -1243,6 +1407,312 @@ end:
 }
 
 
+/*
+ * stripe mode of sixel_quant_apply_palette()
+ *
+ * rows are picked up by worker threads in order, and each row is
+ * processed in chunks. a chunk is started once the row above has
+ * processed "lag" pixels beyond it (wavefront scheduling), so that the
+ * errors are diffused into every pixel in the same order as the
+ * sequential scan. the kernels below drop the errors which go out of
+ * the image instead of wrapping them into the next row, and the cache
+ * table is filled before the workers start. so the result does not
+ * depend on the number of threads.
+ */
+
+#define QUANT_STRIPE_CHUNK  64  /* pixels processed between synchronizations */
+
+typedef struct quant_kernel {
+    int dx;
+    int dy;
+    int numerator;
+    int denominator;    /* 0 for terminator */
+} quant_kernel_t;
+
+static quant_kernel_t const kernel_fs[] = {
+    {  1, 0, 7, 16 },
+    { -1, 1, 3, 16 }, {  0, 1, 5, 16 }, {  1, 1, 1, 16 },
+    {  0, 0, 0, 0 }
+};
+
+static quant_kernel_t const kernel_atkinson[] = {
+    {  1, 0, 1, 8 }, {  2, 0, 1, 8 },
+    { -1, 1, 1, 8 }, {  0, 1, 1, 8 }, {  1, 1, 1, 8 },
+    {  0, 2, 1, 8 },
+    {  0, 0, 0, 0 }
+};
+
+static quant_kernel_t const kernel_jajuni[] = {
+    {  1, 0, 7, 48 }, {  2, 0, 5, 48 },
+    { -2, 1, 3, 48 }, { -1, 1, 5, 48 }, {  0, 1, 7, 48 }, {  1, 1, 5, 48 }, {  2, 1, 3, 48 },
+    { -2, 2, 1, 48 }, { -1, 2, 3, 48 }, {  0, 2, 5, 48 }, {  1, 2, 3, 48 }, {  2, 2, 1, 48 },
+    {  0, 0, 0, 0 }
+};
+
+static quant_kernel_t const kernel_stucki[] = {
+    {  1, 0, 1, 6 }, {  2, 0, 1, 12 },
+    { -2, 1, 1, 24 }, { -1, 1, 1, 12 }, {  0, 1, 1, 6 }, {  1, 1, 1, 12 }, {  2, 1, 1, 24 },
+    { -2, 2, 1, 48 }, { -1, 2, 1, 24 }, {  0, 2, 1, 12 }, {  1, 2, 1, 24 }, {  2, 2, 1, 48 },
+    {  0, 0, 0, 0 }
+};
+
+static quant_kernel_t const kernel_burkes[] = {
+    {  1, 0, 1, 4 }, {  2, 0, 1, 8 },
+    { -2, 1, 1, 16 }, { -1, 1, 1, 8 }, {  0, 1, 1, 4 }, {  1, 1, 1, 8 }, {  2, 1, 1, 16 },
+    {  0, 0, 0, 0 }
+};
+
+
+typedef struct quant_stripe_context {
+    sixel_index_t *result;
+    unsigned char *data;
+    int width;
+    int height;
+    int depth;
+    unsigned char const *palette;
+    int reqcolor;
+    int complexion;
+    unsigned short *indextable;
+    unsigned char const *lut;
+    int (*f_lookup)(unsigned char const * const pixel,
+                    int const depth,
+                    unsigned char const * const palette,
+                    int const reqcolor,
+                    unsigned short * const cachetable,
+                    unsigned char const * const lut,
+                    int const complexion);
+    float (*f_mask)(int x, int y, int c);
+    quant_kernel_t const *kernel;   /* NULL if errors are not diffused */
+    int lag;                        /* distance to the row above */
+    int next;                       /* next row (or table block) to be picked up */
+    int *progress;                  /* number of processed pixels of each row */
+    sixel_mutex_t mutex;
+    sixel_cond_t cond;
+} quant_stripe_context_t;
+
+
+static void
+diffuse_kernel(unsigned char *data, int width, int height,
+               int x, int y, int depth, int error,
+               quant_kernel_t const *kernel)
+{
+    int tx;
+    int ty;
+
+    for (; kernel->denominator; ++kernel) {
+        tx = x + kernel->dx;
+        ty = y + kernel->dy;
+        if (tx >= 0 && tx < width && ty < height) {
+            error_diffuse(data, ty * width + tx, depth, error,
+                          kernel->numerator, kernel->denominator);
+        }
+    }
+}
+
+
+/* fill empty entries of the cache table with the nearest color of the
+   center of each RGB555 cell */
+static void
+quant_prefill_worker(void *arg)
+{
+    quant_stripe_context_t *context = (quant_stripe_context_t *)arg;
+    enum { block = 1024 };
+    unsigned char pixel[3];
+    int start;
+    int hash;
+    int i;
+    int diff;
+    int distant;
+    int result;
+
+    for (;;) {
+        sixel_mutex_lock(&context->mutex);
+        start = context->next;
+        context->next += block;
+        sixel_mutex_unlock(&context->mutex);
+        if (start >= 1 << 3 * 5) {
+            break;
+        }
+        for (hash = start; hash < start + block; ++hash) {
+            if (context->indextable[hash]) {
+                continue;
+            }
+            pixel[0] = (unsigned char)((hash >> 10 & 0x1f) << 3 | 0x4);
+            pixel[1] = (unsigned char)((hash >> 5 & 0x1f) << 3 | 0x4);
+            pixel[2] = (unsigned char)((hash & 0x1f) << 3 | 0x4);
+            diff = INT_MAX;
+            result = 0;
+            for (i = 0; i < context->reqcolor; ++i) {
+                distant = (pixel[0] - context->palette[i * 3 + 0])
+                        * (pixel[0] - context->palette[i * 3 + 0]) * context->complexion
+                        + (pixel[1] - context->palette[i * 3 + 1])
+                        * (pixel[1] - context->palette[i * 3 + 1])
+                        + (pixel[2] - context->palette[i * 3 + 2])
+                        * (pixel[2] - context->palette[i * 3 + 2]);
+                if (distant < diff) {
+                    diff = distant;
+                    result = i;
+                }
+            }
+            context->indextable[hash] = (unsigned short)(result + 1);
+        }
+    }
+}
+
+
+static void
+quant_stripe_worker(void *arg)
+{
+    quant_stripe_context_t *context = (quant_stripe_context_t *)arg;
+    int const width = context->width;
+    int const depth = context->depth;
+    unsigned char *data = context->data;
+    unsigned char const *palette = context->palette;
+    unsigned char copy[4];
+    int x;
+    int y;
+    int x0;
+    int x1;
+    int need;
+    int pos;
+    int n;
+    int val;
+    int color_index;
+    int offset;
+
+    for (;;) {
+        sixel_mutex_lock(&context->mutex);
+        y = context->next++;
+        sixel_mutex_unlock(&context->mutex);
+        if (y >= context->height) {
+            break;
+        }
+        for (x0 = 0; x0 < width; x0 = x1) {
+            x1 = x0 + QUANT_STRIPE_CHUNK < width ? x0 + QUANT_STRIPE_CHUNK: width;
+            if (context->kernel && y > 0) {
+                need = x1 + context->lag < width ? x1 + context->lag: width;
+                sixel_mutex_lock(&context->mutex);
+                while (context->progress[y - 1] < need) {
+                    sixel_cond_wait(&context->cond, &context->mutex);
+                }
+                sixel_mutex_unlock(&context->mutex);
+            }
+            for (x = x0; x < x1; ++x) {
+                pos = y * width + x;
+                if (context->f_mask) {
+                    for (n = 0; n < depth; ++n) {
+                        val = data[pos * depth + n] + context->f_mask(x, y, n) * 32;
+                        copy[n] = val < 0 ? 0 : val > 255 ? 255 : val;
+                    }
+                    color_index = context->f_lookup(copy, depth, palette,
+                                                    context->reqcolor,
+                                                    context->indextable,
+                                                    context->lut,
+                                                    context->complexion);
+                } else {
+                    color_index = context->f_lookup(data + pos * depth, depth, palette,
+                                                    context->reqcolor,
+                                                    context->indextable,
+                                                    context->lut,
+                                                    context->complexion);
+                }
+                context->result[pos] = color_index;
+                if (context->kernel) {
+                    for (n = 0; n < depth; ++n) {
+                        offset = data[pos * depth + n] - palette[color_index * depth + n];
+                        diffuse_kernel(data + n, width, context->height,
+                                       x, y, depth, offset, context->kernel);
+                    }
+                }
+            }
+            if (context->kernel) {
+                sixel_mutex_lock(&context->mutex);
+                context->progress[y] = x1;
+                sixel_cond_broadcast(&context->cond);
+                sixel_mutex_unlock(&context->mutex);
+            }
+        }
+    }
+}
+
+
+static SIXELSTATUS
+quant_apply_palette_stripes(quant_stripe_context_t *context,
+                            int methodForDiffuse,
+                            int nthreads,
+                            sixel_allocator_t *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    context->kernel = NULL;
+    context->lag = 0;
+    if (context->depth == 3 && context->f_mask == NULL) {
+        switch (methodForDiffuse) {
+        case SIXEL_DIFFUSE_FS:
+            context->kernel = kernel_fs;
+            break;
+        case SIXEL_DIFFUSE_ATKINSON:
+            context->kernel = kernel_atkinson;
+            break;
+        case SIXEL_DIFFUSE_JAJUNI:
+            context->kernel = kernel_jajuni;
+            break;
+        case SIXEL_DIFFUSE_STUCKI:
+            context->kernel = kernel_stucki;
+            break;
+        case SIXEL_DIFFUSE_BURKES:
+            context->kernel = kernel_burkes;
+            break;
+        default:
+            break;
+        }
+    }
+    if (context->kernel) {
+        /* a chunk must not touch pixels which the row above is still
+           diffusing into: 2 * (horizontal reach) + 1 */
+        context->lag = context->kernel == kernel_fs ? 3: 5;
+    }
+
+    context->progress = (int *)sixel_allocator_calloc(allocator,
+                                                      (size_t)context->height,
+                                                      sizeof(int));
+    if (context->progress == NULL) {
+        sixel_helper_set_additional_message(
+            "quant_apply_palette_stripes: sixel_allocator_calloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    status = sixel_mutex_init(&context->mutex);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    status = sixel_cond_init(&context->cond);
+    if (SIXEL_FAILED(status)) {
+        sixel_mutex_destroy(&context->mutex);
+        goto end;
+    }
+
+    if (context->f_lookup == lookup_fast) {
+        /* entries filled on demand would depend on the scan order */
+        context->next = 0;
+        status = sixel_thread_run(nthreads, quant_prefill_worker, context);
+    }
+    if (SIXEL_SUCCEEDED(status)) {
+        context->next = 0;
+        status = sixel_thread_run(nthreads, quant_stripe_worker, context);
+    }
+
+    sixel_cond_destroy(&context->cond);
+    sixel_mutex_destroy(&context->mutex);
+
+end:
+    sixel_allocator_free(allocator, context->progress);
+    context->progress = NULL;
+    return status;
+}
+
+
 /* apply color palette into specified pixel buffers */
 SIXELSTATUS
 sixel_quant_apply_palette(
@@ -1258,13 +1728,16 @@ sixel_quant_apply_palette(
     int               /* in */  foptimize_palette,
     int               /* in */  complexion,
     unsigned short    /* in */  *cachetable,
+    unsigned char const /* in */ *lut,
+    int               /* in */  lut_type,
+    int               /* in */  nthreads,
     int               /* in */  *ncolors,
     sixel_allocator_t /* in */  *allocator)
 {
     typedef int component_t;
     enum { max_depth = 4 };
     SIXELSTATUS status = SIXEL_FALSE;
-    int pos, n, x, y, sum1, sum2;
+    int pos, n, x, y;
     component_t offset;
     int color_index;
     unsigned short *indextable;
@@ -1278,7 +1751,9 @@ sixel_quant_apply_palette(
                     unsigned char const * const palette,
                     int const reqcolor,
                     unsigned short * const cachetable,
+                    unsigned char const * const lut,
                     int const complexion);
+    quant_stripe_context_t stripe_context;
 
     /* check bad reqcolor */
     if (reqcolor < 1) {
@@ -1289,68 +1764,9 @@ sixel_quant_apply_palette(
         goto end;
     }
 
-    if (depth != 3) {
-        f_diffuse = diffuse_none;
-    } else {
-        switch (methodForDiffuse) {
-        case SIXEL_DIFFUSE_NONE:
-            f_diffuse = diffuse_none;
-            break;
-        case SIXEL_DIFFUSE_ATKINSON:
-            f_diffuse = diffuse_atkinson;
-            break;
-        case SIXEL_DIFFUSE_FS:
-            f_diffuse = diffuse_fs;
-            break;
-        case SIXEL_DIFFUSE_JAJUNI:
-            f_diffuse = diffuse_jajuni;
-            break;
-        case SIXEL_DIFFUSE_STUCKI:
-            f_diffuse = diffuse_stucki;
-            break;
-        case SIXEL_DIFFUSE_BURKES:
-            f_diffuse = diffuse_burkes;
-            break;
-        case SIXEL_DIFFUSE_A_DITHER:
-            f_diffuse = diffuse_none;
-            f_mask = mask_a;
-            break;
-        case SIXEL_DIFFUSE_X_DITHER:
-            f_diffuse = diffuse_none;
-            f_mask = mask_x;
-            break;
-        default:
-            quant_trace(stderr, "Internal error: invalid value of"
-                                " methodForDiffuse: %d\n",
-                        methodForDiffuse);
-            f_diffuse = diffuse_none;
-            break;
-        }
-    }
-
-    f_lookup = NULL;
-    if (reqcolor == 2) {
-        sum1 = 0;
-        sum2 = 0;
-        for (n = 0; n < depth; ++n) {
-            sum1 += palette[n];
-        }
-        for (n = depth; n < depth + depth; ++n) {
-            sum2 += palette[n];
-        }
-        if (sum1 == 0 && sum2 == 255 * 3) {
-            f_lookup = lookup_mono_darkbg;
-        } else if (sum1 == 255 * 3 && sum2 == 0) {
-            f_lookup = lookup_mono_lightbg;
-        }
-    }
-    if (f_lookup == NULL) {
-        if (foptimize && depth == 3) {
-            f_lookup = lookup_fast;
-        } else {
-            f_lookup = lookup_normal;
-        }
-    }
+    quant_select_diffuse(methodForDiffuse, depth, &f_diffuse, &f_mask);
+    f_lookup = quant_select_lookup(palette, depth, reqcolor, foptimize,
+                                   complexion, lut, lut_type);
 
     indextable = cachetable;
     if (cachetable == NULL && f_lookup == lookup_fast) {
@@ -1363,7 +1779,49 @@ sixel_quant_apply_palette(
         }
     }
 
-    if (foptimize_palette) {
+    if (nthreads > 0) {
+        stripe_context.result = result;
+        stripe_context.data = data;
+        stripe_context.width = width;
+        stripe_context.height = height;
+        stripe_context.depth = depth;
+        stripe_context.palette = palette;
+        stripe_context.reqcolor = reqcolor;
+        stripe_context.complexion = complexion;
+        stripe_context.indextable = indextable;
+        stripe_context.lut = lut;
+        stripe_context.f_lookup = f_lookup;
+        stripe_context.f_mask = f_mask;
+        status = quant_apply_palette_stripes(&stripe_context,
+                                             methodForDiffuse,
+                                             nthreads,
+                                             allocator);
+        if (SIXEL_FAILED(status)) {
+            if (cachetable == NULL) {
+                sixel_allocator_free(allocator, indextable);
+            }
+            goto end;
+        }
+        if (foptimize_palette) {
+            /* renumber colors in order of appearance */
+            *ncolors = 0;
+            memset(migration_map, 0x00, sizeof(migration_map));
+            for (pos = 0; pos < width * height; ++pos) {
+                color_index = result[pos];
+                if (migration_map[color_index] == 0) {
+                    for (n = 0; n < depth; ++n) {
+                        new_palette[*ncolors * depth + n] = palette[color_index * depth + n];
+                    }
+                    ++*ncolors;
+                    migration_map[color_index] = *ncolors;
+                }
+                result[pos] = migration_map[color_index] - 1;
+            }
+            memcpy(palette, new_palette, (size_t)(*ncolors * depth));
+        } else {
+            *ncolors = reqcolor;
+        }
+    } else if (foptimize_palette) {
         *ncolors = 0;
 
         memset(new_palette, 0x00, sizeof(SIXEL_PALETTE_MAX * depth));
@@ -1382,7 +1840,7 @@ sixel_quant_apply_palette(
                         copy[d] = val < 0 ? 0 : val > 255 ? 255 : val;
                     }
                     color_index = f_lookup(copy, depth,
-                                           palette, reqcolor, indextable, complexion);
+                                           palette, reqcolor, indextable, lut, complexion);
                     if (migration_map[color_index] == 0) {
                         result[pos] = *ncolors;
                         for (n = 0; n < depth; ++n) {
@@ -1401,7 +1859,7 @@ sixel_quant_apply_palette(
                 for (x = 0; x < width; ++x) {
                     pos = y * width + x;
                     color_index = f_lookup(data + (pos * depth), depth,
-                                           palette, reqcolor, indextable, complexion);
+                                           palette, reqcolor, indextable, lut, complexion);
                     if (migration_map[color_index] == 0) {
                         result[pos] = *ncolors;
                         for (n = 0; n < depth; ++n) {
@@ -1434,7 +1892,7 @@ sixel_quant_apply_palette(
                         copy[d] = val < 0 ? 0 : val > 255 ? 255 : val;
                     }
                     result[pos] = f_lookup(copy, depth,
-                                           palette, reqcolor, indextable, complexion);
+                                           palette, reqcolor, indextable, lut, complexion);
                 }
             }
         } else {
@@ -1442,7 +1900,7 @@ sixel_quant_apply_palette(
                 for (x = 0; x < width; ++x) {
                     pos = y * width + x;
                     color_index = f_lookup(data + (pos * depth), depth,
-                                           palette, reqcolor, indextable, complexion);
+                                           palette, reqcolor, indextable, lut, complexion);
                     result[pos] = color_index;
                     for (n = 0; n < depth; ++n) {
                         offset = data[pos * depth + n] - palette[color_index * depth + n];
@@ -1465,6 +1923,99 @@ end:
 }
 
 
+/* apply color palette into the first nrows rows of a band buffer which has
+   height rows, the errors diffused into the following rows are left in data
+   so that the next band continues the diffusion, y is the position of the
+   band in the whole image */
+SIXELSTATUS
+sixel_quant_apply_palette_rows(
+    sixel_index_t       /* out */ *result,
+    unsigned char       /* in */  *data,
+    int                 /* in */  width,
+    int                 /* in */  height,
+    int                 /* in */  nrows,
+    int                 /* in */  y,
+    int                 /* in */  depth,
+    unsigned char       /* in */  *palette,
+    int                 /* in */  reqcolor,
+    int                 /* in */  methodForDiffuse,
+    int                 /* in */  foptimize,
+    int                 /* in */  complexion,
+    unsigned short      /* in */  *cachetable,
+    unsigned char const /* in */  *lut,
+    int                 /* in */  lut_type,
+    sixel_allocator_t   /* in */  *allocator)
+{
+    enum { max_depth = 4 };
+    SIXELSTATUS status = SIXEL_FALSE;
+    int pos, n, x, row, d, val;
+    int offset;
+    int color_index;
+    unsigned short *indextable;
+    unsigned char copy[max_depth];
+    float (*f_mask) (int x, int y, int c);
+    void (*f_diffuse)(unsigned char *data, int width, int height,
+                      int x, int y, int depth, int offset);
+    quant_lookup_fn_t f_lookup;
+
+    if (reqcolor < 1) {
+        status = SIXEL_BAD_ARGUMENT;
+        sixel_helper_set_additional_message(
+            "sixel_quant_apply_palette_rows: "
+            "a bad argument is detected, reqcolor < 0.");
+        goto end;
+    }
+
+    quant_select_diffuse(methodForDiffuse, depth, &f_diffuse, &f_mask);
+    f_lookup = quant_select_lookup(palette, depth, reqcolor, foptimize,
+                                   complexion, lut, lut_type);
+
+    indextable = cachetable;
+    if (cachetable == NULL && f_lookup == lookup_fast) {
+        indextable = (unsigned short *)sixel_allocator_calloc(allocator,
+                                                              (size_t)(1 << depth * 5),
+                                                              sizeof(unsigned short));
+        if (!indextable) {
+            sixel_helper_set_additional_message(
+                "sixel_quant_apply_palette_rows: sixel_allocator_calloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+    }
+
+    for (row = 0; row < nrows; ++row) {
+        for (x = 0; x < width; ++x) {
+            pos = row * width + x;
+            if (f_mask) {
+                for (d = 0; d < depth; d ++) {
+                    val = data[pos * depth + d] + f_mask(x, y + row, d) * 32;
+                    copy[d] = val < 0 ? 0 : val > 255 ? 255 : val;
+                }
+                result[pos] = f_lookup(copy, depth,
+                                       palette, reqcolor, indextable, lut, complexion);
+            } else {
+                color_index = f_lookup(data + (pos * depth), depth,
+                                       palette, reqcolor, indextable, lut, complexion);
+                result[pos] = color_index;
+                for (n = 0; n < depth; ++n) {
+                    offset = data[pos * depth + n] - palette[color_index * depth + n];
+                    f_diffuse(data + n, width, height, x, row, depth, offset);
+                }
+            }
+        }
+    }
+
+    if (cachetable == NULL) {
+        sixel_allocator_free(allocator, indextable);
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
 void
 sixel_quant_free_palette(
     unsigned char       /* in */ *data,
@@ -1494,6 +2045,67 @@ error:
 }
 
 
+/* stripe mode gives the same result for any number of threads */
+static int
+test2(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    enum { width = 97, height = 31, npixels = width * height };
+    static int const methods[] = {
+        SIXEL_DIFFUSE_FS, SIXEL_DIFFUSE_JAJUNI, SIXEL_DIFFUSE_X_DITHER,
+    };
+    unsigned char source[npixels * 3];
+    unsigned char data[npixels * 3];
+    unsigned char palette[4 * 3] = {
+        0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0xff, 0x00, 0xff, 0xff, 0xff,
+    };
+    sixel_index_t expected[npixels];
+    sixel_index_t result[npixels];
+    unsigned int seed = 1;
+    int ncolors;
+    int nthreads;
+    size_t m;
+    int n;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (n = 0; n < npixels * 3; ++n) {
+        seed = seed * 1103515245 + 12345;
+        source[n] = (unsigned char)(seed >> 16 & 0xff);
+    }
+
+    for (m = 0; m < sizeof(methods) / sizeof(methods[0]); ++m) {
+        for (nthreads = 1; nthreads <= 4; ++nthreads) {
+            memcpy(data, source, sizeof(data));
+            status = sixel_quant_apply_palette(result, data, width, height, 3,
+                                               palette, 4, methods[m],
+                                               1, 0, 1, NULL, NULL,
+                                               SIXEL_LUT_NONE, nthreads,
+                                               &ncolors, allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            if (nthreads == 1) {
+                memcpy(expected, result, sizeof(expected));
+            } else if (memcmp(expected, result, sizeof(expected)) != 0) {
+                goto error;
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_quant_tests_main(void)
 {
@@ -1503,6 +2115,7 @@ sixel_quant_tests_main(void)
 
     static testcase const testcases[] = {
         test1,
+        test2,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
@@ -28,6 +28,11 @@ extern "C" {
 
 #include <sixel.h>
 
+/* types of precomputed lookup tables for builtin palettes */
+#define SIXEL_LUT_NONE      0   /* no table */
+#define SIXEL_LUT_RGB555    1   /* 2^15 entries indexed by RGB555 hash */
+#define SIXEL_LUT_GRAYSUM   2   /* 766 entries indexed by R + G + B */
+
 /* choose colors using median-cut method */
 SIXELSTATUS
 sixel_quant_make_palette(
@@ -59,10 +64,35 @@ sixel_quant_apply_palette(
     int                 /* in */  foptimize_palette,
     int                 /* in */  complexion,
     unsigned short      /* in */  *cachetable,
+    unsigned char const /* in */  *lut,         /* precomputed lookup table or NULL */
+    int                 /* in */  lut_type,     /* one of SIXEL_LUT_* */
+    int                 /* in */  nthreads,     /* stripe mode if positive */
     int                 /* in */  *ncolor,
     sixel_allocator_t   /* in */  *allocator);
 
 
+/* apply color palette into the first nrows rows of a band of height rows,
+   the rest rows receive diffused errors for the next band */
+SIXELSTATUS
+sixel_quant_apply_palette_rows(
+    sixel_index_t       /* out */ *result,
+    unsigned char       /* in */  *data,
+    int                 /* in */  width,
+    int                 /* in */  height,
+    int                 /* in */  nrows,
+    int                 /* in */  y,            /* position of the band */
+    int                 /* in */  depth,
+    unsigned char       /* in */  *palette,
+    int                 /* in */  reqcolor,
+    int                 /* in */  methodForDiffuse,
+    int                 /* in */  foptimize,
+    int                 /* in */  complexion,
+    unsigned short      /* in */  *cachetable,
+    unsigned char const /* in */  *lut,         /* precomputed lookup table or NULL */
+    int                 /* in */  lut_type,     /* one of SIXEL_LUT_* */
+    sixel_allocator_t   /* in */  *allocator);
+
+
 /* deallocate specified palette */
 void
 sixel_quant_free_palette(
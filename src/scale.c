@@ -24,6 +24,9 @@
 #if STDC_HEADERS
 # include <stdlib.h>
 #endif  /* STDC_HEADERS */
+#if HAVE_STRING_H
+# include <string.h>
+#endif  /* HAVE_STRING_H */
 #if HAVE_MATH_H
 # define _USE_MATH_DEFINES  /* for MSVC */
 # include <math.h>
@@ -32,7 +35,17 @@
 # define M_PI 3.14159265358979323846
 #endif
 
+#if HAVE_AVX2_DISPATCH
+# include <immintrin.h>
+#endif  /* HAVE_AVX2_DISPATCH */
+#if HAVE_ARM_NEON_H && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+# include <arm_neon.h>
+# define SCALE_USE_NEON 1
+#endif  /* HAVE_ARM_NEON_H */
+
 #include <sixel.h>
+#include "scale.h"
+#include "thread.h"
 
 #if !defined(MAX)
 # define MAX(l, r) ((l) > (r) ? (l) : (r))
@@ -172,31 +185,114 @@ hamming(const double d)
 }
 
 
-static unsigned char
-normalize(double x, double total)
+/* area averaging for integer ratio downscaling,
+   each destination pixel of the rows [y_begin, y_end) is the mean of
+   a kx * ky block, columns is a work area of srcw * depth entries */
+static void
+scale_box_rows(
+    unsigned char *dst,
+    unsigned char const *src,
+    int const srcw,
+    int const srcstride,
+    int const dstw,
+    int const kx,
+    int const ky,
+    int const depth,
+    int const y_begin,
+    int const y_end,
+    int *columns)
 {
-    int result;
+    /* a block may be larger than INT_MAX / 255 pixels, columns of ky
+       rows still fit in int */
+    unsigned long long const area = (unsigned long long)kx * (unsigned long long)ky;
+    int const srclen = srcw * depth;
+    /* (sum * recip) >> 32 equals sum / area for sum < 256 * area
+       as long as area is 4096 or less */
+    unsigned long long const recip = ((1ULL << 32) + area - 1) / area;
+    int x;
+    int y;
+    int i;
+    int j;
+    int k;
+    unsigned long long sums[4];
+    int const *q;
+    unsigned char const *p;
 
-    result = floor(x / total);
-    if (result > 255) {
-        return 0xff;
+    for (y = y_begin; y < y_end; y++) {
+        /* sum up ky rows first, then kx columns */
+        p = src + (size_t)y * (size_t)ky * (size_t)srcstride;
+        for (j = 0; j < srclen; j++) {
+            columns[j] = p[j];
+        }
+        for (k = 1; k < ky; k++) {
+            p += srcstride;
+            for (j = 0; j < srclen; j++) {
+                columns[j] += p[j];
+            }
+        }
+        q = columns;
+        for (x = 0; x < dstw; x++) {
+            for (i = 0; i < depth; i++) {
+                sums[i] = area / 2;
+            }
+            for (j = 0; j < kx; j++) {
+                for (i = 0; i < depth; i++) {
+                    sums[i] += (unsigned long long)*q++;
+                }
+            }
+            for (i = 0; i < depth; i++) {
+                if (area <= 4096) {
+                    *dst++ = (unsigned char)((sums[i] * recip) >> 32);
+                } else {
+                    *dst++ = (unsigned char)(sums[i] / area);
+                }
+            }
+        }
     }
-    if (result < 0) {
-        return 0x00;
+}
+
+
+static int
+scale_box(
+    unsigned char *dst,
+    unsigned char const *src,
+    int const srcw,
+    int const srch,
+    int const srcstride,
+    int const dstw,
+    int const dsth,
+    int const depth,
+    sixel_allocator_t *allocator)
+{
+    int *columns;
+
+    columns = (int *)sixel_allocator_malloc(allocator, sizeof(int) * (size_t)(srcw * depth));
+    if (columns == NULL) {
+        return (-1);
     }
-    return (unsigned char)result;
+
+    scale_box_rows(dst, src, srcw, srcstride, dstw, srcw / dstw, srch / dsth, depth,
+                   0, dsth, columns);
+
+    sixel_allocator_free(allocator, columns);
+
+    return 0;
 }
 
 
+/* nearest neighbor scaling of the destination rows [y_begin, y_end) */
 static void
 scale_without_resampling(
     unsigned char *dst,
     unsigned char const *src,
     int const srcw,
     int const srch,
+    int const srcstride,
     int const dstw,
     int const dsth,
-    int const depth)
+    int const depth,
+    int const y_begin,
+    int const y_end)
 {
     int w;
     int h;
@@ -205,13 +301,13 @@ scale_without_resampling(
     int i;
     int pos;
 
-    for (h = 0; h < dsth; h++) {
+    for (h = y_begin; h < y_end; h++) {
         for (w = 0; w < dstw; w++) {
             x = w * srcw / dstw;
             y = h * srch / dsth;
             for (i = 0; i < depth; i++) {
-                pos = (y * srcw + x) * depth + i;
-                dst[(h * dstw + w) * depth + i] = src[pos];
+                pos = y * srcstride + x * depth + i;
+                dst[((h - y_begin) * dstw + w) * depth + i] = src[pos];
             }
         }
     }
@@ -220,175 +316,1644 @@ scale_without_resampling(
 
 typedef double (*resample_fn_t)(double const d);
 
+/* fixed-point precision of resampling weights */
+#define SCALE_PRECISION_BITS    14
+#define SCALE_PRECISION_ONE     (1 << SCALE_PRECISION_BITS)
+
+/* resampling weights of one axis, precomputed for each destination index */
+typedef struct scale_weights {
+    int *first;     /* first source index of the window */
+    int *count;     /* number of source pixels in the window */
+    short *coeffs;  /* fixed-point weights, "window" entries per destination index */
+    int window;     /* maximum number of source pixels in a window */
+} scale_weights_t;
+
+
+/* retrieve range of affected source pixels for a destination index */
 static void
-scale_with_resampling(
+scale_compute_range(
+    int const i,
+    int const srclen,
+    int const dstlen,
+    double const n,
+    double *center,
+    int *first,
+    int *last)
+{
+    if (dstlen >= srclen) {
+        *center = (i + 0.5) * srclen / dstlen;
+        *first = MAX(*center - n, 0);
+        *last = MIN(*center + n, srclen - 1);
+    } else {
+        *center = i + 0.5;
+        *first = MAX(floor((*center - n) * srclen / dstlen), 0);
+        *last = MIN(floor((*center + n) * srclen / dstlen), srclen - 1);
+    }
+}
+
+
+static void
+scale_weights_dispose(
+    scale_weights_t *weights,
+    sixel_allocator_t *allocator)
+{
+    sixel_allocator_free(allocator, weights->first);
+    sixel_allocator_free(allocator, weights->coeffs);
+    weights->first = NULL;
+    weights->count = NULL;
+    weights->coeffs = NULL;
+}
+
+
+/* precompute normalized fixed-point weights of one axis */
+static int
+scale_weights_init(
+    scale_weights_t *weights,
+    int const srclen,
+    int const dstlen,
+    resample_fn_t const f_resample,
+    double const n,
+    sixel_allocator_t *allocator)
+{
+    int i;
+    int k;
+    int first;
+    int last;
+    int count;
+    int sum;
+    int largest;
+    int coeff;
+    short *coeffs;
+    double center;
+    double diff;
+    double total;
+    double *values = NULL;
+
+    weights->first = NULL;
+    weights->count = NULL;
+    weights->coeffs = NULL;
+    weights->window = 1;
+
+    for (i = 0; i < dstlen; i++) {
+        scale_compute_range(i, srclen, dstlen, n, &center, &first, &last);
+        weights->window = MAX(weights->window, last - first + 1);
+    }
+
+    weights->first = (int *)sixel_allocator_malloc(
+        allocator, sizeof(int) * (size_t)dstlen * 2);
+    weights->coeffs = (short *)sixel_allocator_malloc(
+        allocator, sizeof(short) * (size_t)dstlen * (size_t)weights->window);
+    values = (double *)sixel_allocator_malloc(
+        allocator, sizeof(double) * (size_t)weights->window);
+    if (weights->first == NULL || weights->coeffs == NULL || values == NULL) {
+        sixel_allocator_free(allocator, values);
+        scale_weights_dispose(weights, allocator);
+        return (-1);
+    }
+    weights->count = weights->first + dstlen;
+
+    for (i = 0; i < dstlen; i++) {
+        scale_compute_range(i, srclen, dstlen, n, &center, &first, &last);
+        coeffs = weights->coeffs + i * weights->window;
+
+        /* accumerate weights of affected pixels */
+        total = 0.0;
+        for (k = 0; k <= last - first; k++) {
+            if (dstlen >= srclen) {
+                diff = (first + k + 0.5) - center;
+            } else {
+                diff = (first + k + 0.5) * dstlen / srclen - center;
+            }
+            values[k] = f_resample(fabs(diff));
+            total += values[k];
+        }
+
+        if (total <= 0.0) {
+            /* degenerated window, fall back to nearest neighbor */
+            weights->first[i] = MIN(i * srclen / dstlen, srclen - 1);
+            weights->count[i] = 1;
+            coeffs[0] = SCALE_PRECISION_ONE;
+            continue;
+        }
+
+        /* normalize, and put rounding error on the largest weight
+           so that the weights sum up to exactly one */
+        sum = 0;
+        largest = 0;
+        for (k = 0; k <= last - first; k++) {
+            coeff = (int)floor(values[k] / total * SCALE_PRECISION_ONE + 0.5);
+            coeffs[k] = (short)coeff;
+            sum += coeff;
+            if (coeff > coeffs[largest]) {
+                largest = k;
+            }
+        }
+        coeffs[largest] = (short)(coeffs[largest] + SCALE_PRECISION_ONE - sum);
+
+        /* trim zero weights on both ends of the window */
+        count = last - first + 1;
+        while (count > 1 && coeffs[count - 1] == 0) {
+            count--;
+        }
+        k = 0;
+        while (k < count - 1 && coeffs[k] == 0) {
+            k++;
+        }
+        if (k > 0) {
+            memmove(coeffs, coeffs + k, sizeof(short) * (size_t)(count - k));
+        }
+        weights->first[i] = first + k;
+        weights->count[i] = count - k;
+    }
+
+    sixel_allocator_free(allocator, values);
+
+    return 0;
+}
+
+
+static unsigned char
+scale_clamp(int acc)
+{
+    if (acc < 0) {
+        return 0x00;
+    }
+    acc >>= SCALE_PRECISION_BITS;
+    if (acc > 255) {
+        return 0xff;
+    }
+    return (unsigned char)acc;
+}
+
+
+/* resample one row horizontally */
+static void
+scale_horizontal(
     unsigned char *dst,
     unsigned char const *src,
     int const srcw,
-    int const srch,
     int const dstw,
-    int const dsth,
     int const depth,
-    resample_fn_t const f_resample,
-    double n)
+    scale_weights_t const *weights)
 {
-    int w;
-    int h;
     int x;
-    int y;
     int i;
-    int pos;
-    int x_first, x_last, y_first, y_last;
-    double center_x, center_y;
-    double diff_x, diff_y;
-    double weight;
-    double total;
-    double offsets[8];
+    int k;
+    int acc[4];
+    short const *coeffs;
+    unsigned char const *p;
 
-    for (h = 0; h < dsth; h++) {
-        for (w = 0; w < dstw; w++) {
-            total = 0.0;
+    (void) srcw;
+
+    for (x = 0; x < dstw; x++) {
+        coeffs = weights->coeffs + x * weights->window;
+        p = src + weights->first[x] * depth;
+        for (i = 0; i < depth; i++) {
+            acc[i] = 1 << (SCALE_PRECISION_BITS - 1);
+        }
+        for (k = 0; k < weights->count[x]; k++) {
             for (i = 0; i < depth; i++) {
-                offsets[i] = 0;
+                acc[i] += p[i] * coeffs[k];
             }
+            p += depth;
+        }
+        for (i = 0; i < depth; i++) {
+            *dst++ = scale_clamp(acc[i]);
+        }
+    }
+}
 
-            /* retrieve range of affected pixels */
-            if (dstw >= srcw) {
-                center_x = (w + 0.5) * srcw / dstw;
-                x_first = MAX(center_x - n, 0);
-                x_last = MIN(center_x + n, srcw - 1);
-            } else {
-                center_x = w + 0.5;
-                x_first = MAX(floor((center_x - n) * srcw / dstw), 0);
-                x_last = MIN(floor((center_x + n) * srcw / dstw), srcw - 1);
-            }
-            if (dsth >= srch) {
-                center_y = (h + 0.5) * srch / dsth;
-                y_first = MAX(center_y - n, 0);
-                y_last = MIN(center_y + n, srch - 1);
-            } else {
-                center_y = h + 0.5;
-                y_first = MAX(floor((center_y - n) * srch / dsth), 0);
-                y_last = MIN(floor((center_y + n) * srch / dsth), srch - 1);
-            }
 
-            /* accumerate weights of affected pixels */
-            for (y = y_first; y <= y_last; y++) {
-                for (x = x_first; x <= x_last; x++) {
-                    if (dstw >= srcw) {
-                        diff_x = (x + 0.5) - center_x;
-                    } else {
-                        diff_x = (x + 0.5) * dstw / srcw - center_x;
-                    }
-                    if (dsth >= srch) {
-                        diff_y = (y + 0.5) - center_y;
-                    } else {
-                        diff_y = (y + 0.5) * dsth / srch - center_y;
-                    }
-                    weight = f_resample(fabs(diff_x)) * f_resample(fabs(diff_y));
-                    for (i = 0; i < depth; i++) {
-                        pos = (y * srcw + x) * depth + i;
-                        offsets[i] += src[pos] * weight;
-                    }
-                    total += weight;
-                }
-            }
+/* resample one row vertically from horizontally resampled rows */
+static void
+scale_vertical(
+    unsigned char *dst,
+    unsigned char const *src,
+    int *acc,
+    int const rowlen,
+    int const y,
+    scale_weights_t const *weights)
+{
+    int j;
+    int k;
+    int coeff;
+    short const *coeffs;
+    unsigned char const *p;
 
-            /* normalize */
-            if (total > 0.0) {
-                for (i = 0; i < depth; i++) {
-                    pos = (h * dstw + w) * depth + i;
-                    dst[pos] = normalize(offsets[i], total);
-                }
-            }
+    coeffs = weights->coeffs + y * weights->window;
+    for (j = 0; j < rowlen; j++) {
+        acc[j] = 1 << (SCALE_PRECISION_BITS - 1);
+    }
+    for (k = 0; k < weights->count[y]; k++) {
+        p = src + (weights->first[y] + k) * rowlen;
+        coeff = coeffs[k];
+        for (j = 0; j < rowlen; j++) {
+            acc[j] += p[j] * coeff;
         }
     }
+    for (j = 0; j < rowlen; j++) {
+        dst[j] = scale_clamp(acc[j]);
+    }
 }
 
 
-SIXELAPI int
-sixel_helper_scale_image(
-    unsigned char       /* out */ *dst,
-    unsigned char const /* in */  *src,                   /* source image data */
-    int                 /* in */  srcw,                   /* source image width */
-    int                 /* in */  srch,                   /* source image height */
-    int                 /* in */  pixelformat,            /* one of enum pixelFormat */
-    int                 /* in */  dstw,                   /* destination image width */
-    int                 /* in */  dsth,                   /* destination image height */
-    int                 /* in */  method_for_resampling,  /* one of methodForResampling */
-    sixel_allocator_t   /* in */  *allocator)             /* allocator object */
+/* resample the rest of a row vertically, used by vectorized kernels */
+static void
+scale_vertical_tail(
+    unsigned char *dst,
+    unsigned char const *src,
+    int const j_first,
+    int const rowlen,
+    int const y,
+    scale_weights_t const *weights)
 {
-    int const depth = sixel_helper_compute_depth(pixelformat);
-    unsigned char *new_src = NULL;
-    int nret;
-    int new_pixelformat;
+    int j;
+    int k;
+    int acc;
+    short const *coeffs;
+    unsigned char const *p;
 
-    if (depth != 3) {
-        new_src = (unsigned char *)sixel_allocator_malloc(allocator, (size_t)(srcw * srch * 3));
-        if (new_src == NULL) {
-            return (-1);
+    coeffs = weights->coeffs + y * weights->window;
+    p = src + weights->first[y] * rowlen;
+    for (j = j_first; j < rowlen; j++) {
+        acc = 1 << (SCALE_PRECISION_BITS - 1);
+        for (k = 0; k < weights->count[y]; k++) {
+            acc += p[k * rowlen + j] * coeffs[k];
         }
-        nret = sixel_helper_normalize_pixelformat(new_src,
-                                                  &new_pixelformat,
-                                                  src, pixelformat,
-                                                  srcw, srch);
-        if (nret != 0) {
-            sixel_allocator_free(allocator, new_src);
-            return (-1);
+        dst[j] = scale_clamp(acc);
+    }
+}
+
+
+#if HAVE_AVX2_DISPATCH
+/* pack two 16bit weights into a 32bit lane for pmaddwd */
+# define SCALE_PAIR(c0, c1) \
+    ((int)((unsigned int)(unsigned short)(c0) | \
+           (unsigned int)(unsigned short)(c1) << 16))
+
+/* resample one RGB888 row horizontally, four taps per iteration */
+__attribute__((target("avx2")))
+static void
+scale_horizontal_avx2(
+    unsigned char *dst,
+    unsigned char const *src,
+    int const srcw,
+    int const dstw,
+    int const depth,
+    scale_weights_t const *weights)
+{
+    int x;
+    int i;
+    int k;
+    int first;
+    int count;
+    int acc[4];
+    short const *coeffs;
+    unsigned char const *p;
+    __m256i sum;
+    __m256i pixels;
+    __m256i c;
+    /* spread taps 0, 1 over the lower lane and taps 2, 3 over the upper lane
+       as (tap0, tap1) pairs of 16bit RGB components */
+    __m256i const mask = _mm256_setr_epi8(
+        0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1,
+        6, -1, 9, -1, 7, -1, 10, -1, 8, -1, 11, -1, -1, -1, -1, -1);
+
+    (void) depth;
+
+    for (x = 0; x < dstw; x++) {
+        coeffs = weights->coeffs + x * weights->window;
+        first = weights->first[x];
+        count = weights->count[x];
+        p = src + first * 3;
+        sum = _mm256_setzero_si256();
+
+        /* 16 bytes are loaded for 4 taps, do not step over the row end */
+        for (k = 0; k + 4 <= count && (first + k) * 3 + 16 <= srcw * 3; k += 4) {
+            pixels = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((__m128i const *)(p + k * 3)));
+            pixels = _mm256_shuffle_epi8(pixels, mask);
+            c = _mm256_setr_epi32(
+                SCALE_PAIR(coeffs[k + 0], coeffs[k + 1]),
+                SCALE_PAIR(coeffs[k + 0], coeffs[k + 1]),
+                SCALE_PAIR(coeffs[k + 0], coeffs[k + 1]),
+                0,
+                SCALE_PAIR(coeffs[k + 2], coeffs[k + 3]),
+                SCALE_PAIR(coeffs[k + 2], coeffs[k + 3]),
+                SCALE_PAIR(coeffs[k + 2], coeffs[k + 3]),
+                0);
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(pixels, c));
         }
+        _mm_storeu_si128((__m128i *)acc,
+                         _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                       _mm256_extracti128_si256(sum, 1)));
 
-        src = new_src;
-    } else {
-        new_pixelformat = pixelformat;
+        for (; k < count; k++) {
+            for (i = 0; i < 3; i++) {
+                acc[i] += p[k * 3 + i] * coeffs[k];
+            }
+        }
+        for (i = 0; i < 3; i++) {
+            *dst++ = scale_clamp(acc[i] + (1 << (SCALE_PRECISION_BITS - 1)));
+        }
     }
+}
 
-    /* choose re-sampling strategy */
-    switch (method_for_resampling) {
-    case SIXEL_RES_NEAREST:
-        scale_without_resampling(dst, src, srcw, srch, dstw, dsth, depth);
-        break;
-    case SIXEL_RES_GAUSSIAN:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              gaussian, 1.0);
-        break;
-    case SIXEL_RES_HANNING:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              hanning, 1.0);
-        break;
-    case SIXEL_RES_HAMMING:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              hamming, 1.0);
-        break;
-    case SIXEL_RES_WELSH:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              welsh, 1.0);
-        break;
-    case SIXEL_RES_BICUBIC:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              bicubic, 2.0);
-        break;
-    case SIXEL_RES_LANCZOS2:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              lanczos2, 3.0);
-        break;
-    case SIXEL_RES_LANCZOS3:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              lanczos3, 3.0);
-        break;
-    case SIXEL_RES_LANCZOS4:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              lanczos4, 4.0);
-        break;
-    case SIXEL_RES_BILINEAR:
-    default:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              bilinear, 1.0);
-        break;
+
+/* resample one row vertically, 32 bytes per iteration */
+__attribute__((target("avx2")))
+static void
+scale_vertical_avx2(
+    unsigned char *dst,
+    unsigned char const *src,
+    int *acc,
+    int const rowlen,
+    int const y,
+    scale_weights_t const *weights)
+{
+    int j;
+    int k;
+    int count;
+    short const *coeffs;
+    unsigned char const *p;
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const bias = _mm256_set1_epi32(1 << (SCALE_PRECISION_BITS - 1));
+    __m256i s0, s1, s2, s3;
+    __m256i r0, r1;
+    __m256i lo, hi;
+    __m256i c;
+
+    (void) acc;
+
+    coeffs = weights->coeffs + y * weights->window;
+    count = weights->count[y];
+    p = src + weights->first[y] * rowlen;
+
+    for (j = 0; j + 32 <= rowlen; j += 32) {
+        s0 = s1 = s2 = s3 = bias;
+        /* interleave two rows so that pmaddwd applies a pair of weights */
+        for (k = 0; k < count; k += 2) {
+            r0 = _mm256_loadu_si256((__m256i const *)(p + k * rowlen + j));
+            if (k + 1 < count) {
+                r1 = _mm256_loadu_si256((__m256i const *)(p + (k + 1) * rowlen + j));
+                c = _mm256_set1_epi32(SCALE_PAIR(coeffs[k], coeffs[k + 1]));
+            } else {
+                r1 = zero;
+                c = _mm256_set1_epi32(SCALE_PAIR(coeffs[k], 0));
+            }
+            lo = _mm256_unpacklo_epi8(r0, r1);
+            hi = _mm256_unpackhi_epi8(r0, r1);
+            s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), c));
+            s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), c));
+            s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), c));
+            s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), c));
+        }
+        /* packing in the same lanes restores the original byte order */
+        s0 = _mm256_packs_epi32(_mm256_srai_epi32(s0, SCALE_PRECISION_BITS),
+                                _mm256_srai_epi32(s1, SCALE_PRECISION_BITS));
+        s2 = _mm256_packs_epi32(_mm256_srai_epi32(s2, SCALE_PRECISION_BITS),
+                                _mm256_srai_epi32(s3, SCALE_PRECISION_BITS));
+        _mm256_storeu_si256((__m256i *)(dst + j), _mm256_packus_epi16(s0, s2));
     }
 
-    free(new_src);
-    return 0;
+    scale_vertical_tail(dst, src, j, rowlen, y, weights);
+}
+#endif  /* HAVE_AVX2_DISPATCH */
+
+
+#if SCALE_USE_NEON
+static int
+scale_sum_neon(int32x4_t v)
+{
+    int32x2_t t;
+
+    t = vadd_s32(vget_low_s32(v), vget_high_s32(v));
+    return vget_lane_s32(vpadd_s32(t, t), 0);
+}
+
+
+/* resample one RGB888 row horizontally, eight taps per iteration */
+static void
+scale_horizontal_neon(
+    unsigned char *dst,
+    unsigned char const *src,
+    int const srcw,
+    int const dstw,
+    int const depth,
+    scale_weights_t const *weights)
+{
+    int x;
+    int i;
+    int k;
+    int count;
+    int acc[3];
+    short const *coeffs;
+    unsigned char const *p;
+    uint8x8x3_t pixels;
+    int16x8_t c;
+    int16x8_t v;
+    int32x4_t sum[3];
+
+    (void) srcw;
+    (void) depth;
+
+    for (x = 0; x < dstw; x++) {
+        coeffs = weights->coeffs + x * weights->window;
+        count = weights->count[x];
+        p = src + weights->first[x] * 3;
+        for (i = 0; i < 3; i++) {
+            sum[i] = vdupq_n_s32(0);
+        }
+        for (k = 0; k + 8 <= count; k += 8) {
+            pixels = vld3_u8(p + k * 3);
+            c = vld1q_s16(coeffs + k);
+            for (i = 0; i < 3; i++) {
+                v = vreinterpretq_s16_u16(vmovl_u8(pixels.val[i]));
+                sum[i] = vmlal_s16(sum[i], vget_low_s16(v), vget_low_s16(c));
+                sum[i] = vmlal_s16(sum[i], vget_high_s16(v), vget_high_s16(c));
+            }
+        }
+        for (i = 0; i < 3; i++) {
+            acc[i] = scale_sum_neon(sum[i]) + (1 << (SCALE_PRECISION_BITS - 1));
+        }
+        for (; k < count; k++) {
+            for (i = 0; i < 3; i++) {
+                acc[i] += p[k * 3 + i] * coeffs[k];
+            }
+        }
+        for (i = 0; i < 3; i++) {
+            *dst++ = scale_clamp(acc[i]);
+        }
+    }
+}
+
+
+/* resample one row vertically, 16 bytes per iteration */
+static void
+scale_vertical_neon(
+    unsigned char *dst,
+    unsigned char const *src,
+    int *acc,
+    int const rowlen,
+    int const y,
+    scale_weights_t const *weights)
+{
+    int j;
+    int k;
+    int count;
+    short const *coeffs;
+    unsigned char const *p;
+    uint8x16_t r;
+    int16x8_t lo;
+    int16x8_t hi;
+    int32x4_t s0, s1, s2, s3;
+
+    (void) acc;
+
+    coeffs = weights->coeffs + y * weights->window;
+    count = weights->count[y];
+    p = src + weights->first[y] * rowlen;
+
+    for (j = 0; j + 16 <= rowlen; j += 16) {
+        s0 = s1 = s2 = s3 = vdupq_n_s32(1 << (SCALE_PRECISION_BITS - 1));
+        for (k = 0; k < count; k++) {
+            r = vld1q_u8(p + k * rowlen + j);
+            lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(r)));
+            hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(r)));
+            s0 = vmlal_n_s16(s0, vget_low_s16(lo), coeffs[k]);
+            s1 = vmlal_n_s16(s1, vget_high_s16(lo), coeffs[k]);
+            s2 = vmlal_n_s16(s2, vget_low_s16(hi), coeffs[k]);
+            s3 = vmlal_n_s16(s3, vget_high_s16(hi), coeffs[k]);
+        }
+        /* saturating narrowing shifts clamp the results into 0..255 */
+        vst1q_u8(dst + j,
+                 vcombine_u8(
+                     vqmovn_u16(vcombine_u16(vqshrun_n_s32(s0, SCALE_PRECISION_BITS),
+                                             vqshrun_n_s32(s1, SCALE_PRECISION_BITS))),
+                     vqmovn_u16(vcombine_u16(vqshrun_n_s32(s2, SCALE_PRECISION_BITS),
+                                             vqshrun_n_s32(s3, SCALE_PRECISION_BITS)))));
+    }
+
+    scale_vertical_tail(dst, src, j, rowlen, y, weights);
+}
+#endif  /* SCALE_USE_NEON */
+
+
+typedef void (*scale_horizontal_fn_t)(
+    unsigned char *dst,
+    unsigned char const *src,
+    int const srcw,
+    int const dstw,
+    int const depth,
+    scale_weights_t const *weights);
+
+typedef void (*scale_vertical_fn_t)(
+    unsigned char *dst,
+    unsigned char const *src,
+    int *acc,
+    int const rowlen,
+    int const y,
+    scale_weights_t const *weights);
+
+/* convolution kernels for each pass */
+typedef struct scale_kernels {
+    scale_horizontal_fn_t horizontal;
+    scale_vertical_fn_t vertical;
+} scale_kernels_t;
+
+
+/* choose the fastest convolution kernels available on this CPU */
+static void
+scale_select_kernels(
+    scale_kernels_t *kernels,
+    int const depth)
+{
+    kernels->horizontal = scale_horizontal;
+    kernels->vertical = scale_vertical;
+
+#if HAVE_AVX2_DISPATCH
+    if (__builtin_cpu_supports("avx2")) {
+        kernels->vertical = scale_vertical_avx2;
+        if (depth == 3) {
+            kernels->horizontal = scale_horizontal_avx2;
+        }
+    }
+#elif SCALE_USE_NEON
+    kernels->vertical = scale_vertical_neon;
+    if (depth == 3) {
+        kernels->horizontal = scale_horizontal_neon;
+    }
+#else
+    (void) depth;
+#endif
+}
+
+
+/* number of rows picked up by a worker at once */
+#define SCALE_STRIPE_ROWS   16
+
+/* shared context of resampling workers */
+typedef struct scale_stripe_context {
+    unsigned char *dst;
+    unsigned char const *src;
+    unsigned char *tmp;             /* horizontally resampled rows */
+    int *acc;                       /* accumulators, rowlen entries per worker */
+    int srcw;
+    int srcstride;                  /* bytes per source row */
+    int dstw;
+    int depth;
+    int rowlen;
+    scale_weights_t const *xweights;
+    scale_weights_t const *yweights;
+    scale_kernels_t const *kernels;
+    int vertical;                   /* whether the current pass is vertical */
+    int y_end;                      /* end of rows of the current pass */
+    int next;                       /* next row to be picked up */
+    int nworkers;                   /* number of started workers */
+    sixel_mutex_t mutex;
+} scale_stripe_context_t;
+
+
+static void
+scale_stripe_worker(void *arg)
+{
+    scale_stripe_context_t *context = (scale_stripe_context_t *)arg;
+    int const rowlen = context->rowlen;
+    int *acc;
+    int y;
+    int y_last;
+
+    sixel_mutex_lock(&context->mutex);
+    acc = context->acc + context->nworkers++ * rowlen;
+    sixel_mutex_unlock(&context->mutex);
+
+    for (;;) {
+        sixel_mutex_lock(&context->mutex);
+        y = context->next;
+        context->next += SCALE_STRIPE_ROWS;
+        sixel_mutex_unlock(&context->mutex);
+        if (y >= context->y_end) {
+            break;
+        }
+        y_last = MIN(y + SCALE_STRIPE_ROWS, context->y_end);
+        for (; y < y_last; y++) {
+            if (context->vertical) {
+                context->kernels->vertical(context->dst + y * rowlen,
+                                           context->tmp, acc, rowlen,
+                                           y, context->yweights);
+            } else {
+                context->kernels->horizontal(context->tmp + y * rowlen,
+                                             context->src + y * context->srcstride,
+                                             context->srcw, context->dstw,
+                                             context->depth, context->xweights);
+            }
+        }
+    }
+}
+
+
+/* separable two-pass resampling with precomputed fixed-point weights,
+   each pass is split into row stripes processed by nthreads workers */
+static int
+scale_with_resampling(
+    unsigned char *dst,
+    unsigned char const *src,
+    int const srcw,
+    int const srch,
+    int const srcstride,
+    int const dstw,
+    int const dsth,
+    int const depth,
+    resample_fn_t const f_resample,
+    double n,
+    scale_kernels_t const *kernels,
+    int nthreads,
+    sixel_allocator_t *allocator)
+{
+    int nret = (-1);
+    SIXELSTATUS status;
+    int y;
+    int y_first;
+    int y_last;
+    int const rowlen = dstw * depth;
+    scale_weights_t xweights;
+    scale_weights_t yweights;
+    scale_stripe_context_t context;
+    unsigned char *tmp = NULL;
+    int *acc = NULL;
+
+    xweights.first = yweights.first = NULL;
+    xweights.coeffs = yweights.coeffs = NULL;
+
+    nthreads = MAX(MIN(nthreads, SIXEL_THREADS_MAX), 1);
+
+    if (scale_weights_init(&xweights, srcw, dstw, f_resample, n, allocator) != 0) {
+        goto end;
+    }
+    if (scale_weights_init(&yweights, srch, dsth, f_resample, n, allocator) != 0) {
+        goto end;
+    }
+
+    /* only the source rows referred by the vertical pass are needed */
+    y_first = srch - 1;
+    y_last = 0;
+    for (y = 0; y < dsth; y++) {
+        y_first = MIN(y_first, yweights.first[y]);
+        y_last = MAX(y_last, yweights.first[y] + yweights.count[y] - 1);
+    }
+
+    tmp = (unsigned char *)sixel_allocator_malloc(
+        allocator, (size_t)rowlen * (size_t)srch);
+    acc = (int *)sixel_allocator_malloc(
+        allocator, sizeof(int) * (size_t)rowlen * (size_t)nthreads);
+    if (tmp == NULL || acc == NULL) {
+        goto end;
+    }
+
+    context.dst = dst;
+    context.src = src;
+    context.tmp = tmp;
+    context.acc = acc;
+    context.srcw = srcw;
+    context.srcstride = srcstride;
+    context.dstw = dstw;
+    context.depth = depth;
+    context.rowlen = rowlen;
+    context.xweights = &xweights;
+    context.yweights = &yweights;
+    context.kernels = kernels;
+
+    status = sixel_mutex_init(&context.mutex);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    /* the vertical pass starts after all horizontal stripes are done */
+    context.vertical = 0;
+    context.next = y_first;
+    context.y_end = y_last + 1;
+    context.nworkers = 0;
+    status = sixel_thread_run(nthreads, scale_stripe_worker, &context);
+    if (SIXEL_SUCCEEDED(status)) {
+        context.vertical = 1;
+        context.next = 0;
+        context.y_end = dsth;
+        context.nworkers = 0;
+        status = sixel_thread_run(nthreads, scale_stripe_worker, &context);
+    }
+
+    sixel_mutex_destroy(&context.mutex);
+
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    nret = 0;
+
+end:
+    sixel_allocator_free(allocator, acc);
+    sixel_allocator_free(allocator, tmp);
+    scale_weights_dispose(&xweights, allocator);
+    scale_weights_dispose(&yweights, allocator);
+    return nret;
+}
+
+
+/* strategies of scaling */
+#define SCALE_STRATEGY_NEAREST      0   /* pick up the nearest pixel */
+#define SCALE_STRATEGY_BOX          1   /* average integer ratio blocks */
+#define SCALE_STRATEGY_RESAMPLING   2   /* separable convolution */
+
+/* choose scaling strategy, and resampling filter with its radius */
+static int
+scale_choose_strategy(
+    int const method_for_resampling,
+    int const srcw,
+    int const srch,
+    int const dstw,
+    int const dsth,
+    resample_fn_t *f_resample,
+    double *n)
+{
+    *f_resample = bilinear;
+    *n = 1.0;
+
+    switch (method_for_resampling) {
+    case SIXEL_RES_NEAREST:
+        return SCALE_STRATEGY_NEAREST;
+    case SIXEL_RES_GAUSSIAN:
+        *f_resample = gaussian;
+        break;
+    case SIXEL_RES_HANNING:
+        *f_resample = hanning;
+        break;
+    case SIXEL_RES_HAMMING:
+        *f_resample = hamming;
+        break;
+    case SIXEL_RES_WELSH:
+        *f_resample = welsh;
+        break;
+    case SIXEL_RES_BICUBIC:
+        *f_resample = bicubic;
+        *n = 2.0;
+        break;
+    case SIXEL_RES_LANCZOS2:
+        *f_resample = lanczos2;
+        *n = 3.0;
+        break;
+    case SIXEL_RES_LANCZOS3:
+        *f_resample = lanczos3;
+        *n = 3.0;
+        break;
+    case SIXEL_RES_LANCZOS4:
+        *f_resample = lanczos4;
+        *n = 4.0;
+        break;
+    case SIXEL_RES_BILINEAR:
+    default:
+        if (srcw % dstw == 0 && srch % dsth == 0) {
+            /* integer ratio downscaling, e.g. -w 50% */
+            return SCALE_STRATEGY_BOX;
+        }
+        break;
+    }
+
+    return SCALE_STRATEGY_RESAMPLING;
+}
+
+
+/* scale image with nthreads workers */
+int
+sixel_scale_image(
+    unsigned char       /* out */ *dst,
+    unsigned char const /* in */  *src,                   /* source image data */
+    int                 /* in */  srcw,                   /* source image width */
+    int                 /* in */  srch,                   /* source image height */
+    int                 /* in */  srcstride,              /* bytes per source row */
+    int                 /* in */  pixelformat,            /* one of enum pixelFormat */
+    int                 /* in */  dstw,                   /* destination image width */
+    int                 /* in */  dsth,                   /* destination image height */
+    int                 /* in */  method_for_resampling,  /* one of methodForResampling */
+    int                 /* in */  nthreads,               /* number of threads */
+    sixel_allocator_t   /* in */  *allocator)             /* allocator object */
+{
+    int const depth = sixel_helper_compute_depth(pixelformat);
+    unsigned char *new_src = NULL;
+    int nret;
+    int new_pixelformat;
+    scale_kernels_t kernels;
+    resample_fn_t f_resample;
+    double n;
+
+    if (depth != 3) {
+        new_src = (unsigned char *)sixel_allocator_malloc(allocator, (size_t)(srcw * srch * 3));
+        if (new_src == NULL) {
+            return (-1);
+        }
+        nret = sixel_helper_normalize_pixelformat_with_stride(new_src,
+                                                              &new_pixelformat,
+                                                              src, pixelformat,
+                                                              srcw, srch,
+                                                              srcstride);
+        if (nret != 0) {
+            sixel_allocator_free(allocator, new_src);
+            return (-1);
+        }
+
+        src = new_src;
+        srcstride = srcw * 3;
+    } else {
+        new_pixelformat = pixelformat;
+    }
+
+    scale_select_kernels(&kernels, depth);
+
+    /* choose re-sampling strategy */
+    switch (scale_choose_strategy(method_for_resampling,
+                                  srcw, srch, dstw, dsth,
+                                  &f_resample, &n)) {
+    case SCALE_STRATEGY_NEAREST:
+        scale_without_resampling(dst, src, srcw, srch, srcstride,
+                                 dstw, dsth, depth, 0, dsth);
+        nret = 0;
+        break;
+    case SCALE_STRATEGY_BOX:
+        nret = scale_box(dst, src, srcw, srch, srcstride,
+                         dstw, dsth, depth, allocator);
+        break;
+    case SCALE_STRATEGY_RESAMPLING:
+    default:
+        nret = scale_with_resampling(dst, src, srcw, srch, srcstride,
+                                     dstw, dsth, depth,
+                                     f_resample, n, &kernels, nthreads,
+                                     allocator);
+        break;
+    }
+
+    sixel_allocator_free(allocator, new_src);
+    return nret;
+}
+
+
+SIXELAPI int
+sixel_helper_scale_image(
+    unsigned char       /* out */ *dst,
+    unsigned char const /* in */  *src,                   /* source image data */
+    int                 /* in */  srcw,                   /* source image width */
+    int                 /* in */  srch,                   /* source image height */
+    int                 /* in */  pixelformat,            /* one of enum pixelFormat */
+    int                 /* in */  dstw,                   /* destination image width */
+    int                 /* in */  dsth,                   /* destination image height */
+    int                 /* in */  method_for_resampling,  /* one of methodForResampling */
+    sixel_allocator_t   /* in */  *allocator)             /* allocator object */
+{
+    return sixel_scale_image(dst, src, srcw, srch,
+                             srcw * sixel_helper_compute_depth(pixelformat),
+                             pixelformat, dstw, dsth,
+                             method_for_resampling, 0, allocator);
+}
+
+
+/* streaming scaler which produces destination rows on demand, only the
+   horizontally resampled source rows under the current window are kept */
+struct sixel_scaler {
+    unsigned char const *src;       /* source image data */
+    unsigned char *new_src;         /* normalized copy of the source or NULL */
+    int srcw;
+    int srch;
+    int srcstride;                  /* bytes per source row */
+    int dstw;
+    int dsth;
+    int depth;
+    int strategy;                   /* one of SCALE_STRATEGY_* */
+    scale_weights_t xweights;
+    scale_weights_t yweights;
+    scale_kernels_t kernels;
+    int *keep;                      /* first source row used by the rest rows */
+    unsigned char *window;          /* horizontally resampled source rows */
+    int window_first;               /* source row at the top of the window */
+    int window_rows;                /* number of rows in the window */
+    int *acc;                       /* accumulators or column sums */
+    sixel_allocator_t *allocator;
+};
+
+
+/* create a streaming scaler */
+SIXELSTATUS
+sixel_scaler_new(
+    sixel_scaler_t      /* out */ **ppscaler,
+    unsigned char const /* in */  *src,                   /* source image data */
+    int                 /* in */  srcw,                   /* source image width */
+    int                 /* in */  srch,                   /* source image height */
+    int                 /* in */  srcstride,              /* bytes per source row */
+    int                 /* in */  pixelformat,            /* one of enum pixelFormat */
+    int                 /* in */  dstw,                   /* destination image width */
+    int                 /* in */  dsth,                   /* destination image height */
+    int                 /* in */  method_for_resampling,  /* one of methodForResampling */
+    sixel_allocator_t   /* in */  *allocator)             /* allocator object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_scaler_t *scaler = NULL;
+    resample_fn_t f_resample;
+    double n;
+    int new_pixelformat;
+    int capacity;
+    int keep;
+    int y;
+
+    scaler = (sixel_scaler_t *)sixel_allocator_calloc(allocator, 1, sizeof(sixel_scaler_t));
+    if (scaler == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_scaler_new: sixel_allocator_calloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    scaler->allocator = allocator;
+    scaler->srcw = srcw;
+    scaler->srch = srch;
+    scaler->srcstride = srcstride;
+    scaler->dstw = dstw;
+    scaler->dsth = dsth;
+    scaler->depth = sixel_helper_compute_depth(pixelformat);
+    scaler->src = src;
+
+    if (scaler->depth != 3) {
+        scaler->new_src = (unsigned char *)sixel_allocator_malloc(allocator, (size_t)(srcw * srch * 3));
+        if (scaler->new_src == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_scaler_new: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        status = sixel_helper_normalize_pixelformat_with_stride(scaler->new_src,
+                                                                &new_pixelformat,
+                                                                src, pixelformat,
+                                                                srcw, srch,
+                                                                srcstride);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        scaler->src = scaler->new_src;
+        scaler->srcstride = srcw * 3;
+        scaler->depth = 3;
+    }
+
+    scale_select_kernels(&scaler->kernels, scaler->depth);
+    scaler->strategy = scale_choose_strategy(method_for_resampling,
+                                             srcw, srch, dstw, dsth,
+                                             &f_resample, &n);
+
+    if (scaler->strategy == SCALE_STRATEGY_RESAMPLING) {
+        if (scale_weights_init(&scaler->xweights, srcw, dstw,
+                               f_resample, n, allocator) != 0 ||
+            scale_weights_init(&scaler->yweights, srch, dsth,
+                               f_resample, n, allocator) != 0) {
+            sixel_helper_set_additional_message(
+                "sixel_scaler_new: scale_weights_init() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+
+        /* the window must hold the source rows from the smallest first
+           index of the rest rows to the end of the current one */
+        scaler->keep = (int *)sixel_allocator_malloc(allocator, sizeof(int) * (size_t)dsth);
+        if (scaler->keep == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_scaler_new: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        capacity = 1;
+        keep = srch;
+        for (y = dsth - 1; y >= 0; y--) {
+            keep = MIN(keep, scaler->yweights.first[y]);
+            scaler->keep[y] = keep;
+            capacity = MAX(capacity, scaler->yweights.first[y]
+                                     + scaler->yweights.count[y] - keep);
+        }
+        scaler->window = (unsigned char *)sixel_allocator_malloc(
+            allocator, (size_t)capacity * (size_t)(dstw * scaler->depth));
+        if (scaler->window == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_scaler_new: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+    }
+
+    scaler->acc = (int *)sixel_allocator_malloc(
+        allocator, sizeof(int) * (size_t)(MAX(srcw, dstw) * scaler->depth));
+    if (scaler->acc == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_scaler_new: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    *ppscaler = scaler;
+    scaler = NULL;
+
+    status = SIXEL_OK;
+
+end:
+    sixel_scaler_destroy(scaler);
+    return status;
+}
+
+
+/* destroy a streaming scaler */
+void
+sixel_scaler_destroy(
+    sixel_scaler_t  /* in */ *scaler)
+{
+    sixel_allocator_t *allocator;
+
+    if (scaler) {
+        allocator = scaler->allocator;
+        sixel_allocator_free(allocator, scaler->acc);
+        sixel_allocator_free(allocator, scaler->window);
+        sixel_allocator_free(allocator, scaler->keep);
+        scale_weights_dispose(&scaler->xweights, allocator);
+        scale_weights_dispose(&scaler->yweights, allocator);
+        sixel_allocator_free(allocator, scaler->new_src);
+        sixel_allocator_free(allocator, scaler);
+    }
+}
+
+
+/* produce the destination rows [y, y + nrows), the result is the same as
+   the corresponding rows of sixel_scale_image(), rows are expected to be
+   requested from top to bottom */
+SIXELSTATUS
+sixel_scaler_get_rows(
+    sixel_scaler_t  /* in */  *scaler,  /* scaler object */
+    unsigned char   /* out */ *dst,     /* nrows rows of destination image */
+    int             /* in */  y,        /* first row to be produced */
+    int             /* in */  nrows)    /* number of rows */
+{
+    int const rowlen = scaler->dstw * scaler->depth;
+    int const y_end = MIN(y + nrows, scaler->dsth);
+    int first;
+    int last;
+    int keep;
+    int drop;
+    scale_weights_t weights;
+
+    if (y < 0 || y >= y_end) {
+        sixel_helper_set_additional_message(
+            "sixel_scaler_get_rows: bad row range.");
+        return SIXEL_BAD_ARGUMENT;
+    }
+
+    switch (scaler->strategy) {
+    case SCALE_STRATEGY_NEAREST:
+        scale_without_resampling(dst, scaler->src,
+                                 scaler->srcw, scaler->srch, scaler->srcstride,
+                                 scaler->dstw, scaler->dsth,
+                                 scaler->depth, y, y_end);
+        break;
+    case SCALE_STRATEGY_BOX:
+        scale_box_rows(dst, scaler->src, scaler->srcw, scaler->srcstride,
+                       scaler->dstw,
+                       scaler->srcw / scaler->dstw,
+                       scaler->srch / scaler->dsth,
+                       scaler->depth, y, y_end, scaler->acc);
+        break;
+    case SCALE_STRATEGY_RESAMPLING:
+    default:
+        for (; y < y_end; y++, dst += rowlen) {
+            first = scaler->yweights.first[y];
+            last = first + scaler->yweights.count[y];
+            keep = scaler->keep[y];
+
+            /* slide the window, rows before keep are no longer used */
+            if (keep < scaler->window_first ||
+                keep >= scaler->window_first + scaler->window_rows) {
+                scaler->window_first = keep;
+                scaler->window_rows = 0;
+            } else if (keep > scaler->window_first) {
+                drop = keep - scaler->window_first;
+                memmove(scaler->window,
+                        scaler->window + drop * rowlen,
+                        (size_t)((scaler->window_rows - drop) * rowlen));
+                scaler->window_first = keep;
+                scaler->window_rows -= drop;
+            }
+            while (scaler->window_first + scaler->window_rows < last) {
+                scaler->kernels.horizontal(
+                    scaler->window + scaler->window_rows * rowlen,
+                    scaler->src + (scaler->window_first + scaler->window_rows) * scaler->srcstride,
+                    scaler->srcw, scaler->dstw, scaler->depth,
+                    &scaler->xweights);
+                scaler->window_rows++;
+            }
+
+            /* weights of this row relative to the top of the window */
+            first -= scaler->window_first;
+            weights.first = &first;
+            weights.count = scaler->yweights.count + y;
+            weights.coeffs = scaler->yweights.coeffs + y * scaler->yweights.window;
+            weights.window = scaler->yweights.window;
+            scaler->kernels.vertical(dst, scaler->window, scaler->acc,
+                                     rowlen, 0, &weights);
+        }
+        break;
+    }
+
+    return SIXEL_OK;
+}
+
+
+#if HAVE_TESTS
+/* straightforward two-dimensional resampling for reference */
+static void
+test_scale_reference(
+    unsigned char *dst,
+    unsigned char const *src,
+    int const srcw,
+    int const srch,
+    int const dstw,
+    int const dsth,
+    resample_fn_t const f_resample,
+    double n)
+{
+    int w;
+    int h;
+    int x;
+    int y;
+    int i;
+    int x_first, x_last, y_first, y_last;
+    int value;
+    double center_x, center_y;
+    double diff_x, diff_y;
+    double weight;
+    double total;
+    double offsets[3];
+
+    for (h = 0; h < dsth; h++) {
+        for (w = 0; w < dstw; w++) {
+            total = 0.0;
+            offsets[0] = offsets[1] = offsets[2] = 0.0;
+            scale_compute_range(w, srcw, dstw, n, &center_x, &x_first, &x_last);
+            scale_compute_range(h, srch, dsth, n, &center_y, &y_first, &y_last);
+            for (y = y_first; y <= y_last; y++) {
+                for (x = x_first; x <= x_last; x++) {
+                    if (dstw >= srcw) {
+                        diff_x = (x + 0.5) - center_x;
+                    } else {
+                        diff_x = (x + 0.5) * dstw / srcw - center_x;
+                    }
+                    if (dsth >= srch) {
+                        diff_y = (y + 0.5) - center_y;
+                    } else {
+                        diff_y = (y + 0.5) * dsth / srch - center_y;
+                    }
+                    weight = f_resample(fabs(diff_x)) * f_resample(fabs(diff_y));
+                    for (i = 0; i < 3; i++) {
+                        offsets[i] += src[(y * srcw + x) * 3 + i] * weight;
+                    }
+                    total += weight;
+                }
+            }
+            for (i = 0; i < 3; i++) {
+                value = (int)floor(offsets[i] / total + 0.5);
+                dst[(h * dstw + w) * 3 + i] = (unsigned char)MAX(MIN(value, 255), 0);
+            }
+        }
+    }
+}
+
+
+/* separable resampler matches two-dimensional resampling */
+static int
+test1(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char src[37 * 23 * 3];
+    unsigned char dst[41 * 29 * 3];
+    unsigned char ref[41 * 29 * 3];
+    int sizes[][2] = { { 16, 11 }, { 41, 29 }, { 9, 29 } };
+    size_t i;
+    int j;
+    int k;
+
+    struct {
+        int method;
+        resample_fn_t f_resample;
+        double n;
+    } const methods[] = {
+        { SIXEL_RES_BILINEAR, bilinear, 1.0 },
+        { SIXEL_RES_WELSH,    welsh,    1.0 },
+        { SIXEL_RES_BICUBIC,  bicubic,  2.0 },
+        { SIXEL_RES_LANCZOS3, lanczos3, 3.0 },
+        { SIXEL_RES_GAUSSIAN, gaussian, 1.0 },
+    };
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    /* smooth gradient */
+    for (j = 0; j < 37 * 23; j++) {
+        src[j * 3 + 0] = (unsigned char)(j % 37 * 6);
+        src[j * 3 + 1] = (unsigned char)(j / 37 * 10);
+        src[j * 3 + 2] = (unsigned char)((j % 37 + j / 37) * 4);
+    }
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        for (j = 0; j < (int)(sizeof(sizes) / sizeof(sizes[0])); j++) {
+            if (sixel_helper_scale_image(dst, src, 37, 23,
+                                         SIXEL_PIXELFORMAT_RGB888,
+                                         sizes[j][0], sizes[j][1],
+                                         methods[i].method, allocator) != 0) {
+                goto error;
+            }
+            test_scale_reference(ref, src, 37, 23, sizes[j][0], sizes[j][1],
+                                 methods[i].f_resample, methods[i].n);
+            for (k = 0; k < sizes[j][0] * sizes[j][1] * 3; k++) {
+                if (abs(dst[k] - ref[k]) > 1) {
+                    goto error;
+                }
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* resampling to the same size keeps the image for interpolating filters */
+static int
+test2(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char src[13 * 7 * 3];
+    unsigned char dst[13 * 7 * 3];
+    int const methods[] = { SIXEL_RES_BILINEAR, SIXEL_RES_LANCZOS3 };
+    size_t i;
+    int j;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (j = 0; j < 13 * 7 * 3; j++) {
+        src[j] = (unsigned char)(j * 97 % 256);
+    }
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (sixel_helper_scale_image(dst, src, 13, 7, SIXEL_PIXELFORMAT_RGB888,
+                                     13, 7, methods[i], allocator) != 0) {
+            goto error;
+        }
+        if (memcmp(dst, src, sizeof(src)) != 0) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* vectorized kernels produce the same result as scalar kernels */
+static int
+test3(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char *src = NULL;
+    unsigned char *dst = NULL;
+    unsigned char *ref = NULL;
+    int const srcw = 101;
+    int const srch = 37;
+    int sizes[][2] = { { 50, 20 }, { 203, 75 }, { 33, 90 }, { 7, 3 } };
+    scale_kernels_t scalar;
+    scale_kernels_t selected;
+    size_t i;
+    int j;
+    int k;
+    unsigned int seed = 1;
+
+    struct {
+        resample_fn_t f_resample;
+        double n;
+    } const methods[] = {
+        { bilinear, 1.0 },
+        { bicubic,  2.0 },
+        { lanczos3, 3.0 },
+        { lanczos4, 4.0 },
+        { gaussian, 1.0 },
+    };
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    src = (unsigned char *)sixel_allocator_malloc(allocator, (size_t)(srcw * srch * 3));
+    dst = (unsigned char *)sixel_allocator_malloc(allocator, 203 * 90 * 3);
+    ref = (unsigned char *)sixel_allocator_malloc(allocator, 203 * 90 * 3);
+    if (src == NULL || dst == NULL || ref == NULL) {
+        goto error;
+    }
+
+    /* noisy image, which makes the filters overshoot */
+    for (j = 0; j < srcw * srch * 3; j++) {
+        seed = seed * 1103515245 + 12345;
+        src[j] = (unsigned char)(seed >> 16);
+    }
+
+    scalar.horizontal = scale_horizontal;
+    scalar.vertical = scale_vertical;
+    scale_select_kernels(&selected, 3);
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        for (j = 0; j < (int)(sizeof(sizes) / sizeof(sizes[0])); j++) {
+            if (scale_with_resampling(ref, src, srcw, srch, srcw * 3, sizes[j][0], sizes[j][1], 3,
+                                      methods[i].f_resample, methods[i].n,
+                                      &scalar, 0, allocator) != 0) {
+                goto error;
+            }
+            if (scale_with_resampling(dst, src, srcw, srch, srcw * 3, sizes[j][0], sizes[j][1], 3,
+                                      methods[i].f_resample, methods[i].n,
+                                      &selected, 0, allocator) != 0) {
+                goto error;
+            }
+            for (k = 0; k < sizes[j][0] * sizes[j][1] * 3; k++) {
+                if (dst[k] != ref[k]) {
+                    goto error;
+                }
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_free(allocator, src);
+    sixel_allocator_free(allocator, dst);
+    sixel_allocator_free(allocator, ref);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* output does not depend on the number of threads */
+static int
+test4(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char src[67 * 45 * 3];
+    unsigned char dst[120 * 80 * 3];
+    unsigned char ref[120 * 80 * 3];
+    int const methods[] = {
+        SIXEL_RES_NEAREST, SIXEL_RES_BILINEAR, SIXEL_RES_LANCZOS3
+    };
+    size_t i;
+    int j;
+    int nthreads;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (j = 0; j < 67 * 45 * 3; j++) {
+        src[j] = (unsigned char)(j * 131 % 251);
+    }
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (sixel_scale_image(ref, src, 67, 45, 67 * 3, SIXEL_PIXELFORMAT_RGB888,
+                              120, 80, methods[i], 0, allocator) != 0) {
+            goto error;
+        }
+        for (nthreads = 1; nthreads <= 4; nthreads++) {
+            memset(dst, 0, sizeof(dst));
+            if (sixel_scale_image(dst, src, 67, 45, 67 * 3, SIXEL_PIXELFORMAT_RGB888,
+                                  120, 80, methods[i], nthreads, allocator) != 0) {
+                goto error;
+            }
+            if (memcmp(dst, ref, sizeof(ref)) != 0) {
+                goto error;
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* integer ratio downscaling with bilinear filter averages blocks */
+static int
+test5(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char src[12 * 6 * 3];
+    unsigned char dst[12 * 6 * 3];
+    int sizes[][2] = { { 6, 3 }, { 4, 3 }, { 12, 2 }, { 1, 1 } };
+    int x, y, i, j, k, kx, ky, sum;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (j = 0; j < 12 * 6 * 3; j++) {
+        src[j] = (unsigned char)(j * 89 % 256);
+    }
+
+    for (k = 0; k < (int)(sizeof(sizes) / sizeof(sizes[0])); k++) {
+        if (sixel_helper_scale_image(dst, src, 12, 6, SIXEL_PIXELFORMAT_RGB888,
+                                     sizes[k][0], sizes[k][1],
+                                     SIXEL_RES_BILINEAR, allocator) != 0) {
+            goto error;
+        }
+        kx = 12 / sizes[k][0];
+        ky = 6 / sizes[k][1];
+        for (y = 0; y < sizes[k][1]; y++) {
+            for (x = 0; x < sizes[k][0]; x++) {
+                for (i = 0; i < 3; i++) {
+                    sum = 0;
+                    for (j = 0; j < kx * ky; j++) {
+                        sum += src[((y * ky + j / kx) * 12 + x * kx + j % kx) * 3 + i];
+                    }
+                    if (dst[(y * sizes[k][0] + x) * 3 + i] !=
+                            (sum + kx * ky / 2) / (kx * ky)) {
+                        goto error;
+                    }
+                }
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* streaming scaler produces the same rows as the whole image scaling */
+static int
+test6(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    sixel_scaler_t *scaler = NULL;
+    unsigned char src[67 * 45 * 3];
+    unsigned char dst[134 * 90 * 3];
+    unsigned char ref[134 * 90 * 3];
+    int const methods[] = {
+        SIXEL_RES_NEAREST, SIXEL_RES_BILINEAR, SIXEL_RES_LANCZOS3
+    };
+    int const sizes[][2] = { { 120, 80 }, { 30, 17 }, { 67, 15 }, { 134, 90 } };
+    size_t i;
+    size_t k;
+    int j;
+    int y;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (j = 0; j < 67 * 45 * 3; j++) {
+        src[j] = (unsigned char)(j * 131 % 251);
+    }
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+            if (sixel_scale_image(ref, src, 67, 45, 67 * 3, SIXEL_PIXELFORMAT_RGB888,
+                                  sizes[k][0], sizes[k][1], methods[i],
+                                  0, allocator) != 0) {
+                goto error;
+            }
+            status = sixel_scaler_new(&scaler, src, 67, 45, 67 * 3,
+                                      SIXEL_PIXELFORMAT_RGB888,
+                                      sizes[k][0], sizes[k][1], methods[i],
+                                      allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            memset(dst, 0, sizeof(dst));
+            for (y = 0; y < sizes[k][1]; y += 6) {
+                status = sixel_scaler_get_rows(scaler,
+                                               dst + y * sizes[k][0] * 3,
+                                               y, 6);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+            }
+            sixel_scaler_destroy(scaler);
+            scaler = NULL;
+            if (memcmp(dst, ref, (size_t)(sizes[k][0] * sizes[k][1] * 3)) != 0) {
+                goto error;
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_scaler_destroy(scaler);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* sums of a block larger than INT_MAX / 255 pixels do not overflow */
+static int
+test7(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char *src = NULL;
+    unsigned char dst[3];
+    size_t const size = (size_t)3000 * 3000 * 3;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    src = (unsigned char *)sixel_allocator_malloc(allocator, size);
+    if (src == NULL) {
+        goto error;
+    }
+    memset(src, 0xff, size);
+
+    if (sixel_helper_scale_image(dst, src, 3000, 3000, SIXEL_PIXELFORMAT_RGB888,
+                                 1, 1, SIXEL_RES_BILINEAR, allocator) != 0) {
+        goto error;
+    }
+    if (dst[0] != 0xff || dst[1] != 0xff || dst[2] != 0xff) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_free(allocator, src);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+SIXELAPI int
+sixel_scale_tests_main(void)
+{
+    int nret = EXIT_FAILURE;
+    size_t i;
+    typedef int (* testcase)(void);
+
+    static testcase const testcases[] = {
+        test1,
+        test2,
+        test3,
+        test4,
+        test5,
+        test6,
+        test7,
+    };
+
+    for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
+        nret = testcases[i]();
+        if (nret != EXIT_SUCCESS) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
 }
+#endif  /* HAVE_TESTS */
 
 /* emacs Local Variables:      */
 /* emacs mode: c               */
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2014-2016 Hayaki Saito
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBSIXEL_SCALE_H
+#define LIBSIXEL_SCALE_H
+
+#include <sixel.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* scale image, same as sixel_helper_scale_image() but the source rows are
+   srcstride bytes apart and the destination rows are processed in stripes
+   by nthreads threads if it is more than 1 */
+int
+sixel_scale_image(
+    unsigned char       /* out */ *dst,
+    unsigned char const /* in */  *src,                   /* source image data */
+    int                 /* in */  srcw,                   /* source image width */
+    int                 /* in */  srch,                   /* source image height */
+    int                 /* in */  srcstride,              /* bytes per source row */
+    int                 /* in */  pixelformat,            /* one of enum pixelFormat */
+    int                 /* in */  dstw,                   /* destination image width */
+    int                 /* in */  dsth,                   /* destination image height */
+    int                 /* in */  method_for_resampling,  /* one of methodForResampling */
+    int                 /* in */  nthreads,               /* number of threads */
+    sixel_allocator_t   /* in */  *allocator);            /* allocator object */
+
+/* streaming scaler which produces destination rows on demand */
+typedef struct sixel_scaler sixel_scaler_t;
+
+/* create a streaming scaler, src must live until the scaler is destroyed */
+SIXELSTATUS
+sixel_scaler_new(
+    sixel_scaler_t      /* out */ **ppscaler,
+    unsigned char const /* in */  *src,                   /* source image data */
+    int                 /* in */  srcw,                   /* source image width */
+    int                 /* in */  srch,                   /* source image height */
+    int                 /* in */  srcstride,              /* bytes per source row */
+    int                 /* in */  pixelformat,            /* one of enum pixelFormat */
+    int                 /* in */  dstw,                   /* destination image width */
+    int                 /* in */  dsth,                   /* destination image height */
+    int                 /* in */  method_for_resampling,  /* one of methodForResampling */
+    sixel_allocator_t   /* in */  *allocator);            /* allocator object */
+
+/* destroy a streaming scaler */
+void
+sixel_scaler_destroy(
+    sixel_scaler_t      /* in */  *scaler);
+
+/* produce the destination rows [y, y + nrows) */
+SIXELSTATUS
+sixel_scaler_get_rows(
+    sixel_scaler_t      /* in */  *scaler,      /* scaler object */
+    unsigned char       /* out */ *dst,         /* nrows rows of destination image */
+    int                 /* in */  y,            /* first row to be produced */
+    int                 /* in */  nrows);       /* number of rows */
+
+#if HAVE_TESTS
+int
+sixel_scale_tests_main(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSIXEL_SCALE_H */
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
@@ -51,6 +51,10 @@
 #include "fromgif.h"
 #include "chunk.h"
 #include "allocator.h"
+#include "palcache.h"
+#include "thread.h"
+#include "scale.h"
+#include "fromsixel.h"
 
 #if HAVE_TESTS
 
@@ -158,6 +162,38 @@ main(int argc, char *argv[])
     puts("allocator ok.");
     fflush(stdout);
 
+    nret = sixel_palcache_tests_main();
+    if (nret != EXIT_SUCCESS) {
+        goto error;
+    }
+
+    puts("palcache ok.");
+    fflush(stdout);
+
+    nret = sixel_thread_tests_main();
+    if (nret != EXIT_SUCCESS) {
+        goto error;
+    }
+
+    puts("thread ok.");
+    fflush(stdout);
+
+    nret = sixel_scale_tests_main();
+    if (nret != EXIT_SUCCESS) {
+        goto error;
+    }
+
+    puts("scale ok.");
+    fflush(stdout);
+
+    nret = sixel_fromsixel_tests_main();
+    if (nret != EXIT_SUCCESS) {
+        goto error;
+    }
+
+    puts("fromsixel ok.");
+    fflush(stdout);
+
 error:
     return nret;
 }
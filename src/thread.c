@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2014-2020 Hayaki Saito
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#if STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+#endif  /* STDC_HEADERS */
+
+#include <sixel.h>
+#include "thread.h"
+
+
+SIXELSTATUS
+sixel_mutex_init(sixel_mutex_t /* in */ *mutex)
+{
+#if HAVE_PTHREAD_H
+    if (pthread_mutex_init(mutex, NULL) != 0) {
+        sixel_helper_set_additional_message(
+            "sixel_mutex_init: pthread_mutex_init() failed.");
+        return SIXEL_RUNTIME_ERROR;
+    }
+#else
+    *mutex = 0;
+#endif
+    return SIXEL_OK;
+}
+
+
+void
+sixel_mutex_destroy(sixel_mutex_t /* in */ *mutex)
+{
+#if HAVE_PTHREAD_H
+    (void) pthread_mutex_destroy(mutex);
+#else
+    (void) mutex;
+#endif
+}
+
+
+void
+sixel_mutex_lock(sixel_mutex_t /* in */ *mutex)
+{
+#if HAVE_PTHREAD_H
+    (void) pthread_mutex_lock(mutex);
+#else
+    (void) mutex;
+#endif
+}
+
+
+void
+sixel_mutex_unlock(sixel_mutex_t /* in */ *mutex)
+{
+#if HAVE_PTHREAD_H
+    (void) pthread_mutex_unlock(mutex);
+#else
+    (void) mutex;
+#endif
+}
+
+
+SIXELSTATUS
+sixel_cond_init(sixel_cond_t /* in */ *cond)
+{
+#if HAVE_PTHREAD_H
+    if (pthread_cond_init(cond, NULL) != 0) {
+        sixel_helper_set_additional_message(
+            "sixel_cond_init: pthread_cond_init() failed.");
+        return SIXEL_RUNTIME_ERROR;
+    }
+#else
+    *cond = 0;
+#endif
+    return SIXEL_OK;
+}
+
+
+void
+sixel_cond_destroy(sixel_cond_t /* in */ *cond)
+{
+#if HAVE_PTHREAD_H
+    (void) pthread_cond_destroy(cond);
+#else
+    (void) cond;
+#endif
+}
+
+
+void
+sixel_cond_wait(
+    sixel_cond_t    /* in */ *cond,
+    sixel_mutex_t   /* in */ *mutex)
+{
+#if HAVE_PTHREAD_H
+    (void) pthread_cond_wait(cond, mutex);
+#else
+    /* never reached, waits are satisfied in single-threaded runs */
+    (void) cond;
+    (void) mutex;
+#endif
+}
+
+
+void
+sixel_cond_broadcast(sixel_cond_t /* in */ *cond)
+{
+#if HAVE_PTHREAD_H
+    (void) pthread_cond_broadcast(cond);
+#else
+    (void) cond;
+#endif
+}
+
+
+#if HAVE_PTHREAD_H
+typedef struct sixel_thread_start {
+    void (*func)(void *);
+    void *arg;
+} sixel_thread_start_t;
+
+
+static void *
+sixel_thread_entry(void *data)
+{
+    sixel_thread_start_t *start = (sixel_thread_start_t *)data;
+
+    start->func(start->arg);
+
+    return NULL;
+}
+#endif
+
+
+SIXELSTATUS
+sixel_thread_run(
+    int             /* in */ nthreads,
+    void            /* in */ (*func)(void *),
+    void            /* in */ *arg)
+{
+#if HAVE_PTHREAD_H
+    pthread_t threads[SIXEL_THREADS_MAX];
+    sixel_thread_start_t start;
+    int nstarted = 0;
+    int i;
+
+    if (nthreads > SIXEL_THREADS_MAX) {
+        nthreads = SIXEL_THREADS_MAX;
+    }
+
+    start.func = func;
+    start.arg = arg;
+
+    /* if a thread can not be created, the others take over its share */
+    for (i = 1; i < nthreads; ++i) {
+        if (pthread_create(&threads[nstarted], NULL,
+                           sixel_thread_entry, &start) != 0) {
+            break;
+        }
+        ++nstarted;
+    }
+
+    func(arg);
+
+    for (i = 0; i < nstarted; ++i) {
+        (void) pthread_join(threads[i], NULL);
+    }
+#else
+    (void) nthreads;
+    func(arg);
+#endif
+
+    return SIXEL_OK;
+}
+
+
+#if HAVE_TESTS
+typedef struct test_context {
+    sixel_mutex_t mutex;
+    int next;
+    int sum;
+} test_context_t;
+
+
+static void
+test_worker(void *arg)
+{
+    test_context_t *context = (test_context_t *)arg;
+    int n;
+
+    for (;;) {
+        sixel_mutex_lock(&context->mutex);
+        n = context->next++;
+        if (n < 1000) {
+            context->sum += n;
+        }
+        sixel_mutex_unlock(&context->mutex);
+        if (n >= 1000) {
+            break;
+        }
+    }
+}
+
+
+static int
+test1(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    test_context_t context;
+    int nthreads;
+
+    for (nthreads = 1; nthreads <= 8; nthreads *= 2) {
+        status = sixel_mutex_init(&context.mutex);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        context.next = 0;
+        context.sum = 0;
+        status = sixel_thread_run(nthreads, test_worker, &context);
+        sixel_mutex_destroy(&context.mutex);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (context.sum != 999 * 1000 / 2) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
+}
+
+
+SIXELAPI int
+sixel_thread_tests_main(void)
+{
+    int nret = EXIT_FAILURE;
+    size_t i;
+    typedef int (* testcase)(void);
+
+    static testcase const testcases[] = {
+        test1,
+    };
+
+    for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
+        nret = testcases[i]();
+        if (nret != EXIT_SUCCESS) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
+}
+#endif  /* HAVE_TESTS */
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2014-2020 Hayaki Saito
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef LIBSIXEL_THREAD_H
+#define LIBSIXEL_THREAD_H
+
+#include <sixel.h>
+
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+/* upper limit of worker threads */
+#define SIXEL_THREADS_MAX   64
+
+#if HAVE_PTHREAD_H
+typedef pthread_mutex_t sixel_mutex_t;
+typedef pthread_cond_t sixel_cond_t;
+#else
+typedef int sixel_mutex_t;
+typedef int sixel_cond_t;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SIXELSTATUS
+sixel_mutex_init(sixel_mutex_t /* in */ *mutex);
+
+void
+sixel_mutex_destroy(sixel_mutex_t /* in */ *mutex);
+
+void
+sixel_mutex_lock(sixel_mutex_t /* in */ *mutex);
+
+void
+sixel_mutex_unlock(sixel_mutex_t /* in */ *mutex);
+
+SIXELSTATUS
+sixel_cond_init(sixel_cond_t /* in */ *cond);
+
+void
+sixel_cond_destroy(sixel_cond_t /* in */ *cond);
+
+void
+sixel_cond_wait(
+    sixel_cond_t    /* in */ *cond,
+    sixel_mutex_t   /* in */ *mutex);
+
+void
+sixel_cond_broadcast(sixel_cond_t /* in */ *cond);
+
+/* run func(arg) on nthreads threads including the calling one and wait
+   for all of them. workers must pick up their share of the work from
+   the shared context by themselves, so that the result does not depend
+   on how many threads could actually be started. */
+SIXELSTATUS
+sixel_thread_run(
+    int             /* in */ nthreads,      /* number of threads */
+    void            /* in */ (*func)(void *),
+    void            /* in */ *arg);         /* shared context */
+
+#if HAVE_TESTS
+int
+sixel_thread_tests_main(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSIXEL_THREAD_H */
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
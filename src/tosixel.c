@@ -36,6 +36,8 @@
 #include <sixel.h>
 #include "output.h"
 #include "dither.h"
+#include "pixelformat.h"
+#include "tosixel.h"
 
 #define DCS_START_7BIT       "\033P"
 #define DCS_START_7BIT_SIZE  (sizeof(DCS_START_7BIT) - 1)
@@ -486,75 +488,71 @@ output_hls_palette_definition(
 }
 
 
+/* output palette definitions */
 static SIXELSTATUS
-sixel_encode_body(
+sixel_encode_palette(
+    unsigned char       /* in */ *palette,
+    int                 /* in */ ncolors,
+    int                 /* in */ keycolor,
+    sixel_output_t      /* in */ *output)
+{
+    SIXELSTATUS status = SIXEL_OK;
+    int n;
+
+    if (output->palette_type == SIXEL_PALETTETYPE_HLS) {
+        for (n = 0; n < ncolors; n++) {
+            status = output_hls_palette_definition(output, palette, n, keycolor);
+            if (SIXEL_FAILED(status)) {
+                break;
+            }
+        }
+    } else {
+        for (n = 0; n < ncolors; n++) {
+            status = output_rgb_palette_definition(output, palette, n, keycolor);
+            if (SIXEL_FAILED(status)) {
+                break;
+            }
+        }
+    }
+
+    return status;
+}
+
+
+/* encode a band of up to six rows which starts at row y of the image,
+   pixels points the first row of the band, map is a work area of
+   ncolors * width bytes which must be cleared */
+static SIXELSTATUS
+sixel_encode_band(
     sixel_index_t       /* in */ *pixels,
     int                 /* in */ width,
-    int                 /* in */ height,
-    unsigned char       /* in */ *palette,
+    int                 /* in */ y,
+    int                 /* in */ nrows,
     int                 /* in */ ncolors,
     int                 /* in */ keycolor,
-    int                 /* in */ bodyonly,
     sixel_output_t      /* in */ *output,
     unsigned char       /* in */ *palstate,
+    char                /* in */ *map,
     sixel_allocator_t   /* in */ *allocator)
 {
     SIXELSTATUS status = SIXEL_FALSE;
     int x;
-    int y;
     int i;
     int n;
     int c;
     int sx;
     int mx;
-    int len;
     int pix;
-    char *map = NULL;
     int check_integer_overflow;
     sixel_node_t *np, *tp, top;
-    int fillable;
-
-    if (ncolors < 1) {
-        status = SIXEL_BAD_ARGUMENT;
-        goto end;
-    }
-    len = ncolors * width;
-    output->active_palette = (-1);
-
-    map = (char *)sixel_allocator_calloc(allocator,
-                                         (size_t)len,
-                                         sizeof(char));
-    if (map == NULL) {
-        sixel_helper_set_additional_message(
-            "sixel_encode_body: sixel_allocator_calloc() failed.");
-        status = SIXEL_BAD_ALLOCATION;
-        goto end;
-    }
+    int fillable = 0;
 
-    if (!bodyonly && (ncolors != 2 || keycolor == (-1))) {
-        if (output->palette_type == SIXEL_PALETTETYPE_HLS) {
-            for (n = 0; n < ncolors; n++) {
-                status = output_hls_palette_definition(output, palette, n, keycolor);
-                if (SIXEL_FAILED(status)) {
-                    goto end;
-                }
-            }
-        } else {
-            for (n = 0; n < ncolors; n++) {
-                status = output_rgb_palette_definition(output, palette, n, keycolor);
-                if (SIXEL_FAILED(status)) {
-                    goto end;
-                }
-            }
-        }
-    }
-
-    for (y = i = 0; y < height; y++) {
+    for (i = 0; i < nrows; i++) {
         if (output->encode_policy != SIXEL_ENCODEPOLICY_SIZE) {
             fillable = 0;
         } else if (palstate) {
             /* high color sixel */
-            pix = pixels[(y - i) * width];
+            pix = pixels[0];
             if (pix >= ncolors) {
                 fillable = 0;
             } else {
@@ -565,7 +563,7 @@ sixel_encode_body(
             fillable = 1;
         }
         for (x = 0; x < width; x++) {
-            if (y > INT_MAX / width) {
+            if (y + i > INT_MAX / width) {
                 /* integer overflow */
                 sixel_helper_set_additional_message(
                     "sixel_encode_body: integer overflow detected."
@@ -573,7 +571,7 @@ sixel_encode_body(
                 status = SIXEL_BAD_INTEGER_OVERFLOW;
                 goto end;
             }
-            check_integer_overflow = y * width;
+            check_integer_overflow = (y + i) * width;
             if (check_integer_overflow > INT_MAX - x) {
                 /* integer overflow */
                 sixel_helper_set_additional_message(
@@ -582,7 +580,7 @@ sixel_encode_body(
                 status = SIXEL_BAD_INTEGER_OVERFLOW;
                 goto end;
             }
-            pix = pixels[check_integer_overflow + x];  /* color index */
+            pix = pixels[i * width + x];  /* color index */
             if (pix >= 0 && pix < ncolors && pix != keycolor) {
                 if (pix > INT_MAX / width) {
                     /* integer overflow */
@@ -607,86 +605,100 @@ sixel_encode_body(
                 fillable = 0;
             }
         }
+    }
 
-        if (++i < 6 && (y + 1) < height) {
-            continue;
-        }
+    for (c = 0; c < ncolors; c++) {
+        for (sx = 0; sx < width; sx++) {
+            if (*(map + c * width + sx) == 0) {
+                continue;
+            }
 
-        for (c = 0; c < ncolors; c++) {
-            for (sx = 0; sx < width; sx++) {
-                if (*(map + c * width + sx) == 0) {
+            for (mx = sx + 1; mx < width; mx++) {
+                if (*(map + c * width + mx) != 0) {
                     continue;
                 }
 
-                for (mx = sx + 1; mx < width; mx++) {
-                    if (*(map + c * width + mx) != 0) {
-                        continue;
-                    }
-
-                    for (n = 1; (mx + n) < width; n++) {
-                        if (*(map + c * width + mx + n) != 0) {
-                            break;
-                        }
-                    }
-
-                    if (n >= 10 || (mx + n) >= width) {
+                for (n = 1; (mx + n) < width; n++) {
+                    if (*(map + c * width + mx + n) != 0) {
                         break;
                     }
-                    mx = mx + n - 1;
                 }
 
-                if ((np = output->node_free) != NULL) {
-                    output->node_free = np->next;
-                } else {
-                    status = sixel_node_new(&np, allocator);
-                    if (SIXEL_FAILED(status)) {
-                        goto end;
-                    }
+                if (n >= 10 || (mx + n) >= width) {
+                    break;
                 }
+                mx = mx + n - 1;
+            }
 
-                np->pal = c;
-                np->sx = sx;
-                np->mx = mx;
-                np->map = map + c * width;
-
-                top.next = output->node_top;
-                tp = &top;
-
-                while (tp->next != NULL) {
-                    if (np->sx < tp->next->sx) {
-                        break;
-                    } else if (np->sx == tp->next->sx && np->mx > tp->next->mx) {
-                        break;
-                    }
-                    tp = tp->next;
+            if ((np = output->node_free) != NULL) {
+                output->node_free = np->next;
+            } else {
+                status = sixel_node_new(&np, allocator);
+                if (SIXEL_FAILED(status)) {
+                    goto end;
                 }
+            }
+
+            np->pal = c;
+            np->sx = sx;
+            np->mx = mx;
+            np->map = map + c * width;
 
-                np->next = tp->next;
-                tp->next = np;
-                output->node_top = top.next;
+            top.next = output->node_top;
+            tp = &top;
 
-                sx = mx - 1;
+            while (tp->next != NULL) {
+                if (np->sx < tp->next->sx) {
+                    break;
+                } else if (np->sx == tp->next->sx && np->mx > tp->next->mx) {
+                    break;
+                }
+                tp = tp->next;
             }
 
+            np->next = tp->next;
+            tp->next = np;
+            output->node_top = top.next;
+
+            sx = mx - 1;
         }
 
-        if (y != 5) {
-            /* DECGNL Graphics Next Line */
-            output->buffer[output->pos] = '-';
+    }
+
+    if (y + nrows - 1 != 5) {
+        /* DECGNL Graphics Next Line */
+        output->buffer[output->pos] = '-';
+        sixel_advance(output, 1);
+    }
+
+    for (x = 0; (np = output->node_top) != NULL;) {
+        sixel_node_t *next;
+        if (x > np->sx) {
+            /* DECGCR Graphics Carriage Return */
+            output->buffer[output->pos] = '$';
             sixel_advance(output, 1);
+            x = 0;
         }
 
-        for (x = 0; (np = output->node_top) != NULL;) {
-            sixel_node_t *next;
-            if (x > np->sx) {
-                /* DECGCR Graphics Carriage Return */
-                output->buffer[output->pos] = '$';
-                sixel_advance(output, 1);
-                x = 0;
+        if (fillable) {
+            memset(np->map + np->sx, (1 << nrows) - 1, (size_t)(np->mx - np->sx));
+        }
+        status = sixel_put_node(output, &x, np, ncolors, keycolor);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        next = np->next;
+        sixel_node_del(output, np);
+        np = next;
+
+        while (np != NULL) {
+            if (np->sx < x) {
+                np = np->next;
+                continue;
             }
 
             if (fillable) {
-                memset(np->map + np->sx, (1 << i) - 1, (size_t)(np->mx - np->sx));
+                memset(np->map + np->sx, (1 << nrows) - 1, (size_t)(np->mx - np->sx));
             }
             status = sixel_put_node(output, &x, np, ncolors, keycolor);
             if (SIXEL_FAILED(status)) {
@@ -695,30 +707,132 @@ sixel_encode_body(
             next = np->next;
             sixel_node_del(output, np);
             np = next;
+        }
 
-            while (np != NULL) {
-                if (np->sx < x) {
-                    np = np->next;
-                    continue;
-                }
+        fillable = 0;
+    }
 
-                if (fillable) {
-                    memset(np->map + np->sx, (1 << i) - 1, (size_t)(np->mx - np->sx));
-                }
-                status = sixel_put_node(output, &x, np, ncolors, keycolor);
-                if (SIXEL_FAILED(status)) {
-                    goto end;
-                }
-                next = np->next;
-                sixel_node_del(output, np);
-                np = next;
-            }
+    memset(map, 0, (size_t)(ncolors * width));
 
-            fillable = 0;
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* release nodes which are cached in the output context */
+static void
+sixel_encode_free_nodes(
+    sixel_output_t      /* in */ *output,
+    sixel_allocator_t   /* in */ *allocator)
+{
+    sixel_node_t *np;
+
+    while ((np = output->node_free) != NULL) {
+        output->node_free = np->next;
+        sixel_allocator_free(allocator, np);
+    }
+    output->node_top = NULL;
+}
+
+
+/* encode indexes band by band, indexes packed in PAL1/2/4 or G1/2/4
+   are unpacked for each band instead of expanding the whole image */
+static SIXELSTATUS
+sixel_encode_body(
+    sixel_index_t       /* in */ *pixels,
+    int                 /* in */ width,
+    int                 /* in */ height,
+    int                 /* in */ pixelformat,
+    unsigned char       /* in */ *palette,
+    int                 /* in */ ncolors,
+    int                 /* in */ keycolor,
+    int                 /* in */ bodyonly,
+    sixel_output_t      /* in */ *output,
+    unsigned char       /* in */ *palstate,
+    sixel_allocator_t   /* in */ *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int y;
+    int len;
+    int nrows;
+    int stride;
+    int dummy;
+    char *map = NULL;
+    sixel_index_t *band = NULL;
+    sixel_index_t *indexes;
+
+    if (ncolors < 1) {
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+    len = ncolors * width;
+    output->active_palette = (-1);
+
+    map = (char *)sixel_allocator_calloc(allocator,
+                                         (size_t)len,
+                                         sizeof(char));
+    if (map == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_body: sixel_allocator_calloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_PAL1:
+    case SIXEL_PIXELFORMAT_PAL2:
+    case SIXEL_PIXELFORMAT_PAL4:
+    case SIXEL_PIXELFORMAT_G1:
+    case SIXEL_PIXELFORMAT_G2:
+    case SIXEL_PIXELFORMAT_G4:
+        stride = sixel_pixelformat_compute_stride(pixelformat, width);
+        band = (sixel_index_t *)sixel_allocator_malloc(allocator,
+                                                       (size_t)width * 6);
+        if (band == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_encode_body: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        break;
+    default:
+        stride = width;
+        break;
+    }
+
+    if (!bodyonly && (ncolors != 2 || keycolor == (-1))) {
+        status = sixel_encode_palette(palette, ncolors, keycolor, output);
+        if (SIXEL_FAILED(status)) {
+            goto end;
         }
+    }
 
-        i = 0;
-        memset(map, 0, (size_t)len);
+    for (y = 0; y < height; y += 6) {
+        nrows = height - y < 6 ? height - y : 6;
+        indexes = pixels + y * stride;
+        if (band) {
+            status = sixel_helper_normalize_pixelformat_with_stride(
+                band, &dummy, indexes, pixelformat, width, nrows, stride);
+            if (SIXEL_FAILED(status)) {
+                goto end;
+            }
+            indexes = band;
+        }
+        status = sixel_encode_band(indexes,
+                                   width,
+                                   y,
+                                   nrows,
+                                   ncolors,
+                                   keycolor,
+                                   output,
+                                   palstate,
+                                   map,
+                                   allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
     }
 
     if (palstate) {
@@ -730,13 +844,10 @@ sixel_encode_body(
 
 end:
     /* free nodes */
-    while ((np = output->node_free) != NULL) {
-        output->node_free = np->next;
-        sixel_allocator_free(allocator, np);
-    }
-    output->node_top = NULL;
+    sixel_encode_free_nodes(output, allocator);
 
     sixel_allocator_free(allocator, map);
+    sixel_allocator_free(allocator, band);
 
     return status;
 }
@@ -792,7 +903,7 @@ sixel_encode_dither(
     SIXELSTATUS status = SIXEL_FALSE;
     sixel_index_t *paletted_pixels = NULL;
     sixel_index_t *input_pixels;
-    size_t bufsize;
+    int pixelformat = SIXEL_PIXELFORMAT_PAL8;
 
     switch (dither->pixelformat) {
     case SIXEL_PIXELFORMAT_PAL1:
@@ -801,23 +912,11 @@ sixel_encode_dither(
     case SIXEL_PIXELFORMAT_G1:
     case SIXEL_PIXELFORMAT_G2:
     case SIXEL_PIXELFORMAT_G4:
-        bufsize = (sizeof(sixel_index_t) * (size_t)width * (size_t)height * 3UL);
-        paletted_pixels = (sixel_index_t *)sixel_allocator_malloc(dither->allocator, bufsize);
-        if (paletted_pixels == NULL) {
-            sixel_helper_set_additional_message(
-                "sixel_encode_dither: sixel_allocator_malloc() failed.");
-            status = SIXEL_BAD_ALLOCATION;
-            goto end;
-        }
-        status = sixel_helper_normalize_pixelformat(paletted_pixels,
-                                                    &dither->pixelformat,
-                                                    pixels,
-                                                    dither->pixelformat,
-                                                    width, height);
-        if (SIXEL_FAILED(status)) {
-            goto end;
-        }
-        input_pixels = paletted_pixels;
+        /* unpacked for each band in sixel_encode_body() */
+        input_pixels = pixels;
+        pixelformat = dither->pixelformat;
+        dither->pixelformat = pixelformat & SIXEL_FORMATTYPE_PALETTE ?
+                              SIXEL_PIXELFORMAT_PAL8 : SIXEL_PIXELFORMAT_G8;
         break;
     case SIXEL_PIXELFORMAT_PAL8:
     case SIXEL_PIXELFORMAT_G8:
@@ -845,6 +944,7 @@ sixel_encode_dither(
     status = sixel_encode_body(input_pixels,
                                width,
                                height,
+                               pixelformat,
                                dither->palette,
                                dither->ncolors,
                                dither->keycolor,
@@ -867,6 +967,149 @@ end:
     return status;
 }
 
+/* whether sixel_encode() modifies the given pixels in place, errors of
+   diffusion are accumulated into the pixel buffer, while the pixels in
+   other formats than RGB888 are converted into a temporary buffer */
+int
+sixel_encode_modifies_pixels(
+    sixel_dither_t  /* in */ *dither)   /* dither context */
+{
+    if (dither->pixelformat != SIXEL_PIXELFORMAT_RGB888) {
+        return 0;
+    }
+
+    switch (dither->method_for_diffuse) {
+    case SIXEL_DIFFUSE_NONE:
+        return 0;
+    case SIXEL_DIFFUSE_A_DITHER:
+    case SIXEL_DIFFUSE_X_DITHER:
+        /* masks are applied to copies of pixels except high color mode */
+        return dither->quality_mode == SIXEL_QUALITY_HIGHCOLOR;
+    default:
+        return 1;
+    }
+}
+
+
+/* encode an image band by band, rows are pulled from fn_source six rows
+   at a time and quantized with the lookahead rows which carry the errors
+   diffused across bands, so the whole image is never materialized */
+SIXELSTATUS
+sixel_encode_rows(
+    sixel_row_source_function /* in */ fn_source, /* function to fill rows */
+    void            /* in */ *priv,     /* private data for fn_source */
+    int             /* in */ width,     /* image width */
+    int             /* in */ height,    /* image height */
+    sixel_dither_t  /* in */ *dither,   /* dither context */
+    sixel_output_t  /* in */ *output)   /* output context */
+{
+    /* error diffusion reaches two rows below, one more row keeps the
+       boundary conditions of the diffusion kernels same as the whole image */
+    enum { band_rows = 6, lookahead_rows = 3 };
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *band = NULL;
+    sixel_index_t *indexes = NULL;
+    char *map = NULL;
+    int y;
+    int nrows;
+    int bufrows;
+    int filled = 0;
+    size_t rowsize;
+
+    sixel_dither_ref(dither);
+    sixel_output_ref(output);
+
+    if (width < 1 || height < 1) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_rows: bad size parameter.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+    if (dither->ncolors < 1 || dither->quality_mode == SIXEL_QUALITY_HIGHCOLOR) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_rows: the dither context is not supported.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    rowsize = (size_t)width * 3;
+    band = (unsigned char *)sixel_allocator_malloc(
+        dither->allocator, rowsize * (band_rows + lookahead_rows));
+    indexes = (sixel_index_t *)sixel_allocator_malloc(
+        dither->allocator, sizeof(sixel_index_t) * (size_t)width * band_rows);
+    map = (char *)sixel_allocator_calloc(dither->allocator,
+                                         (size_t)(dither->ncolors * width),
+                                         sizeof(char));
+    if (band == NULL || indexes == NULL || map == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_rows: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    status = sixel_encode_header(width, height, output);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    output->active_palette = (-1);
+    if (!dither->bodyonly && (dither->ncolors != 2 || dither->keycolor == (-1))) {
+        status = sixel_encode_palette(dither->palette, dither->ncolors,
+                                      dither->keycolor, output);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    for (y = 0; y < height; y += nrows) {
+        nrows = height - y < band_rows ? height - y : band_rows;
+        bufrows = height - y < band_rows + lookahead_rows
+                ? height - y : band_rows + lookahead_rows;
+
+        if (filled < bufrows) {
+            status = fn_source(band + rowsize * (size_t)filled,
+                               y + filled, bufrows - filled, priv);
+            if (SIXEL_FAILED(status)) {
+                goto end;
+            }
+            filled = bufrows;
+        }
+
+        status = sixel_dither_apply_palette_rows(dither, indexes, band,
+                                                 width, bufrows, nrows, y);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+
+        status = sixel_encode_band(indexes, width, y, nrows,
+                                   dither->ncolors, dither->keycolor,
+                                   output, NULL, map, dither->allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+
+        /* lookahead rows become the top of the next band */
+        filled = bufrows - nrows;
+        memmove(band, band + rowsize * (size_t)nrows, rowsize * (size_t)filled);
+    }
+
+    status = sixel_encode_footer(output);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+end:
+    sixel_encode_free_nodes(output, dither->allocator);
+    sixel_allocator_free(dither->allocator, map);
+    sixel_allocator_free(dither->allocator, indexes);
+    sixel_allocator_free(dither->allocator, band);
+    sixel_output_unref(output);
+    sixel_dither_unref(dither);
+
+    return status;
+}
+
+
 static void
 dither_func_none(unsigned char *data, int width)
 {
@@ -1451,6 +1694,7 @@ next:
             status = sixel_encode_body(paletted_pixels,
                                        width,
                                        height,
+                                       SIXEL_PIXELFORMAT_PAL8,
                                        dither->palette,
                                        255,
                                        255,
@@ -1487,6 +1731,7 @@ end:
     status = sixel_encode_body(paletted_pixels,
                                width,
                                height,
+                               SIXEL_PIXELFORMAT_PAL8,
                                dither->palette,
                                255,
                                255,
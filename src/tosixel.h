@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2014-2020 Hayaki Saito
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBSIXEL_TOSIXEL_H
+#define LIBSIXEL_TOSIXEL_H
+
+#include <sixel.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* function to fill the rows [y, y + nrows) of an image in RGB888 */
+typedef SIXELSTATUS (* sixel_row_source_function)(
+    unsigned char   /* out */ *rows,    /* nrows rows to be filled */
+    int             /* in */  y,        /* first row */
+    int             /* in */  nrows,    /* number of rows */
+    void            /* in */  *priv);   /* private data */
+
+/* encode an image with a fixed palette band by band, rows are requested
+   from top to bottom and the palette of the dither is not optimized */
+SIXELSTATUS
+sixel_encode_rows(
+    sixel_row_source_function /* in */ fn_source, /* function to fill rows */
+    void            /* in */ *priv,     /* private data for fn_source */
+    int             /* in */ width,     /* image width */
+    int             /* in */ height,    /* image height */
+    sixel_dither_t  /* in */ *dither,   /* dither context */
+    sixel_output_t  /* in */ *output);  /* output context */
+
+/* whether sixel_encode() modifies the given pixels in place */
+int
+sixel_encode_modifies_pixels(
+    sixel_dither_t  /* in */ *dither);  /* dither context */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSIXEL_TOSIXEL_H */
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
@@ -41,6 +41,7 @@
 #endif  /* HAVE_LIBPNG */
 
 #include <sixel.h>
+#include "writer.h"
 
 #if !defined(HAVE_MEMCPY)
 # define memcpy(d, s, n) (bcopy ((s), (d), (n)))
@@ -55,11 +56,10 @@
 #endif  /* !defined(O_BINARY) && !defined(_O_BINARY) */
 
 
-#if !HAVE_LIBPNG
+/* it is used for animated PNG even if libpng is available */
 unsigned char *
 stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes,
                       int x, int y, int n, int *out_len);
-#endif
 
 static SIXELSTATUS
 write_png_to_file(
@@ -386,6 +386,382 @@ end:
 }
 
 
+/* delay of each frame of animated PNG in 1/100 seconds */
+#define SIXEL_APNG_DELAY    10
+
+/* animated PNG being written, the chunks of frames are kept in memory
+   until the number of frames is known */
+struct sixel_apng_writer {
+    char *filename;             /* destination filename */
+    int width;                  /* canvas width, the width of the first frame */
+    int height;                 /* canvas height */
+    int nframes;                /* number of frames */
+    unsigned int sequence;      /* sequence number of fcTL and fdAT */
+    unsigned char *chunks;      /* fcTL, IDAT and fdAT chunks */
+    size_t size;                /* bytes of chunks */
+    size_t capacity;            /* allocated bytes of chunks */
+    unsigned int crctable[256]; /* CRC-32 of bytes */
+    sixel_allocator_t *allocator;
+};
+
+
+static void
+apng_put32(unsigned char *p, unsigned int value)
+{
+    p[0] = (unsigned char)(value >> 24 & 0xff);
+    p[1] = (unsigned char)(value >> 16 & 0xff);
+    p[2] = (unsigned char)(value >> 8 & 0xff);
+    p[3] = (unsigned char)(value & 0xff);
+}
+
+
+static unsigned int
+apng_get32(unsigned char const *p)
+{
+    return (unsigned int)p[0] << 24 | (unsigned int)p[1] << 16 |
+           (unsigned int)p[2] << 8 | (unsigned int)p[3];
+}
+
+
+/* append a chunk to the buffer, prefix is put before the data */
+static SIXELSTATUS
+apng_append_chunk(
+    sixel_apng_writer_t *writer,
+    char const          *type,      /* chunk type */
+    unsigned char const *prefix,    /* bytes put before data, or NULL */
+    size_t               nprefix,   /* size of prefix */
+    unsigned char const *data,      /* chunk data */
+    size_t               ndata)     /* size of data */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *chunks;
+    unsigned char *p;
+    unsigned int crc;
+    size_t capacity;
+    size_t need;
+    size_t i;
+
+    need = writer->size + 12 + nprefix + ndata;
+    if (need > writer->capacity) {
+        capacity = writer->capacity > 0 ? writer->capacity : 64 * 1024;
+        while (capacity < need) {
+            capacity *= 2;
+        }
+        chunks = (unsigned char *)sixel_allocator_realloc(writer->allocator,
+                                                          writer->chunks,
+                                                          capacity);
+        if (chunks == NULL) {
+            sixel_helper_set_additional_message(
+                "apng_append_chunk: sixel_allocator_realloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        writer->chunks = chunks;
+        writer->capacity = capacity;
+    }
+
+    p = writer->chunks + writer->size;
+    apng_put32(p, (unsigned int)(nprefix + ndata));
+    memcpy(p + 4, type, 4);
+    if (nprefix > 0) {
+        memcpy(p + 8, prefix, nprefix);
+    }
+    if (ndata > 0) {
+        memcpy(p + 8 + nprefix, data, ndata);
+    }
+
+    /* the CRC covers the type and the data */
+    crc = 0xffffffff;
+    for (i = 4; i < 8 + nprefix + ndata; ++i) {
+        crc = writer->crctable[(crc ^ p[i]) & 0xff] ^ crc >> 8;
+    }
+    apng_put32(p + 8 + nprefix + ndata, ~crc);
+    writer->size = need;
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* create an animated PNG writer, the file is written when it is finished */
+SIXELSTATUS
+sixel_apng_writer_new(
+    sixel_apng_writer_t /* out */ **ppwriter,   /* writer to be created */
+    char const          /* in */  *filename,    /* destination filename */
+    sixel_allocator_t   /* in */  *allocator)   /* allocator object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_apng_writer_t *writer;
+    unsigned int c;
+    int n;
+    int k;
+
+    writer = (sixel_apng_writer_t *)sixel_allocator_malloc(allocator,
+                                                           sizeof(sixel_apng_writer_t));
+    if (writer == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_apng_writer_new: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    writer->filename = (char *)sixel_allocator_malloc(allocator, strlen(filename) + 1);
+    if (writer->filename == NULL) {
+        sixel_allocator_free(allocator, writer);
+        writer = NULL;
+        sixel_helper_set_additional_message(
+            "sixel_apng_writer_new: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    strcpy(writer->filename, filename);
+    writer->width = 0;
+    writer->height = 0;
+    writer->nframes = 0;
+    writer->sequence = 0;
+    writer->chunks = NULL;
+    writer->size = 0;
+    writer->capacity = 0;
+    for (n = 0; n < 256; ++n) {
+        c = (unsigned int)n;
+        for (k = 0; k < 8; ++k) {
+            c = c & 1 ? 0xedb88320 ^ c >> 1 : c >> 1;
+        }
+        writer->crctable[n] = c;
+    }
+    sixel_allocator_ref(allocator);
+    writer->allocator = allocator;
+
+    status = SIXEL_OK;
+
+end:
+    *ppwriter = writer;
+    return status;
+}
+
+
+/* destroy an animated PNG writer */
+void
+sixel_apng_writer_destroy(
+    sixel_apng_writer_t /* in */ *writer)   /* writer object */
+{
+    sixel_allocator_t *allocator;
+
+    if (writer) {
+        allocator = writer->allocator;
+        sixel_allocator_free(allocator, writer->chunks);
+        sixel_allocator_free(allocator, writer->filename);
+        sixel_allocator_free(allocator, writer);
+        sixel_allocator_unref(allocator);
+    }
+}
+
+
+/* add a frame, the first frame decides the size of the animation, and
+   the following frames are drawn over it from the top-left corner */
+SIXELSTATUS
+sixel_apng_writer_add_frame(
+    sixel_apng_writer_t /* in */ *writer,       /* writer object */
+    unsigned char       /* in */ *pixels,       /* PAL8 or RGB888 pixels */
+    int                 /* in */ width,         /* frame width */
+    int                 /* in */ height,        /* frame height */
+    unsigned char       /* in */ *palette,      /* palette for PAL8 */
+    int                 /* in */ pixelformat)   /* SIXEL_PIXELFORMAT_PAL8 or
+                                                   SIXEL_PIXELFORMAT_RGB888 */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *rgb = NULL;
+    unsigned char *png = NULL;
+    unsigned char *chunk;
+    unsigned char fctl[26];
+    unsigned char sequence[4];
+    int png_len = 0;
+    int sx;
+    int sy;
+    int i;
+    size_t length;
+
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_PAL8:
+        rgb = (unsigned char *)sixel_allocator_malloc(writer->allocator,
+                                                      (size_t)width * (size_t)height * 3);
+        if (rgb == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_apng_writer_add_frame: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        for (i = 0; i < width * height; ++i) {
+            rgb[i * 3 + 0] = palette[pixels[i] * 3 + 0];
+            rgb[i * 3 + 1] = palette[pixels[i] * 3 + 1];
+            rgb[i * 3 + 2] = palette[pixels[i] * 3 + 2];
+        }
+        pixels = rgb;
+        break;
+    case SIXEL_PIXELFORMAT_RGB888:
+        break;
+    default:
+        sixel_helper_set_additional_message(
+            "sixel_apng_writer_add_frame: unsupported pixelformat.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    if (writer->nframes == 0) {
+        writer->width = width;
+        writer->height = height;
+    }
+
+    /* frames larger than the first one are clipped */
+    sx = width < writer->width ? width : writer->width;
+    sy = height < writer->height ? height : writer->height;
+    png = stbi_write_png_to_mem(pixels, width * 3, sx, sy, 3, &png_len);
+    if (png == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_apng_writer_add_frame: stbi_write_png_to_mem() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    apng_put32(fctl, writer->sequence++);
+    apng_put32(fctl + 4, (unsigned int)sx);
+    apng_put32(fctl + 8, (unsigned int)sy);
+    apng_put32(fctl + 12, 0);                   /* x_offset */
+    apng_put32(fctl + 16, 0);                   /* y_offset */
+    fctl[20] = 0;                               /* delay_num */
+    fctl[21] = SIXEL_APNG_DELAY;
+    fctl[22] = 0;                               /* delay_den */
+    fctl[23] = 100;
+    fctl[24] = 0;                               /* APNG_DISPOSE_OP_NONE */
+    fctl[25] = 0;                               /* APNG_BLEND_OP_SOURCE */
+    status = apng_append_chunk(writer, "fcTL", NULL, 0, fctl, sizeof(fctl));
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    /* image data of the first frame is IDAT, the others are fdAT */
+    for (chunk = png + 8; chunk + 12 <= png + png_len; chunk += 12 + length) {
+        length = apng_get32(chunk);
+        if (memcmp(chunk + 4, "IDAT", 4) != 0) {
+            continue;
+        }
+        if (writer->nframes == 0) {
+            status = apng_append_chunk(writer, "IDAT", NULL, 0, chunk + 8, length);
+        } else {
+            apng_put32(sequence, writer->sequence++);
+            status = apng_append_chunk(writer, "fdAT", sequence, sizeof(sequence),
+                                       chunk + 8, length);
+        }
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+    writer->nframes++;
+
+    status = SIXEL_OK;
+
+end:
+    free(png);
+    sixel_allocator_free(writer->allocator, rgb);
+    return status;
+}
+
+
+/* write the animated PNG into the file */
+SIXELSTATUS
+sixel_apng_writer_finish(
+    sixel_apng_writer_t /* in */ *writer)   /* writer object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    static unsigned char const signature[] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+    };
+    unsigned char ihdr[13];
+    unsigned char actl[8];
+    unsigned char *frames = NULL;
+    size_t nframes;
+    FILE *output_fp = NULL;
+
+    if (writer->nframes == 0) {
+        sixel_helper_set_additional_message(
+            "sixel_apng_writer_finish: no frame is given.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    /* IHDR and acTL are put before the chunks of frames */
+    frames = writer->chunks;
+    nframes = writer->size;
+    writer->chunks = NULL;
+    writer->size = writer->capacity = 0;
+
+    apng_put32(ihdr, (unsigned int)writer->width);
+    apng_put32(ihdr + 4, (unsigned int)writer->height);
+    ihdr[8] = 8;        /* bit depth */
+    ihdr[9] = 2;        /* truecolor */
+    ihdr[10] = 0;       /* deflate */
+    ihdr[11] = 0;       /* adaptive filtering */
+    ihdr[12] = 0;       /* no interlace */
+    status = apng_append_chunk(writer, "IHDR", NULL, 0, ihdr, sizeof(ihdr));
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    apng_put32(actl, (unsigned int)writer->nframes);
+    apng_put32(actl + 4, 0);        /* loop forever */
+    status = apng_append_chunk(writer, "acTL", NULL, 0, actl, sizeof(actl));
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    if (strcmp(writer->filename, "-") == 0) {
+#if defined(O_BINARY)
+# if HAVE__SETMODE
+        _setmode(fileno(stdout), O_BINARY);
+# elif HAVE_SETMODE
+        setmode(fileno(stdout), O_BINARY);
+# endif  /* HAVE_SETMODE */
+#endif  /* defined(O_BINARY) */
+        output_fp = stdout;
+    } else {
+        output_fp = fopen(writer->filename, "wb");
+        if (!output_fp) {
+            status = (SIXEL_LIBC_ERROR | (errno & 0xff));
+            sixel_helper_set_additional_message("fopen() failed.");
+            goto end;
+        }
+    }
+
+    if (fwrite(signature, 1, sizeof(signature), output_fp) != sizeof(signature) ||
+        fwrite(writer->chunks, 1, writer->size, output_fp) != writer->size ||
+        fwrite(frames, 1, nframes, output_fp) != nframes) {
+        status = (SIXEL_LIBC_ERROR | (errno & 0xff));
+        sixel_helper_set_additional_message("fwrite() failed.");
+        goto end;
+    }
+
+    writer->size = 0;
+    status = apng_append_chunk(writer, "IEND", NULL, 0, NULL, 0);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    if (fwrite(writer->chunks, 1, writer->size, output_fp) != writer->size) {
+        status = (SIXEL_LIBC_ERROR | (errno & 0xff));
+        sixel_helper_set_additional_message("fwrite() failed.");
+        goto end;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    if (output_fp && output_fp != stdout) {
+        fclose(output_fp);
+    }
+    sixel_allocator_free(writer->allocator, frames);
+    return status;
+}
+
+
 #if HAVE_TESTS
 static int
 test1(void)
@@ -22,10 +22,45 @@
 #ifndef LIBSIXEL_WRITER_H
 #define LIBSIXEL_WRITER_H
 
+#include <sixel.h>
+
+/* animated PNG writer */
+struct sixel_apng_writer;
+typedef struct sixel_apng_writer sixel_apng_writer_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* create an animated PNG writer, the file is written when it is finished */
+SIXELSTATUS
+sixel_apng_writer_new(
+    sixel_apng_writer_t /* out */ **ppwriter,   /* writer to be created */
+    char const          /* in */  *filename,    /* destination filename */
+    sixel_allocator_t   /* in */  *allocator);  /* allocator object */
+
+/* destroy an animated PNG writer */
+void
+sixel_apng_writer_destroy(
+    sixel_apng_writer_t /* in */ *writer);  /* writer object */
+
+/* add a frame, the first frame decides the size of the animation, and
+   the following frames are drawn over it from the top-left corner */
+SIXELSTATUS
+sixel_apng_writer_add_frame(
+    sixel_apng_writer_t /* in */ *writer,       /* writer object */
+    unsigned char       /* in */ *pixels,       /* PAL8 or RGB888 pixels */
+    int                 /* in */ width,         /* frame width */
+    int                 /* in */ height,        /* frame height */
+    unsigned char       /* in */ *palette,      /* palette for PAL8 */
+    int                 /* in */ pixelformat);  /* SIXEL_PIXELFORMAT_PAL8 or
+                                                   SIXEL_PIXELFORMAT_RGB888 */
+
+/* write the animated PNG into the file */
+SIXELSTATUS
+sixel_apng_writer_finish(
+    sixel_apng_writer_t /* in */ *writer);  /* writer object */
+
 #if HAVE_TESTS
 int
 sixel_writer_tests_main(void);